@@ -25,6 +25,8 @@
 
 bool exit_request;
 CPUState *tcg_current_cpu;
+bool mttcg_enabled;
+bool parallel_cpus;
 
 /* exit the current TB, but without causing any exception to be raised */
 void cpu_loop_exit_noexc(CPUState *cpu)
@@ -77,3 +79,11 @@ void cpu_loop_exit_restore(CPUState *cpu, uintptr_t pc)
     }
     siglongjmp(cpu->jmp_env, 1);
 }
+
+/* Restart the current instruction in an exclusive section, because it
+   cannot be done atomically while the other vCPUs are running.  */
+void cpu_loop_exit_atomic(CPUState *cpu, uintptr_t pc)
+{
+    cpu->exception_index = EXCP_ATOMIC;
+    cpu_loop_exit_restore(cpu, pc);
+}
@@ -29,6 +29,8 @@
 #include "qemu/rcu.h"
 #include "exec/tb-hash.h"
 #include "exec/log.h"
+#include "exec/guest-profile.h"
+#include "qemu/main-loop.h"
 #if defined(TARGET_I386) && !defined(CONFIG_USER_ONLY)
 #include "hw/i386/apic.h"
 #endif
@@ -210,6 +212,7 @@ static void cpu_exec_nocache(CPUState *cpu, int max_cycles,
     if (max_cycles > CF_COUNT_MASK)
         max_cycles = CF_COUNT_MASK;
 
+    tb_lock();
     old_tb_flushed = cpu->tb_flushed;
     cpu->tb_flushed = false;
     tb = tb_gen_code(cpu, orig_tb->pc, orig_tb->cs_base, orig_tb->flags,
@@ -217,11 +220,60 @@ static void cpu_exec_nocache(CPUState *cpu, int max_cycles,
                          | (ignore_icount ? CF_IGNORE_ICOUNT : 0));
     tb->orig_tb = cpu->tb_flushed ? NULL : orig_tb;
     cpu->tb_flushed |= old_tb_flushed;
+    tb_unlock();
+
     /* execute the generated code */
     trace_exec_tb_nocache(tb, tb->pc);
     cpu_tb_exec(cpu, tb);
+
+    tb_lock();
     tb_phys_invalidate(tb, -1);
     tb_free(tb);
+    tb_unlock();
+}
+
+/* Execute one instruction that stopped with EXCP_ATOMIC.  The caller has
+   stopped all other vCPUs, so the instruction is translated without host
+   atomics and run in a TB of its own that is thrown away afterwards.  */
+void cpu_exec_step_atomic(CPUState *cpu)
+{
+    CPUClass *cc = CPU_GET_CLASS(cpu);
+    CPUArchState *env = (CPUArchState *)cpu->env_ptr;
+    TranslationBlock *volatile tb = NULL;
+    target_ulong cs_base, pc;
+    uint32_t flags;
+
+    current_cpu = cpu;
+    rcu_read_lock();
+    parallel_cpus = false;
+    cc->cpu_exec_enter(cpu);
+
+    if (sigsetjmp(cpu->jmp_env, 0) == 0) {
+        cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+        tb_lock();
+        tb = tb_gen_code(cpu, pc, cs_base, flags,
+                         1 | CF_NOCACHE | CF_IGNORE_ICOUNT);
+        tb->orig_tb = NULL;
+        tb_unlock();
+
+        trace_exec_tb_nocache(tb, pc);
+        cpu_tb_exec(cpu, tb);
+    } else {
+        /* The exception, if any, is left for cpu_exec to deliver.  */
+        tb_lock_reset();
+    }
+    cc->cpu_exec_exit(cpu);
+
+    if (tb) {
+        tb_lock();
+        tb_phys_invalidate(tb, -1);
+        tb_free(tb);
+        tb_unlock();
+    }
+
+    parallel_cpus = true;
+    rcu_read_unlock();
+    current_cpu = NULL;
 }
 #endif
 
@@ -259,10 +311,10 @@ static bool tb_cmp(const void *p, const void *d)
     return false;
 }
 
-static TranslationBlock *tb_find_physical(CPUState *cpu,
-                                          target_ulong pc,
-                                          target_ulong cs_base,
-                                          uint32_t flags)
+TranslationBlock *tb_find_physical(CPUState *cpu,
+                                   target_ulong pc,
+                                   target_ulong cs_base,
+                                   uint32_t flags)
 {
     tb_page_addr_t phys_pc;
     struct tb_desc desc;
@@ -278,10 +330,14 @@ static TranslationBlock *tb_find_physical(CPUState *cpu,
     return qht_lookup(&tcg_ctx.tb_ctx.htable, tb_cmp, &desc, h);
 }
 
+/* Called without tb_lock; takes it only if the TB has to be generated.
+ * *HAVE_TB_LOCK is set when tb_lock is left held for the caller.
+ */
 static TranslationBlock *tb_find_slow(CPUState *cpu,
                                       target_ulong pc,
                                       target_ulong cs_base,
-                                      uint32_t flags)
+                                      uint32_t flags,
+                                      bool *have_tb_lock)
 {
     TranslationBlock *tb;
 
@@ -290,35 +346,35 @@ static TranslationBlock *tb_find_slow(CPUState *cpu,
         goto found;
     }
 
-#ifdef CONFIG_USER_ONLY
-    /* mmap_lock is needed by tb_gen_code, and mmap_lock must be
-     * taken outside tb_lock.  Since we're momentarily dropping
-     * tb_lock, there's a chance that our desired tb has been
-     * translated.
+    /* Another vCPU may have translated the block while we were taking
+     * the lock, so look again.
      */
-    tb_unlock();
-    mmap_lock();
     tb_lock();
+    *have_tb_lock = true;
     tb = tb_find_physical(cpu, pc, cs_base, flags);
-    if (tb) {
-        mmap_unlock();
-        goto found;
+    if (!tb) {
+        /* if no translated code available, then translate it now */
+        tb = tb_gen_code(cpu, pc, cs_base, flags, 0);
     }
-#endif
-
-    /* if no translated code available, then translate it now */
-    tb = tb_gen_code(cpu, pc, cs_base, flags, 0);
-
-#ifdef CONFIG_USER_ONLY
-    mmap_unlock();
-#endif
 
 found:
     /* we add the TB in the virtual pc hash table */
-    cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)] = tb;
+    atomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)], tb);
     return tb;
 }
 
+#ifndef CONFIG_USER_ONLY
+static inline bool tb_jump_crosses_page(TranslationBlock *tb,
+                                        TranslationBlock *tb_next)
+{
+    target_ulong page = tb_next->pc & TARGET_PAGE_MASK;
+
+    return tb_next->page_addr[1] != -1 ||
+           (page != (tb->pc & TARGET_PAGE_MASK) &&
+            page != ((tb->pc + tb->size - 1) & TARGET_PAGE_MASK));
+}
+#endif
+
 static inline TranslationBlock *tb_find_fast(CPUState *cpu,
                                              TranslationBlock **last_tb,
                                              int tb_exit)
@@ -327,16 +383,16 @@ static inline TranslationBlock *tb_find_fast(CPUState *cpu,
     TranslationBlock *tb;
     target_ulong cs_base, pc;
     uint32_t flags;
+    bool have_tb_lock = false;
 
     /* we record a subset of the CPU state. It will
        always be the same before a given translated block
        is executed. */
     cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
-    tb_lock();
-    tb = cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)];
+    tb = atomic_rcu_read(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)]);
     if (unlikely(!tb || tb->pc != pc || tb->cs_base != cs_base ||
                  tb->flags != flags)) {
-        tb = tb_find_slow(cpu, pc, cs_base, flags);
+        tb = tb_find_slow(cpu, pc, cs_base, flags, &have_tb_lock);
     }
     if (cpu->tb_flushed) {
         /* Ensure that no TB jump will be modified as the
@@ -345,12 +401,42 @@ static inline TranslationBlock *tb_find_fast(CPUState *cpu,
         *last_tb = NULL;
         cpu->tb_flushed = false;
     }
+    if (tb_trace_threshold) {
+        if (!have_tb_lock) {
+            tb_lock();
+            have_tb_lock = true;
+        }
+        tb = tb_trace_profile(cpu, *last_tb, tb_exit, tb);
+        /* Blocks must come back here to be counted; only traces are
+           chained to each other.  */
+        if (!(tb->cflags & CF_TRACE) ||
+            (*last_tb && !((*last_tb)->cflags & CF_TRACE))) {
+            *last_tb = NULL;
+        }
+    }
+    /* Patching jumps needs tb_lock; TB may have been invalidated by
+     * another vCPU before we got it.
+     */
+    if (*last_tb && !qemu_loglevel_mask(CPU_LOG_TB_NOCHAIN)) {
+        if (!have_tb_lock) {
+            tb_lock();
+            have_tb_lock = true;
+        }
+        if (tb->invalid) {
+            *last_tb = NULL;
+        }
+    }
 #ifndef CONFIG_USER_ONLY
-    /* We don't take care of direct jumps when address mapping changes in
-     * system emulation. So it's not safe to make a direct jump to a TB
-     * spanning two pages because the mapping for the second page can change.
+    /* In system emulation, a direct jump to another page must be undone
+     * when the address mapping changes; this includes the second page
+     * of a TB that spans two.  See tb_add_cross_page_jump().
      */
-    if (tb->page_addr[1] != -1) {
+    if (*last_tb && tb_jump_crosses_page(*last_tb, tb)) {
+        tcg_ctx.tb_ctx.cross_page_exit_count++;
+        if (tb_cross_page_chaining &&
+            !qemu_loglevel_mask(CPU_LOG_TB_NOCHAIN)) {
+            tb_add_cross_page_jump(*last_tb, tb_exit, tb);
+        }
         *last_tb = NULL;
     }
 #endif
@@ -358,7 +444,9 @@ static inline TranslationBlock *tb_find_fast(CPUState *cpu,
     if (*last_tb && !qemu_loglevel_mask(CPU_LOG_TB_NOCHAIN)) {
         tb_add_jump(*last_tb, tb_exit, tb);
     }
-    tb_unlock();
+    if (have_tb_lock) {
+        tb_unlock();
+    }
     return tb;
 }
 
@@ -369,8 +457,16 @@ static inline bool cpu_handle_halt(CPUState *cpu)
         if ((cpu->interrupt_request & CPU_INTERRUPT_POLL)
             && replay_interrupt()) {
             X86CPU *x86_cpu = X86_CPU(cpu);
+            bool locked = qemu_tcg_mttcg_enabled();
+
+            if (locked) {
+                qemu_mutex_lock_iothread();
+            }
             apic_poll_irq(x86_cpu->apic_state);
             cpu_reset_interrupt(cpu, CPU_INTERRUPT_POLL);
+            if (locked) {
+                qemu_mutex_unlock_iothread();
+            }
         }
 #endif
         if (!cpu_has_work(cpu)) {
@@ -424,7 +520,15 @@ static inline bool cpu_handle_exception(CPUState *cpu, int *ret)
 #else
             if (replay_exception()) {
                 CPUClass *cc = CPU_GET_CLASS(cpu);
+                bool locked = qemu_tcg_mttcg_enabled();
+
+                if (locked) {
+                    qemu_mutex_lock_iothread();
+                }
                 cc->do_interrupt(cpu);
+                if (locked) {
+                    qemu_mutex_unlock_iothread();
+                }
                 cpu->exception_index = -1;
             } else if (!replay_has_interrupt()) {
                 /* give a chance to iothread in replay mode */
@@ -454,6 +558,18 @@ static inline void cpu_handle_interrupt(CPUState *cpu,
     int interrupt_request = cpu->interrupt_request;
 
     if (unlikely(interrupt_request)) {
+        bool locked = false;
+
+        /* Interrupt delivery touches device state (APICs, GICs) that is
+         * protected by the BQL.  With multi-threaded TCG the vCPU runs
+         * without it, so take it here.  If one of the paths below longjmps
+         * out, cpu_exec drops the lock on the way back in.
+         */
+        if (qemu_tcg_mttcg_enabled()) {
+            qemu_mutex_lock_iothread();
+            locked = true;
+            interrupt_request = cpu->interrupt_request;
+        }
         if (unlikely(cpu->singlestep_enabled & SSTEP_NOIRQ)) {
             /* Mask out external interrupts for this step. */
             interrupt_request &= ~CPU_INTERRUPT_SSTEP_MASK;
@@ -508,6 +624,9 @@ static inline void cpu_handle_interrupt(CPUState *cpu,
                the program flow was changed */
             *last_tb = NULL;
         }
+        if (locked) {
+            qemu_mutex_unlock_iothread();
+        }
     }
     if (unlikely(cpu->exit_request || replay_has_interrupt())) {
         cpu->exit_request = 0;
@@ -621,6 +740,9 @@ int cpu_exec(CPUState *cpu)
             cpu->tb_flushed = false; /* reset before first TB lookup */
             for(;;) {
                 cpu_handle_interrupt(cpu, &last_tb);
+                if (unlikely(atomic_read(&cpu->profile_sample))) {
+                    guest_profile_sample(cpu);
+                }
                 tb = tb_find_fast(cpu, &last_tb, tb_exit);
                 cpu_loop_exec_tb(cpu, tb, &last_tb, &tb_exit, &sc);
                 /* Try to align the host and virtual clocks
@@ -642,6 +764,9 @@ int cpu_exec(CPUState *cpu)
 #endif /* buggy compiler */
             cpu->can_do_io = 1;
             tb_lock_reset();
+            if (qemu_tcg_mttcg_enabled() && qemu_mutex_iothread_locked()) {
+                qemu_mutex_unlock_iothread();
+            }
         }
     } /* for(;;) */
 
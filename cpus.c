@@ -36,6 +36,7 @@
 #include "sysemu/kvm.h"
 #include "qmp-commands.h"
 #include "exec/exec-all.h"
+#include "exec/cputlb.h"
 
 #include "qemu/thread.h"
 #include "sysemu/cpus.h"
@@ -46,6 +47,9 @@
 #include "qapi-event.h"
 #include "hw/nmi.h"
 #include "sysemu/replay.h"
+#include "tcg.h"
+#include "exec/jit-perf.h"
+#include "exec/guest-profile.h"
 
 #ifndef _WIN32
 #include "qemu/compatfd.h"
@@ -688,6 +692,121 @@ void configure_icount(QemuOpts *opts, Error **errp)
 }
 
 /***********************************************************/
+/* Multi-threaded TCG
+ *
+ * By default a single host thread runs every TCG vCPU in turn.  With
+ * "-accel tcg,thread=multi" each vCPU gets its own host thread, which
+ * executes translated code without holding the BQL.
+ */
+
+static bool check_tcg_memory_orders_compatible(void)
+{
+#if defined(TCG_GUEST_DEFAULT_MO) && defined(TCG_TARGET_DEFAULT_MO)
+    return (TCG_GUEST_DEFAULT_MO & ~TCG_TARGET_DEFAULT_MO) == 0;
+#elif defined(TCG_GUEST_DEFAULT_MO)
+    /* Without a declaration, assume the host gives no ordering at all */
+    return TCG_GUEST_DEFAULT_MO == 0;
+#else
+    return false;
+#endif
+}
+
+void qemu_tcg_configure(QemuOpts *opts, Error **errp)
+{
+    const char *t = qemu_opt_get(opts, "thread");
+    const char *cache = qemu_opt_get(opts, "tb-cache");
+    uint64_t threshold = qemu_opt_get_number(opts, "trace-threshold", 0);
+    uint64_t vtlb_size = qemu_opt_get_number(opts, "vtlb-size",
+                                             CPU_VTLB_SIZE);
+
+    if (cache) {
+        Error *local_err = NULL;
+
+        tb_cache_init(cache, &local_err);
+        if (local_err) {
+            error_propagate(errp, local_err);
+            return;
+        }
+    }
+    if (threshold) {
+        if (use_icount) {
+            error_setg(errp, "No trace formation when icount is enabled");
+            return;
+        }
+        tb_trace_threshold = MIN(threshold, UINT32_MAX);
+    }
+    if (vtlb_size < 1 || vtlb_size > CPU_VTLB_MAX_SIZE) {
+        error_setg(errp, "vtlb-size must be between 1 and %d",
+                   CPU_VTLB_MAX_SIZE);
+        return;
+    }
+    tlb_victim_size = vtlb_size;
+    if (qemu_opt_get_bool(opts, "perf-map", false)) {
+        Error *local_err = NULL;
+
+        jit_perf_enable_perfmap(&local_err);
+        if (local_err) {
+            error_propagate(errp, local_err);
+            return;
+        }
+    }
+    if (qemu_opt_get_bool(opts, "jitdump", false)) {
+        Error *local_err = NULL;
+
+        jit_perf_enable_jitdump(&local_err);
+        if (local_err) {
+            error_propagate(errp, local_err);
+            return;
+        }
+    }
+    if (qemu_opt_get_bool(opts, "speculate", false)) {
+        tb_speculate_enable();
+    }
+    tb_profile_enabled = qemu_opt_get_bool(opts, "profile", false);
+    if (qemu_opt_get(opts, "sample-profile")) {
+        Error *local_err = NULL;
+
+        guest_profile_start(qemu_opt_get(opts, "sample-profile"),
+                            qemu_opt_get_number(opts, "sample-rate", 1000),
+                            qemu_opt_get_bool(opts, "sample-stack", false),
+                            &local_err);
+        if (local_err) {
+            error_propagate(errp, local_err);
+            return;
+        }
+    }
+    /* Only the TLB of the vCPU that chained the blocks is watched */
+    tb_cross_page_chaining = qemu_opt_get_bool(opts, "chain-pages", true) &&
+                             max_cpus == 1;
+    if (!t) {
+        return;
+    }
+    if (strcmp(t, "multi") == 0) {
+#if !defined(TARGET_SUPPORTS_MTTCG)
+        error_setg(errp, "No MTTCG support for this guest architecture");
+#elif TARGET_LONG_BITS > TCG_TARGET_REG_BITS
+        error_setg(errp, "No MTTCG when guest word size > host's");
+#else
+        if (use_icount) {
+            error_setg(errp, "No MTTCG when icount is enabled");
+            return;
+        }
+        if (!check_tcg_memory_orders_compatible()) {
+            error_report("warning: guest expects a stronger memory ordering "
+                         "than the host provides");
+            error_printf("This may cause strange/hard to debug errors\n");
+        }
+        mttcg_enabled = true;
+        parallel_cpus = true;
+#endif
+    } else if (strcmp(t, "single") == 0) {
+        mttcg_enabled = false;
+        parallel_cpus = false;
+    } else {
+        error_setg(errp, "Invalid 'thread' setting %s", t);
+    }
+}
+
 void hw_error(const char *fmt, ...)
 {
     va_list ap;
@@ -898,6 +1017,10 @@ static QemuCond qemu_cpu_cond;
 /* system init */
 static QemuCond qemu_pause_cond;
 static QemuCond qemu_work_cond;
+/* exclusive (safe) work */
+static QemuCond qemu_exclusive_cond;
+static QemuCond qemu_exclusive_resume;
+static int pending_cpus;
 
 void qemu_init_cpu_loop(void)
 {
@@ -905,12 +1028,30 @@ void qemu_init_cpu_loop(void)
     qemu_cond_init(&qemu_cpu_cond);
     qemu_cond_init(&qemu_pause_cond);
     qemu_cond_init(&qemu_work_cond);
+    qemu_cond_init(&qemu_exclusive_cond);
+    qemu_cond_init(&qemu_exclusive_resume);
     qemu_cond_init(&qemu_io_proceeded_cond);
     qemu_mutex_init(&qemu_global_mutex);
 
     qemu_thread_get_self(&io_thread);
 }
 
+static void queue_work_on_cpu(CPUState *cpu, struct qemu_work_item *wi)
+{
+    qemu_mutex_lock(&cpu->work_mutex);
+    if (cpu->queued_work_first == NULL) {
+        cpu->queued_work_first = wi;
+    } else {
+        cpu->queued_work_last->next = wi;
+    }
+    cpu->queued_work_last = wi;
+    wi->next = NULL;
+    wi->done = false;
+    qemu_mutex_unlock(&cpu->work_mutex);
+
+    qemu_cpu_kick(cpu);
+}
+
 void run_on_cpu(CPUState *cpu, void (*func)(void *data), void *data)
 {
     struct qemu_work_item wi;
@@ -923,19 +1064,9 @@ void run_on_cpu(CPUState *cpu, void (*func)(void *data), void *data)
     wi.func = func;
     wi.data = data;
     wi.free = false;
+    wi.exclusive = false;
 
-    qemu_mutex_lock(&cpu->work_mutex);
-    if (cpu->queued_work_first == NULL) {
-        cpu->queued_work_first = &wi;
-    } else {
-        cpu->queued_work_last->next = &wi;
-    }
-    cpu->queued_work_last = &wi;
-    wi.next = NULL;
-    wi.done = false;
-    qemu_mutex_unlock(&cpu->work_mutex);
-
-    qemu_cpu_kick(cpu);
+    queue_work_on_cpu(cpu, &wi);
     while (!atomic_mb_read(&wi.done)) {
         CPUState *self_cpu = current_cpu;
 
@@ -958,18 +1089,81 @@ void async_run_on_cpu(CPUState *cpu, void (*func)(void *data), void *data)
     wi->data = data;
     wi->free = true;
 
-    qemu_mutex_lock(&cpu->work_mutex);
-    if (cpu->queued_work_first == NULL) {
-        cpu->queued_work_first = wi;
-    } else {
-        cpu->queued_work_last->next = wi;
+    queue_work_on_cpu(cpu, wi);
+}
+
+/* Exclusive operations force every other vCPU out of cpu_exec().  The
+ * bookkeeping is protected by the BQL, which vCPU threads only drop
+ * while they execute translated code.
+ */
+
+/* Wait for pending exclusive operations to complete.  */
+static void exclusive_idle(void)
+{
+    while (pending_cpus) {
+        qemu_cond_wait(&qemu_exclusive_resume, &qemu_global_mutex);
     }
-    cpu->queued_work_last = wi;
-    wi->next = NULL;
-    wi->done = false;
-    qemu_mutex_unlock(&cpu->work_mutex);
+}
 
-    qemu_cpu_kick(cpu);
+/* Start an exclusive operation.
+   Must be called with the BQL held and from outside cpu_exec.  */
+static void start_exclusive(void)
+{
+    CPUState *other_cpu;
+
+    exclusive_idle();
+
+    pending_cpus = 1;
+    /* Make all other cpus stop executing.  */
+    CPU_FOREACH(other_cpu) {
+        if (other_cpu->running) {
+            pending_cpus++;
+            cpu_exit(other_cpu);
+        }
+    }
+    while (pending_cpus > 1) {
+        qemu_cond_wait(&qemu_exclusive_cond, &qemu_global_mutex);
+    }
+}
+
+/* Finish an exclusive operation.  */
+static void end_exclusive(void)
+{
+    pending_cpus = 0;
+    qemu_cond_broadcast(&qemu_exclusive_resume);
+}
+
+/* Wait for exclusive ops to finish, and begin cpu execution.  */
+static void tcg_cpu_exec_start(CPUState *cpu)
+{
+    exclusive_idle();
+    cpu->running = true;
+}
+
+/* Mark cpu as not executing, and release pending exclusive ops.  */
+static void tcg_cpu_exec_end(CPUState *cpu)
+{
+    cpu->running = false;
+    if (pending_cpus > 1) {
+        pending_cpus--;
+        if (pending_cpus == 1) {
+            qemu_cond_signal(&qemu_exclusive_cond);
+        }
+    }
+}
+
+void async_safe_run_on_cpu(CPUState *cpu, void (*func)(void *data), void *data)
+{
+    struct qemu_work_item *wi;
+
+    /* Never run the work item directly: we may be inside cpu_exec.  */
+    wi = g_malloc0(sizeof(struct qemu_work_item));
+    wi->func = func;
+    wi->data = data;
+    wi->free = true;
+    wi->exclusive = true;
+
+    queue_work_on_cpu(cpu, wi);
 }
 
 static void qemu_kvm_destroy_vcpu(CPUState *cpu)
@@ -1000,7 +1194,13 @@ static void flush_queued_work(CPUState *cpu)
             cpu->queued_work_last = NULL;
         }
         qemu_mutex_unlock(&cpu->work_mutex);
-        wi->func(wi->data);
+        if (wi->exclusive) {
+            start_exclusive();
+            wi->func(wi->data);
+            end_exclusive();
+        } else {
+            wi->func(wi->data);
+        }
         qemu_mutex_lock(&cpu->work_mutex);
         if (wi->free) {
             g_free(wi);
@@ -1026,7 +1226,10 @@ static void qemu_wait_io_event_common(CPUState *cpu)
 static void qemu_tcg_wait_io_event(CPUState *cpu)
 {
     while (all_cpu_threads_idle()) {
-        qemu_cond_wait(cpu->halt_cond, &qemu_global_mutex);
+        /* Use the idle time to translate ahead of the vCPUs.  */
+        if (!runstate_is_running() || !tb_speculate(NULL)) {
+            qemu_cond_wait(cpu->halt_cond, &qemu_global_mutex);
+        }
     }
 
     while (iothread_requesting_mutex) {
@@ -1038,6 +1241,26 @@ static void qemu_tcg_wait_io_event(CPUState *cpu)
     }
 }
 
+static void qemu_tcg_mttcg_wait_io_event(CPUState *cpu)
+{
+    bool found;
+
+    while (cpu_thread_is_idle(cpu)) {
+        if (runstate_is_running()) {
+            /* Translate ahead without holding up the other vCPUs.  */
+            qemu_mutex_unlock_iothread();
+            found = tb_speculate(cpu);
+            qemu_mutex_lock_iothread();
+            if (found) {
+                continue;
+            }
+        }
+        qemu_cond_wait(cpu->halt_cond, &qemu_global_mutex);
+    }
+
+    qemu_wait_io_event_common(cpu);
+}
+
 static void qemu_kvm_wait_io_event(CPUState *cpu)
 {
     while (cpu_thread_is_idle(cpu)) {
@@ -1136,8 +1359,13 @@ static void *qemu_dummy_cpu_thread_fn(void *arg)
 }
 
 static void tcg_exec_all(void);
+static int tcg_cpu_exec(CPUState *cpu);
 
-static void *qemu_tcg_cpu_thread_fn(void *arg)
+/* Single-threaded TCG
+ *
+ * A single thread runs all vCPUs round-robin in tcg_exec_all().
+ */
+static void *qemu_tcg_rr_cpu_thread_fn(void *arg)
 {
     CPUState *cpu = arg;
     CPUState *remove_cpu = NULL;
@@ -1195,6 +1423,52 @@ static void *qemu_tcg_cpu_thread_fn(void *arg)
     return NULL;
 }
 
+/* Multi-threaded TCG
+ *
+ * Each vCPU has its own thread and drops the BQL while it executes
+ * translated code.  Accesses to devices re-acquire it as needed.
+ */
+static void *qemu_tcg_cpu_thread_fn(void *arg)
+{
+    CPUState *cpu = arg;
+    int r;
+
+    rcu_register_thread();
+
+    qemu_mutex_lock_iothread();
+    qemu_thread_get_self(cpu->thread);
+
+    cpu->thread_id = qemu_get_thread_id();
+    cpu->created = true;
+    cpu->can_do_io = 1;
+    qemu_cond_signal(&qemu_cpu_cond);
+
+    do {
+        if (cpu_can_run(cpu)) {
+            tcg_cpu_exec_start(cpu);
+            qemu_mutex_unlock_iothread();
+            r = tcg_cpu_exec(cpu);
+            qemu_mutex_lock_iothread();
+            tcg_cpu_exec_end(cpu);
+            if (r == EXCP_DEBUG) {
+                cpu_handle_guest_debug(cpu);
+            } else if (r == EXCP_ATOMIC) {
+                /* Redo the instruction with every other vCPU stopped.  */
+                start_exclusive();
+                cpu_exec_step_atomic(cpu);
+                end_exclusive();
+            }
+        }
+        qemu_tcg_mttcg_wait_io_event(cpu);
+    } while (!cpu->unplug || cpu_can_run(cpu));
+
+    qemu_tcg_destroy_vcpu(cpu);
+    cpu->created = false;
+    qemu_cond_signal(&qemu_cpu_cond);
+    qemu_mutex_unlock_iothread();
+    return NULL;
+}
+
 static void qemu_cpu_kick_thread(CPUState *cpu)
 {
 #ifndef _WIN32
@@ -1230,7 +1504,9 @@ static void qemu_cpu_kick_no_halt(void)
 void qemu_cpu_kick(CPUState *cpu)
 {
     qemu_cond_broadcast(cpu->halt_cond);
-    if (tcg_enabled()) {
+    if (tcg_enabled() && qemu_tcg_mttcg_enabled()) {
+        cpu_exit(cpu);
+    } else if (tcg_enabled()) {
         qemu_cpu_kick_no_halt();
     } else {
         qemu_cpu_kick_thread(cpu);
@@ -1264,10 +1540,11 @@ void qemu_mutex_lock_iothread(void)
 {
     atomic_inc(&iothread_requesting_mutex);
     /* In the simple case there is no need to bump the VCPU thread out of
-     * TCG code execution.
+     * TCG code execution.  Multi-threaded TCG never holds the lock while
+     * executing translated code.
      */
-    if (!tcg_enabled() || qemu_in_vcpu_thread() ||
-        !first_cpu || !first_cpu->created) {
+    if (!tcg_enabled() || qemu_tcg_mttcg_enabled() ||
+        qemu_in_vcpu_thread() || !first_cpu || !first_cpu->created) {
         qemu_mutex_lock(&qemu_global_mutex);
         atomic_dec(&iothread_requesting_mutex);
     } else {
@@ -1312,7 +1589,7 @@ void pause_all_vcpus(void)
 
     if (qemu_in_vcpu_thread()) {
         cpu_stop_current();
-        if (!kvm_enabled()) {
+        if (!kvm_enabled() && !qemu_tcg_mttcg_enabled()) {
             CPU_FOREACH(cpu) {
                 cpu->stop = false;
                 cpu->stopped = true;
@@ -1370,18 +1647,34 @@ static void qemu_tcg_init_vcpu(CPUState *cpu)
     static QemuCond *tcg_halt_cond;
     static QemuThread *tcg_cpu_thread;
 
-    /* share a single thread for all cpus with TCG */
-    if (!tcg_cpu_thread) {
+    if (qemu_tcg_mttcg_enabled()) {
+        /* create a thread per vCPU with TCG (MTTCG) */
         cpu->thread = g_malloc0(sizeof(QemuThread));
         cpu->halt_cond = g_malloc0(sizeof(QemuCond));
         qemu_cond_init(cpu->halt_cond);
-        tcg_halt_cond = cpu->halt_cond;
         snprintf(thread_name, VCPU_THREAD_NAME_SIZE, "CPU %d/TCG",
                  cpu->cpu_index);
         qemu_thread_create(cpu->thread, thread_name, qemu_tcg_cpu_thread_fn,
                            cpu, QEMU_THREAD_JOINABLE);
 #ifdef _WIN32
         cpu->hThread = qemu_thread_get_handle(cpu->thread);
+#endif
+        while (!cpu->created) {
+            qemu_cond_wait(&qemu_cpu_cond, &qemu_global_mutex);
+        }
+    } else if (!tcg_cpu_thread) {
+        /* share a single thread for all cpus with TCG */
+        cpu->thread = g_malloc0(sizeof(QemuThread));
+        cpu->halt_cond = g_malloc0(sizeof(QemuCond));
+        qemu_cond_init(cpu->halt_cond);
+        tcg_halt_cond = cpu->halt_cond;
+        snprintf(thread_name, VCPU_THREAD_NAME_SIZE, "CPU %d/TCG",
+                 cpu->cpu_index);
+        qemu_thread_create(cpu->thread, thread_name,
+                           qemu_tcg_rr_cpu_thread_fn,
+                           cpu, QEMU_THREAD_JOINABLE);
+#ifdef _WIN32
+        cpu->hThread = qemu_thread_get_handle(cpu->thread);
 #endif
         while (!cpu->created) {
             qemu_cond_wait(&qemu_cpu_cond, &qemu_global_mutex);
@@ -31,7 +31,10 @@
 #include "exec/exec-all.h"
 #include "tcg/tcg.h"
 #include "qemu/error-report.h"
+#include "qemu/main-loop.h"
+#include "qemu/timer.h"
 #include "exec/log.h"
+#include "sysemu/replay.h"
 
 /* DEBUG defines, enable DEBUG_TLB_LOG to log to the CPU_LOG_MMU target */
 /* #define DEBUG_TLB */
@@ -61,6 +64,171 @@
 /* statistics */
 int tlb_flush_count;
 
+/* Number of entries in each victim tlb, set with -accel tcg,vtlb-size=n */
+unsigned int tlb_victim_size = CPU_VTLB_SIZE;
+
+/* The use rate of a dynamically sized TLB is measured over windows of
+ * this length.  A TLB is only shrunk when it was sparsely used for a
+ * whole window, so that a burst of flushes does not make it thrash.
+ */
+#define TLB_RESIZE_WINDOW_NS (100 * SCALE_MS)
+
+/* With multi-threaded TCG a vCPU's TLB is only ever modified by its own
+ * thread.  Flushes requested by another thread are queued as work for
+ * the owning vCPU, which performs them before it next executes code.
+ */
+static inline bool tlb_flush_is_remote(CPUState *cpu)
+{
+    return qemu_tcg_mttcg_enabled() && cpu->created && !qemu_cpu_is_self(cpu);
+}
+
+static inline bool tlb_entry_is_empty(const CPUTLBEntry *te)
+{
+    return te->addr_read == -1 && te->addr_write == -1 && te->addr_code == -1;
+}
+
+static void tlb_window_reset(CPUTLBDesc *desc, int64_t ns, size_t max_entries)
+{
+    desc->window_begin_ns = ns;
+    desc->window_max_entries = max_entries;
+}
+
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+/* Allocate a main TLB of N_ENTRIES for MMU_IDX, or of fewer entries if
+ * memory is tight.  The caller must initialize the entries.
+ */
+static void tlb_mmu_alloc(CPUArchState *env, int mmu_idx, size_t n_entries)
+{
+    CPUTLBEntry *table = g_try_new(CPUTLBEntry, n_entries);
+    CPUIOTLBEntry *iotlb = g_try_new(CPUIOTLBEntry, n_entries);
+
+    while (table == NULL || iotlb == NULL) {
+        if (n_entries == (1 << CPU_TLB_DYN_MIN_BITS)) {
+            error_report("Failed to allocate the TLB");
+            abort();
+        }
+        n_entries >>= 1;
+        g_free(table);
+        g_free(iotlb);
+        table = g_try_new(CPUTLBEntry, n_entries);
+        iotlb = g_try_new(CPUIOTLBEntry, n_entries);
+    }
+    env->tlb_mask[mmu_idx] = (n_entries - 1) << CPU_TLB_ENTRY_BITS;
+    env->tlb_table[mmu_idx] = table;
+    env->iotlb[mmu_idx] = iotlb;
+}
+
+/* Called at flush time to pick a size for the TLB of MMU_IDX, based on
+ * the largest number of entries that were in use at a flush during the
+ * current window.  Double the TLB if that is above 70% of its entries;
+ * if it stayed below 30% for a whole window, shrink it so that the use
+ * rate gets back to at most 70%.  This keeps the TLB large for guests
+ * that touch many pages between flushes, and the flush itself cheap
+ * for those that don't.
+ */
+static void tlb_mmu_resize(CPUArchState *env, int mmu_idx)
+{
+    CPUTLBDesc *desc = &env->tlb_d[mmu_idx];
+    size_t old_size = tlb_n_entries(env, mmu_idx);
+    size_t new_size = old_size;
+    size_t rate;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    bool window_expired = now > desc->window_begin_ns + TLB_RESIZE_WINDOW_NS;
+
+    if (desc->n_used_entries > desc->window_max_entries) {
+        desc->window_max_entries = desc->n_used_entries;
+    }
+    rate = desc->window_max_entries * 100 / old_size;
+
+    if (rate > 70) {
+        new_size = MIN(old_size << 1, 1 << CPU_TLB_DYN_MAX_BITS);
+    } else if (rate < 30 && window_expired) {
+        size_t ceil = pow2ceil(MAX(desc->window_max_entries,
+                                   1 << CPU_TLB_DYN_MIN_BITS));
+
+        if (desc->window_max_entries * 100 / ceil > 70) {
+            ceil <<= 1;
+        }
+        new_size = ceil;
+    }
+
+    if (new_size == old_size) {
+        if (window_expired) {
+            tlb_window_reset(desc, now, desc->n_used_entries);
+        }
+        return;
+    }
+
+    tlb_window_reset(desc, now, 0);
+    desc->resizes++;
+
+    /* tlb_reset_dirty may be walking the table from another thread.  */
+    qemu_spin_lock(&env->tlb_lock);
+    g_free(env->tlb_table[mmu_idx]);
+    g_free(env->iotlb[mmu_idx]);
+    tlb_mmu_alloc(env, mmu_idx, new_size);
+    qemu_spin_unlock(&env->tlb_lock);
+}
+#endif
+
+static void tlb_mmu_clear(CPUArchState *env, int mmu_idx)
+{
+    memset(env->tlb_table[mmu_idx], -1,
+           tlb_n_entries(env, mmu_idx) * sizeof(CPUTLBEntry));
+    memset(env->tlb_v_table[mmu_idx], -1,
+           tlb_victim_size * sizeof(CPUTLBEntry));
+    env->tlb_d[mmu_idx].n_used_entries = 0;
+}
+
+static void tlb_flush_one_mmuidx(CPUArchState *env, int mmu_idx)
+{
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+    tlb_mmu_resize(env, mmu_idx);
+#endif
+    tlb_mmu_clear(env, mmu_idx);
+}
+
+void tlb_init(CPUState *cpu)
+{
+    CPUArchState *env = cpu->env_ptr;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int mmu_idx;
+
+    qemu_spin_init(&env->tlb_lock);
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        memset(&env->tlb_d[mmu_idx], 0, sizeof(env->tlb_d[0]));
+        tlb_window_reset(&env->tlb_d[mmu_idx], now, 0);
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+        tlb_mmu_alloc(env, mmu_idx, 1 << CPU_TLB_DYN_DEFAULT_BITS);
+#endif
+        env->tlb_v_table[mmu_idx] = g_new(CPUTLBEntry, tlb_victim_size);
+        env->iotlb_v[mmu_idx] = g_new(CPUIOTLBEntry, tlb_victim_size);
+        tlb_mmu_clear(env, mmu_idx);
+    }
+    env->vtlb_index = 0;
+    env->tlb_flush_addr = -1;
+    env->tlb_flush_mask = 0;
+}
+
+void tlb_destroy(CPUState *cpu)
+{
+    CPUArchState *env = cpu->env_ptr;
+    int mmu_idx;
+
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+        g_free(env->tlb_table[mmu_idx]);
+        g_free(env->iotlb[mmu_idx]);
+        env->tlb_table[mmu_idx] = NULL;
+        env->iotlb[mmu_idx] = NULL;
+#endif
+        g_free(env->tlb_v_table[mmu_idx]);
+        g_free(env->iotlb_v[mmu_idx]);
+        env->tlb_v_table[mmu_idx] = NULL;
+        env->iotlb_v[mmu_idx] = NULL;
+    }
+}
+
 /* NOTE:
  * If flush_global is true (the usual case), flush all tlb entries.
  * If flush_global is false, flush (at least) all tlb entries not
@@ -73,20 +241,37 @@ int tlb_flush_count;
  * entries from the TLB at any time, so flushing more entries than
  * required is only an efficiency issue, not a correctness issue.
  */
-void tlb_flush(CPUState *cpu, int flush_global)
+static void tlb_flush_nocheck(CPUState *cpu, int flush_global)
 {
     CPUArchState *env = cpu->env_ptr;
+    int mmu_idx;
 
     tlb_debug("(%d)\n", flush_global);
 
-    memset(env->tlb_table, -1, sizeof(env->tlb_table));
-    memset(env->tlb_v_table, -1, sizeof(env->tlb_v_table));
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        tlb_flush_one_mmuidx(env, mmu_idx);
+    }
     memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
+    tb_unlink_cross_page_jumps();
 
     env->vtlb_index = 0;
     env->tlb_flush_addr = -1;
     env->tlb_flush_mask = 0;
-    tlb_flush_count++;
+    atomic_inc(&tlb_flush_count);
+}
+
+static void tlb_flush_global_async_work(void *data)
+{
+    tlb_flush_nocheck(data, 1);
+}
+
+void tlb_flush(CPUState *cpu, int flush_global)
+{
+    if (tlb_flush_is_remote(cpu)) {
+        async_run_on_cpu(cpu, tlb_flush_global_async_work, cpu);
+    } else {
+        tlb_flush_nocheck(cpu, flush_global);
+    }
 }
 
 static inline void v_tlb_flush_by_mmuidx(CPUState *cpu, va_list argp)
@@ -104,22 +289,29 @@ static inline void v_tlb_flush_by_mmuidx(CPUState *cpu, va_list argp)
 
         tlb_debug("%d\n", mmu_idx);
 
-        memset(env->tlb_table[mmu_idx], -1, sizeof(env->tlb_table[0]));
-        memset(env->tlb_v_table[mmu_idx], -1, sizeof(env->tlb_v_table[0]));
+        tlb_flush_one_mmuidx(env, mmu_idx);
     }
 
     memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
+    tb_unlink_cross_page_jumps();
 }
 
 void tlb_flush_by_mmuidx(CPUState *cpu, ...)
 {
     va_list argp;
+
+    if (tlb_flush_is_remote(cpu)) {
+        /* The index list cannot outlive this call; flush everything.  */
+        async_run_on_cpu(cpu, tlb_flush_global_async_work, cpu);
+        return;
+    }
+
     va_start(argp, cpu);
     v_tlb_flush_by_mmuidx(cpu, argp);
     va_end(argp);
 }
 
-static inline void tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
+static inline bool tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
 {
     if (addr == (tlb_entry->addr_read &
                  (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
@@ -128,15 +320,39 @@ static inline void tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
         addr == (tlb_entry->addr_code &
                  (TARGET_PAGE_MASK | TLB_INVALID_MASK))) {
         memset(tlb_entry, -1, sizeof(*tlb_entry));
+        return true;
+    }
+    return false;
+}
+
+static inline void tlb_flush_main_entry(CPUArchState *env, int mmu_idx,
+                                        target_ulong addr)
+{
+    if (tlb_flush_entry(tlb_entry(env, mmu_idx, addr), addr)) {
+        env->tlb_d[mmu_idx].n_used_entries--;
+    }
+}
+
+static inline void tlb_flush_victim_entries(CPUArchState *env, int mmu_idx,
+                                            target_ulong addr)
+{
+    unsigned int k;
+
+    for (k = 0; k < tlb_victim_size; k++) {
+        tlb_flush_entry(&env->tlb_v_table[mmu_idx][k], addr);
     }
 }
 
 void tlb_flush_page(CPUState *cpu, target_ulong addr)
 {
     CPUArchState *env = cpu->env_ptr;
-    int i;
     int mmu_idx;
 
+    if (tlb_flush_is_remote(cpu)) {
+        async_run_on_cpu(cpu, tlb_flush_global_async_work, cpu);
+        return;
+    }
+
     tlb_debug("page :" TARGET_FMT_lx "\n", addr);
 
     /* Check if we need to flush due to large pages.  */
@@ -150,28 +366,29 @@ void tlb_flush_page(CPUState *cpu, target_ulong addr)
     }
 
     addr &= TARGET_PAGE_MASK;
-    i = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        tlb_flush_entry(&env->tlb_table[mmu_idx][i], addr);
+        tlb_flush_main_entry(env, mmu_idx, addr);
     }
 
     /* check whether there are entries that need to be flushed in the vtlb */
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        int k;
-        for (k = 0; k < CPU_VTLB_SIZE; k++) {
-            tlb_flush_entry(&env->tlb_v_table[mmu_idx][k], addr);
-        }
+        tlb_flush_victim_entries(env, mmu_idx, addr);
     }
 
     tb_flush_jmp_cache(cpu, addr);
+    tb_unlink_cross_page_jumps();
 }
 
 void tlb_flush_page_by_mmuidx(CPUState *cpu, target_ulong addr, ...)
 {
     CPUArchState *env = cpu->env_ptr;
-    int i, k;
     va_list argp;
 
+    if (tlb_flush_is_remote(cpu)) {
+        async_run_on_cpu(cpu, tlb_flush_global_async_work, cpu);
+        return;
+    }
+
     va_start(argp, addr);
 
     tlb_debug("addr "TARGET_FMT_lx"\n", addr);
@@ -188,7 +405,6 @@ void tlb_flush_page_by_mmuidx(CPUState *cpu, target_ulong addr, ...)
     }
 
     addr &= TARGET_PAGE_MASK;
-    i = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
 
     for (;;) {
         int mmu_idx = va_arg(argp, int);
@@ -199,16 +415,15 @@ void tlb_flush_page_by_mmuidx(CPUState *cpu, target_ulong addr, ...)
 
         tlb_debug("idx %d\n", mmu_idx);
 
-        tlb_flush_entry(&env->tlb_table[mmu_idx][i], addr);
+        tlb_flush_main_entry(env, mmu_idx, addr);
 
         /* check whether there are vltb entries that need to be flushed */
-        for (k = 0; k < CPU_VTLB_SIZE; k++) {
-            tlb_flush_entry(&env->tlb_v_table[mmu_idx][k], addr);
-        }
+        tlb_flush_victim_entries(env, mmu_idx, addr);
     }
     va_end(argp);
 
     tb_flush_jmp_cache(cpu, addr);
+    tb_unlink_cross_page_jumps();
 }
 
 /* update the TLBs so that writes to code in the virtual page 'addr'
@@ -263,19 +478,21 @@ void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
     int mmu_idx;
 
     env = cpu->env_ptr;
+    qemu_spin_lock(&env->tlb_lock);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        unsigned int i;
+        size_t i, n = tlb_n_entries(env, mmu_idx);
 
-        for (i = 0; i < CPU_TLB_SIZE; i++) {
+        for (i = 0; i < n; i++) {
             tlb_reset_dirty_range(&env->tlb_table[mmu_idx][i],
                                   start1, length);
         }
 
-        for (i = 0; i < CPU_VTLB_SIZE; i++) {
+        for (i = 0; i < tlb_victim_size; i++) {
             tlb_reset_dirty_range(&env->tlb_v_table[mmu_idx][i],
                                   start1, length);
         }
     }
+    qemu_spin_unlock(&env->tlb_lock);
 }
 
 static inline void tlb_set_dirty1(CPUTLBEntry *tlb_entry, target_ulong vaddr)
@@ -290,18 +507,16 @@ static inline void tlb_set_dirty1(CPUTLBEntry *tlb_entry, target_ulong vaddr)
 void tlb_set_dirty(CPUState *cpu, target_ulong vaddr)
 {
     CPUArchState *env = cpu->env_ptr;
-    int i;
     int mmu_idx;
 
     vaddr &= TARGET_PAGE_MASK;
-    i = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        tlb_set_dirty1(&env->tlb_table[mmu_idx][i], vaddr);
+        tlb_set_dirty1(tlb_entry(env, mmu_idx, vaddr), vaddr);
     }
 
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        int k;
-        for (k = 0; k < CPU_VTLB_SIZE; k++) {
+        unsigned int k;
+        for (k = 0; k < tlb_victim_size; k++) {
             tlb_set_dirty1(&env->tlb_v_table[mmu_idx][k], vaddr);
         }
     }
@@ -342,14 +557,14 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
                              int mmu_idx, target_ulong size)
 {
     CPUArchState *env = cpu->env_ptr;
+    CPUTLBDesc *desc = &env->tlb_d[mmu_idx];
     MemoryRegionSection *section;
-    unsigned int index;
+    uintptr_t index;
     target_ulong address;
     target_ulong code_address;
     uintptr_t addend;
     CPUTLBEntry *te;
     hwaddr iotlb, xlat, sz;
-    unsigned vidx = env->vtlb_index++ % CPU_VTLB_SIZE;
     int asidx = cpu_asidx_from_attrs(cpu, attrs);
 
     assert(size >= TARGET_PAGE_SIZE);
@@ -379,12 +594,19 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     iotlb = memory_region_section_get_iotlb(cpu, section, vaddr, paddr, xlat,
                                             prot, &address);
 
-    index = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    index = tlb_index(env, mmu_idx, vaddr);
     te = &env->tlb_table[mmu_idx][index];
 
     /* do not discard the translation in te, evict it into a victim tlb */
-    env->tlb_v_table[mmu_idx][vidx] = *te;
-    env->iotlb_v[mmu_idx][vidx] = env->iotlb[mmu_idx][index];
+    if (tlb_entry_is_empty(te)) {
+        desc->n_used_entries++;
+    } else {
+        unsigned vidx = env->vtlb_index++ % tlb_victim_size;
+
+        env->tlb_v_table[mmu_idx][vidx] = *te;
+        env->iotlb_v[mmu_idx][vidx] = env->iotlb[mmu_idx][index];
+    }
+    desc->fills++;
 
     /* refill the tlb */
     env->iotlb[mmu_idx][index].addr = iotlb - vaddr;
@@ -469,17 +691,19 @@ static void report_bad_exec(CPUState *cpu, target_ulong addr)
  */
 tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong addr)
 {
-    int mmu_idx, page_index, pd;
+    int mmu_idx, pd;
+    uintptr_t page_index;
     void *p;
     MemoryRegion *mr;
     CPUState *cpu = ENV_GET_CPU(env1);
     CPUIOTLBEntry *iotlbentry;
 
-    page_index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     mmu_idx = cpu_mmu_index(env1, true);
+    page_index = tlb_index(env1, mmu_idx, addr);
     if (unlikely(env1->tlb_table[mmu_idx][page_index].addr_code !=
                  (addr & TARGET_PAGE_MASK))) {
         cpu_ldub_code(env1, addr);
+        page_index = tlb_index(env1, mmu_idx, addr);
     }
     iotlbentry = &env1->iotlb[mmu_idx][page_index];
     pd = iotlbentry->addr & ~TARGET_PAGE_MASK;
@@ -498,13 +722,35 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong addr)
     return qemu_ram_addr_from_host_nofail(p);
 }
 
+/* Like get_page_addr_code, but only looks at the TLB and never faults.
+ * Returns -1 unless ADDR is mapped to RAM for instruction fetch there.
+ */
+tb_page_addr_t tlb_probe_page_addr_code(CPUArchState *env1, target_ulong addr)
+{
+    int mmu_idx = cpu_mmu_index(env1, true);
+    uintptr_t page_index = tlb_index(env1, mmu_idx, addr);
+    CPUTLBEntry *entry = &env1->tlb_table[mmu_idx][page_index];
+    ram_addr_t ram_addr;
+
+    /* I/O pages have TLB_MMIO set in addr_code and do not compare equal */
+    if (entry->addr_code != (addr & TARGET_PAGE_MASK)) {
+        return -1;
+    }
+    ram_addr = qemu_ram_addr_from_host((void *)((uintptr_t)addr +
+                                                entry->addend));
+    if (ram_addr == RAM_ADDR_INVALID) {
+        return -1;
+    }
+    return ram_addr;
+}
+
 /* Return true if ADDR is present in the victim tlb, and has been copied
    back to the main tlb.  */
 static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
                            size_t elt_ofs, target_ulong page)
 {
     size_t vidx;
-    for (vidx = 0; vidx < CPU_VTLB_SIZE; ++vidx) {
+    for (vidx = 0; vidx < tlb_victim_size; ++vidx) {
         CPUTLBEntry *vtlb = &env->tlb_v_table[mmu_idx][vidx];
         target_ulong cmp = *(target_ulong *)((uintptr_t)vtlb + elt_ofs);
 
@@ -514,14 +760,65 @@ static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
             CPUIOTLBEntry tmpio, *io = &env->iotlb[mmu_idx][index];
             CPUIOTLBEntry *vio = &env->iotlb_v[mmu_idx][vidx];
 
+            if (tlb_entry_is_empty(tlb)) {
+                env->tlb_d[mmu_idx].n_used_entries++;
+            }
             tmptlb = *tlb; *tlb = *vtlb; *vtlb = tmptlb;
             tmpio = *io; *io = *vio; *vio = tmpio;
+            env->tlb_d[mmu_idx].victim_hits++;
             return true;
         }
     }
     return false;
 }
 
+void dump_tlb_info(FILE *f, fprintf_function cpu_fprintf)
+{
+    CPUState *cpu;
+    uint64_t hits = 0, victim_hits = 0, fills = 0, resizes = 0;
+    size_t entries = 0;
+
+    CPU_FOREACH(cpu) {
+        CPUArchState *env = cpu->env_ptr;
+        int mmu_idx;
+
+        for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+            CPUTLBDesc *desc = &env->tlb_d[mmu_idx];
+
+            entries += tlb_n_entries(env, mmu_idx);
+            hits += desc->hits;
+            victim_hits += desc->victim_hits;
+            fills += desc->fills;
+            resizes += desc->resizes;
+        }
+    }
+    cpu_fprintf(f, "TLB entries         %zd (victim TLB %u per mode)\n",
+                entries, tlb_victim_size);
+    cpu_fprintf(f, "TLB helper hits     %" PRIu64 "\n", hits);
+    cpu_fprintf(f, "TLB victim hits     %" PRIu64 "\n", victim_hits);
+    cpu_fprintf(f, "TLB fills           %" PRIu64 "\n", fills);
+    cpu_fprintf(f, "TLB resize count    %" PRIu64 "\n", resizes);
+}
+
+/* With icount, an access to a device is normally retranslated to be the
+ * last instruction of its TB, see cpu_io_recompile().  Timing insensitive
+ * regions skip this and run with the count at the end of the TB.  Returns
+ * true if CAN_DO_IO was raised for the access and must be cleared again.
+ */
+static bool io_prepare_icount(CPUState *cpu, MemoryRegion *mr,
+                              uintptr_t retaddr)
+{
+    if (mr == &io_mem_rom || mr == &io_mem_notdirty || cpu->can_do_io) {
+        return false;
+    }
+    if (!mr->timing_insensitive || replay_mode != REPLAY_MODE_NONE) {
+        cpu_io_recompile(cpu, retaddr);
+    }
+    /* The device may read the clock or raise an interrupt.  */
+    cpu->can_do_io = 1;
+    return true;
+}
+
 /* Macro to call the above, with local variables from the use context.  */
 #define VICTIM_TLB_HIT(TY, ADDR) \
   victim_tlb_hit(env, mmu_idx, index, offsetof(CPUTLBEntry, TY), \
@@ -25,37 +25,32 @@
 /* Disassemble TCI bytecode. */
 int print_insn_tci(bfd_vma addr, disassemble_info *info)
 {
-    int length;
-    uint8_t byte;
+    bfd_byte buf[8];
+    uint64_t insn;
     int status;
     TCGOpcode op;
+    int i;
 
-    status = info->read_memory_func(addr, &byte, 1, info);
+    status = info->read_memory_func(addr, buf, sizeof(buf), info);
     if (status != 0) {
         info->memory_error_func(status, addr, info);
         return -1;
     }
-    op = byte;
-
-    addr++;
-    status = info->read_memory_func(addr, &byte, 1, info);
-    if (status != 0) {
-        info->memory_error_func(status, addr, info);
-        return -1;
-    }
-    length = byte;
+    memcpy(&insn, buf, sizeof(insn));
+    op = TCI_OPC(insn);
 
     if (op >= tcg_op_defs_max) {
         info->fprintf_func(info->stream, "illegal opcode %d", op);
     } else {
         const TCGOpDef *def = &tcg_op_defs[op];
-        int nb_oargs = def->nb_oargs;
-        int nb_iargs = def->nb_iargs;
-        int nb_cargs = def->nb_cargs;
-        /* TODO: Improve disassembler output. */
-        info->fprintf_func(info->stream, "%s\to=%d i=%d c=%d",
-                           def->name, nb_oargs, nb_iargs, nb_cargs);
+        int nb_regs = def->nb_oargs + def->nb_iargs;
+
+        info->fprintf_func(info->stream, "%s", def->name);
+        for (i = 0; i < nb_regs && i < 6; i++) {
+            info->fprintf_func(info->stream, "%sr%d", i ? "," : "\t",
+                               TCI_FIELD(insn, i));
+        }
     }
 
-    return length;
+    return TCI_LEN(insn) ? TCI_LEN(insn) * 8 : 8;
 }
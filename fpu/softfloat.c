@@ -83,6 +83,8 @@ this code that are retained.
  * target-dependent and needs the TARGET_* macros.
  */
 #include "qemu/osdep.h"
+#include <math.h>
+#include <float.h>
 
 #include "fpu/softfloat.h"
 
@@ -2158,6 +2160,83 @@ static float32 subFloat32Sigs(float32 a, float32 b, flag zSign,
 
 }
 
+/*----------------------------------------------------------------------------
+| Host FPU fast path.  If the rounding mode is nearest-even and the inexact
+| flag is already raised, the host FPU computes the same result as the code
+| below for zero or normal inputs, and the only flag it can add is overflow,
+| which is easily detected.  Results that may be tiny are left to the soft
+| code, which knows about underflow, tininess detection and flush-to-zero.
+| Hosts whose floating-point arithmetic may use excess precision cannot
+| take this path, since their results could be rounded twice.
+*----------------------------------------------------------------------------*/
+
+#if defined(__FAST_MATH__) || !defined(FLT_EVAL_METHOD) || FLT_EVAL_METHOD != 0
+#define QEMU_NO_HARDFLOAT 1
+#else
+#define QEMU_NO_HARDFLOAT 0
+#endif
+
+typedef union {
+    float32 s;
+    float h;
+} union_float32;
+
+typedef union {
+    float64 s;
+    double h;
+} union_float64;
+
+static inline bool can_use_fpu(const float_status *status)
+{
+    return !QEMU_NO_HARDFLOAT
+        && (status->float_exception_flags & float_flag_inexact)
+        && status->float_rounding_mode == float_round_nearest_even;
+}
+
+static inline bool float32_is_zero_or_normal(float32 a)
+{
+    int aExp = extractFloat32Exp(a);
+
+    return aExp != 0xFF && (aExp != 0 || extractFloat32Frac(a) == 0);
+}
+
+static inline bool float64_is_zero_or_normal(float64 a)
+{
+    int aExp = extractFloat64Exp(a);
+
+    return aExp != 0x7FF && (aExp != 0 || extractFloat64Frac(a) == 0);
+}
+
+/*----------------------------------------------------------------------------
+| Returns true if the host result `r' can be returned as is, raising the
+| overflow flag if it is infinite.  A zero or tiny result is only accepted if
+| `exact_zero' says that the operation gives an exact zero.
+*----------------------------------------------------------------------------*/
+
+static inline bool float32_hard_result(union_float32 r, bool exact_zero,
+                                       float_status *status)
+{
+    uint32_t abs = float32_val(r.s) & 0x7FFFFFFF;
+
+    if (unlikely(abs == 0x7F800000)) {
+        float_raise(float_flag_overflow, status);
+        return true;
+    }
+    return likely(abs > 0x00800000) || exact_zero;
+}
+
+static inline bool float64_hard_result(union_float64 r, bool exact_zero,
+                                       float_status *status)
+{
+    uint64_t abs = float64_val(r.s) & LIT64(0x7FFFFFFFFFFFFFFF);
+
+    if (unlikely(abs == LIT64(0x7FF0000000000000))) {
+        float_raise(float_flag_overflow, status);
+        return true;
+    }
+    return likely(abs > LIT64(0x0010000000000000)) || exact_zero;
+}
+
 /*----------------------------------------------------------------------------
 | Returns the result of adding the single-precision floating-point values `a'
 | and `b'.  The operation is performed according to the IEC/IEEE Standard for
@@ -2167,6 +2246,18 @@ static float32 subFloat32Sigs(float32 a, float32 b, flag zSign,
 float32 float32_add(float32 a, float32 b, float_status *status)
 {
     flag aSign, bSign;
+
+    if (can_use_fpu(status) && float32_is_zero_or_normal(a)
+        && float32_is_zero_or_normal(b)) {
+        union_float32 ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h + ub.h;
+        if (float32_hard_result(ur, float32_is_zero(a) && float32_is_zero(b),
+                                status)) {
+            return ur.s;
+        }
+    }
+
     a = float32_squash_input_denormal(a, status);
     b = float32_squash_input_denormal(b, status);
 
@@ -2190,6 +2281,18 @@ float32 float32_add(float32 a, float32 b, float_status *status)
 float32 float32_sub(float32 a, float32 b, float_status *status)
 {
     flag aSign, bSign;
+
+    if (can_use_fpu(status) && float32_is_zero_or_normal(a)
+        && float32_is_zero_or_normal(b)) {
+        union_float32 ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h - ub.h;
+        if (float32_hard_result(ur, float32_is_zero(a) && float32_is_zero(b),
+                                status)) {
+            return ur.s;
+        }
+    }
+
     a = float32_squash_input_denormal(a, status);
     b = float32_squash_input_denormal(b, status);
 
@@ -2218,6 +2321,17 @@ float32 float32_mul(float32 a, float32 b, float_status *status)
     uint64_t zSig64;
     uint32_t zSig;
 
+    if (can_use_fpu(status) && float32_is_zero_or_normal(a)
+        && float32_is_zero_or_normal(b)) {
+        union_float32 ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h * ub.h;
+        if (float32_hard_result(ur, float32_is_zero(a) || float32_is_zero(b),
+                                status)) {
+            return ur.s;
+        }
+    }
+
     a = float32_squash_input_denormal(a, status);
     b = float32_squash_input_denormal(b, status);
 
@@ -2280,6 +2394,17 @@ float32 float32_div(float32 a, float32 b, float_status *status)
     flag aSign, bSign, zSign;
     int aExp, bExp, zExp;
     uint32_t aSig, bSig, zSig;
+
+    if (can_use_fpu(status) && float32_is_zero_or_normal(a)
+        && float32_is_zero_or_normal(b) && !float32_is_zero(b)) {
+        union_float32 ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h / ub.h;
+        if (float32_hard_result(ur, float32_is_zero(a), status)) {
+            return ur.s;
+        }
+    }
+
     a = float32_squash_input_denormal(a, status);
     b = float32_squash_input_denormal(b, status);
 
@@ -2464,6 +2589,18 @@ float32 float32_muladd(float32 a, float32 b, float32 c, int flags,
     int shiftcount;
     flag signflip, infzero;
 
+    if (flags == 0 && can_use_fpu(status)
+        && float32_is_zero_or_normal(a) && !float32_is_zero(a)
+        && float32_is_zero_or_normal(b) && !float32_is_zero(b)
+        && float32_is_zero_or_normal(c)) {
+        union_float32 ua = { .s = a }, ub = { .s = b }, uc = { .s = c }, ur;
+
+        ur.h = fmaf(ua.h, ub.h, uc.h);
+        if (float32_hard_result(ur, false, status)) {
+            return ur.s;
+        }
+    }
+
     a = float32_squash_input_denormal(a, status);
     b = float32_squash_input_denormal(b, status);
     c = float32_squash_input_denormal(c, status);
@@ -2679,6 +2816,16 @@ float32 float32_sqrt(float32 a, float_status *status)
     int aExp, zExp;
     uint32_t aSig, zSig;
     uint64_t rem, term;
+
+    if (can_use_fpu(status) && float32_is_zero_or_normal(a)
+        && (!float32_is_neg(a) || float32_is_zero(a))) {
+        union_float32 ua = { .s = a }, ur;
+
+        /* The square root of a normal number is normal.  */
+        ur.h = sqrtf(ua.h);
+        return ur.s;
+    }
+
     a = float32_squash_input_denormal(a, status);
 
     aSig = extractFloat32Frac( a );
@@ -3962,6 +4109,18 @@ static float64 subFloat64Sigs(float64 a, float64 b, flag zSign,
 float64 float64_add(float64 a, float64 b, float_status *status)
 {
     flag aSign, bSign;
+
+    if (can_use_fpu(status) && float64_is_zero_or_normal(a)
+        && float64_is_zero_or_normal(b)) {
+        union_float64 ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h + ub.h;
+        if (float64_hard_result(ur, float64_is_zero(a) && float64_is_zero(b),
+                                status)) {
+            return ur.s;
+        }
+    }
+
     a = float64_squash_input_denormal(a, status);
     b = float64_squash_input_denormal(b, status);
 
@@ -3985,6 +4144,18 @@ float64 float64_add(float64 a, float64 b, float_status *status)
 float64 float64_sub(float64 a, float64 b, float_status *status)
 {
     flag aSign, bSign;
+
+    if (can_use_fpu(status) && float64_is_zero_or_normal(a)
+        && float64_is_zero_or_normal(b)) {
+        union_float64 ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h - ub.h;
+        if (float64_hard_result(ur, float64_is_zero(a) && float64_is_zero(b),
+                                status)) {
+            return ur.s;
+        }
+    }
+
     a = float64_squash_input_denormal(a, status);
     b = float64_squash_input_denormal(b, status);
 
@@ -4011,6 +4182,17 @@ float64 float64_mul(float64 a, float64 b, float_status *status)
     int aExp, bExp, zExp;
     uint64_t aSig, bSig, zSig0, zSig1;
 
+    if (can_use_fpu(status) && float64_is_zero_or_normal(a)
+        && float64_is_zero_or_normal(b)) {
+        union_float64 ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h * ub.h;
+        if (float64_hard_result(ur, float64_is_zero(a) || float64_is_zero(b),
+                                status)) {
+            return ur.s;
+        }
+    }
+
     a = float64_squash_input_denormal(a, status);
     b = float64_squash_input_denormal(b, status);
 
@@ -4075,6 +4257,17 @@ float64 float64_div(float64 a, float64 b, float_status *status)
     uint64_t aSig, bSig, zSig;
     uint64_t rem0, rem1;
     uint64_t term0, term1;
+
+    if (can_use_fpu(status) && float64_is_zero_or_normal(a)
+        && float64_is_zero_or_normal(b) && !float64_is_zero(b)) {
+        union_float64 ua = { .s = a }, ub = { .s = b }, ur;
+
+        ur.h = ua.h / ub.h;
+        if (float64_hard_result(ur, float64_is_zero(a), status)) {
+            return ur.s;
+        }
+    }
+
     a = float64_squash_input_denormal(a, status);
     b = float64_squash_input_denormal(b, status);
 
@@ -4250,6 +4443,18 @@ float64 float64_muladd(float64 a, float64 b, float64 c, int flags,
     int shiftcount;
     flag signflip, infzero;
 
+    if (flags == 0 && can_use_fpu(status)
+        && float64_is_zero_or_normal(a) && !float64_is_zero(a)
+        && float64_is_zero_or_normal(b) && !float64_is_zero(b)
+        && float64_is_zero_or_normal(c)) {
+        union_float64 ua = { .s = a }, ub = { .s = b }, uc = { .s = c }, ur;
+
+        ur.h = fma(ua.h, ub.h, uc.h);
+        if (float64_hard_result(ur, false, status)) {
+            return ur.s;
+        }
+    }
+
     a = float64_squash_input_denormal(a, status);
     b = float64_squash_input_denormal(b, status);
     c = float64_squash_input_denormal(c, status);
@@ -4487,6 +4692,16 @@ float64 float64_sqrt(float64 a, float_status *status)
     int aExp, zExp;
     uint64_t aSig, zSig, doubleZSig;
     uint64_t rem0, rem1, term0, term1;
+
+    if (can_use_fpu(status) && float64_is_zero_or_normal(a)
+        && (!float64_is_neg(a) || float64_is_zero(a))) {
+        union_float64 ua = { .s = a }, ur;
+
+        /* The square root of a normal number is normal.  */
+        ur.h = sqrt(ua.h);
+        return ur.s;
+    }
+
     a = float64_squash_input_denormal(a, status);
 
     aSig = extractFloat64Frac( a );
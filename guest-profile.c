@@ -0,0 +1,374 @@
+/*
+ * Sampling profiler for guest code
+ *
+ * Copyright (c) 2016 agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "cpu.h"
+#include "disas/disas.h"
+#include "exec/guest-profile.h"
+#include "qemu/timer.h"
+#include "qemu/error-report.h"
+#include "sysemu/sysemu.h"
+
+/* A host timer sets cpu->profile_sample and makes the vCPU leave its
+ * chain of TBs, and cpu_exec() takes the sample before it looks up the
+ * next TB, when the guest state is up to date.  Each vCPU counts its
+ * samples in its own table, which is only read once the vCPUs are
+ * stopped, so no locking is needed.  With icount, translated code does
+ * not check tcg_exit_req, so samples are delayed to the next exit.
+ */
+
+#define GUEST_PROFILE_MAX_FRAMES 32
+
+/* A call stack, innermost first: addrs[0] is the PC */
+typedef struct GuestProfileStack {
+    uint64_t count;
+    int depth;
+    vaddr addrs[GUEST_PROFILE_MAX_FRAMES];
+} GuestProfileStack;
+
+typedef struct GuestProfileCPU {
+    GHashTable *stacks;
+} GuestProfileCPU;
+
+/* A guest function in the output */
+typedef struct GuestProfileSymbol {
+    char *name;
+    uint64_t self;
+    uint64_t total;
+    /* last stack that counted towards total */
+    GuestProfileStack *seen;
+} GuestProfileSymbol;
+
+static struct {
+    bool enabled;
+    bool stack;
+    char *filename;
+    unsigned int rate;
+    int64_t period_ns;
+    QEMUTimer *timer;
+    /* samples in which no vCPU was running, from the timer only */
+    uint64_t idle;
+} profile;
+
+static size_t stack_size(int depth)
+{
+    return offsetof(GuestProfileStack, addrs) + depth * sizeof(vaddr);
+}
+
+static guint stack_hash(gconstpointer p)
+{
+    const GuestProfileStack *s = p;
+    guint h = s->depth;
+    int i;
+
+    for (i = 0; i < s->depth; i++) {
+        h = h * 31 + (guint)(s->addrs[i] ^ (s->addrs[i] >> 32));
+    }
+    return h;
+}
+
+static gboolean stack_equal(gconstpointer a, gconstpointer b)
+{
+    const GuestProfileStack *sa = a;
+    const GuestProfileStack *sb = b;
+
+    return sa->depth == sb->depth &&
+           !memcmp(sa->addrs, sb->addrs, sa->depth * sizeof(vaddr));
+}
+
+void guest_profile_sample(CPUState *cpu)
+{
+    CPUClass *cc = CPU_GET_CLASS(cpu);
+    CPUArchState *env = cpu->env_ptr;
+    GuestProfileCPU *p = cpu->profile;
+    GuestProfileStack key, *s;
+    target_ulong pc, cs_base;
+    uint32_t flags;
+
+    atomic_set(&cpu->profile_sample, false);
+    if (!atomic_read(&profile.enabled)) {
+        return;
+    }
+    if (!p) {
+        p = g_new0(GuestProfileCPU, 1);
+        p->stacks = g_hash_table_new(stack_hash, stack_equal);
+        cpu->profile = p;
+    }
+
+    cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    key.addrs[0] = pc;
+    key.depth = 1;
+    if (profile.stack && cc->get_return_addresses) {
+        key.depth += cc->get_return_addresses(cpu, key.addrs + 1,
+                                              GUEST_PROFILE_MAX_FRAMES - 1);
+    }
+
+    s = g_hash_table_lookup(p->stacks, &key);
+    if (!s) {
+        s = g_memdup(&key, stack_size(key.depth));
+        s->count = 0;
+        g_hash_table_insert(p->stacks, s, s);
+    }
+    s->count++;
+}
+
+static void guest_profile_tick(void *opaque)
+{
+    CPUState *cpu;
+    bool idle = true;
+
+    if (runstate_is_running()) {
+        CPU_FOREACH(cpu) {
+            if (cpu->halted) {
+                continue;
+            }
+            atomic_set(&cpu->profile_sample, true);
+            /* Seen by cpu_exec() once the TB chain is left */
+            smp_wmb();
+            cpu->tcg_exit_req = 1;
+            idle = false;
+        }
+        if (idle) {
+            profile.idle++;
+        }
+    }
+    timer_mod(profile.timer,
+              qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + profile.period_ns);
+}
+
+static char *symbol_name(vaddr addr)
+{
+    const char *symbol = lookup_symbol(addr);
+
+    if (symbol[0]) {
+        return g_strdup(symbol);
+    }
+    return g_strdup_printf("0x%" VADDR_PRIx, addr);
+}
+
+static GuestProfileSymbol *get_symbol(GHashTable *symbols, vaddr addr)
+{
+    GuestProfileSymbol *sym;
+    char *name = symbol_name(addr);
+
+    sym = g_hash_table_lookup(symbols, name);
+    if (sym) {
+        g_free(name);
+    } else {
+        sym = g_new0(GuestProfileSymbol, 1);
+        sym->name = name;
+        g_hash_table_insert(symbols, name, sym);
+    }
+    return sym;
+}
+
+/* Return addresses follow the call, which may be the last instruction
+   of the caller.  */
+static GuestProfileSymbol *frame_symbol(GHashTable *symbols,
+                                        GuestProfileStack *s, int i)
+{
+    return get_symbol(symbols, i ? s->addrs[i] - 1 : s->addrs[i]);
+}
+
+/* Append to FOLDED the functions of S, outermost first.  Frames in the
+ * same function are merged: the return address found in the link
+ * register may point into the current function.
+ */
+static void fold_stack(GString *folded, GHashTable *symbols,
+                       GuestProfileStack *s)
+{
+    const char *prev = NULL;
+    int i;
+
+    for (i = s->depth - 1; i >= 0; i--) {
+        GuestProfileSymbol *sym = frame_symbol(symbols, s, i);
+
+        if (sym->name == prev) {
+            continue;
+        }
+        if (prev) {
+            g_string_append_c(folded, ';');
+        }
+        g_string_append(folded, sym->name);
+        prev = sym->name;
+    }
+}
+
+static gint symbol_cmp(gconstpointer a, gconstpointer b)
+{
+    const GuestProfileSymbol *sa = *(GuestProfileSymbol * const *)a;
+    const GuestProfileSymbol *sb = *(GuestProfileSymbol * const *)b;
+
+    if (sa->self != sb->self) {
+        return sa->self < sb->self ? 1 : -1;
+    }
+    if (sa->total != sb->total) {
+        return sa->total < sb->total ? 1 : -1;
+    }
+    return strcmp(sa->name, sb->name);
+}
+
+static void write_flat(FILE *f, GPtrArray *symbols, uint64_t samples)
+{
+    double scale = samples ? 100.0 / samples : 0;
+    guint i;
+
+    fprintf(f, "# %" PRIu64 " samples at %u Hz\n", samples, profile.rate);
+    if (profile.stack) {
+        fprintf(f, "#   self  self%%    total total%%  symbol\n");
+    } else {
+        fprintf(f, "#   self  self%%  symbol\n");
+    }
+    if (profile.idle) {
+        fprintf(f, "%8" PRIu64 " %5.1f%%  ", profile.idle,
+                profile.idle * scale);
+        if (profile.stack) {
+            fprintf(f, "%8" PRIu64 " %5.1f%%  ", profile.idle,
+                    profile.idle * scale);
+        }
+        fprintf(f, "[idle]\n");
+    }
+    for (i = 0; i < symbols->len; i++) {
+        GuestProfileSymbol *sym = g_ptr_array_index(symbols, i);
+
+        fprintf(f, "%8" PRIu64 " %5.1f%%  ", sym->self, sym->self * scale);
+        if (profile.stack) {
+            fprintf(f, "%8" PRIu64 " %5.1f%%  ", sym->total,
+                    sym->total * scale);
+        }
+        fprintf(f, "%s\n", sym->name);
+    }
+}
+
+static void write_folded(FILE *f, GHashTable *folded)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, folded);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        fprintf(f, "%s %" PRIu64 "\n", (char *)key, *(uint64_t *)value);
+    }
+    if (profile.idle) {
+        fprintf(f, "[idle] %" PRIu64 "\n", profile.idle);
+    }
+}
+
+static void guest_profile_exit(void)
+{
+    GHashTable *symbols, *folded;
+    GPtrArray *sorted;
+    GHashTableIter iter;
+    gpointer value;
+    GString *str;
+    uint64_t samples = profile.idle;
+    CPUState *cpu;
+    FILE *f;
+
+    atomic_set(&profile.enabled, false);
+    timer_del(profile.timer);
+
+    symbols = g_hash_table_new(g_str_hash, g_str_equal);
+    folded = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    str = g_string_new(NULL);
+
+    CPU_FOREACH(cpu) {
+        if (!cpu->profile) {
+            continue;
+        }
+        g_hash_table_iter_init(&iter, cpu->profile->stacks);
+        while (g_hash_table_iter_next(&iter, NULL, &value)) {
+            GuestProfileStack *s = value;
+            GuestProfileSymbol *sym;
+            uint64_t *count;
+            int i;
+
+            samples += s->count;
+            get_symbol(symbols, s->addrs[0])->self += s->count;
+            for (i = 0; i < s->depth; i++) {
+                /* Recursive functions count once per sample */
+                sym = frame_symbol(symbols, s, i);
+                if (sym->seen != s) {
+                    sym->total += s->count;
+                    sym->seen = s;
+                }
+            }
+
+            if (profile.stack) {
+                g_string_truncate(str, 0);
+                fold_stack(str, symbols, s);
+                count = g_hash_table_lookup(folded, str->str);
+                if (!count) {
+                    count = g_new0(uint64_t, 1);
+                    g_hash_table_insert(folded, g_strdup(str->str), count);
+                }
+                *count += s->count;
+            }
+        }
+    }
+
+    sorted = g_ptr_array_new();
+    g_hash_table_iter_init(&iter, symbols);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        g_ptr_array_add(sorted, value);
+    }
+    g_ptr_array_sort(sorted, symbol_cmp);
+
+    f = fopen(profile.filename, "w");
+    if (f) {
+        write_flat(f, sorted, samples);
+        fclose(f);
+    } else {
+        error_report("could not write the guest profile to %s: %s",
+                     profile.filename, strerror(errno));
+    }
+    if (profile.stack) {
+        char *name = g_strdup_printf("%s.folded", profile.filename);
+
+        f = fopen(name, "w");
+        if (f) {
+            write_folded(f, folded);
+            fclose(f);
+        } else {
+            error_report("could not write the guest profile to %s: %s",
+                         name, strerror(errno));
+        }
+        g_free(name);
+    }
+
+    g_ptr_array_free(sorted, true);
+    g_string_free(str, true);
+    g_hash_table_destroy(folded);
+}
+
+void guest_profile_start(const char *filename, unsigned int rate, bool stack,
+                         Error **errp)
+{
+    if (profile.enabled) {
+        error_setg(errp, "the guest profiler is already running");
+        return;
+    }
+    if (rate < 1 || rate > 100000) {
+        error_setg(errp, "the sampling rate must be between 1 and 100000 Hz");
+        return;
+    }
+
+    profile.filename = g_strdup(filename);
+    profile.rate = rate;
+    profile.period_ns = NANOSECONDS_PER_SECOND / rate;
+    profile.stack = stack;
+    profile.timer = timer_new_ns(QEMU_CLOCK_REALTIME, guest_profile_tick, NULL);
+    timer_mod(profile.timer,
+              qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + profile.period_ns);
+    atomic_set(&profile.enabled, true);
+
+    /* Also covers guests that exit through semihosting, from the vCPU
+       thread; otherwise the vCPUs are paused by then.  */
+    atexit(guest_profile_exit);
+}
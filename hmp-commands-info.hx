@@ -288,6 +288,21 @@ STEXI
 @item info jit
 @findex jit
 Show dynamic compiler info.
+ETEXI
+
+    {
+        .name       = "tb-hot",
+        .args_type  = "count:i?",
+        .params     = "[count]",
+        .help       = "show the most executed translated blocks",
+        .mhandler.cmd = hmp_info_tb_hot,
+    },
+
+STEXI
+@item info tb-hot [@var{count}]
+@findex tb-hot
+Show the @var{count} translated blocks that were executed most, 10 by
+default.  Requires @code{-accel tcg,profile=on}.
 ETEXI
 
     {
@@ -371,6 +371,25 @@ STEXI
 @item delvm @var{tag}|@var{id}
 @findex delvm
 Delete the snapshot identified by @var{tag} or @var{id}.
+ETEXI
+
+    {
+        .name       = "snapshot-fast",
+        .args_type  = "action:s",
+        .params     = "save|restore|delete",
+        .help       = "save, restore or delete the in-memory VM snapshot",
+        .mhandler.cmd = hmp_snapshot_fast,
+    },
+
+STEXI
+@item snapshot-fast save|restore|delete
+@findex snapshot-fast
+Save the state of the virtual machine in host memory, restore it, or free
+it.  Unlike @code{savevm}, the block devices are not part of the
+snapshot, and restoring only copies back the RAM pages written since the
+snapshot was taken.  This is meant for test loops which restart the
+guest from the same state many times.  Migration is blocked while the
+snapshot exists.
 ETEXI
 
     {
@@ -2038,6 +2038,53 @@ void hmp_info_iothreads(Monitor *mon, const QDict *qdict)
     qapi_free_IOThreadInfoList(info_list);
 }
 
+void hmp_snapshot_fast(Monitor *mon, const QDict *qdict)
+{
+    const char *action = qdict_get_str(qdict, "action");
+    Error *err = NULL;
+
+    if (!strcmp(action, "save")) {
+        qmp_snapshot_fast_save(&err);
+    } else if (!strcmp(action, "restore")) {
+        qmp_snapshot_fast_restore(&err);
+    } else if (!strcmp(action, "delete")) {
+        qmp_snapshot_fast_delete(&err);
+    } else {
+        error_setg(&err, "Unknown action '%s', expected save, restore "
+                   "or delete", action);
+    }
+    hmp_handle_error(mon, &err);
+}
+
+void hmp_info_tb_hot(Monitor *mon, const QDict *qdict)
+{
+    bool has_count = qdict_haskey(qdict, "count");
+    int64_t count = qdict_get_try_int(qdict, "count", 0);
+    TbHotInfoList *info_list, *info;
+    Error *err = NULL;
+
+    info_list = qmp_query_tb_hot(has_count, count, &err);
+    if (err) {
+        hmp_handle_error(mon, &err);
+        return;
+    }
+
+    monitor_printf(mon, "%-18s %5s %5s %6s %12s %14s %s\n", "guest PC",
+                   "size", "insns", "host", "executions", "cost", "chained");
+    for (info = info_list; info; info = info->next) {
+        TbHotInfo *tb = info->value;
+
+        monitor_printf(mon, "0x%016" PRIx64 " %5" PRId64 " %5" PRId64
+                       " %6" PRId64 " %12" PRId64 " %14" PRId64 " %"
+                       PRId64 "/%" PRId64 "%s\n",
+                       tb->pc, tb->size, tb->icount, tb->host_size,
+                       tb->exec_count, tb->cost, tb->chained, tb->jumps,
+                       tb->trace ? " (trace)" : "");
+    }
+
+    qapi_free_TbHotInfoList(info_list);
+}
+
 void hmp_qom_list(Monitor *mon, const QDict *qdict)
 {
     const char *path = qdict_get_try_str(qdict, "path");
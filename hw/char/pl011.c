@@ -285,6 +285,7 @@ static void pl011_init(Object *obj)
     PL011State *s = PL011(obj);
 
     memory_region_init_io(&s->iomem, OBJECT(s), &pl011_ops, s, "pl011", 0x1000);
+    memory_region_set_timing_insensitive(&s->iomem);
     sysbus_init_mmio(sbd, &s->iomem);
     sysbus_init_irq(sbd, &s->irq);
 
@@ -1055,6 +1055,7 @@ static void fw_cfg_mem_realize(DeviceState *dev, Error **errp)
 
     memory_region_init_io(&s->ctl_iomem, OBJECT(s), &fw_cfg_ctl_mem_ops,
                           FW_CFG(s), "fwcfg.ctl", FW_CFG_CTL_SIZE);
+    memory_region_set_timing_insensitive(&s->ctl_iomem);
     sysbus_init_mmio(sbd, &s->ctl_iomem);
 
     if (s->data_width > data_ops->valid.max_access_size) {
@@ -1071,6 +1072,7 @@ static void fw_cfg_mem_realize(DeviceState *dev, Error **errp)
     }
     memory_region_init_io(&s->data_iomem, OBJECT(s), data_ops, FW_CFG(s),
                           "fwcfg.data", data_ops->valid.max_access_size);
+    memory_region_set_timing_insensitive(&s->data_iomem);
     sysbus_init_mmio(sbd, &s->data_iomem);
 
     if (FW_CFG(s)->dma_enabled) {
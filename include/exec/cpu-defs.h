@@ -28,6 +28,7 @@
 #include "tcg-target.h"
 #ifndef CONFIG_USER_ONLY
 #include "exec/hwaddr.h"
+#include "qemu/thread.h"
 #endif
 #include "exec/memattrs.h"
 
@@ -55,8 +56,9 @@ typedef uint64_t target_ulong;
 #endif
 
 #if !defined(CONFIG_USER_ONLY)
-/* use a fully associative victim tlb of 8 entries */
-#define CPU_VTLB_SIZE 8
+/* default size of the fully associative victim tlb, see tlb_victim_size */
+#define CPU_VTLB_SIZE 16
+#define CPU_VTLB_MAX_SIZE 256
 
 #if HOST_LONG_BITS == 32 && TARGET_LONG_BITS == 32
 #define CPU_TLB_ENTRY_BITS 4
@@ -64,6 +66,25 @@ typedef uint64_t target_ulong;
 #define CPU_TLB_ENTRY_BITS 5
 #endif
 
+#ifndef TCG_TARGET_IMPLEMENTS_DYN_TLB
+#define TCG_TARGET_IMPLEMENTS_DYN_TLB 0
+#endif
+
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+/* The TCG target loads the size mask and the address of the TLB from
+ * env, so each MMU mode gets a separately allocated table that is
+ * resized on flush according to how many of its entries were used.
+ */
+#define CPU_TLB_DYN_MIN_BITS 6
+#define CPU_TLB_DYN_DEFAULT_BITS 8
+#if HOST_LONG_BITS == 32
+/* Make sure we do not require a double-word shift for the TLB load */
+#define CPU_TLB_DYN_MAX_BITS (32 - TARGET_PAGE_BITS)
+#else
+#define CPU_TLB_DYN_MAX_BITS \
+    MIN(22, TARGET_VIRT_ADDR_SPACE_BITS - TARGET_PAGE_BITS)
+#endif
+#else
 /* TCG_TARGET_TLB_DISPLACEMENT_BITS is used in CPU_TLB_BITS to ensure that
  * the TLB is not unnecessarily small, but still small enough for the
  * TLB lookup instruction sequence used by the TCG target.
@@ -95,6 +116,7 @@ typedef uint64_t target_ulong;
          NB_MMU_MODES <= 8 ? 3 : 4))
 
 #define CPU_TLB_SIZE (1 << CPU_TLB_BITS)
+#endif
 
 typedef struct CPUTLBEntry {
     /* bit TARGET_LONG_BITS to TARGET_PAGE_BITS : virtual address
@@ -129,12 +151,46 @@ typedef struct CPUIOTLBEntry {
     MemTxAttrs attrs;
 } CPUIOTLBEntry;
 
+/* Per MMU mode bookkeeping for the TLB.  Only the vCPU that owns the
+ * TLB updates these fields.
+ */
+typedef struct CPUTLBDesc {
+    /* Start of the current resize window, and the largest number of
+     * valid entries seen at a flush since then.
+     */
+    int64_t window_begin_ns;
+    size_t window_max_entries;
+    /* Number of valid entries in the main table.  */
+    size_t n_used_entries;
+    /* Statistics for "info jit".  Lookups that hit in generated code
+     * are not counted; hits only counts those done by the helpers.
+     */
+    uint64_t hits;
+    uint64_t victim_hits;
+    uint64_t fills;
+    uint64_t resizes;
+} CPUTLBDesc;
+
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+#define CPU_COMMON_TLB_TABLES \
+    /* tlb_mask is (number of entries - 1) << CPU_TLB_ENTRY_BITS */     \
+    uintptr_t tlb_mask[NB_MMU_MODES];                                   \
+    CPUTLBEntry *tlb_table[NB_MMU_MODES];                               \
+    CPUIOTLBEntry *iotlb[NB_MMU_MODES];
+#else
+#define CPU_COMMON_TLB_TABLES \
+    CPUTLBEntry tlb_table[NB_MMU_MODES][CPU_TLB_SIZE];                  \
+    CPUIOTLBEntry iotlb[NB_MMU_MODES][CPU_TLB_SIZE];
+#endif
+
 #define CPU_COMMON_TLB \
     /* The meaning of the MMU modes is defined in the target code. */   \
-    CPUTLBEntry tlb_table[NB_MMU_MODES][CPU_TLB_SIZE];                  \
-    CPUTLBEntry tlb_v_table[NB_MMU_MODES][CPU_VTLB_SIZE];               \
-    CPUIOTLBEntry iotlb[NB_MMU_MODES][CPU_TLB_SIZE];                    \
-    CPUIOTLBEntry iotlb_v[NB_MMU_MODES][CPU_VTLB_SIZE];                 \
+    CPU_COMMON_TLB_TABLES                                               \
+    /* The victim tlbs have tlb_victim_size entries each. */            \
+    CPUTLBEntry *tlb_v_table[NB_MMU_MODES];                             \
+    CPUIOTLBEntry *iotlb_v[NB_MMU_MODES];                               \
+    CPUTLBDesc tlb_d[NB_MMU_MODES];                                     \
+    QemuSpin tlb_lock;                                                  \
     target_ulong tlb_flush_addr;                                        \
     target_ulong tlb_flush_mask;                                        \
     target_ulong vtlb_index;                                            \
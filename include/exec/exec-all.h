@@ -51,6 +51,12 @@ void cpu_gen_init(void);
 bool cpu_restore_state(CPUState *cpu, uintptr_t searched_pc);
 
 void QEMU_NORETURN cpu_loop_exit_noexc(CPUState *cpu);
+void QEMU_NORETURN cpu_loop_exit_atomic(CPUState *cpu, uintptr_t pc);
+void cpu_exec_step_atomic(CPUState *cpu);
+
+/* True while other vCPUs may access guest memory concurrently, so that
+   atomic guest operations must be translated to host atomics.  */
+extern bool parallel_cpus;
 void QEMU_NORETURN cpu_io_recompile(CPUState *cpu, uintptr_t retaddr);
 TranslationBlock *tb_gen_code(CPUState *cpu,
                               target_ulong pc, target_ulong cs_base,
@@ -94,6 +100,19 @@ void cpu_reloading_memory_map(void);
  */
 void cpu_address_space_init(CPUState *cpu, AddressSpace *as, int asidx);
 /* cputlb.c */
+/**
+ * tlb_init:
+ * @cpu: CPU whose TLB should be initialized
+ *
+ * Allocate the TLB of the specified CPU and mark all of its entries
+ * invalid.
+ */
+void tlb_init(CPUState *cpu);
+/**
+ * tlb_destroy:
+ * @cpu: CPU whose TLB should be freed
+ */
+void tlb_destroy(CPUState *cpu);
 /**
  * tlb_flush_page:
  * @cpu: CPU whose TLB should be flushed
@@ -172,6 +191,14 @@ void tb_invalidate_phys_addr(AddressSpace *as, hwaddr addr);
 void probe_write(CPUArchState *env, target_ulong addr, int mmu_idx,
                  uintptr_t retaddr);
 #else
+static inline void tlb_init(CPUState *cpu)
+{
+}
+
+static inline void tlb_destroy(CPUState *cpu)
+{
+}
+
 static inline void tlb_flush_page(CPUState *cpu, target_ulong addr)
 {
 }
@@ -190,6 +217,24 @@ static inline void tlb_flush_by_mmuidx(CPUState *cpu, ...)
 }
 #endif
 
+/**
+ * probe_host:
+ * @env: CPUArchState
+ * @addr: guest virtual address to look up
+ * @access_type: MMU_DATA_LOAD or MMU_DATA_STORE
+ * @mmu_idx: MMU index to use for lookup
+ * @retaddr: host return address of the helper, for exceptions
+ *
+ * Check that the guest may access @addr like a real access would, taking
+ * the exception if not (and then not returning).  If the page is RAM that
+ * can be accessed directly, i.e. not I/O, watched or tracked for writes to
+ * translated code, return the host address of @addr, so that the caller
+ * can process up to the end of the page with plain memcpy and memset.
+ * Otherwise return NULL and let the caller use the normal accessors.
+ */
+void *probe_host(CPUArchState *env, target_ulong addr, int access_type,
+                 int mmu_idx, uintptr_t retaddr);
+
 #define CODE_GEN_ALIGN           16 /* must be >= of the size of a icache line */
 
 /* Estimated block size for TB allocation.  */
@@ -224,8 +269,15 @@ struct TranslationBlock {
 #define CF_NOCACHE     0x10000 /* To be freed after execution */
 #define CF_USE_ICOUNT  0x20000
 #define CF_IGNORE_ICOUNT 0x40000 /* Do not generate icount code */
+#define CF_TRACE       0x80000 /* Hot trace formed from several blocks */
+#define CF_TRACE_TAIL  0x100000 /* Block translated into the middle of a
+                                   trace; no exit request check */
+#define CF_SPECULATIVE 0x200000 /* Translated ahead of time; only passed to
+                                   tb_gen_code, which then returns NULL
+                                   rather than evicting code */
 
     void *tc_ptr;    /* pointer to the translated code */
+    void *tc_cold_ptr; /* start of its out-of-line code, if any */
     uint8_t *tc_search;  /* pointer to search data */
     /* original tb when cflags has CF_NOCACHE */
     struct TranslationBlock *orig_tb;
@@ -262,11 +314,44 @@ struct TranslationBlock {
      */
     uintptr_t jmp_list_next[2];
     uintptr_t jmp_list_first;
+    /* bit n is set while jump n is chained to a TB in another guest page,
+       see tb_add_cross_page_jump() */
+    uint8_t jmp_cross_page;
+
+    /* Data needed to save the code to the persistent translation cache,
+       stored after the search data; NULL if the code cannot be saved. */
+    struct TBCacheInfo *cache_info;
+
+    /* Execution profile used to form hot traces, see tb_trace_profile().
+     * trace_next[n] is the block last executed after leaving through
+     * jump n, exit_count[n] how often that jump was taken.
+     */
+    uint32_t exec_count;
+    uint32_t exit_count[2];
+    struct TranslationBlock *trace_next[2];
+    /* number of times the block was entered, counted by the generated
+       code if tb_profile_enabled */
+    uint64_t prof_count;
+    /* set until the TB is linked into the page tables, and once it has
+       been removed by tb_phys_invalidate() */
+    bool invalid;
 };
 
 void tb_free(TranslationBlock *tb);
 void tb_flush(CPUState *cpu);
+void tb_cache_init(const char *path, Error **errp);
+TranslationBlock *tb_trace_profile(CPUState *cpu, TranslationBlock *last_tb,
+                                   int tb_exit, TranslationBlock *tb);
 void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr);
+TranslationBlock *tb_find_physical(CPUState *cpu, target_ulong pc,
+                                   target_ulong cs_base, uint32_t flags);
+void tb_note_successor(target_ulong pc);
+void tb_speculate_enable(void);
+#ifdef CONFIG_USER_ONLY
+void tb_speculate_fork_child(void);
+#else
+bool tb_speculate(CPUState *cpu);
+#endif
 
 #if defined(USE_DIRECT_JUMP)
 
@@ -392,6 +477,8 @@ static inline void mmap_unlock(void) {}
 
 /* cputlb.c */
 tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong addr);
+tb_page_addr_t tlb_probe_page_addr_code(CPUArchState *env1,
+                                        target_ulong addr);
 
 void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length);
 void tlb_set_dirty(CPUState *cpu, target_ulong vaddr);
@@ -415,6 +502,22 @@ bool memory_region_is_unassigned(MemoryRegion *mr);
 /* vl.c */
 extern int singlestep;
 
+/* translate-all.c: executions after which a block heads a trace, 0 if
+   trace formation is disabled */
+extern unsigned int tb_trace_threshold;
+
+/* translate-all.c: count the executions of each block for query-tb-hot */
+extern bool tb_profile_enabled;
+
+/* translate-all.c: let direct jumps leave the guest page of a block in
+   system emulation; only safe with a single vCPU, see
+   tb_add_cross_page_jump() */
+extern bool tb_cross_page_chaining;
+
+void tb_add_cross_page_jump(TranslationBlock *tb, int n,
+                            TranslationBlock *tb_next);
+void tb_unlink_cross_page_jumps(void);
+
 /* cpu-exec.c, accessed with atomic_mb_read/atomic_mb_set */
 extern CPUState *tcg_current_cpu;
 extern bool exit_request;
@@ -13,12 +13,34 @@ static inline void gen_tb_start(TranslationBlock *tb)
 {
     TCGv_i32 count, flag, imm;
 
-    exitreq_label = gen_new_label();
-    flag = tcg_temp_new_i32();
-    tcg_gen_ld_i32(flag, cpu_env,
-                   offsetof(CPUState, tcg_exit_req) - ENV_OFFSET);
-    tcg_gen_brcondi_i32(TCG_COND_NE, flag, 0, exitreq_label);
-    tcg_temp_free_i32(flag);
+    /* Blocks spliced into a trace rely on the check at its head.  */
+    if (tb->cflags & CF_TRACE_TAIL) {
+        return;
+    }
+
+    /* With icount, cpu_exit() also sets the high half of icount_decr,
+     * so the budget check below catches exit requests as well.
+     */
+    if (!(tb->cflags & CF_USE_ICOUNT)) {
+        exitreq_label = gen_new_label();
+        flag = tcg_temp_new_i32();
+        tcg_gen_ld_i32(flag, cpu_env,
+                       offsetof(CPUState, tcg_exit_req) - ENV_OFFSET);
+        tcg_gen_brcondi_i32(TCG_COND_NE, flag, 0, exitreq_label);
+        tcg_temp_free_i32(flag);
+    }
+
+    if (tb_profile_enabled) {
+        /* Not atomic, so MTTCG may lose a few counts.  */
+        TCGv_ptr ptr = tcg_const_ptr(&tb->prof_count);
+        TCGv_i64 n = tcg_temp_new_i64();
+
+        tcg_gen_ld_i64(n, ptr, 0);
+        tcg_gen_addi_i64(n, n, 1);
+        tcg_gen_st_i64(n, ptr, 0);
+        tcg_temp_free_i64(n);
+        tcg_temp_free_ptr(ptr);
+    }
 
     if (!(tb->cflags & CF_USE_ICOUNT)) {
         return;
@@ -47,8 +69,10 @@ static inline void gen_tb_start(TranslationBlock *tb)
 
 static void gen_tb_end(TranslationBlock *tb, int num_insns)
 {
-    gen_set_label(exitreq_label);
-    tcg_gen_exit_tb((uintptr_t)tb + TB_EXIT_REQUESTED);
+    if (!(tb->cflags & (CF_TRACE_TAIL | CF_USE_ICOUNT))) {
+        gen_set_label(exitreq_label);
+        tcg_gen_exit_tb((uintptr_t)tb + TB_EXIT_REQUESTED);
+    }
 
     if (tb->cflags & CF_USE_ICOUNT) {
         /* Update the num_insn immediate parameter now that we know
@@ -0,0 +1,39 @@
+/*
+ * Sampling profiler for guest code
+ *
+ * Copyright (c) 2016 agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef EXEC_GUEST_PROFILE_H
+#define EXEC_GUEST_PROFILE_H
+
+#include "qapi/error.h"
+
+#ifdef CONFIG_SOFTMMU
+
+/* Sample the guest PC of the running vCPUs RATE times per second of host
+ * time, and write a flat profile to FILENAME when QEMU exits.  With STACK,
+ * the call stack is sampled as well, and FILENAME.folded gets the stacks
+ * in the format of flamegraph.pl.  Addresses are named after the symbols
+ * of the ELF files loaded into the guest.
+ */
+void guest_profile_start(const char *filename, unsigned int rate, bool stack,
+                         Error **errp);
+
+/* Record a sample for CPU.  Called by cpu_exec() between two TBs, after
+ * cpu->profile_sample was set.
+ */
+void guest_profile_sample(CPUState *cpu);
+
+#else
+
+static inline void guest_profile_sample(CPUState *cpu)
+{
+}
+
+#endif
+
+#endif
@@ -0,0 +1,56 @@
+/*
+ * Export translated code to host profilers
+ *
+ * Copyright (c) 2016 agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef EXEC_JIT_PERF_H
+#define EXEC_JIT_PERF_H
+
+#include "qapi/error.h"
+
+#ifdef CONFIG_LINUX
+
+/* Write /tmp/perf-<pid>.map, which "perf report" reads to name the code
+ * of a JIT.  Must be called once the prologue has been generated by
+ * tcg_prologue_init().
+ */
+void jit_perf_enable_perfmap(Error **errp);
+
+/* Write ./jit-<pid>.dump, to be merged into a "perf record -k 1" profile
+ * with "perf inject --jit".  Unlike the map, this also keeps the code, so
+ * that it can be annotated, and copes with addresses that are reused.
+ * Must be called once the prologue has been generated by
+ * tcg_prologue_init().
+ */
+void jit_perf_enable_jitdump(Error **errp);
+
+/* Record that the host code at [START, START + SIZE) implements TB.
+ * Called with tb_lock held.
+ */
+void jit_perf_report_code(struct TranslationBlock *tb, const void *start,
+                          size_t size);
+
+#else
+
+static inline void jit_perf_enable_perfmap(Error **errp)
+{
+    error_setg(errp, "perf map is only supported on Linux hosts");
+}
+
+static inline void jit_perf_enable_jitdump(Error **errp)
+{
+    error_setg(errp, "jitdump is only supported on Linux hosts");
+}
+
+static inline void jit_perf_report_code(struct TranslationBlock *tb,
+                                        const void *start, size_t size)
+{
+}
+
+#endif
+
+#endif
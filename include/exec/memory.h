@@ -175,6 +175,7 @@ struct MemoryRegion {
     bool rom_device;
     bool flush_coalesced_mmio;
     bool global_locking;
+    bool timing_insensitive;
     uint8_t dirty_log_mask;
     RAMBlock *ram_block;
     Object *owner;
@@ -954,6 +955,22 @@ void memory_region_set_global_locking(MemoryRegion *mr);
  */
 void memory_region_clear_global_locking(MemoryRegion *mr);
 
+/**
+ * memory_region_set_timing_insensitive: Declares that the device does not
+ *                                       need the exact instruction count.
+ *
+ * With -icount, TCG normally retranslates a block so that an access to a
+ * device is its last instruction, and the device sees the exact virtual
+ * time.  Accesses to a region marked with this function skip that, and
+ * see the time at the end of the current block instead.  This is still
+ * deterministic, but it is only correct for devices whose behaviour does
+ * not depend on the virtual time of the access.  Record/replay always uses
+ * the exact count.
+ *
+ * @mr: the memory region to be updated.
+ */
+void memory_region_set_timing_insensitive(MemoryRegion *mr);
+
 /**
  * memory_region_add_eventfd: Request an eventfd to be triggered when a word
  *                            is written to a location.
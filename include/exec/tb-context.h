@@ -26,20 +26,58 @@
 #define CODE_GEN_HTABLE_BITS     15
 #define CODE_GEN_HTABLE_SIZE     (1 << CODE_GEN_HTABLE_BITS)
 
+#define TB_REGION_MAX            8
+#define TB_REGION_MIN_SIZE       (256 * 1024)
+
 typedef struct TranslationBlock TranslationBlock;
 typedef struct TBContext TBContext;
+typedef struct TBRegion TBRegion;
+
+/* The code buffer is split into regions, which are filled in turn.
+ * When the last one is full the oldest one is reused, and only the TBs
+ * that it holds are thrown away.  Each region has its own slice of the
+ * tbs array, sorted by tc_ptr.
+ */
+struct TBRegion {
+    void *start;
+    void *highwater;
+    /* end of the generated code when the region was last current */
+    void *end;
+    /* out-of-line code, at the top of the region; NULL if unused */
+    void *cold_start;
+    void *cold_highwater;
+    void *cold_end;
+    TranslationBlock *tbs;
+    int nb_tbs;
+};
 
 struct TBContext {
 
     TranslationBlock *tbs;
     struct qht htable;
+    /* number of TBs in all regions */
     int nb_tbs;
     /* any access to the tbs or the page table must use this lock */
     QemuMutex tb_lock;
 
+    TBRegion regions[TB_REGION_MAX];
+    int nb_regions;
+    int cur_region;
+    int region_max_tbs;
+
     /* statistics */
     int tb_flush_count;
+    int tb_evict_count;
     int tb_phys_invalidate_count;
+    /* jumps from a block to one in another guest page that went through
+       the main loop, and those that were then chained */
+    uint64_t cross_page_exit_count;
+    uint64_t cross_page_chain_count;
+    int cross_page_unlink_count;
+
+    /* (tb | n) for each jump n chained across pages, may hold stale
+       entries whose bit in jmp_cross_page is clear */
+    GArray *cross_page_jumps;
 };
 
 #endif
@@ -236,6 +236,7 @@ void remove_migration_state_change_notifier(Notifier *notify);
 MigrationState *migrate_init(const MigrationParams *params);
 bool migration_is_blocked(Error **errp);
 bool migration_in_setup(MigrationState *);
+bool migration_is_setup_or_active(int state);
 bool migration_has_finished(MigrationState *);
 bool migration_has_failed(MigrationState *);
 /* True if outgoing migration has entered postcopy phase */
@@ -276,6 +277,12 @@ int ram_discard_range(MigrationIncomingState *mis, const char *block_name,
                       uint64_t start, size_t length);
 int ram_postcopy_incoming_init(MigrationIncomingState *mis);
 
+int ram_snapshot_save(Error **errp);
+int64_t ram_snapshot_restore(Error **errp);
+void ram_snapshot_free(void);
+void ram_save_dirty_pages(QEMUFile *f, bool all);
+int ram_load_dirty_pages(QEMUFile *f);
+
 /**
  * @migrate_add_blocker - prevent migration from proceeding
  *
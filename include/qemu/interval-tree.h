@@ -0,0 +1,74 @@
+/*
+ * Interval trees
+ *
+ * Copyright (c) 2016 agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#ifndef QEMU_INTERVAL_TREE_H
+#define QEMU_INTERVAL_TREE_H
+
+/*
+ * An interval tree is a red-black tree of closed intervals [start, last],
+ * ordered by start and augmented so that the intervals overlapping a
+ * given range, and the holes between the intervals, can be found in
+ * O(log n).  The nodes are embedded in the user's structures, which are
+ * allocated and freed by the user; the tree does no allocation.
+ *
+ * The tree does no locking either.  Lookups can run concurrently, but
+ * insertions and removals must be serialized against everything else.
+ */
+
+typedef struct IntervalTreeNode {
+    /* Set by the user before interval_tree_insert(), read-only after */
+    uint64_t start;
+    uint64_t last;
+
+    /* private */
+    struct IntervalTreeNode *parent;
+    struct IntervalTreeNode *left;
+    struct IntervalTreeNode *right;
+    bool red;
+    uint64_t subtree_last;
+    uint64_t gap;
+    uint64_t subtree_gap;
+} IntervalTreeNode;
+
+typedef struct IntervalTreeRoot {
+    IntervalTreeNode *root;
+} IntervalTreeRoot;
+
+void interval_tree_insert(IntervalTreeNode *node, IntervalTreeRoot *root);
+void interval_tree_remove(IntervalTreeNode *node, IntervalTreeRoot *root);
+
+/*
+ * Iterate over the nodes that overlap [start, last], in increasing
+ * order of their start:
+ *
+ *   for (n = interval_tree_iter_first(root, start, last); n;
+ *        n = interval_tree_iter_next(n, start, last)) {
+ *       ...
+ *   }
+ */
+IntervalTreeNode *interval_tree_iter_first(IntervalTreeRoot *root,
+                                           uint64_t start, uint64_t last);
+IntervalTreeNode *interval_tree_iter_next(IntervalTreeNode *node,
+                                          uint64_t start, uint64_t last);
+
+/*
+ * Look for SIZE consecutive values in [min, max], the first of them a
+ * multiple of ALIGN (a power of two), that no interval covers.  On
+ * success store the lowest (find_gap_up) or highest (find_gap_down)
+ * such first value in *ADDR and return true.
+ *
+ * Only valid if the intervals in the tree do not overlap.
+ */
+bool interval_tree_find_gap_up(IntervalTreeRoot *root, uint64_t min,
+                               uint64_t max, uint64_t size, uint64_t align,
+                               uint64_t *addr);
+bool interval_tree_find_gap_down(IntervalTreeRoot *root, uint64_t min,
+                                 uint64_t max, uint64_t size, uint64_t align,
+                                 uint64_t *addr);
+
+#endif
@@ -51,6 +51,9 @@ void replay_start(void);
 void replay_finish(void);
 /*! Adds replay blocker with the specified error description */
 void replay_add_blocker(Error *reason);
+/*! Loads the snapshot that replay was asked to start from, if any.
+    Called once the machine is reset. */
+void replay_snapshot_load(void);
 
 /* Processing the instructions */
 
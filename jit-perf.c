@@ -0,0 +1,242 @@
+/*
+ * Export translated code to host profilers
+ *
+ * Copyright (c) 2016 agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "cpu.h"
+#include "tcg.h"
+#include "disas/disas.h"
+#include "exec/exec-all.h"
+#include "exec/jit-perf.h"
+#include "elf.h"
+
+static FILE *perfmap;
+static FILE *jitdump;
+static void *jitdump_marker;
+static uint64_t jitdump_code_index;
+
+/* The jitdump format is described in tools/perf/Documentation/
+ * jitdump-specification.txt in the Linux sources.  All fields are in
+ * host byte order.
+ */
+#define JITDUMP_MAGIC       0x4A695444
+#define JITDUMP_VERSION     1
+
+enum {
+    JIT_CODE_LOAD = 0,
+    JIT_CODE_CLOSE = 3,
+};
+
+struct jitheader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+};
+
+struct jr_prefix {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+};
+
+struct jr_code_load {
+    struct jr_prefix p;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+};
+
+/* perf matches the records with its samples by CLOCK_MONOTONIC, which is
+ * what "perf record -k 1" uses.
+ */
+static uint64_t jitdump_timestamp(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t host_elf_machine(void)
+{
+    /* e_machine is at the same offset in Elf32_Ehdr and Elf64_Ehdr.  */
+    Elf32_Ehdr ehdr;
+    uint32_t machine = EM_NONE;
+    int fd;
+
+    fd = open("/proc/self/exe", O_RDONLY);
+    if (fd < 0) {
+        return machine;
+    }
+    if (read(fd, &ehdr, sizeof(ehdr)) == sizeof(ehdr) &&
+        memcmp(ehdr.e_ident, ELFMAG, SELFMAG) == 0) {
+        machine = ehdr.e_machine;
+    }
+    close(fd);
+    return machine;
+}
+
+static void perfmap_write(const void *start, size_t size, const char *name)
+{
+    fprintf(perfmap, "%" PRIxPTR " %zx %s\n", (uintptr_t)start, size, name);
+}
+
+static void jitdump_write_load(const void *start, size_t size,
+                               const char *name)
+{
+    struct jr_code_load load;
+    size_t name_size = strlen(name) + 1;
+
+    load.p.id = JIT_CODE_LOAD;
+    load.p.total_size = sizeof(load) + name_size + size;
+    load.p.timestamp = jitdump_timestamp();
+    load.pid = getpid();
+    load.tid = qemu_get_thread_id();
+    load.vma = (uintptr_t)start;
+    load.code_addr = (uintptr_t)start;
+    load.code_size = size;
+    load.code_index = jitdump_code_index++;
+
+    fwrite(&load, sizeof(load), 1, jitdump);
+    fwrite(name, name_size, 1, jitdump);
+    fwrite(start, size, 1, jitdump);
+}
+
+static size_t prologue_size(void)
+{
+    return tcg_ctx.code_gen_buffer - tcg_ctx.code_gen_prologue;
+}
+
+static void jit_perf_exit(void)
+{
+    if (perfmap) {
+        fclose(perfmap);
+        perfmap = NULL;
+    }
+    if (jitdump) {
+        struct jr_prefix close_rec = {
+            .id = JIT_CODE_CLOSE,
+            .total_size = sizeof(close_rec),
+            .timestamp = jitdump_timestamp(),
+        };
+
+        fwrite(&close_rec, sizeof(close_rec), 1, jitdump);
+        munmap(jitdump_marker, getpagesize());
+        fclose(jitdump);
+        jitdump = NULL;
+    }
+}
+
+static void jit_perf_init(void)
+{
+    static bool done;
+
+    if (!done) {
+        atexit(jit_perf_exit);
+        done = true;
+    }
+}
+
+void jit_perf_enable_perfmap(Error **errp)
+{
+    char path[32];
+
+    if (perfmap) {
+        return;
+    }
+    snprintf(path, sizeof(path), "/tmp/perf-%d.map", getpid());
+    perfmap = fopen(path, "w");
+    if (!perfmap) {
+        error_setg_errno(errp, errno, "could not open %s", path);
+        return;
+    }
+    jit_perf_init();
+    perfmap_write(tcg_ctx.code_gen_prologue, prologue_size(), "qemu-prologue");
+}
+
+void jit_perf_enable_jitdump(Error **errp)
+{
+    struct jitheader header;
+    char path[32];
+    int fd;
+
+    if (jitdump) {
+        return;
+    }
+    snprintf(path, sizeof(path), "jit-%d.dump", getpid());
+    fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (fd < 0) {
+        error_setg_errno(errp, errno, "could not open %s", path);
+        return;
+    }
+
+    /* "perf inject" finds the file through this executable mapping.  */
+    jitdump_marker = mmap(NULL, getpagesize(), PROT_READ | PROT_EXEC,
+                          MAP_PRIVATE, fd, 0);
+    if (jitdump_marker == MAP_FAILED) {
+        error_setg_errno(errp, errno, "could not map %s", path);
+        close(fd);
+        return;
+    }
+
+    jitdump = fdopen(fd, "w+");
+    if (!jitdump) {
+        error_setg_errno(errp, errno, "could not open %s", path);
+        munmap(jitdump_marker, getpagesize());
+        close(fd);
+        return;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = JITDUMP_MAGIC;
+    header.version = JITDUMP_VERSION;
+    header.total_size = sizeof(header);
+    header.elf_mach = host_elf_machine();
+    header.pid = getpid();
+    header.timestamp = jitdump_timestamp();
+    fwrite(&header, sizeof(header), 1, jitdump);
+
+    jit_perf_init();
+    jitdump_write_load(tcg_ctx.code_gen_prologue, prologue_size(),
+                       "qemu-prologue");
+}
+
+void jit_perf_report_code(TranslationBlock *tb, const void *start,
+                          size_t size)
+{
+    const char *symbol;
+    char name[256];
+
+    if (likely(!perfmap && !jitdump)) {
+        return;
+    }
+
+    /* The guest symbol is only known if an ELF file was loaded.  */
+    symbol = lookup_symbol(tb->pc);
+    if (symbol[0]) {
+        snprintf(name, sizeof(name), "%s [guest 0x" TARGET_FMT_lx "]",
+                 symbol, tb->pc);
+    } else {
+        snprintf(name, sizeof(name), "guest 0x" TARGET_FMT_lx, tb->pc);
+    }
+
+    if (perfmap) {
+        perfmap_write(start, size, name);
+    }
+    if (jitdump) {
+        jitdump_write_load(start, size, name);
+    }
+}
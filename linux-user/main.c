@@ -29,6 +29,7 @@
 #include "qemu/help_option.h"
 #include "cpu.h"
 #include "exec/exec-all.h"
+#include "exec/jit-perf.h"
 #include "tcg.h"
 #include "qemu/timer.h"
 #include "qemu/envlist.h"
@@ -109,8 +110,12 @@ int cpu_get_pic_interrupt(CPUX86State *env)
 
 /* To implement exclusive operations we force all cpus to syncronise.
    We don't require a full sync, only that no cpus are executing guest code.
-   The alternative is to map target atomic ops onto host equivalents,
-   which requires quite a lot of per host/target work.  */
+   Atomic operations of the guest use host atomics where they can, so this
+   is only needed for the rare cases that they cannot handle.
+
+   cpu_exec_start() and cpu_exec_end() only take exclusive_lock while an
+   exclusive operation is pending, so that the threads do not serialize on
+   it every time they leave guest code.  */
 static pthread_mutex_t cpu_list_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t exclusive_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t exclusive_cond = PTHREAD_COND_INITIALIZER;
@@ -118,16 +123,21 @@ static pthread_cond_t exclusive_resume = PTHREAD_COND_INITIALIZER;
 static int pending_cpus;
 
 /* Make sure everything is in a consistent state for calling fork().  */
+/* Take mmap_lock before tb_lock, as the mapping changes do.  The
+   speculative translation thread only runs with tb_lock held, so the
+   child never sees it halfway through a translation.  The page flags
+   lock is a spinlock taken under tb_lock, so it comes last.  */
 void fork_start(void)
 {
+    mmap_fork_start();
     qemu_mutex_lock(&tcg_ctx.tb_ctx.tb_lock);
     pthread_mutex_lock(&exclusive_lock);
-    mmap_fork_start();
+    page_fork_start();
 }
 
 void fork_end(int child)
 {
-    mmap_fork_end(child);
+    page_fork_end();
     if (child) {
         CPUState *cpu, *next_cpu;
         /* Child processes created by fork() only have a single thread.
@@ -138,15 +148,19 @@ void fork_end(int child)
             }
         }
         pending_cpus = 0;
+        thread_cpu->has_waiter = false;
         pthread_mutex_init(&exclusive_lock, NULL);
         pthread_mutex_init(&cpu_list_mutex, NULL);
         pthread_cond_init(&exclusive_cond, NULL);
         pthread_cond_init(&exclusive_resume, NULL);
         qemu_mutex_init(&tcg_ctx.tb_ctx.tb_lock);
+        mmap_fork_end(child);
+        tb_speculate_fork_child();
         gdbserver_fork(thread_cpu);
     } else {
         pthread_mutex_unlock(&exclusive_lock);
         qemu_mutex_unlock(&tcg_ctx.tb_ctx.tb_lock);
+        mmap_fork_end(child);
     }
 }
 
@@ -164,27 +178,39 @@ static inline void exclusive_idle(void)
 static inline void start_exclusive(void)
 {
     CPUState *other_cpu;
+    int running_cpus;
 
     pthread_mutex_lock(&exclusive_lock);
     exclusive_idle();
 
-    pending_cpus = 1;
     /* Make all other cpus stop executing.  */
+    atomic_set(&pending_cpus, 1);
+
+    /* Write pending_cpus before reading other_cpu->running.  */
+    smp_mb();
+    running_cpus = 0;
     CPU_FOREACH(other_cpu) {
-        if (other_cpu->running) {
-            pending_cpus++;
+        if (atomic_read(&other_cpu->running)) {
+            other_cpu->has_waiter = true;
+            running_cpus++;
             cpu_exit(other_cpu);
         }
     }
-    if (pending_cpus > 1) {
+    atomic_set(&pending_cpus, running_cpus + 1);
+    while (pending_cpus > 1) {
         pthread_cond_wait(&exclusive_cond, &exclusive_lock);
     }
+
+    /* No other exclusive operation can start until end_exclusive()
+       clears pending_cpus.  */
+    pthread_mutex_unlock(&exclusive_lock);
 }
 
 /* Finish an exclusive operation.  */
 static inline void __attribute__((unused)) end_exclusive(void)
 {
-    pending_cpus = 0;
+    pthread_mutex_lock(&exclusive_lock);
+    atomic_set(&pending_cpus, 0);
     pthread_cond_broadcast(&exclusive_resume);
     pthread_mutex_unlock(&exclusive_lock);
 }
@@ -192,25 +218,48 @@ static inline void __attribute__((unused)) end_exclusive(void)
 /* Wait for exclusive ops to finish, and begin cpu execution.  */
 static inline void cpu_exec_start(CPUState *cpu)
 {
-    pthread_mutex_lock(&exclusive_lock);
-    exclusive_idle();
-    cpu->running = true;
-    pthread_mutex_unlock(&exclusive_lock);
+    atomic_set(&cpu->running, true);
+
+    /* Write cpu->running before reading pending_cpus.  */
+    smp_mb();
+
+    /* If start_exclusive() saw cpu->running, it set cpu->has_waiter and
+       cpu_exec_end() will release it; we were kicked and will not run
+       for long.  Otherwise, wait for the exclusive operation to end.
+       With no exclusive operation pending, start_exclusive() is bound
+       to see cpu->running.  */
+    if (unlikely(atomic_read(&pending_cpus))) {
+        pthread_mutex_lock(&exclusive_lock);
+        if (!cpu->has_waiter) {
+            atomic_set(&cpu->running, false);
+            exclusive_idle();
+            atomic_set(&cpu->running, true);
+        }
+        pthread_mutex_unlock(&exclusive_lock);
+    }
 }
 
 /* Mark cpu as not executing, and release pending exclusive ops.  */
 static inline void cpu_exec_end(CPUState *cpu)
 {
-    pthread_mutex_lock(&exclusive_lock);
-    cpu->running = false;
-    if (pending_cpus > 1) {
-        pending_cpus--;
-        if (pending_cpus == 1) {
-            pthread_cond_signal(&exclusive_cond);
+    atomic_set(&cpu->running, false);
+
+    /* Write cpu->running before reading pending_cpus.  */
+    smp_mb();
+
+    /* Only the CPUs that start_exclusive() counted in pending_cpus have
+       to report; the others wait in their next cpu_exec_start().  */
+    if (unlikely(atomic_read(&pending_cpus))) {
+        pthread_mutex_lock(&exclusive_lock);
+        if (cpu->has_waiter) {
+            cpu->has_waiter = false;
+            atomic_set(&pending_cpus, pending_cpus - 1);
+            if (pending_cpus == 1) {
+                pthread_cond_signal(&exclusive_cond);
+            }
         }
+        pthread_mutex_unlock(&exclusive_lock);
     }
-    exclusive_idle();
-    pthread_mutex_unlock(&exclusive_lock);
 }
 
 void cpu_list_lock(void)
@@ -501,6 +550,98 @@ void cpu_loop(CPUX86State *env)
         put_user_u16(__x, (gaddr));                     \
     })
 
+/* The guest memory representation of 16 and 32-bit data, as a host
+   integer.  */
+static inline uint16_t arm_data_mem16(CPUARMState *env, uint16_t val)
+{
+    if (arm_cpu_bswap_data(env)) {
+        val = bswap16(val);
+    }
+    return tswap16(val);
+}
+
+static inline uint32_t arm_data_mem32(CPUARMState *env, uint32_t val)
+{
+    if (arm_cpu_bswap_data(env)) {
+        val = bswap32(val);
+    }
+    return tswap32(val);
+}
+
+/* The same for the words LO at the lower address and HI above it.  */
+static inline uint64_t arm_data_mem32_pair(CPUARMState *env,
+                                           uint32_t lo, uint32_t hi)
+{
+    uint32_t mem[2] = { arm_data_mem32(env, lo), arm_data_mem32(env, hi) };
+
+    return ldq_he_p(mem);
+}
+
+/* Compare and exchange the 1 << SIZE bytes of guest memory at ADDR, which
+ * the caller checked are writable.  CMP and NEWV are given as host
+ * integers in the representation of guest memory.  Returns true if the
+ * exchange happened.
+ *
+ * This uses host atomics, so that the other threads keep running.  They
+ * need aligned data, which the guest should provide anyway, and 64-bit
+ * ones a 64-bit host; otherwise the other threads are stopped instead.
+ * Like the host operation, this does not notice if the memory was written
+ * with the same value since the load exclusive.
+ */
+static bool arm_cmpxchg_guest(abi_ulong addr, int size,
+                              uint64_t cmp, uint64_t newv)
+{
+    void *p = g2h(addr);
+    bool ok;
+
+    if (!(addr & ((1 << size) - 1))) {
+        switch (size) {
+        case 0:
+            return atomic_cmpxchg((uint8_t *)p, cmp, newv) == (uint8_t)cmp;
+        case 1:
+            return atomic_cmpxchg((uint16_t *)p, cmp, newv) == (uint16_t)cmp;
+        case 2:
+            return atomic_cmpxchg((uint32_t *)p, cmp, newv) == (uint32_t)cmp;
+#if HOST_LONG_BITS == 64
+        case 3:
+            return atomic_cmpxchg((uint64_t *)p, cmp, newv) == cmp;
+#endif
+        }
+    }
+
+    start_exclusive();
+    switch (size) {
+    case 0:
+        ok = ldub_p(p) == (uint8_t)cmp;
+        if (ok) {
+            stb_p(p, newv);
+        }
+        break;
+    case 1:
+        ok = lduw_he_p(p) == (uint16_t)cmp;
+        if (ok) {
+            stw_he_p(p, newv);
+        }
+        break;
+    case 2:
+        ok = (uint32_t)ldl_he_p(p) == (uint32_t)cmp;
+        if (ok) {
+            stl_he_p(p, newv);
+        }
+        break;
+    case 3:
+        ok = ldq_he_p(p) == cmp;
+        if (ok) {
+            stq_he_p(p, newv);
+        }
+        break;
+    default:
+        abort();
+    }
+    end_exclusive();
+    return ok;
+}
+
 #ifdef TARGET_ABI32
 /* Commpage handling -- there is no commpage for AArch64 */
 
@@ -520,17 +661,13 @@ void cpu_loop(CPUX86State *env)
  */
 static void arm_kernel_cmpxchg64_helper(CPUARMState *env)
 {
-    uint64_t oldval, newval, val;
+    uint64_t oldval, newval;
     uint32_t addr, cpsr;
     target_siginfo_t info;
 
     /* Based on the 32 bit code in do_kernel_trap */
 
-    /* XXX: This only works between threads, not between processes.
-       It's probably possible to implement this with native host
-       operations. However things like ldrex/strex are much harder so
-       there's not much point trying.  */
-    start_exclusive();
+    /* XXX: This only works between threads, not between processes.  */
     cpsr = cpsr_read(env);
     addr = env->regs[2];
 
@@ -544,19 +681,12 @@ static void arm_kernel_cmpxchg64_helper(CPUARMState *env)
         goto segv;
     };
 
-    if (get_user_u64(val, addr)) {
+    if (!access_ok(VERIFY_WRITE, addr, 8)) {
         env->exception.vaddress = addr;
         goto segv;
     }
 
-    if (val == oldval) {
-        val = newval;
-
-        if (put_user_u64(val, addr)) {
-            env->exception.vaddress = addr;
-            goto segv;
-        };
-
+    if (arm_cmpxchg_guest(addr, 3, tswap64(oldval), tswap64(newval))) {
         env->regs[0] = 0;
         cpsr |= CPSR_C;
     } else {
@@ -564,11 +694,9 @@ static void arm_kernel_cmpxchg64_helper(CPUARMState *env)
         cpsr &= ~CPSR_C;
     }
     cpsr_write(env, cpsr, CPSR_C, CPSRWriteByInstr);
-    end_exclusive();
     return;
 
 segv:
-    end_exclusive();
     /* We get the PC of the entry address - which is as good as anything,
        on a real kernel what you get depends on which mode it uses. */
     info.si_signo = TARGET_SIGSEGV;
@@ -585,27 +713,20 @@ do_kernel_trap(CPUARMState *env)
 {
     uint32_t addr;
     uint32_t cpsr;
-    uint32_t val;
 
     switch (env->regs[15]) {
     case 0xffff0fa0: /* __kernel_memory_barrier */
-        /* ??? No-op. Will need to do better for SMP.  */
+        /* Other threads run guest code concurrently */
+        smp_mb();
         break;
     case 0xffff0fc0: /* __kernel_cmpxchg */
-         /* XXX: This only works between threads, not between processes.
-            It's probably possible to implement this with native host
-            operations. However things like ldrex/strex are much harder so
-            there's not much point trying.  */
-        start_exclusive();
+         /* XXX: This only works between threads, not between processes.  */
         cpsr = cpsr_read(env);
         addr = env->regs[2];
         /* FIXME: This should SEGV if the access fails.  */
-        if (get_user_u32(val, addr))
-            val = ~env->regs[0];
-        if (val == env->regs[0]) {
-            val = env->regs[1];
-            /* FIXME: Check for segfaults.  */
-            put_user_u32(val, addr);
+        if (access_ok(VERIFY_WRITE, addr, 4) &&
+            arm_cmpxchg_guest(addr, 2, tswap32(env->regs[0]),
+                              tswap32(env->regs[1]))) {
             env->regs[0] = 0;
             cpsr |= CPSR_C;
         } else {
@@ -613,7 +734,6 @@ do_kernel_trap(CPUARMState *env)
             cpsr &= ~CPSR_C;
         }
         cpsr_write(env, cpsr, CPSR_C, CPSRWriteByInstr);
-        end_exclusive();
         break;
     case 0xffff0fe0: /* __kernel_get_tls */
         env->regs[0] = cpu_get_tls(env);
@@ -636,15 +756,16 @@ do_kernel_trap(CPUARMState *env)
     return 0;
 }
 
-/* Store exclusive handling for AArch32 */
+/* Store exclusive handling for AArch32: the store happens if the memory
+   still holds the value that the load exclusive read.  */
 static int do_strex(CPUARMState *env)
 {
-    uint64_t val;
+    uint64_t cmp, newv;
+    uint32_t rt, rt2;
     int size;
     int rc = 1;
-    int segv = 0;
     uint32_t addr;
-    start_exclusive();
+
     if (env->exclusive_addr != env->exclusive_test) {
         goto fail;
     }
@@ -655,73 +776,52 @@ static int do_strex(CPUARMState *env)
     assert(extract64(env->exclusive_addr, 32, 32) == 0);
     addr = env->exclusive_addr;
     size = env->exclusive_info & 0xf;
-    switch (size) {
-    case 0:
-        segv = get_user_u8(val, addr);
-        break;
-    case 1:
-        segv = get_user_data_u16(val, addr, env);
-        break;
-    case 2:
-    case 3:
-        segv = get_user_data_u32(val, addr, env);
-        break;
-    default:
-        abort();
-    }
-    if (segv) {
+    if (!access_ok(VERIFY_WRITE, addr, size == 3 ? 4 : 1 << size)) {
         env->exception.vaddress = addr;
-        goto done;
-    }
-    if (size == 3) {
-        uint32_t valhi;
-        segv = get_user_data_u32(valhi, addr + 4, env);
-        if (segv) {
-            env->exception.vaddress = addr + 4;
-            goto done;
-        }
-        if (arm_cpu_bswap_data(env)) {
-            val = deposit64((uint64_t)valhi, 32, 32, val);
-        } else {
-            val = deposit64(val, 32, 32, valhi);
-        }
+        return 1;
     }
-    if (val != env->exclusive_val) {
-        goto fail;
+    if (size == 3 && !access_ok(VERIFY_WRITE, addr + 4, 4)) {
+        env->exception.vaddress = addr + 4;
+        return 1;
     }
 
-    val = env->regs[(env->exclusive_info >> 8) & 0xf];
+    rt = env->regs[(env->exclusive_info >> 8) & 0xf];
     switch (size) {
     case 0:
-        segv = put_user_u8(val, addr);
+        cmp = env->exclusive_val;
+        newv = rt;
         break;
     case 1:
-        segv = put_user_data_u16(val, addr, env);
+        cmp = arm_data_mem16(env, env->exclusive_val);
+        newv = arm_data_mem16(env, rt);
         break;
     case 2:
+        cmp = arm_data_mem32(env, env->exclusive_val);
+        newv = arm_data_mem32(env, rt);
+        break;
     case 3:
-        segv = put_user_data_u32(val, addr, env);
+        /* The load exclusive put the word at addr in the high half of
+           exclusive_val for BE8, like a 64-bit load.  */
+        if (arm_cpu_bswap_data(env)) {
+            cmp = arm_data_mem32_pair(env, env->exclusive_val >> 32,
+                                      env->exclusive_val);
+        } else {
+            cmp = arm_data_mem32_pair(env, env->exclusive_val,
+                                      env->exclusive_val >> 32);
+        }
+        rt2 = env->regs[(env->exclusive_info >> 12) & 0xf];
+        newv = arm_data_mem32_pair(env, rt, rt2);
         break;
+    default:
+        abort();
     }
-    if (segv) {
-        env->exception.vaddress = addr;
-        goto done;
-    }
-    if (size == 3) {
-        val = env->regs[(env->exclusive_info >> 12) & 0xf];
-        segv = put_user_data_u32(val, addr + 4, env);
-        if (segv) {
-            env->exception.vaddress = addr + 4;
-            goto done;
-        }
+    if (arm_cmpxchg_guest(addr, size, cmp, newv)) {
+        rc = 0;
     }
-    rc = 0;
 fail:
     env->regs[15] += 4;
     env->regs[(env->exclusive_info >> 4) & 0xf] = rc;
-done:
-    end_exclusive();
-    return segv;
+    return 0;
 }
 
 void cpu_loop(CPUARMState *env)
@@ -953,7 +1053,7 @@ void cpu_loop(CPUARMState *env)
  */
 static int do_strex_a64(CPUARMState *env)
 {
-    uint64_t val;
+    uint64_t val, val2, cmp, newv;
     int size;
     bool is_pair;
     int rc = 1;
@@ -961,7 +1061,6 @@ static int do_strex_a64(CPUARMState *env)
     uint64_t addr;
     int rs, rt, rt2;
 
-    start_exclusive();
     /* size | is_pair << 2 | (rs << 4) | (rt << 9) | (rt2 << 14)); */
     size = extract32(env->exclusive_info, 0, 2);
     is_pair = extract32(env->exclusive_info, 2, 1);
@@ -975,76 +1074,74 @@ static int do_strex_a64(CPUARMState *env)
         goto finish;
     }
 
-    switch (size) {
-    case 0:
-        segv = get_user_u8(val, addr);
-        break;
-    case 1:
-        segv = get_user_u16(val, addr);
-        break;
-    case 2:
-        segv = get_user_u32(val, addr);
-        break;
-    case 3:
-        segv = get_user_u64(val, addr);
-        break;
-    default:
-        abort();
-    }
-    if (segv) {
+    if (!access_ok(VERIFY_WRITE, addr, 1 << size)) {
         env->exception.vaddress = addr;
+        segv = 1;
         goto error;
     }
-    if (val != env->exclusive_val) {
-        goto finish;
-    }
-    if (is_pair) {
-        if (size == 2) {
-            segv = get_user_u32(val, addr + 4);
-        } else {
-            segv = get_user_u64(val, addr + 8);
-        }
-        if (segv) {
-            env->exception.vaddress = addr + (size == 2 ? 4 : 8);
-            goto error;
-        }
-        if (val != env->exclusive_high) {
-            goto finish;
-        }
+    if (is_pair && !access_ok(VERIFY_WRITE, addr + (1 << size), 1 << size)) {
+        env->exception.vaddress = addr + (1 << size);
+        segv = 1;
+        goto error;
     }
+
     /* handle the zero register */
     val = rt == 31 ? 0 : env->xregs[rt];
-    switch (size) {
+    val2 = rt2 == 31 ? 0 : env->xregs[rt2];
+    switch (size | is_pair << 2) {
     case 0:
-        segv = put_user_u8(val, addr);
+        cmp = env->exclusive_val;
+        newv = val;
         break;
     case 1:
-        segv = put_user_u16(val, addr);
+        cmp = tswap16(env->exclusive_val);
+        newv = tswap16(val);
         break;
     case 2:
-        segv = put_user_u32(val, addr);
+        cmp = tswap32(env->exclusive_val);
+        newv = tswap32(val);
         break;
     case 3:
-        segv = put_user_u64(val, addr);
+        cmp = tswap64(env->exclusive_val);
+        newv = tswap64(val);
+        break;
+    case 6: {
+        /* A pair of words is a doubleword in memory order */
+        uint32_t mem_cmp[2] = { tswap32(env->exclusive_val),
+                                tswap32(env->exclusive_high) };
+        uint32_t mem_newv[2] = { tswap32(val), tswap32(val2) };
+
+        cmp = ldq_he_p(mem_cmp);
+        newv = ldq_he_p(mem_newv);
+        size = 3;
         break;
     }
-    if (segv) {
-        goto error;
-    }
-    if (is_pair) {
-        /* handle the zero register */
-        val = rt2 == 31 ? 0 : env->xregs[rt2];
-        if (size == 2) {
-            segv = put_user_u32(val, addr + 4);
-        } else {
-            segv = put_user_u64(val, addr + 8);
-        }
-        if (segv) {
-            env->exception.vaddress = addr + (size == 2 ? 4 : 8);
+    case 7: {
+        /* No 128-bit host atomics, stop the other threads */
+        uint64_t cur_lo, cur_hi;
+
+        start_exclusive();
+        if (get_user_u64(cur_lo, addr) || get_user_u64(cur_hi, addr + 8)) {
+            /* unmapped meanwhile by a thread in a syscall */
+            end_exclusive();
+            env->exception.vaddress = addr;
+            segv = 1;
             goto error;
         }
+        if (cur_lo == env->exclusive_val && cur_hi == env->exclusive_high) {
+            put_user_u64(val, addr);
+            put_user_u64(val2, addr + 8);
+            rc = 0;
+        }
+        end_exclusive();
+        goto finish;
+    }
+    default:
+        abort();
+    }
+    if (arm_cmpxchg_guest(addr, size, cmp, newv)) {
+        rc = 0;
     }
-    rc = 0;
 finish:
     env->pc += 4;
     /* rs == 31 encodes a write to the ZR, thus throwing away
@@ -1057,7 +1154,6 @@ error:
     /* instruction faulted, PC does not advance */
     /* either way a strex releases any exclusive lock we have */
     env->exclusive_addr = -1;
-    end_exclusive();
     return segv;
 }
 
@@ -3997,6 +4093,25 @@ static void handle_arg_strace(const char *arg)
     do_strace = 1;
 }
 
+static bool perf_map;
+static bool perf_jitdump;
+static bool tb_speculate_on;
+
+static void handle_arg_perfmap(const char *arg)
+{
+    perf_map = true;
+}
+
+static void handle_arg_jitdump(const char *arg)
+{
+    perf_jitdump = true;
+}
+
+static void handle_arg_speculate(const char *arg)
+{
+    tb_speculate_on = true;
+}
+
 static void handle_arg_version(const char *arg)
 {
     printf("qemu-" TARGET_NAME " version " QEMU_VERSION QEMU_PKGVERSION
@@ -4056,6 +4171,12 @@ static const struct qemu_argument arg_table[] = {
      "",           "run in singlestep mode"},
     {"strace",     "QEMU_STRACE",      false, handle_arg_strace,
      "",           "log system calls"},
+    {"perfmap",    "QEMU_PERFMAP",     false, handle_arg_perfmap,
+     "",           "write /tmp/perf-<pid>.map for the translated code"},
+    {"jitdump",    "QEMU_JITDUMP",     false, handle_arg_jitdump,
+     "",           "write jit-<pid>.dump for the translated code"},
+    {"speculate",  "QEMU_SPECULATE",   false, handle_arg_speculate,
+     "",           "translate likely successor blocks in a helper thread"},
     {"seed",       "QEMU_RAND_SEED",   true,  handle_arg_randseed,
      "",           "Seed for pseudo-random number generator"},
     {"trace",      "QEMU_TRACE",       true,  handle_arg_trace,
@@ -4452,6 +4573,15 @@ int main(int argc, char **argv, char **envp)
        generating the prologue until now so that the prologue can take
        the real value of GUEST_BASE into account.  */
     tcg_prologue_init(&tcg_ctx);
+    if (perf_map) {
+        jit_perf_enable_perfmap(&error_fatal);
+    }
+    if (perf_jitdump) {
+        jit_perf_enable_jitdump(&error_fatal);
+    }
+    if (tb_speculate_on) {
+        tb_speculate_enable();
+    }
 
 #if defined(TARGET_I386)
     env->cr[0] = CR0_PG_MASK | CR0_WP_MASK | CR0_PE_MASK;
@@ -23,6 +23,7 @@
 #include "qemu.h"
 #include "qemu-common.h"
 #include "translate-all.h"
+#include "tcg.h"
 
 //#define DEBUG_MMAP
 
@@ -84,6 +85,7 @@ int target_mprotect(abi_ulong start, abi_ulong len, int prot)
         return 0;
 
     mmap_lock();
+    tb_lock();
     host_start = start & qemu_host_page_mask;
     host_end = HOST_PAGE_ALIGN(end);
     if (start > host_start) {
@@ -122,9 +124,11 @@ int target_mprotect(abi_ulong start, abi_ulong len, int prot)
             goto error;
     }
     page_set_flags(start, start + len, prot | PAGE_VALID);
+    tb_unlock();
     mmap_unlock();
     return 0;
 error:
+    tb_unlock();
     mmap_unlock();
     return ret;
 }
@@ -143,9 +147,10 @@ static int mmap_frag(abi_ulong real_start,
 
     /* get the protection of the target pages outside the mapping */
     prot1 = 0;
-    for(addr = real_start; addr < real_end; addr++) {
-        if (addr < start || addr >= end)
+    for (addr = real_start; addr < real_end; addr += TARGET_PAGE_SIZE) {
+        if (addr < start || addr >= end) {
             prot1 |= page_get_flags(addr);
+        }
     }
 
     if (prot1 == 0) {
@@ -204,40 +209,30 @@ unsigned long last_brk;
    of guest address space.  */
 static abi_ulong mmap_find_vma_reserved(abi_ulong start, abi_ulong size)
 {
-    abi_ulong addr;
+    abi_ulong addr = -1;
     abi_ulong end_addr;
-    int prot;
-    int looped = 0;
 
     if (size > reserved_va) {
         return (abi_ulong)-1;
     }
 
+    /* The highest free block that ends by start + size, else the highest
+       one in the reserved area.  */
     size = HOST_PAGE_ALIGN(size);
     end_addr = start + size;
     if (end_addr > reserved_va) {
         end_addr = reserved_va;
     }
-    addr = end_addr - qemu_host_page_size;
-
-    while (1) {
-        if (addr > end_addr) {
-            if (looped) {
-                return (abi_ulong)-1;
-            }
-            end_addr = reserved_va;
-            addr = end_addr - qemu_host_page_size;
-            looped = 1;
-            continue;
-        }
-        prot = page_get_flags(addr);
-        if (prot) {
-            end_addr = addr;
-        }
-        if (addr + size == end_addr) {
-            break;
+    if (end_addr >= size) {
+        addr = page_find_range_empty(0, end_addr - 1, size,
+                                     qemu_host_page_size);
+    }
+    if (addr == (abi_ulong)-1) {
+        addr = page_find_range_empty(0, reserved_va - 1, size,
+                                     qemu_host_page_size);
+        if (addr == (abi_ulong)-1) {
+            return (abi_ulong)-1;
         }
-        addr -= qemu_host_page_size;
     }
 
     if (start == mmap_next_start) {
@@ -468,6 +463,9 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int prot,
             host_start += offset - host_offset;
         }
         start = h2g(host_start);
+        /* Only the range reserved by mmap_find_vma() has changed so far,
+           and it holds no guest pages yet.  */
+        tb_lock();
     } else {
         if (start & ~TARGET_PAGE_MASK) {
             errno = EINVAL;
@@ -510,7 +508,10 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int prot,
             }
             goto the_end;
         }
-        
+
+        /* from here on the mapping of guest pages changes */
+        tb_lock();
+
         /* handle the start of the mapping */
         if (start > real_start) {
             if (real_end == real_start + qemu_host_page_size) {
@@ -518,13 +519,13 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int prot,
                 ret = mmap_frag(real_start, start, end,
                                 prot, flags, fd, offset);
                 if (ret == -1)
-                    goto fail;
+                    goto fail_unlock;
                 goto the_end1;
             }
             ret = mmap_frag(real_start, start, real_start + qemu_host_page_size,
                             prot, flags, fd, offset);
             if (ret == -1)
-                goto fail;
+                goto fail_unlock;
             real_start += qemu_host_page_size;
         }
         /* handle the end of the mapping */
@@ -534,7 +535,7 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int prot,
                             prot, flags, fd,
                             offset + real_end - qemu_host_page_size - start);
             if (ret == -1)
-                goto fail;
+                goto fail_unlock;
             real_end -= qemu_host_page_size;
         }
 
@@ -549,20 +550,23 @@ abi_long target_mmap(abi_ulong start, abi_ulong len, int prot,
             p = mmap(g2h(real_start), real_end - real_start,
                      prot, flags, fd, offset1);
             if (p == MAP_FAILED)
-                goto fail;
+                goto fail_unlock;
         }
     }
  the_end1:
     page_set_flags(start, start + len, prot | PAGE_VALID);
+    tb_invalidate_phys_range(start, start + len);
+    tb_unlock();
  the_end:
 #ifdef DEBUG_MMAP
     printf("ret=0x" TARGET_ABI_FMT_lx "\n", start);
     page_dump(stdout);
     printf("\n");
 #endif
-    tb_invalidate_phys_range(start, start + len);
     mmap_unlock();
     return start;
+fail_unlock:
+    tb_unlock();
 fail:
     mmap_unlock();
     return -1;
@@ -625,6 +629,7 @@ int target_munmap(abi_ulong start, abi_ulong len)
     if (len == 0)
         return -EINVAL;
     mmap_lock();
+    tb_lock();
     end = start + len;
     real_start = start & qemu_host_page_mask;
     real_end = HOST_PAGE_ALIGN(end);
@@ -667,6 +672,7 @@ int target_munmap(abi_ulong start, abi_ulong len)
         page_set_flags(start, start + len, 0);
         tb_invalidate_phys_range(start, start + len);
     }
+    tb_unlock();
     mmap_unlock();
     return ret;
 }
@@ -679,6 +685,7 @@ abi_long target_mremap(abi_ulong old_addr, abi_ulong old_size,
     void *host_addr;
 
     mmap_lock();
+    tb_lock();
 
     if (flags & MREMAP_FIXED) {
         host_addr = (void *) syscall(__NR_mremap, g2h(old_addr),
@@ -710,13 +717,11 @@ abi_long target_mremap(abi_ulong old_addr, abi_ulong old_size,
         }
     } else {
         int prot = 0;
-        if (reserved_va && old_size < new_size) {
-            abi_ulong addr;
-            for (addr = old_addr + old_size;
-                 addr < old_addr + new_size;
-                 addr++) {
-                prot |= page_get_flags(addr);
-            }
+        if (reserved_va && old_size < new_size &&
+            page_find_range_empty(old_addr + old_size,
+                                  old_addr + new_size - 1,
+                                  new_size - old_size, 1) == -1) {
+            prot = PAGE_VALID;
         }
         if (prot == 0) {
             host_addr = mremap(g2h(old_addr), old_size, new_size, flags);
@@ -745,6 +750,7 @@ abi_long target_mremap(abi_ulong old_addr, abi_ulong old_size,
         page_set_flags(new_addr, new_addr + new_size, prot | PAGE_VALID);
     }
     tb_invalidate_phys_range(new_addr, new_addr + new_size);
+    tb_unlock();
     mmap_unlock();
     return new_addr;
 }
@@ -111,6 +111,7 @@ int __clone2(int (*fn)(void *), void *child_stack_base,
 #include "uname.h"
 
 #include "qemu.h"
+#include "tcg.h"
 
 #define CLONE_NPTL_FLAGS2 (CLONE_SETTLS | \
     CLONE_PARENT_SETTID | CLONE_CHILD_SETTID | CLONE_CHILD_CLEARTID)
@@ -3118,6 +3119,31 @@ static abi_long do_getsockopt(int sockfd, int level, int optname,
     return ret;
 }
 
+/* Most calls pass a few buffers, like the kernel's UIO_FASTIOV: convert
+   their iovecs in a per-thread array instead of allocating one each time.  */
+#define IOVEC_CACHE_SIZE 8
+
+static __thread struct iovec iovec_cache[IOVEC_CACHE_SIZE];
+static __thread bool iovec_cache_busy;
+
+static struct iovec *iovec_alloc(int count)
+{
+    if (count <= IOVEC_CACHE_SIZE && !iovec_cache_busy) {
+        iovec_cache_busy = true;
+        return iovec_cache;
+    }
+    return g_try_new(struct iovec, count);
+}
+
+static void iovec_free(struct iovec *vec)
+{
+    if (vec == iovec_cache) {
+        iovec_cache_busy = false;
+    } else {
+        g_free(vec);
+    }
+}
+
 static struct iovec *lock_iovec(int type, abi_ulong target_addr,
                                 int count, int copy)
 {
@@ -3137,7 +3163,7 @@ static struct iovec *lock_iovec(int type, abi_ulong target_addr,
         return NULL;
     }
 
-    vec = g_try_new0(struct iovec, count);
+    vec = iovec_alloc(count);
     if (vec == NULL) {
         errno = ENOMEM;
         return NULL;
@@ -3201,7 +3227,7 @@ static struct iovec *lock_iovec(int type, abi_ulong target_addr,
     }
     unlock_user(target_vec, target_addr, 0);
  fail2:
-    g_free(vec);
+    iovec_free(vec);
     errno = err;
     return NULL;
 }
@@ -3209,6 +3235,10 @@ static struct iovec *lock_iovec(int type, abi_ulong target_addr,
 static void unlock_iovec(struct iovec *vec, abi_ulong target_addr,
                          int count, int copy)
 {
+    /* Unless DEBUG_REMAP makes lock_user() copy, the buffers are guest
+       memory itself and unlock_user() has nothing to do: do not read the
+       guest's iovecs again.  */
+#ifdef DEBUG_REMAP
     struct target_iovec *target_vec;
     int i;
 
@@ -3225,8 +3255,9 @@ static void unlock_iovec(struct iovec *vec, abi_ulong target_addr,
         }
         unlock_user(target_vec, target_addr, 0);
     }
+#endif
 
-    g_free(vec);
+    iovec_free(vec);
 }
 
 static inline int target_to_host_sock_type(int *type)
@@ -4583,6 +4614,7 @@ static inline abi_ulong do_shmat(int shmid, abi_ulong shmaddr, int shmflg)
     }
 
     mmap_lock();
+    tb_lock();
 
     if (shmaddr)
         host_raddr = shmat(shmid, (void *)g2h(shmaddr), shmflg);
@@ -4599,6 +4631,7 @@ static inline abi_ulong do_shmat(int shmid, abi_ulong shmaddr, int shmflg)
     }
 
     if (host_raddr == (void *)-1) {
+        tb_unlock();
         mmap_unlock();
         return get_errno((long)host_raddr);
     }
@@ -4617,6 +4650,7 @@ static inline abi_ulong do_shmat(int shmid, abi_ulong shmaddr, int shmflg)
         }
     }
 
+    tb_unlock();
     mmap_unlock();
     return raddr;
 
@@ -4625,6 +4659,10 @@ static inline abi_ulong do_shmat(int shmid, abi_ulong shmaddr, int shmflg)
 static inline abi_long do_shmdt(abi_ulong shmaddr)
 {
     int i;
+    abi_long rv;
+
+    mmap_lock();
+    tb_lock();
 
     for (i = 0; i < N_SHM_REGIONS; ++i) {
         if (shm_regions[i].in_use && shm_regions[i].start == shmaddr) {
@@ -4633,8 +4671,11 @@ static inline abi_long do_shmdt(abi_ulong shmaddr)
             break;
         }
     }
+    rv = get_errno(shmdt(g2h(shmaddr)));
 
-    return get_errno(shmdt(g2h(shmaddr)));
+    tb_unlock();
+    mmap_unlock();
+    return rv;
 }
 
 #ifdef TARGET_NR_ipc
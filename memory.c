@@ -1828,6 +1828,11 @@ void memory_region_clear_global_locking(MemoryRegion *mr)
     mr->global_locking = false;
 }
 
+void memory_region_set_timing_insensitive(MemoryRegion *mr)
+{
+    mr->timing_insensitive = true;
+}
+
 static bool userspace_eventfd_warning;
 
 void memory_region_add_eventfd(MemoryRegion *mr,
@@ -43,6 +43,8 @@
 #include "trace.h"
 #include "exec/ram_addr.h"
 #include "qemu/rcu_queue.h"
+#include "exec/exec-all.h"
+#include "translate-all.h"
 
 #ifdef DEBUG_MIGRATION_RAM
 #define DPRINTF(fmt, ...) \
@@ -2578,6 +2580,285 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
     return ret;
 }
 
+/***********************************************************/
+/* In-memory RAM snapshot, see snapshot-fast-save */
+
+typedef struct RAMSnapshotBlock {
+    char *idstr;
+    ram_addr_t offset;
+    ram_addr_t length;
+    uint8_t *data;
+} RAMSnapshotBlock;
+
+static RAMSnapshotBlock *ram_snapshot;
+static int ram_snapshot_nb_blocks;
+
+void ram_snapshot_free(void)
+{
+    int i;
+
+    if (!ram_snapshot) {
+        return;
+    }
+    for (i = 0; i < ram_snapshot_nb_blocks; i++) {
+        g_free(ram_snapshot[i].idstr);
+        qemu_vfree(ram_snapshot[i].data);
+    }
+    g_free(ram_snapshot);
+    ram_snapshot = NULL;
+    ram_snapshot_nb_blocks = 0;
+    memory_global_dirty_log_stop();
+}
+
+/* Copy all of RAM, and start tracking the pages that are written from
+ * now on in the migration dirty bitmap.  Called with the VM stopped.
+ */
+int ram_snapshot_save(Error **errp)
+{
+    RAMSnapshotBlock *s;
+    RAMBlock *block;
+    int n = 0;
+
+    ram_snapshot_free();
+    /* Device DMA only sets the migration bits while this is on.  */
+    memory_global_dirty_log_start();
+
+    rcu_read_lock();
+    QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
+        n++;
+    }
+    ram_snapshot = g_new0(RAMSnapshotBlock, n);
+
+    address_space_sync_dirty_bitmap(&address_space_memory);
+    QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
+        s = &ram_snapshot[ram_snapshot_nb_blocks++];
+        s->idstr = g_strdup(block->idstr);
+        s->offset = block->offset;
+        s->length = block->used_length;
+        s->data = qemu_try_memalign(TARGET_PAGE_SIZE, s->length);
+        if (!s->data) {
+            error_setg(errp, "Not enough memory to copy RAM block %s",
+                       block->idstr);
+            rcu_read_unlock();
+            ram_snapshot_free();
+            return -ENOMEM;
+        }
+        memcpy(s->data, block->host, s->length);
+        cpu_physical_memory_test_and_clear_dirty(block->offset,
+                                                 block->used_length,
+                                                 DIRTY_MEMORY_MIGRATION);
+    }
+    rcu_read_unlock();
+    return 0;
+}
+
+/* Return the first page in [PAGE, END) whose migration dirty bit is set,
+ * or END.  Called within an RCU critical section.
+ */
+static unsigned long ram_next_dirty_page(unsigned long page,
+                                         unsigned long end)
+{
+    DirtyMemoryBlocks *blocks;
+
+    blocks = atomic_rcu_read(&ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION]);
+    while (page < end) {
+        unsigned long idx = page / DIRTY_MEMORY_BLOCK_SIZE;
+        unsigned long offset = page % DIRTY_MEMORY_BLOCK_SIZE;
+        unsigned long num = MIN(end - page, DIRTY_MEMORY_BLOCK_SIZE - offset);
+        unsigned long bit = find_next_bit(blocks->blocks[idx], offset + num,
+                                          offset);
+
+        if (bit < offset + num) {
+            return page + bit - offset;
+        }
+        page += num;
+    }
+    return end;
+}
+
+/* Pages of RAM are about to be overwritten behind the back of the TCG. */
+static void ram_replace_begin(void)
+{
+    if (tcg_enabled()) {
+        tb_lock();
+    }
+}
+
+/* Drop the translated code of the page at ADDR, whose contents were
+ * replaced, and tell display and migration that it changed.  Called
+ * between ram_replace_begin() and ram_replace_end().
+ */
+static void ram_page_replaced(ram_addr_t addr)
+{
+    if (tcg_enabled() &&
+        !cpu_physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_CODE)) {
+        tb_invalidate_phys_range(addr, addr + TARGET_PAGE_SIZE);
+    }
+    cpu_physical_memory_set_dirty_range(addr, TARGET_PAGE_SIZE,
+                                        DIRTY_CLIENTS_NOCODE);
+}
+
+static void ram_replace_end(void)
+{
+    CPUState *cpu;
+
+    if (tcg_enabled()) {
+        tb_unlock();
+        /* The TLBs may map replaced pages as already dirty.  */
+        CPU_FOREACH(cpu) {
+            tlb_flush(cpu, 1);
+        }
+    }
+}
+
+/* Called within an RCU critical section, between ram_replace_begin() and
+ * ram_replace_end().
+ */
+static uint64_t ram_snapshot_restore_block(RAMSnapshotBlock *s,
+                                           RAMBlock *block)
+{
+    unsigned long first = s->offset >> TARGET_PAGE_BITS;
+    unsigned long end = first + (s->length >> TARGET_PAGE_BITS);
+    unsigned long page;
+    uint64_t restored = 0;
+
+    for (page = ram_next_dirty_page(first, end); page < end;
+         page = ram_next_dirty_page(page + 1, end)) {
+        ram_addr_t addr = (ram_addr_t)(page - first) << TARGET_PAGE_BITS;
+
+        memcpy(block->host + addr, s->data + addr, TARGET_PAGE_SIZE);
+        ram_page_replaced(s->offset + addr);
+        restored++;
+    }
+    cpu_physical_memory_test_and_clear_dirty(s->offset, s->length,
+                                             DIRTY_MEMORY_MIGRATION);
+    return restored;
+}
+
+/* Copy back the pages written since ram_snapshot_save(), and drop the
+ * translated code in them.  Called with the VM stopped.  Returns the
+ * number of pages restored, or a negative value on error.
+ */
+int64_t ram_snapshot_restore(Error **errp)
+{
+    RAMBlock **blocks;
+    int64_t restored = 0;
+    int i;
+
+    if (!ram_snapshot) {
+        error_setg(errp, "No RAM snapshot");
+        return -ENOENT;
+    }
+
+    rcu_read_lock();
+    blocks = g_new(RAMBlock *, ram_snapshot_nb_blocks);
+    for (i = 0; i < ram_snapshot_nb_blocks; i++) {
+        RAMSnapshotBlock *s = &ram_snapshot[i];
+
+        blocks[i] = qemu_ram_block_by_name(s->idstr);
+        if (!blocks[i] || blocks[i]->offset != s->offset ||
+            blocks[i]->used_length != s->length) {
+            error_setg(errp, "RAM block %s changed since the snapshot",
+                       s->idstr);
+            g_free(blocks);
+            rcu_read_unlock();
+            return -EINVAL;
+        }
+    }
+
+    address_space_sync_dirty_bitmap(&address_space_memory);
+    ram_replace_begin();
+    for (i = 0; i < ram_snapshot_nb_blocks; i++) {
+        restored += ram_snapshot_restore_block(&ram_snapshot[i], blocks[i]);
+    }
+    ram_replace_end();
+    g_free(blocks);
+    rcu_read_unlock();
+    return restored;
+}
+
+/***********************************************************/
+/* RAM diffs, see replay/replay-snapshot.c */
+
+#define RAM_DIFF_BLOCK_END  (~(uint64_t)0)
+
+/* Write to F the RAM pages written since the previous call, or all of RAM
+ * if ALL, and start tracking the pages written from now on.  The global
+ * dirty log must be on.  Called with the iothread lock held.
+ */
+void ram_save_dirty_pages(QEMUFile *f, bool all)
+{
+    RAMBlock *block;
+
+    rcu_read_lock();
+    address_space_sync_dirty_bitmap(&address_space_memory);
+    QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
+        unsigned long first = block->offset >> TARGET_PAGE_BITS;
+        unsigned long end = first + (block->used_length >> TARGET_PAGE_BITS);
+        unsigned long page;
+
+        page = all ? first : ram_next_dirty_page(first, end);
+        if (page == end) {
+            continue;
+        }
+
+        qemu_put_byte(f, strlen(block->idstr));
+        qemu_put_buffer(f, (uint8_t *)block->idstr, strlen(block->idstr));
+        qemu_put_be64(f, block->used_length);
+        for (; page < end;
+             page = all ? page + 1 : ram_next_dirty_page(page + 1, end)) {
+            ram_addr_t addr = (ram_addr_t)(page - first) << TARGET_PAGE_BITS;
+
+            qemu_put_be64(f, addr);
+            qemu_put_buffer(f, block->host + addr, TARGET_PAGE_SIZE);
+        }
+        qemu_put_be64(f, RAM_DIFF_BLOCK_END);
+
+        cpu_physical_memory_test_and_clear_dirty(block->offset,
+                                                 block->used_length,
+                                                 DIRTY_MEMORY_MIGRATION);
+    }
+    qemu_put_byte(f, 0);
+    rcu_read_unlock();
+}
+
+/* Apply the pages written by ram_save_dirty_pages().  Returns 0 or a
+ * negative error code.
+ */
+int ram_load_dirty_pages(QEMUFile *f)
+{
+    char idstr[256];
+    RAMBlock *block;
+    uint64_t addr, length;
+    int ret = 0;
+
+    rcu_read_lock();
+    ram_replace_begin();
+    while (ret == 0 && qemu_get_counted_string(f, idstr)) {
+        length = qemu_get_be64(f);
+        block = qemu_ram_block_by_name(idstr);
+        if (!block || block->used_length != length) {
+            error_report("RAM block %s does not match the saved one", idstr);
+            ret = -EINVAL;
+            break;
+        }
+        while ((addr = qemu_get_be64(f)) != RAM_DIFF_BLOCK_END) {
+            if (addr >= length || qemu_file_get_error(f)) {
+                ret = -EINVAL;
+                break;
+            }
+            qemu_get_buffer(f, block->host + addr, TARGET_PAGE_SIZE);
+            ram_page_replaced(block->offset + addr);
+        }
+        if (ret == 0) {
+            ret = qemu_file_get_error(f);
+        }
+    }
+    ram_replace_end();
+    rcu_read_unlock();
+    return ret ? ret : qemu_file_get_error(f);
+}
+
 static SaveVMHandlers savevm_ram_handlers = {
     .save_live_setup = ram_save_setup,
     .save_live_iterate = ram_save_iterate,
@@ -54,6 +54,7 @@
 #include "qemu/cutils.h"
 #include "io/channel-buffer.h"
 #include "io/channel-file.h"
+#include "sysemu/replay.h"
 
 #ifndef ETH_P_RARP
 #define ETH_P_RARP 0x8035
@@ -1189,7 +1190,7 @@ done:
     return ret;
 }
 
-static int qemu_save_device_state(QEMUFile *f)
+int qemu_save_device_state(QEMUFile *f)
 {
     SaveStateEntry *se;
 
@@ -2111,6 +2112,156 @@ void qmp_xen_load_devices_state(const char *filename, Error **errp)
     migration_incoming_state_destroy();
 }
 
+/* The device state of the in-memory snapshot, see snapshot-fast-save.
+ * RAM is kept by migration/ram.c.
+ */
+static struct {
+    uint8_t *devices;
+    size_t devices_size;
+    Error *blocker;
+} snapshot_fast;
+
+/* Load the devices saved by qemu_save_device_state(), while no incoming
+ * migration is running.
+ */
+int qemu_load_device_state(QEMUFile *f)
+{
+    MigrationIncomingState *mis;
+    int ret;
+
+    if (qemu_get_be32(f) != QEMU_VM_FILE_MAGIC ||
+        qemu_get_be32(f) != QEMU_VM_FILE_VERSION) {
+        return -EINVAL;
+    }
+    mis = migration_incoming_state_new(f);
+    ret = qemu_loadvm_state_main(f, mis);
+    migration_incoming_state_destroy();
+    if (ret == 0) {
+        ret = qemu_file_get_error(f);
+    }
+    cpu_synchronize_all_post_init();
+    return ret;
+}
+
+void qmp_snapshot_fast_delete(Error **errp)
+{
+    if (!snapshot_fast.devices) {
+        return;
+    }
+    ram_snapshot_free();
+    g_free(snapshot_fast.devices);
+    snapshot_fast.devices = NULL;
+    snapshot_fast.devices_size = 0;
+    migrate_del_blocker(snapshot_fast.blocker);
+    error_free(snapshot_fast.blocker);
+    snapshot_fast.blocker = NULL;
+}
+
+void qmp_snapshot_fast_save(Error **errp)
+{
+    QIOChannelBuffer *bioc;
+    QEMUFile *f;
+    int saved_vm_running;
+    int ret;
+
+    if (migration_is_setup_or_active(migrate_get_current()->state)) {
+        error_setg(errp, QERR_MIGRATION_ACTIVE);
+        return;
+    }
+    if (replay_mode != REPLAY_MODE_NONE) {
+        error_setg(errp, "Fast snapshots are not supported with "
+                   "record/replay");
+        return;
+    }
+    if (qemu_savevm_state_blocked(errp)) {
+        return;
+    }
+
+    saved_vm_running = runstate_is_running();
+    vm_stop(RUN_STATE_SAVE_VM);
+    qmp_snapshot_fast_delete(NULL);
+
+    bioc = qio_channel_buffer_new(4096);
+    f = qemu_fopen_channel_output(QIO_CHANNEL(bioc));
+    ret = qemu_save_device_state(f);
+    qemu_fflush(f);
+    if (ret == 0) {
+        snapshot_fast.devices = g_memdup(bioc->data, bioc->usage);
+        snapshot_fast.devices_size = bioc->usage;
+    }
+    qemu_fclose(f);
+    object_unref(OBJECT(bioc));
+    if (ret < 0) {
+        error_setg(errp, "Error %d while saving the device state", ret);
+        goto the_end;
+    }
+
+    ret = ram_snapshot_save(errp);
+    if (ret < 0) {
+        g_free(snapshot_fast.devices);
+        snapshot_fast.devices = NULL;
+        goto the_end;
+    }
+
+    /* Migration would clear the dirty bits that restoring relies on.  */
+    error_setg(&snapshot_fast.blocker, "A fast snapshot exists, delete it "
+               "with snapshot-fast-delete first");
+    migrate_add_blocker(snapshot_fast.blocker);
+
+ the_end:
+    if (saved_vm_running) {
+        vm_start();
+    }
+}
+
+void qmp_snapshot_fast_restore(Error **errp)
+{
+    QIOChannelBuffer *bioc;
+    QEMUFile *f;
+    int saved_vm_running;
+    int64_t pages;
+    int ret;
+
+    if (!snapshot_fast.devices) {
+        error_setg(errp, "No fast snapshot, create one with "
+                   "snapshot-fast-save");
+        return;
+    }
+    if (migration_incoming_get_current()) {
+        error_setg(errp, "Cannot restore a snapshot during an incoming "
+                   "migration");
+        return;
+    }
+
+    saved_vm_running = runstate_is_running();
+    vm_stop(RUN_STATE_RESTORE_VM);
+
+    pages = ram_snapshot_restore(errp);
+    if (pages < 0) {
+        goto the_end;
+    }
+
+    bioc = qio_channel_buffer_new(snapshot_fast.devices_size);
+    memcpy(bioc->data, snapshot_fast.devices, snapshot_fast.devices_size);
+    bioc->usage = snapshot_fast.devices_size;
+    f = qemu_fopen_channel_input(QIO_CHANNEL(bioc));
+
+    ret = qemu_load_device_state(f);
+    qemu_fclose(f);
+    object_unref(OBJECT(bioc));
+    trace_snapshot_fast_restore(pages, snapshot_fast.devices_size, ret);
+    if (ret < 0) {
+        /* Like loadvm, leave a half restored VM stopped.  */
+        error_setg(errp, "Error %d while loading the device state", ret);
+        return;
+    }
+
+ the_end:
+    if (saved_vm_running) {
+        vm_start();
+    }
+}
+
 int load_vmstate(const char *name)
 {
     BlockDriverState *bs, *bs_vm_state;
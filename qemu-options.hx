@@ -3241,6 +3241,104 @@ STEXI
 Set the filename for the BIOS.
 ETEXI
 
+DEF("accel", HAS_ARG, QEMU_OPTION_accel,
+    "-accel [accel=]accelerator[,thread=single|multi][,tb-cache=file]\n"
+    "                [,trace-threshold=n][,vtlb-size=n][,perf-map=on|off]\n"
+    "                [,jitdump=on|off][,speculate=on|off][,profile=on|off]\n"
+    "                [,chain-pages=on|off][,sample-profile=file]\n"
+    "                [,sample-rate=n][,sample-stack=on|off]\n"
+    "                select accelerator (kvm, xen, tcg)\n"
+    "                thread=single|multi (enable multi-threaded TCG)\n"
+    "                tb-cache=file (keep translated code across runs)\n"
+    "                trace-threshold=n (merge blocks run n times into traces)\n"
+    "                vtlb-size=n (entries in each victim TLB, default 16)\n"
+    "                perf-map=on|off (name translated code for perf)\n"
+    "                jitdump=on|off (save translated code for perf)\n"
+    "                speculate=on|off (translate likely successors when idle)\n"
+    "                profile=on|off (count executions of translated blocks)\n"
+    "                chain-pages=on|off (jump directly between guest pages)\n"
+    "                sample-profile=file (write a sampled guest profile)\n"
+    "                sample-rate=n (samples per second, default 1000)\n"
+    "                sample-stack=on|off (also sample guest call stacks)\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -accel @var{name}[,prop=@var{value}[,...]]
+@findex -accel
+This is used to enable an accelerator. Depending on the target architecture,
+kvm, xen, or tcg can be available. By default, tcg is used. Supported
+properties are:
+@table @option
+@item thread=single|multi
+Controls the number of TCG threads. When the TCG is multi-threaded there
+will be one host thread per guest vCPU, and each of them executes
+translated code in parallel.  This is only available for guest
+architectures which support it, and cannot be combined with -icount.
+The default is a single thread which runs all vCPUs in turn.
+@item tb-cache=@var{file}
+Save the translated code to @var{file} when QEMU exits, and reuse it
+in later runs instead of translating the same guest code again.  Cached
+code is only used if the guest code is unchanged, and the file is only
+accepted by the same QEMU executable with the same CPU configuration.
+It contains host code, so it must not be writable by untrusted users.
+This is currently supported for x86-64 Linux hosts.
+@item trace-threshold=@var{n}
+Count how often each translated block runs and which block follows it.
+Once a block has run @var{n} times, it is translated again together
+with the blocks that usually follow it, so that guest registers can stay
+in host registers across the whole sequence.  Other blocks are not
+chained to each other in this mode, which makes code that does not run
+hot slower.  This cannot be combined with -icount.
+@item vtlb-size=@var{n}
+Set the number of entries in the fully associative victim TLB that
+backs the softmmu TLB of each MMU mode, between 1 and 256.  The
+default is 16.  A larger victim TLB makes TLB conflicts cheaper,
+at the price of a longer search when a page is not in it.
+@item perf-map=on|off
+Write @file{/tmp/perf-@var{pid}.map}, so that @command{perf report}
+can name the translated code after the guest address and, if an ELF
+file was loaded, the guest symbol it comes from.  Because translated
+code is thrown away and regenerated, the map may have several entries
+for the same host address; use @option{jitdump} if this is a problem.
+@item jitdump=on|off
+Write @file{jit-@var{pid}.dump} in the current directory, with the
+name and a copy of every translated block.  Record the profile with
+@command{perf record -k 1} and merge it with @command{perf inject --jit}.
+Both options are only available on Linux hosts.
+@item speculate=on|off
+When a vCPU is idle, translate the blocks that are likely to run after
+recently translated ones, so that the guest does not have to wait for
+them later.  This helps most while the guest runs new code, for example
+when it boots.
+@item profile=on|off
+Count how often each translated block is entered, so that the monitor
+command @code{info tb-hot} and the QMP command @code{query-tb-hot} can
+list the guest code that runs most.  The counting slows the guest down
+a little, and the translation cache is not used.
+@item chain-pages=on|off
+Let translated blocks jump directly to blocks in other guest pages,
+instead of going through a lookup of the target address each time.
+These jumps are undone whenever the guest flushes its TLB.  This is
+only done when the machine has a single vCPU, and is on by default.
+The monitor command @code{info jit} counts the jumps between pages.
+@item sample-profile=@var{file}
+Interrupt the running vCPUs at regular intervals of host time and record
+the guest code they execute, then write a flat profile to @var{file}
+when QEMU exits.  Addresses are named after the symbols of the ELF files
+loaded into the guest, for example with @option{-kernel}.  The overhead
+is small enough to profile firmware at full speed; with @option{-icount}
+the samples are less precise.
+@item sample-rate=@var{n}
+Take @var{n} samples per second for @option{sample-profile}.  The
+default is 1000.
+@item sample-stack=on|off
+Also walk the guest call stack in each sample, and write the stacks to
+@file{@var{file}.folded}, in the format read by @command{flamegraph.pl}.
+The stack is followed through the frame pointer, so the guest code must
+be compiled with @option{-fno-omit-frame-pointer}.  This is currently
+supported for ARM guests.
+@end table
+ETEXI
+
 DEF("enable-kvm", 0, QEMU_OPTION_enable_kvm, \
     "-enable-kvm     enable KVM full virtualization support\n", QEMU_ARCH_ALL)
 STEXI
@@ -3361,11 +3459,12 @@ ETEXI
 
 DEF("icount", HAS_ARG, QEMU_OPTION_icount, \
     "-icount [shift=N|auto][,align=on|off][,sleep=on|off,rr=record|replay,rrfile=<filename>]\n" \
+    "       [,rrperiod=N][,rrstart=N]\n" \
     "                enable virtual instruction counter with 2^N clock ticks per\n" \
     "                instruction, enable aligning the host and virtual clocks\n" \
     "                or disable real time cpu sleeping\n", QEMU_ARCH_ALL)
 STEXI
-@item -icount [shift=@var{N}|auto][,rr=record|replay,rrfile=@var{filename}]
+@item -icount [shift=@var{N}|auto][,rr=record|replay,rrfile=@var{filename}][,rrperiod=@var{N}][,rrstart=@var{N}]
 @findex -icount
 Enable virtual instruction counter.  The virtual cpu will execute one
 instruction every 2^@var{N} ns of virtual time.  If @code{auto} is specified
@@ -3398,6 +3497,11 @@ when the shift value is high (how high depends on the host machine).
 When @option{rr} option is specified deterministic record/replay is enabled.
 Replay log is written into @var{filename} file in record mode and
 read from this file in replay mode.
+
+With @option{rrperiod}, the recording saves a snapshot of the VM into the
+log every @var{N} instructions or so.  With @option{rrstart}, replay starts
+from the last of these snapshots at or before instruction @var{N} instead
+of the beginning.
 ETEXI
 
 DEF("watchdog", HAS_ARG, QEMU_OPTION_watchdog, \
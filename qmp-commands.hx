@@ -611,6 +611,67 @@ Example:
      "arguments": { "filename": "/tmp/resume" } }
 <- { "return": {} }
 
+EQMP
+
+    {
+        .name       = "snapshot-fast-save",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_snapshot_fast_save,
+    },
+
+SQMP
+snapshot-fast-save
+------------------
+
+Save the state of the VM to host memory, replacing the previous fast
+snapshot if there is one.  The block devices are not saved.  Migration
+is blocked while the snapshot exists.
+
+Example:
+
+-> { "execute": "snapshot-fast-save" }
+<- { "return": {} }
+
+EQMP
+
+    {
+        .name       = "snapshot-fast-restore",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_snapshot_fast_restore,
+    },
+
+SQMP
+snapshot-fast-restore
+---------------------
+
+Return the VM to the state saved by snapshot-fast-save.  Only the RAM
+pages written since the snapshot are copied back.  The snapshot is kept,
+so the VM can be restored again and again.
+
+Example:
+
+-> { "execute": "snapshot-fast-restore" }
+<- { "return": {} }
+
+EQMP
+
+    {
+        .name       = "snapshot-fast-delete",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_snapshot_fast_delete,
+    },
+
+SQMP
+snapshot-fast-delete
+--------------------
+
+Free the snapshot saved by snapshot-fast-save, if there is one.
+
+Example:
+
+-> { "execute": "snapshot-fast-delete" }
+<- { "return": {} }
+
 EQMP
 
     {
@@ -2966,6 +3027,58 @@ EQMP
         .mhandler.cmd_new = qmp_marshal_query_iothreads,
     },
 
+SQMP
+query-tb-hot
+------------
+
+Show the translated blocks that were executed most.  This requires
+"-accel tcg,profile=on".
+
+Arguments:
+
+- "count": number of blocks to return, default 10 (json-int, optional)
+
+Return a json-array, most executed block first.  Each block is represented
+by a json-object, which contains:
+
+- "pc": guest address of the block (json-int)
+- "size": size of the guest code, in bytes (json-int)
+- "icount": number of guest instructions (json-int)
+- "host-size": size of the host code, in bytes (json-int)
+- "exec-count": number of times the block was entered (json-int)
+- "cost": exec-count times host-size (json-int)
+- "jumps": number of direct jumps to other blocks (json-int)
+- "chained": number of direct jumps that lead straight into another
+             block (json-int)
+- "trace": true if the block is a trace (json-bool)
+
+Example:
+
+-> { "execute": "query-tb-hot", "arguments": { "count": 1 } }
+<- {
+      "return":[
+         {
+            "pc":1048598,
+            "size":12,
+            "icount":4,
+            "host-size":96,
+            "exec-count":1048576,
+            "cost":100663296,
+            "jumps":2,
+            "chained":1,
+            "trace":false
+         }
+      ]
+   }
+
+EQMP
+
+    {
+        .name       = "query-tb-hot",
+        .args_type  = "count:i?",
+        .mhandler.cmd_new = qmp_marshal_query_tb_hot,
+    },
+
 SQMP
 query-pci
 ---------
@@ -28,6 +28,7 @@
 #include "exec/log.h"
 #include "qemu/error-report.h"
 #include "sysemu/sysemu.h"
+#include "sysemu/cpus.h"
 #include "hw/qdev-properties.h"
 
 bool cpu_exists(int64_t id)
@@ -123,6 +124,10 @@ void cpu_exit(CPUState *cpu)
     /* Ensure cpu_exec will see the exit request after TCG has exited.  */
     smp_wmb();
     cpu->tcg_exit_req = 1;
+    if (use_icount) {
+        /* Translated code only checks icount_decr in this mode.  */
+        cpu->icount_decr.u16.high = 0xffff;
+    }
 }
 
 int cpu_write_elf32_qemunote(WriteCoreDumpFunction f, CPUState *cpu,
@@ -13,8 +13,12 @@
 #include "qemu-common.h"
 #include "sysemu/replay.h"
 #include "replay-internal.h"
+#include "qemu/bswap.h"
 #include "qemu/error-report.h"
 #include "sysemu/sysemu.h"
+#include "qemu/thread.h"
+#include "qemu/queue.h"
+#include <zlib.h>
 
 unsigned int replay_data_kind = -1;
 static unsigned int replay_has_unread_data;
@@ -29,10 +33,310 @@ static QemuMutex lock;
 /* File for replay writing */
 FILE *replay_file;
 
+/* The log is a sequence of zlib-compressed records, each made of a type
+   byte, the 64-bit big-endian raw and compressed sizes, and the compressed
+   data.
+   The event stream is cut into REPLAY_BLOCK_SIZE records, which a separate
+   thread compresses and writes while recording, so that the vCPU never
+   waits for the disk. */
+#define REPLAY_BLOCK_SIZE           (64 * 1024)
+#define REPLAY_RECORD_HEADER_SIZE   (1 + 2 * sizeof(uint64_t))
+/* Blocks that may wait for the writer before recording stalls */
+#define REPLAY_WRITER_QUEUE_MAX     64
+
+typedef struct ReplayRecord {
+    uint8_t type;
+    uint8_t *data;
+    size_t size;
+    /* For snapshot chunks, the step the snapshot was taken at */
+    uint64_t step;
+    /* Whether this is the last chunk of the snapshot */
+    bool last;
+    QSIMPLEQ_ENTRY(ReplayRecord) next;
+} ReplayRecord;
+
+static struct {
+    QemuThread thread;
+    QemuMutex lock;
+    /* Signalled when a record is queued, or when exiting */
+    QemuCond cond;
+    /* Signalled when a record is taken from the queue */
+    QemuCond space_cond;
+    QSIMPLEQ_HEAD(, ReplayRecord) queue;
+    int queued;
+    bool running;
+    bool exiting;
+    /* The rest is only accessed by the writer thread until it is joined */
+    uint64_t offset;
+    /* Offset of the first record of the snapshot being written */
+    uint64_t snapshot_offset;
+    GArray *index;
+    bool error;
+} writer;
+
+/* Events block being filled when recording, or consumed when replaying */
+static uint8_t *replay_buf;
+static size_t replay_buf_len;
+static size_t replay_buf_pos;
+static bool replay_eof;
+static bool replay_read_failed;
+
+static void replay_write_record(ReplayRecord *rec)
+{
+    uLongf csize = compressBound(rec->size);
+    uint8_t *buf = g_malloc(REPLAY_RECORD_HEADER_SIZE + csize);
+
+    if (compress2(buf + REPLAY_RECORD_HEADER_SIZE, &csize,
+                  rec->data, rec->size, Z_BEST_SPEED) != Z_OK) {
+        error_report("replay: could not compress the log");
+        writer.error = true;
+        g_free(buf);
+        return;
+    }
+    buf[0] = rec->type;
+    stq_be_p(buf + 1, rec->size);
+    stq_be_p(buf + 1 + sizeof(uint64_t), csize);
+
+    /* A snapshot that failed half way has no last chunk, and is not
+       indexed */
+    if (rec->type == REPLAY_RECORD_SNAPSHOT) {
+        writer.snapshot_offset = writer.offset;
+    }
+    if (rec->last) {
+        ReplaySnapshotEntry entry = {
+            .step = rec->step,
+            .offset = writer.snapshot_offset,
+            .events_offset = writer.offset + REPLAY_RECORD_HEADER_SIZE + csize,
+        };
+        g_array_append_val(writer.index, entry);
+    }
+
+    if (fwrite(buf, 1, REPLAY_RECORD_HEADER_SIZE + csize, replay_file)
+        != REPLAY_RECORD_HEADER_SIZE + csize && !writer.error) {
+        error_report("replay: could not write the log: %s", strerror(errno));
+        writer.error = true;
+    }
+    writer.offset += REPLAY_RECORD_HEADER_SIZE + csize;
+    g_free(buf);
+}
+
+static void *replay_writer_thread(void *opaque)
+{
+    ReplayRecord *rec;
+
+    qemu_mutex_lock(&writer.lock);
+    for (;;) {
+        while (QSIMPLEQ_EMPTY(&writer.queue) && !writer.exiting) {
+            qemu_cond_wait(&writer.cond, &writer.lock);
+        }
+        rec = QSIMPLEQ_FIRST(&writer.queue);
+        if (!rec) {
+            break;
+        }
+        QSIMPLEQ_REMOVE_HEAD(&writer.queue, next);
+        writer.queued--;
+        qemu_cond_signal(&writer.space_cond);
+        qemu_mutex_unlock(&writer.lock);
+
+        replay_write_record(rec);
+        g_free(rec->data);
+        g_free(rec);
+
+        qemu_mutex_lock(&writer.lock);
+    }
+    qemu_mutex_unlock(&writer.lock);
+    return NULL;
+}
+
+/* Hands DATA, which is g_malloc'ed, over to the writer thread. */
+static void replay_queue_record(uint8_t type, uint8_t *data, size_t size,
+                                uint64_t step, bool last)
+{
+    ReplayRecord *rec = g_new0(ReplayRecord, 1);
+
+    rec->type = type;
+    rec->data = data;
+    rec->size = size;
+    rec->step = step;
+    rec->last = last;
+
+    qemu_mutex_lock(&writer.lock);
+    while (writer.queued >= REPLAY_WRITER_QUEUE_MAX) {
+        qemu_cond_wait(&writer.space_cond, &writer.lock);
+    }
+    QSIMPLEQ_INSERT_TAIL(&writer.queue, rec, next);
+    writer.queued++;
+    qemu_cond_signal(&writer.cond);
+    qemu_mutex_unlock(&writer.lock);
+}
+
+/* Queues the events block being filled.  Called with the mutex held. */
+static void replay_flush_block(void)
+{
+    if (replay_buf_len) {
+        replay_queue_record(REPLAY_RECORD_EVENTS, replay_buf, replay_buf_len,
+                            0, false);
+        replay_buf = g_malloc(REPLAY_BLOCK_SIZE);
+        replay_buf_len = 0;
+    }
+}
+
+void replay_writer_start(uint64_t offset)
+{
+    qemu_mutex_init(&writer.lock);
+    qemu_cond_init(&writer.cond);
+    qemu_cond_init(&writer.space_cond);
+    QSIMPLEQ_INIT(&writer.queue);
+    writer.offset = offset;
+    writer.index = g_array_new(false, false, sizeof(ReplaySnapshotEntry));
+    replay_buf = g_malloc(REPLAY_BLOCK_SIZE);
+    replay_buf_len = 0;
+
+    writer.running = true;
+    qemu_thread_create(&writer.thread, "replay-writer", replay_writer_thread,
+                       NULL, QEMU_THREAD_JOINABLE);
+}
+
+uint64_t replay_writer_stop(void)
+{
+    ReplayRecord rec = { .type = REPLAY_RECORD_INDEX };
+    uint64_t index_offset;
+    uint8_t *p;
+    int i;
+
+    if (!writer.running) {
+        return 0;
+    }
+    replay_flush_block();
+    qemu_mutex_lock(&writer.lock);
+    writer.exiting = true;
+    qemu_cond_signal(&writer.cond);
+    qemu_mutex_unlock(&writer.lock);
+    qemu_thread_join(&writer.thread);
+    writer.running = false;
+
+    /* The snapshot index goes last, the file header points to it */
+    rec.size = writer.index->len * 3 * sizeof(uint64_t);
+    rec.data = p = g_malloc(rec.size + 1);
+    for (i = 0; i < writer.index->len; i++) {
+        ReplaySnapshotEntry *entry =
+            &g_array_index(writer.index, ReplaySnapshotEntry, i);
+
+        stq_be_p(p, entry->step);
+        stq_be_p(p + 8, entry->offset);
+        stq_be_p(p + 16, entry->events_offset);
+        p += 3 * sizeof(uint64_t);
+    }
+    index_offset = writer.offset;
+    replay_write_record(&rec);
+    g_free(rec.data);
+
+    g_array_free(writer.index, true);
+    g_free(replay_buf);
+    replay_buf = NULL;
+    qemu_cond_destroy(&writer.space_cond);
+    qemu_cond_destroy(&writer.cond);
+    qemu_mutex_destroy(&writer.lock);
+    return index_offset;
+}
+
+void replay_write_snapshot(uint8_t *data, size_t size, uint64_t step,
+                           bool first, bool last)
+{
+    uint8_t type = first ? REPLAY_RECORD_SNAPSHOT : REPLAY_RECORD_SNAPSHOT_DATA;
+
+    if (last) {
+        replay_mutex_lock();
+        /* Replay restarts from the events that follow the snapshot */
+        replay_flush_block();
+        replay_queue_record(type, data, size, step, true);
+        replay_mutex_unlock();
+    } else {
+        replay_queue_record(type, data, size, step, false);
+    }
+}
+
+uint8_t *replay_read_record(uint8_t type, size_t *size)
+{
+    uint8_t header[REPLAY_RECORD_HEADER_SIZE];
+    uint8_t *cbuf, *data;
+    uint64_t size64, csize;
+    uLongf len;
+
+    for (;;) {
+        if (fread(header, 1, sizeof(header), replay_file) != sizeof(header)) {
+            return NULL;
+        }
+        csize = ldq_be_p(header + 1 + sizeof(uint64_t));
+        if (header[0] == type) {
+            break;
+        }
+        /* The index marks the end of the events, and a new snapshot the
+           end of the previous one */
+        if (header[0] == REPLAY_RECORD_INDEX ||
+            (header[0] == REPLAY_RECORD_SNAPSHOT &&
+             type == REPLAY_RECORD_SNAPSHOT_DATA) ||
+            fseek(replay_file, csize, SEEK_CUR) < 0) {
+            return NULL;
+        }
+    }
+
+    size64 = ldq_be_p(header + 1);
+    len = size64;
+    if (len != size64 || (size_t)csize != csize) {
+        replay_read_failed = true;
+        return NULL;
+    }
+    cbuf = g_malloc(csize);
+    data = g_malloc(len + 1);
+    if (fread(cbuf, 1, csize, replay_file) != csize ||
+        uncompress(data, &len, cbuf, csize) != Z_OK ||
+        len != size64) {
+        replay_read_failed = true;
+        g_free(cbuf);
+        g_free(data);
+        return NULL;
+    }
+    g_free(cbuf);
+    *size = len;
+    return data;
+}
+
+void replay_seek_events(uint64_t offset)
+{
+    g_free(replay_buf);
+    replay_buf = NULL;
+    replay_buf_len = replay_buf_pos = 0;
+    replay_eof = false;
+    if (fseek(replay_file, offset, SEEK_SET) < 0) {
+        replay_read_failed = true;
+    }
+    replay_data_kind = -1;
+    replay_has_unread_data = 0;
+    replay_state.instructions_count = 0;
+    replay_fetch_data_kind();
+}
+
+/* Reads the next events block.  Returns false at the end of the log. */
+static bool replay_next_block(void)
+{
+    g_free(replay_buf);
+    replay_buf = NULL;
+    replay_buf_len = replay_buf_pos = 0;
+    if (!replay_eof) {
+        replay_buf = replay_read_record(REPLAY_RECORD_EVENTS, &replay_buf_len);
+        replay_eof = !replay_buf;
+    }
+    return !replay_eof;
+}
+
 void replay_put_byte(uint8_t byte)
 {
     if (replay_file) {
-        putc(byte, replay_file);
+        if (replay_buf_len == REPLAY_BLOCK_SIZE) {
+            replay_flush_block();
+        }
+        replay_buf[replay_buf_len++] = byte;
     }
 }
 
@@ -65,7 +369,18 @@ void replay_put_array(const uint8_t *buf, size_t size)
 {
     if (replay_file) {
         replay_put_dword(size);
-        fwrite(buf, 1, size, replay_file);
+        while (size) {
+            size_t len;
+
+            if (replay_buf_len == REPLAY_BLOCK_SIZE) {
+                replay_flush_block();
+            }
+            len = MIN(size, REPLAY_BLOCK_SIZE - replay_buf_len);
+            memcpy(replay_buf + replay_buf_len, buf, len);
+            replay_buf_len += len;
+            buf += len;
+            size -= len;
+        }
     }
 }
 
@@ -73,7 +388,9 @@ uint8_t replay_get_byte(void)
 {
     uint8_t byte = 0;
     if (replay_file) {
-        byte = getc(replay_file);
+        if (replay_buf_pos < replay_buf_len || replay_next_block()) {
+            byte = replay_buf[replay_buf_pos++];
+        }
     }
     return byte;
 }
@@ -111,13 +428,28 @@ int64_t replay_get_qword(void)
     return qword;
 }
 
+static void replay_get_bytes(uint8_t *buf, size_t size)
+{
+    while (size) {
+        size_t len;
+
+        if (replay_buf_pos == replay_buf_len && !replay_next_block()) {
+            error_report("replay read error");
+            return;
+        }
+        len = MIN(size, replay_buf_len - replay_buf_pos);
+        memcpy(buf, replay_buf + replay_buf_pos, len);
+        replay_buf_pos += len;
+        buf += len;
+        size -= len;
+    }
+}
+
 void replay_get_array(uint8_t *buf, size_t *size)
 {
     if (replay_file) {
         *size = replay_get_dword();
-        if (fread(buf, 1, *size, replay_file) != *size) {
-            error_report("replay read error");
-        }
+        replay_get_bytes(buf, *size);
     }
 }
 
@@ -126,23 +458,21 @@ void replay_get_array_alloc(uint8_t **buf, size_t *size)
     if (replay_file) {
         *size = replay_get_dword();
         *buf = g_malloc(*size);
-        if (fread(*buf, 1, *size, replay_file) != *size) {
-            error_report("replay read error");
-        }
+        replay_get_bytes(*buf, *size);
     }
 }
 
 void replay_check_error(void)
 {
     if (replay_file) {
-        if (feof(replay_file)) {
-            error_report("replay file is over");
-            qemu_system_vmstop_request_prepare();
-            qemu_system_vmstop_request(RUN_STATE_PAUSED);
-        } else if (ferror(replay_file)) {
+        if (replay_read_failed || ferror(replay_file)) {
             error_report("replay file is over or something goes wrong");
             qemu_system_vmstop_request_prepare();
             qemu_system_vmstop_request(RUN_STATE_INTERNAL_ERROR);
+        } else if (replay_eof) {
+            error_report("replay file is over");
+            qemu_system_vmstop_request_prepare();
+            qemu_system_vmstop_request(RUN_STATE_PAUSED);
         }
     }
 }
@@ -70,6 +70,30 @@ extern unsigned int replay_data_kind;
 /* File for replay writing */
 extern FILE *replay_file;
 
+/* Types of the records of the log file */
+enum ReplayRecordType {
+    /* a block of the event stream */
+    REPLAY_RECORD_EVENTS,
+    /* the first chunk of a snapshot of the VM, see replay-snapshot.c */
+    REPLAY_RECORD_SNAPSHOT,
+    /* the next chunks of the snapshot */
+    REPLAY_RECORD_SNAPSHOT_DATA,
+    /* the table of the snapshots, last in the file */
+    REPLAY_RECORD_INDEX,
+};
+
+typedef struct ReplaySnapshotEntry {
+    /*! Step the snapshot was taken at. */
+    uint64_t step;
+    /*! Offset of the first record of the snapshot. */
+    uint64_t offset;
+    /*! Offset of the first events record after the snapshot. */
+    uint64_t events_offset;
+} ReplaySnapshotEntry;
+
+/* File offset of the snapshot index, when replaying */
+extern uint64_t replay_index_offset;
+
 void replay_put_byte(uint8_t byte);
 void replay_put_event(uint8_t event);
 void replay_put_word(uint16_t word);
@@ -84,6 +108,24 @@ int64_t replay_get_qword(void);
 void replay_get_array(uint8_t *buf, size_t *size);
 void replay_get_array_alloc(uint8_t **buf, size_t *size);
 
+/*! Starts the thread that writes the log from file offset OFFSET. */
+void replay_writer_start(uint64_t offset);
+/*! Writes the pending events and the snapshot index, and stops the
+    writer thread.  Returns the file offset of the index. */
+uint64_t replay_writer_stop(void);
+/*! Queues a chunk of the snapshot taken at STEP, FIRST and LAST saying
+    which one it is.  The LAST chunk goes after the events that came before
+    the snapshot or while it was saved, and adds it to the index.  DATA is
+    freed by the writer. */
+void replay_write_snapshot(uint8_t *data, size_t size, uint64_t step,
+                           bool first, bool last);
+/*! Reads the next record of type TYPE, skipping the other ones.
+    Returns NULL at the end of the events, at the end of the snapshot
+    for REPLAY_RECORD_SNAPSHOT_DATA, or on error. */
+uint8_t *replay_read_record(uint8_t type, size_t *size);
+/*! Continues reading the events from file offset OFFSET. */
+void replay_seek_events(uint64_t offset);
+
 /* Mutex functions for protecting replay log file */
 
 void replay_mutex_init(void);
@@ -135,6 +177,16 @@ void replay_read_events(int checkpoint);
 void replay_add_event(ReplayAsyncEventKind event_kind, void *opaque,
                       void *opaque2, uint64_t id);
 
+/* Snapshots */
+
+/*! Saves a snapshot into the log if one is due.  Called when recording,
+    with the iothread lock held and the vCPUs out of guest code. */
+void replay_save_snapshot(void);
+/*! Reads the snapshot options of -icount. */
+void replay_snapshot_configure(QemuOpts *opts);
+/*! Prepares the VM for taking snapshots when recording. */
+void replay_snapshot_start(void);
+
 /* Input events */
 
 /*! Saves input event to the log */
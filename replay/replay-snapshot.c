@@ -0,0 +1,306 @@
+/*
+ * replay-snapshot.c
+ *
+ * Copyright (c) 2016 agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu-common.h"
+#include "sysemu/replay.h"
+#include "replay-internal.h"
+#include "qemu/bswap.h"
+#include "sysemu/sysemu.h"
+#include "exec/memory.h"
+#include "migration/migration.h"
+#include "migration/qemu-file.h"
+#include "qemu/error-report.h"
+
+/* A snapshot holds the RAM pages written since the previous snapshot (all
+   of RAM for the first one), the device state and the replay state.  To
+   load snapshot N, the RAM of snapshots 0 to N is applied in order, then
+   the devices of N.  Disk images are not part of the snapshots.
+
+   The snapshot is streamed to and from the log in chunks of
+   REPLAY_SNAPSHOT_CHUNK_SIZE, so that RAM is never buffered as a whole. */
+#define REPLAY_SNAPSHOT_CHUNK_SIZE  (1024 * 1024)
+
+/* Steps between two snapshots when recording, 0 to take none */
+static uint64_t replay_snapshot_period;
+/* Step to replay from, when replaying */
+static uint64_t replay_snapshot_target;
+static uint64_t replay_next_snapshot;
+static bool replay_snapshot_taken;
+static Error *replay_snapshot_blocker;
+
+/* The chunk of the snapshot being written or read */
+typedef struct ReplaySnapshotFile {
+    uint8_t *buf;
+    size_t len;
+    /* Read position, when loading */
+    size_t pos;
+    uint64_t step;
+    /* Whether BUF holds, or will hold, the first chunk */
+    bool first;
+} ReplaySnapshotFile;
+
+static ssize_t replay_snapshot_writev_buffer(void *opaque, struct iovec *iov,
+                                             int iovcnt, int64_t pos)
+{
+    ReplaySnapshotFile *s = opaque;
+    ssize_t done = 0;
+    int i;
+
+    for (i = 0; i < iovcnt; i++) {
+        const uint8_t *p = iov[i].iov_base;
+        size_t size = iov[i].iov_len;
+
+        while (size) {
+            size_t len;
+
+            if (s->len == REPLAY_SNAPSHOT_CHUNK_SIZE) {
+                replay_write_snapshot(s->buf, s->len, s->step, s->first,
+                                      false);
+                s->buf = g_malloc(REPLAY_SNAPSHOT_CHUNK_SIZE);
+                s->len = 0;
+                s->first = false;
+            }
+            len = MIN(size, REPLAY_SNAPSHOT_CHUNK_SIZE - s->len);
+            memcpy(s->buf + s->len, p, len);
+            s->len += len;
+            p += len;
+            size -= len;
+            done += len;
+        }
+    }
+    return done;
+}
+
+static ssize_t replay_snapshot_get_buffer(void *opaque, uint8_t *buf,
+                                          int64_t pos, size_t size)
+{
+    ReplaySnapshotFile *s = opaque;
+    size_t len;
+
+    if (s->pos == s->len) {
+        g_free(s->buf);
+        s->buf = replay_read_record(s->first ? REPLAY_RECORD_SNAPSHOT
+                                             : REPLAY_RECORD_SNAPSHOT_DATA,
+                                    &s->len);
+        s->pos = 0;
+        s->first = false;
+        if (!s->buf) {
+            s->len = 0;
+            return 0;
+        }
+    }
+    len = MIN(size, s->len - s->pos);
+    memcpy(buf, s->buf + s->pos, len);
+    s->pos += len;
+    return len;
+}
+
+static int replay_snapshot_close(void *opaque)
+{
+    ReplaySnapshotFile *s = opaque;
+
+    g_free(s->buf);
+    s->buf = NULL;
+    return 0;
+}
+
+static const QEMUFileOps replay_snapshot_write_ops = {
+    .writev_buffer = replay_snapshot_writev_buffer,
+    .close = replay_snapshot_close,
+};
+
+static const QEMUFileOps replay_snapshot_read_ops = {
+    .get_buffer = replay_snapshot_get_buffer,
+    .close = replay_snapshot_close,
+};
+
+void replay_snapshot_configure(QemuOpts *opts)
+{
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        replay_snapshot_period = qemu_opt_get_number(opts, "rrperiod", 0);
+    } else if (replay_mode == REPLAY_MODE_PLAY) {
+        replay_snapshot_target = qemu_opt_get_number(opts, "rrstart", 0);
+    }
+}
+
+void replay_snapshot_start(void)
+{
+    Error *err = NULL;
+
+    if (!replay_snapshot_period) {
+        return;
+    }
+    if (qemu_savevm_state_blocked(&err)) {
+        error_reportf_err(err, "Record/replay snapshots: ");
+        exit(1);
+    }
+
+    /* The migration bitmap tracks the pages of the next RAM diff, which
+       a migration would clear.  */
+    error_setg(&replay_snapshot_blocker,
+               "Recording with rrperiod does not support migration");
+    migrate_add_blocker(replay_snapshot_blocker);
+    memory_global_dirty_log_start();
+    replay_next_snapshot = replay_snapshot_period;
+}
+
+void replay_save_snapshot(void)
+{
+    ReplaySnapshotFile s;
+    QEMUFile *f;
+    int i, ret;
+
+    if (!replay_snapshot_period ||
+        replay_state.current_step < replay_next_snapshot) {
+        return;
+    }
+    /* Queued events would be lost when loading the snapshot */
+    if (replay_has_events()) {
+        return;
+    }
+
+    s = (ReplaySnapshotFile) {
+        .buf = g_malloc(REPLAY_SNAPSHOT_CHUNK_SIZE),
+        .step = replay_state.current_step,
+        .first = true,
+    };
+    f = qemu_fopen_ops(&s, &replay_snapshot_write_ops);
+    ram_save_dirty_pages(f, !replay_snapshot_taken);
+    ret = qemu_save_device_state(f);
+
+    /* After the devices, whose state may depend on clock reads */
+    replay_mutex_lock();
+    qemu_put_be64(f, replay_state.current_step);
+    for (i = 0; i < REPLAY_CLOCK_COUNT; i++) {
+        qemu_put_sbe64(f, replay_state.cached_clock[i]);
+    }
+    replay_mutex_unlock();
+    qemu_fflush(f);
+    if (ret == 0) {
+        ret = qemu_file_get_error(f);
+    }
+    if (ret == 0) {
+        replay_write_snapshot(s.buf, s.len, s.step, s.first, true);
+        s.buf = NULL;
+    }
+    qemu_fclose(f);
+
+    if (ret < 0) {
+        error_report("Record/replay: error %d while saving a snapshot, "
+                     "no more snapshots will be taken", ret);
+        replay_snapshot_period = 0;
+        return;
+    }
+    replay_snapshot_taken = true;
+    replay_next_snapshot = replay_state.current_step + replay_snapshot_period;
+}
+
+static ReplaySnapshotEntry *replay_read_index(int *nb_entries)
+{
+    ReplaySnapshotEntry *entries;
+    uint8_t *data;
+    size_t size;
+    int i;
+
+    if (!replay_index_offset ||
+        fseek(replay_file, replay_index_offset, SEEK_SET) < 0) {
+        return NULL;
+    }
+    data = replay_read_record(REPLAY_RECORD_INDEX, &size);
+    if (!data) {
+        return NULL;
+    }
+    *nb_entries = size / (3 * sizeof(uint64_t));
+    entries = g_new(ReplaySnapshotEntry, *nb_entries);
+    for (i = 0; i < *nb_entries; i++) {
+        uint8_t *p = data + i * 3 * sizeof(uint64_t);
+
+        entries[i].step = ldq_be_p(p);
+        entries[i].offset = ldq_be_p(p + 8);
+        entries[i].events_offset = ldq_be_p(p + 16);
+    }
+    g_free(data);
+    return entries;
+}
+
+/* Loads the RAM of snapshot ENTRY, and its devices if LAST. */
+static int replay_load_snapshot_entry(ReplaySnapshotEntry *entry, bool last)
+{
+    ReplaySnapshotFile s = { .first = true };
+    QEMUFile *f;
+    int i, ret;
+
+    if (fseek(replay_file, entry->offset, SEEK_SET) < 0) {
+        return -EIO;
+    }
+    f = qemu_fopen_ops(&s, &replay_snapshot_read_ops);
+
+    ret = ram_load_dirty_pages(f);
+    if (ret == 0 && last) {
+        ret = qemu_load_device_state(f);
+    }
+    if (ret == 0 && last) {
+        replay_state.current_step = qemu_get_be64(f);
+        for (i = 0; i < REPLAY_CLOCK_COUNT; i++) {
+            replay_state.cached_clock[i] = qemu_get_sbe64(f);
+        }
+        ret = qemu_file_get_error(f);
+    }
+    qemu_fclose(f);
+    return ret;
+}
+
+void replay_snapshot_load(void)
+{
+    ReplaySnapshotEntry *entries;
+    int nb_entries, last, i, ret;
+    long pos;
+
+    if (replay_mode != REPLAY_MODE_PLAY || !replay_snapshot_target) {
+        return;
+    }
+
+    pos = ftell(replay_file);
+
+    entries = replay_read_index(&nb_entries);
+    if (!entries) {
+        error_report("Replay: the log has no snapshot index");
+        exit(1);
+    }
+    for (last = -1; last + 1 < nb_entries; last++) {
+        if (entries[last + 1].step > replay_snapshot_target) {
+            break;
+        }
+    }
+    if (last < 0) {
+        /* Nothing to skip, replay from the beginning */
+        fseek(replay_file, pos, SEEK_SET);
+        g_free(entries);
+        return;
+    }
+
+    for (i = 0; i <= last; i++) {
+        ret = replay_load_snapshot_entry(&entries[i], i == last);
+        if (ret < 0) {
+            error_report("Replay: error %d while loading the snapshot at "
+                         "step %" PRIu64, ret, entries[i].step);
+            exit(1);
+        }
+    }
+
+    replay_clear_events();
+    replay_mutex_lock();
+    replay_init_events();
+    replay_seek_events(entries[last].events_offset);
+    replay_mutex_unlock();
+    g_free(entries);
+}
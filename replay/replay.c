@@ -14,6 +14,7 @@
 #include "qemu-common.h"
 #include "sysemu/replay.h"
 #include "replay-internal.h"
+#include "qemu/bswap.h"
 #include "qemu/timer.h"
 #include "qemu/main-loop.h"
 #include "sysemu/sysemu.h"
@@ -21,8 +22,8 @@
 
 /* Current version of the replay mechanism.
    Increase it when file format changes. */
-#define REPLAY_VERSION              0xe02004
-/* Size of replay log header */
+#define REPLAY_VERSION              0xe02005
+/* Size of replay log header: the version and the offset of the index */
 #define HEADER_SIZE                 (sizeof(uint32_t) + sizeof(uint64_t))
 
 ReplayMode replay_mode = REPLAY_MODE_NONE;
@@ -30,6 +31,7 @@ ReplayMode replay_mode = REPLAY_MODE_NONE;
 /* Name of replay file  */
 static char *replay_filename;
 ReplayState replay_state;
+uint64_t replay_index_offset;
 static GSList *replay_blockers;
 
 bool replay_next_event_is(int event)
@@ -183,6 +185,13 @@ bool replay_checkpoint(ReplayCheckpoint checkpoint)
         return true;
     }
 
+    /* Snapshots are taken just before this checkpoint, which is thus the
+       first event that replay expects after loading one */
+    if (replay_mode == REPLAY_MODE_RECORD &&
+        checkpoint == CHECKPOINT_CLOCK_VIRTUAL) {
+        replay_save_snapshot();
+    }
+
     replay_mutex_lock();
 
     if (replay_mode == REPLAY_MODE_PLAY) {
@@ -244,14 +253,16 @@ static void replay_enable(const char *fname, int mode)
     /* skip file header for RECORD and check it for PLAY */
     if (replay_mode == REPLAY_MODE_RECORD) {
         fseek(replay_file, HEADER_SIZE, SEEK_SET);
+        replay_writer_start(HEADER_SIZE);
     } else if (replay_mode == REPLAY_MODE_PLAY) {
-        unsigned int version = replay_get_dword();
-        if (version != REPLAY_VERSION) {
+        uint8_t header[HEADER_SIZE];
+
+        if (fread(header, 1, HEADER_SIZE, replay_file) != HEADER_SIZE ||
+            ldl_be_p(header) != REPLAY_VERSION) {
             fprintf(stderr, "Replay: invalid input log file version\n");
             exit(1);
         }
-        /* go to the beginning */
-        fseek(replay_file, HEADER_SIZE, SEEK_SET);
+        replay_index_offset = ldq_be_p(header + sizeof(uint32_t));
         replay_fetch_data_kind();
     }
 
@@ -292,6 +303,7 @@ void replay_configure(QemuOpts *opts)
     }
 
     replay_enable(fname, mode);
+    replay_snapshot_configure(opts);
 
 out:
     loc_pop(&loc);
@@ -312,7 +324,7 @@ void replay_start(void)
         exit(1);
     }
 
-    /* Timer for snapshotting will be set up here. */
+    replay_snapshot_start();
 
     replay_enable_events();
 }
@@ -328,12 +340,16 @@ void replay_finish(void)
     /* finalize the file */
     if (replay_file) {
         if (replay_mode == REPLAY_MODE_RECORD) {
+            uint8_t header[HEADER_SIZE];
+
             /* write end event */
             replay_put_event(EVENT_END);
+            stq_be_p(header + sizeof(uint32_t), replay_writer_stop());
 
             /* write header */
+            stl_be_p(header, REPLAY_VERSION);
             fseek(replay_file, 0, SEEK_SET);
-            replay_put_dword(REPLAY_VERSION);
+            fwrite(header, 1, HEADER_SIZE, replay_file);
         }
 
         fclose(replay_file);
@@ -0,0 +1,474 @@
+#!/usr/bin/env python
+#
+# Generate an instruction decoder from a description of the encodings
+#
+# Copyright (c) 2016 agent <agent@local>
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+# The input describes each instruction with a line giving its name and
+# its bits, most significant first:
+#
+#   %field   pos:len [pos:len ...] [!function=func]
+#       A field made of the concatenation of the given bit ranges, the
+#       first one most significant.  'pos:slen' sign-extends the range.
+#       func, if given, is a C function that transforms the value.
+#
+#   &argset  name [name ...]
+#       A structure, arg_argset, to pass the fields of an instruction.
+#
+#   @format  bits [field ...] [&argset]
+#   name     bits [field ...] [&argset] [@format]
+#       A format is a pattern that other patterns can refer to.  bits are
+#       made of '0' and '1' for fixed bits, '.' for bits that belong to a
+#       field and '-' for bits that are ignored, as well as 'name:len' or
+#       'name:slen' for the inline definition of a field.  Other fields are
+#       given as 'name=%field', '%field' or 'name=constant'.
+#
+# Lines can be continued with a backslash, and '#' starts a comment.
+#
+# For each pattern NAME, the generated decoder calls
+#   static bool trans_NAME(DisasContext *ctx, arg_argset *a);
+# which the includer must define, and which returns false if the encoding
+# is not valid after all.  The decoder tries the patterns that match in
+# the order of the input file, and returns false if none succeeded.  The
+# patterns are sorted into switch statements on the bits that they have in
+# common, so that only a few of them need to be checked for each insn.
+
+import getopt
+import re
+import sys
+
+insnwidth = 32
+insnmask = 0xffffffff
+decode_function = 'decode'
+
+fields = {}
+arguments = {}
+formats = {}
+patterns = []
+output_file = sys.stdout
+
+re_ident = r'[a-zA-Z][a-zA-Z0-9_]*'
+
+
+def error(lineno, msg):
+    if lineno:
+        sys.stderr.write('%s:%d: error: %s\n' % (input_file, lineno, msg))
+    else:
+        sys.stderr.write('error: %s\n' % msg)
+    sys.exit(1)
+
+
+def output(*args):
+    for a in args:
+        output_file.write(a)
+
+
+def str_hex(x):
+    return '0x%08x' % x
+
+
+class Field(object):
+    """A field made of bit ranges of the insn"""
+    def __init__(self, segs, func):
+        # segs is a list of (pos, len, signed), most significant first
+        self.segs = segs
+        self.func = func
+
+    def str_extract(self):
+        ret = None
+        pos = 0
+        for (p, l, signed) in reversed(self.segs):
+            if signed:
+                ext = 'sextract32(insn, %d, %d)' % (p, l)
+            else:
+                ext = 'extract32(insn, %d, %d)' % (p, l)
+            if ret is None:
+                ret = ext
+            else:
+                ret = 'deposit32(%s, %d, %d, %s)' % (ret, pos, 32 - pos, ext)
+            pos += l
+        if self.func:
+            ret = '%s(%s)' % (self.func, ret)
+        return ret
+
+    def mask(self):
+        m = 0
+        for (p, l, signed) in self.segs:
+            m |= ((1 << l) - 1) << p
+        return m
+
+
+class Const(object):
+    def __init__(self, value):
+        self.value = value
+
+    def str_extract(self):
+        return str(self.value)
+
+    def mask(self):
+        return 0
+
+
+class Arguments(object):
+    def __init__(self, name, members):
+        self.name = name
+        self.members = members
+
+    def struct_name(self):
+        return 'arg_' + self.name
+
+
+class Pattern(object):
+    def __init__(self, name, lineno, fixedmask, fixedbits, ignmask,
+                 fieldmask, fields, args, fmt):
+        self.name = name
+        self.lineno = lineno
+        self.fixedmask = fixedmask
+        self.fixedbits = fixedbits
+        self.ignmask = ignmask
+        self.fieldmask = fieldmask
+        self.fields = fields
+        self.args = args
+        self.fmt = fmt
+        self.extract_name = None
+
+    def str_bits(self):
+        s = ''
+        for i in range(insnwidth - 1, -1, -1):
+            bit = 1 << i
+            if self.fixedmask & bit:
+                s += '1' if self.fixedbits & bit else '0'
+            elif self.ignmask & bit:
+                s += '-'
+            else:
+                s += '.'
+            if i and i % 8 == 0:
+                s += ' '
+        return s
+
+
+def parse_field(lineno, name, toks):
+    """Parse %name pos:len ... [!function=func]"""
+    segs = []
+    func = None
+    for t in toks:
+        m = re.match(r'^!function=(' + re_ident + ')$', t)
+        if m:
+            func = m.group(1)
+            continue
+        m = re.match(r'^(\d+):(s?)(\d+)$', t)
+        if not m:
+            error(lineno, 'invalid field token "%s"' % t)
+        p = int(m.group(1))
+        l = int(m.group(3))
+        if l == 0 or p + l > insnwidth:
+            error(lineno, 'field %s out of range' % name)
+        segs.append((p, l, m.group(2) == 's'))
+    if not segs:
+        error(lineno, 'field %s has no bits' % name)
+    if name in fields:
+        error(lineno, 'duplicate field %s' % name)
+    fields[name] = Field(segs, func)
+
+
+def parse_arguments(lineno, name, toks):
+    """Parse &name member ..."""
+    for t in toks:
+        if not re.match('^' + re_ident + '$', t):
+            error(lineno, 'invalid argument set member "%s"' % t)
+        if toks.count(t) > 1:
+            error(lineno, 'duplicate member %s' % t)
+    if name in arguments:
+        error(lineno, 'duplicate argument set %s' % name)
+    arguments[name] = Arguments(name, toks)
+
+
+def parse_generic(lineno, is_format, name, toks):
+    """Parse a format or a pattern"""
+    fixedmask = 0
+    fixedbits = 0
+    ignmask = 0
+    width = 0
+    flds = {}
+    args = None
+    fmt = None
+
+    for t in toks:
+        if t[0] == '&':
+            if t[1:] not in arguments:
+                error(lineno, 'undefined argument set %s' % t)
+            if args:
+                error(lineno, 'multiple argument sets')
+            args = arguments[t[1:]]
+            continue
+        if t[0] == '@':
+            if is_format:
+                error(lineno, 'format referencing a format')
+            if t[1:] not in formats:
+                error(lineno, 'undefined format %s' % t)
+            if fmt:
+                error(lineno, 'multiple formats')
+            fmt = formats[t[1:]]
+            continue
+
+        # field references
+        m = re.match('^(' + re_ident + ')=%(' + re_ident + ')$', t)
+        if not m:
+            m = re.match('^%((' + re_ident + '))$', t)
+        if m:
+            if m.group(2) not in fields:
+                error(lineno, 'undefined field %%%s' % m.group(2))
+            flds[m.group(1)] = fields[m.group(2)]
+            continue
+        m = re.match('^(' + re_ident + ')=(-?\\d+)$', t)
+        if m:
+            flds[m.group(1)] = Const(int(m.group(2)))
+            continue
+
+        # bits
+        m = re.match('^(' + re_ident + '):(s?)(\\d+)$', t)
+        if m:
+            l = int(m.group(3))
+            width += l
+            if width > insnwidth:
+                error(lineno, 'too many bits')
+            f = Field([(insnwidth - width, l, m.group(2) == 's')], None)
+            flds[m.group(1)] = f
+            continue
+        if re.match('^[01.-]+$', t):
+            for c in t:
+                width += 1
+                if width > insnwidth:
+                    error(lineno, 'too many bits')
+                bit = 1 << (insnwidth - width)
+                if c == '0' or c == '1':
+                    fixedmask |= bit
+                    if c == '1':
+                        fixedbits |= bit
+                elif c == '-':
+                    ignmask |= bit
+            continue
+        error(lineno, 'invalid token "%s"' % t)
+
+    if width != insnwidth:
+        error(lineno, '%s has %d bits instead of %d' % (name, width, insnwidth))
+
+    if fmt:
+        if fixedmask & fmt.fixedmask & (fixedbits ^ fmt.fixedbits):
+            error(lineno, 'fixed bits of %s conflict with its format' % name)
+        fixedbits |= fmt.fixedbits & ~fixedmask
+        fixedmask |= fmt.fixedmask
+        ignmask |= fmt.ignmask
+        merged = dict(fmt.fields)
+        merged.update(flds)
+        flds = merged
+        if not args:
+            args = fmt.args
+
+    fieldmask = 0
+    for f in flds.values():
+        fieldmask |= f.mask()
+    if fieldmask & fixedmask:
+        error(lineno, 'fields of %s overlap its fixed bits' % name)
+
+    if not args:
+        # An implicit argument set, named after the format or pattern
+        members = sorted(flds.keys())
+        args = Arguments(name, members)
+        if name in arguments:
+            error(lineno, 'implicit argument set %s already defined' % name)
+        arguments[name] = args
+    for n in flds:
+        if n not in args.members:
+            error(lineno, '%s is not in argument set %s' % (n, args.name))
+
+    p = Pattern(name, lineno, fixedmask, fixedbits, ignmask, fieldmask,
+                flds, args, fmt)
+    if is_format:
+        if name in formats:
+            error(lineno, 'duplicate format %s' % name)
+        formats[name] = p
+    else:
+        patterns.append(p)
+
+
+def parse_file(f):
+    lineno = 0
+    toks = []
+    for line in f:
+        lineno += 1
+        line = line.split('#', 1)[0]
+        cont = line.rstrip().endswith('\\')
+        if cont:
+            line = line.rstrip()[:-1]
+        if not toks:
+            start = lineno
+        toks += line.split()
+        if cont or not toks:
+            continue
+
+        name = toks[0]
+        rest = toks[1:]
+        toks = []
+        if name[0] == '%':
+            parse_field(start, name[1:], rest)
+        elif name[0] == '&':
+            parse_arguments(start, name[1:], rest)
+        elif name[0] == '@':
+            parse_generic(start, True, name[1:], rest)
+        elif re.match('^' + re_ident + '$', name):
+            parse_generic(start, False, name, rest)
+        else:
+            error(start, 'invalid line start "%s"' % name)
+    if toks:
+        error(lineno, 'unterminated continuation line')
+
+
+def output_extract(p):
+    """Generate the extraction function of P, shared when possible"""
+    body = ''
+    for n in sorted(p.fields.keys()):
+        body += '    a->%s = %s;\n' % (n, p.fields[n].str_extract())
+    key = (p.args.name, body)
+    if key in extract_functions:
+        p.extract_name = extract_functions[key]
+        return
+    if p.fmt:
+        base = p.fmt.name
+    else:
+        base = p.name
+    name = '%s_extract_%s' % (decode_function, base)
+    if name in extract_functions.values():
+        name = '%s_extract_%s' % (decode_function, p.name)
+    extract_functions[key] = name
+    p.extract_name = name
+    output('static void ', name, '(', p.args.struct_name(),
+           ' *a, uint32_t insn)\n{\n', body, '}\n\n')
+
+
+extract_functions = {}
+
+
+def output_call(p, ind):
+    arg = 'u.f_' + p.args.name
+    output(ind, '/* ', p.str_bits(), ' */\n')
+    output(ind, p.extract_name, '(&', arg, ', insn);\n')
+    output(ind, 'if (trans_', p.name, '(ctx, &', arg, ')) {\n')
+    output(ind, '    return true;\n')
+    output(ind, '}\n')
+
+
+def output_tree(pats, tested, ind):
+    common = insnmask & ~tested
+    for p in pats:
+        common &= p.fixedmask
+
+    if len(pats) == 1 or common == 0:
+        # Nothing left to switch on: try the patterns in order
+        for p in pats:
+            remaining = p.fixedmask & ~tested
+            if remaining:
+                output(ind, 'if ((insn & ', str_hex(remaining), ') == ',
+                       str_hex(p.fixedbits & remaining), ') {\n')
+                output_call(p, ind + '    ')
+                output(ind, '}\n')
+            else:
+                output_call(p, ind)
+        return
+
+    # Sort the patterns by the value of the common bits, keeping the
+    # order of the file within each bucket
+    buckets = []
+    by_value = {}
+    for p in pats:
+        v = p.fixedbits & common
+        if v not in by_value:
+            by_value[v] = []
+            buckets.append(v)
+        by_value[v].append(p)
+
+    if len(buckets) == 1:
+        v = buckets[0]
+        output(ind, 'if ((insn & ', str_hex(common), ') == ', str_hex(v),
+               ') {\n')
+        output_tree(by_value[v], tested | common, ind + '    ')
+        output(ind, '}\n')
+        return
+
+    output(ind, 'switch (insn & ', str_hex(common), ') {\n')
+    for v in buckets:
+        output(ind, 'case ', str_hex(v), ':\n')
+        output_tree(by_value[v], tested | common, ind + '    ')
+        output(ind, '    break;\n')
+    output(ind, '}\n')
+
+
+def main():
+    global input_file, output_file, decode_function, insnwidth, insnmask
+
+    try:
+        opts, args = getopt.getopt(sys.argv[1:], 'o:w:',
+                                   ['output=', 'decode=', 'insnwidth='])
+    except getopt.GetoptError as e:
+        error(0, str(e))
+    out = None
+    for o, a in opts:
+        if o in ('-o', '--output'):
+            out = a
+        elif o == '--decode':
+            decode_function = a
+        elif o in ('-w', '--insnwidth'):
+            insnwidth = int(a)
+            if insnwidth not in (16, 32):
+                error(0, 'the insn width must be 16 or 32')
+            insnmask = (1 << insnwidth) - 1
+    if len(args) != 1:
+        error(0, 'usage: decodetree.py [-o output] [--decode name] '
+              '[--insnwidth 16|32] input')
+
+    input_file = args[0]
+    f = open(input_file, 'r')
+    parse_file(f)
+    f.close()
+
+    if out:
+        output_file = open(out, 'w')
+
+    output('/* This file is autogenerated by scripts/decodetree.py.  */\n\n')
+
+    used = []
+    for p in patterns:
+        if p.args not in used:
+            used.append(p.args)
+    for a in used:
+        output('typedef struct {\n')
+        for m in a.members:
+            output('    int ', m, ';\n')
+        output('} ', a.struct_name(), ';\n\n')
+
+    for p in patterns:
+        output('static bool trans_', p.name, '(DisasContext *ctx, ',
+               p.args.struct_name(), ' *a);\n')
+    output('\n')
+
+    for p in patterns:
+        output_extract(p)
+
+    output('static bool ', decode_function,
+           '(DisasContext *ctx, uint32_t insn)\n{\n')
+    output('    union {\n')
+    for a in used:
+        output('        ', a.struct_name(), ' f_', a.name, ';\n')
+    output('    } u;\n\n')
+    output_tree(patterns, 0, '    ')
+    output('    return false;\n}\n')
+
+    if out:
+        output_file.close()
+
+
+if __name__ == '__main__':
+    main()
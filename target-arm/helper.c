@@ -8144,6 +8144,106 @@ hwaddr arm_cpu_get_phys_page_attrs_debug(CPUState *cs, vaddr addr,
     return phys_addr;
 }
 
+/* Read a frame word, which must be in RAM: the sampling profiler must not
+ * touch device registers, whatever the guest has left in its frame pointer.
+ */
+static bool arm_read_frame_word(CPUState *cs, vaddr addr, int size,
+                                uint64_t *val)
+{
+    CPUARMState *env = &ARM_CPU(cs)->env;
+    MemTxAttrs attrs;
+    MemoryRegion *mr;
+    hwaddr phys_addr, xlat, len = size;
+    uint8_t buf[8];
+    bool ok;
+
+    if (addr & (size - 1)) {
+        return false;
+    }
+    phys_addr = arm_cpu_get_phys_page_attrs_debug(cs, addr & TARGET_PAGE_MASK,
+                                                  &attrs);
+    if (phys_addr == -1) {
+        return false;
+    }
+    phys_addr += addr & ~TARGET_PAGE_MASK;
+
+    rcu_read_lock();
+    mr = address_space_translate(cpu_get_address_space(cs,
+                                         cpu_asidx_from_attrs(cs, attrs)),
+                                 phys_addr, &xlat, &len, false);
+    ok = memory_region_is_ram(mr) && len >= size;
+    if (ok) {
+        memcpy(buf, qemu_map_ram_ptr(mr->ram_block, xlat), size);
+    }
+    rcu_read_unlock();
+    if (!ok) {
+        return false;
+    }
+
+    if (size == 8) {
+        *val = arm_cpu_data_is_big_endian(env) ? ldq_be_p(buf) : ldq_le_p(buf);
+    } else {
+        *val = arm_cpu_data_is_big_endian(env) ? ldl_be_p(buf) : ldl_le_p(buf);
+    }
+    return true;
+}
+
+/* Follow the frame records built with -fno-omit-frame-pointer.  A record
+ * is the caller's frame pointer followed by the return address.  In
+ * AArch64 (x29) and Thumb (r7) code the frame pointer points to the
+ * record.  In ARM code GCC points r11 at the saved return address, so the
+ * record starts 4 bytes below; clang's ARM-mode layout is not handled.
+ * The instruction set of the current function is assumed for the whole
+ * stack.  The link register comes first, for leaf functions that have no
+ * frame.  Exception frames are not followed.
+ */
+int arm_cpu_get_return_addresses(CPUState *cs, vaddr *addrs, int max)
+{
+    CPUARMState *env = &ARM_CPU(cs)->env;
+    int size = is_a64(env) ? 8 : 4;
+    int bias = 0;
+    uint64_t fp, lr, next_fp, ret;
+    int n = 0;
+
+    if (is_a64(env)) {
+        fp = env->xregs[29];
+        lr = env->xregs[30];
+    } else {
+        fp = env->regs[env->thumb ? 7 : 11];
+        lr = env->regs[14] & ~1;
+        if (arm_feature(env, ARM_FEATURE_M) && lr >= 0xffffff00) {
+            /* EXC_RETURN: the caller is in the exception frame */
+            return 0;
+        }
+        if (!env->thumb) {
+            bias = 4;
+        }
+    }
+    if (lr && n < max) {
+        addrs[n++] = lr;
+    }
+
+    while (fp > bias && n < max) {
+        if (!arm_read_frame_word(cs, fp - bias, size, &next_fp) ||
+            !arm_read_frame_word(cs, fp - bias + size, size, &ret) || !ret) {
+            break;
+        }
+        if (!is_a64(env)) {
+            ret &= ~1;
+        }
+        /* The first record is usually the one that saved the LR */
+        if (n != 1 || ret != addrs[0]) {
+            addrs[n++] = ret;
+        }
+        if (next_fp <= fp) {
+            /* The stack grows down, anything else is not a frame */
+            break;
+        }
+        fp = next_fp;
+    }
+    return n;
+}
+
 uint32_t HELPER(v7m_mrs)(CPUARMState *env, uint32_t reg)
 {
     ARMCPU *cpu = arm_env_get_cpu(env);
@@ -8279,45 +8379,38 @@ void HELPER(dc_zva)(CPUARMState *env, uint64_t vaddr_in)
          * same QEMU executable.
          */
         int maxidx = DIV_ROUND_UP(blocklen, TARGET_PAGE_SIZE);
-        void *hostaddr[maxidx];
-        int try, i;
+        uint8_t *hostaddr[maxidx];
+        int first = (vaddr_in - vaddr) / TARGET_PAGE_SIZE;
+        int i;
         unsigned mmu_idx = cpu_mmu_index(env, false);
         TCGMemOpIdx oi = make_memop_idx(MO_UB, mmu_idx);
+        uint8_t *p;
 
-        for (try = 0; try < 2; try++) {
-
-            for (i = 0; i < maxidx; i++) {
-                hostaddr[i] = tlb_vaddr_to_host(env,
-                                                vaddr + TARGET_PAGE_SIZE * i,
-                                                1, mmu_idx);
-                if (!hostaddr[i]) {
-                    break;
-                }
-            }
-            if (i == maxidx) {
-                /* If it's all in the TLB it's fair game for just writing to;
-                 * we know we don't need to update dirty status, etc.
-                 */
-                for (i = 0; i < maxidx - 1; i++) {
-                    memset(hostaddr[i], 0, TARGET_PAGE_SIZE);
-                }
-                memset(hostaddr[i], 0, blocklen - (i * TARGET_PAGE_SIZE));
-                return;
+        /* Probe the page of the actual register value first, so that a
+         * fault on it reports that address.  Probing may take the
+         * exception, in which case we will longjmp out of here.
+         */
+        p = probe_host(env, vaddr_in, MMU_DATA_STORE, mmu_idx, GETRA());
+        hostaddr[first] = p ? p - (vaddr_in - vaddr - first * TARGET_PAGE_SIZE)
+                            : NULL;
+        for (i = 0; i < maxidx; i++) {
+            if (i != first) {
+                hostaddr[i] = probe_host(env, vaddr + TARGET_PAGE_SIZE * i,
+                                         MMU_DATA_STORE, mmu_idx, GETRA());
             }
-            /* OK, try a store and see if we can populate the tlb. This
-             * might cause an exception if the memory isn't writable,
-             * in which case we will longjmp out of here. We must for
-             * this purpose use the actual register value passed to us
-             * so that we get the fault address right.
+        }
+        for (i = 0; i < maxidx && hostaddr[i]; i++) {
+            continue;
+        }
+        if (i == maxidx) {
+            /* If it's all plain RAM it's fair game for just writing to;
+             * we know we don't need to update dirty status, etc.
              */
-            helper_ret_stb_mmu(env, vaddr_in, 0, oi, GETRA());
-            /* Now we can populate the other TLB entries, if any */
-            for (i = 0; i < maxidx; i++) {
-                uint64_t va = vaddr + TARGET_PAGE_SIZE * i;
-                if (va != (vaddr_in & TARGET_PAGE_MASK)) {
-                    helper_ret_stb_mmu(env, va, 0, oi, GETRA());
-                }
+            for (i = 0; i < maxidx - 1; i++) {
+                memset(hostaddr[i], 0, TARGET_PAGE_SIZE);
             }
+            memset(hostaddr[i], 0, blocklen - (i * TARGET_PAGE_SIZE));
+            return;
         }
 
         /* Slow path (probably attempt to do this to an I/O device or
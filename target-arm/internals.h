@@ -442,6 +442,9 @@ bool arm_debug_check_watchpoint(CPUState *cs, CPUWatchpoint *wp);
 /* Callback function for when a watchpoint or breakpoint triggers. */
 void arm_debug_excp_handler(CPUState *cs);
 
+/* Callback function for walking the guest call stack when profiling. */
+int arm_cpu_get_return_addresses(CPUState *cs, vaddr *addrs, int max);
+
 #ifdef CONFIG_USER_ONLY
 static inline bool arm_is_psci_call(ARMCPU *cpu, int excp_type)
 {
@@ -21,6 +21,7 @@
 #include "cpu.h"
 #include "exec/exec-all.h"
 #include "tcg-op.h"
+#include "tcg-op-gvec.h"
 #include "qemu/log.h"
 #include "arm_ldst.h"
 #include "translate.h"
@@ -276,8 +277,10 @@ static inline bool use_goto_tb(DisasContext *s, int n, uint64_t dest)
     }
 
 #ifndef CONFIG_USER_ONLY
-    /* Only link tbs from inside the same guest page */
-    if ((s->tb->pc & TARGET_PAGE_MASK) != (dest & TARGET_PAGE_MASK)) {
+    /* Only link tbs from inside the same guest page, unless the links
+       are undone on TLB flushes */
+    if (!tb_cross_page_chaining &&
+        (s->tb->pc & TARGET_PAGE_MASK) != (dest & TARGET_PAGE_MASK)) {
         return false;
     }
 #endif
@@ -290,6 +293,7 @@ static inline void gen_goto_tb(DisasContext *s, int n, uint64_t dest)
     TranslationBlock *tb;
 
     tb = s->tb;
+    tb_note_successor(dest);
     if (use_goto_tb(s, n, dest)) {
         tcg_gen_goto_tb(n);
         gen_a64_set_pc_im(dest);
@@ -488,6 +492,16 @@ static inline int fp_reg_offset(DisasContext *s, int regno, TCGMemOp size)
     return offs;
 }
 
+/* Offset of the whole 128 bit vector Qn, for the generic vector
+ * expansions of tcg-op-gvec.h.  Those operate element-wise, so the
+ * order of the two halves on big-endian hosts does not matter.
+ */
+static inline int vec_full_reg_offset(DisasContext *s, int regno)
+{
+    assert_fp_access_checked(s);
+    return offsetof(CPUARMState, vfp.regs[regno * 2]);
+}
+
 /* Offset of the high half of the 128 bit vector Qn */
 static inline int fp_reg_hi_offset(DisasContext *s, int regno)
 {
@@ -1305,7 +1319,7 @@ static void handle_sync(DisasContext *s, uint32_t insn,
         return;
     case 4: /* DSB */
     case 5: /* DMB */
-        /* We don't emulate caches so barriers are no-ops */
+        tcg_gen_mb(TCG_MO_ALL);
         return;
     case 6: /* ISB */
         /* We need to break the TB after this insn to execute
@@ -1761,9 +1775,11 @@ static void disas_b_exc_sys(DisasContext *s, uint32_t insn)
  * mandated semantics, but it works for typical guest code sequences
  * and avoids having to monitor regular stores.
  *
- * In system emulation mode only one CPU will be running at once, so
- * this sequence is effectively atomic.  In user emulation mode we
- * throw an exception and handle the atomic operation elsewhere.
+ * In system emulation mode the store does the compare and the write
+ * as one host cmpxchg when vCPUs run in parallel; otherwise only one
+ * CPU runs at once and the sequence is effectively atomic.  In user
+ * emulation mode we throw an exception and handle the atomic operation
+ * elsewhere.
  */
 static void gen_load_exclusive(DisasContext *s, int rt, int rt2,
                                TCGv_i64 addr, int size, bool is_pair)
@@ -1804,6 +1820,71 @@ static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
     gen_exception_internal_insn(s, 4, EXCP_STREX);
 }
 #else
+/* Store {Rt} (and {Rt2} for a pair) to [addr] with a host cmpxchg
+ * against the value seen by the load exclusive.  A pair of 64-bit
+ * registers is wider than the cmpxchg, so it is done in an exclusive
+ * section instead.
+ */
+static void gen_store_exclusive_parallel(DisasContext *s, int rd, int rt,
+                                         int rt2, TCGv_i64 inaddr, int size,
+                                         int is_pair)
+{
+    TCGLabel *fail_label, *done_label;
+    TCGv_i64 addr, cmpv, newv, oldv;
+    TCGMemOp memop;
+
+    if (is_pair && size == 3) {
+        gen_helper_exit_atomic(cpu_env);
+        return;
+    }
+
+    fail_label = gen_new_label();
+    done_label = gen_new_label();
+
+    /* Copy input into a local temp so it is not trashed when the
+     * basic block ends at the branch insn.
+     */
+    addr = tcg_temp_local_new_i64();
+    tcg_gen_mov_i64(addr, inaddr);
+    tcg_gen_brcond_i64(TCG_COND_NE, addr, cpu_exclusive_addr, fail_label);
+
+    cmpv = tcg_temp_new_i64();
+    newv = tcg_temp_new_i64();
+    oldv = tcg_temp_new_i64();
+    if (is_pair) {
+        /* Two words as one doubleword, the one at [addr] in the low
+         * half for little-endian data and in the high half otherwise.
+         */
+        memop = s->be_data | MO_64 | MO_ALIGN;
+        if (s->be_data == MO_LE) {
+            tcg_gen_concat32_i64(cmpv, cpu_exclusive_val,
+                                 cpu_exclusive_high);
+            tcg_gen_concat32_i64(newv, cpu_reg(s, rt), cpu_reg(s, rt2));
+        } else {
+            tcg_gen_concat32_i64(cmpv, cpu_exclusive_high,
+                                 cpu_exclusive_val);
+            tcg_gen_concat32_i64(newv, cpu_reg(s, rt2), cpu_reg(s, rt));
+        }
+    } else {
+        memop = s->be_data | size | MO_ALIGN;
+        tcg_gen_mov_i64(cmpv, cpu_exclusive_val);
+        tcg_gen_mov_i64(newv, cpu_reg(s, rt));
+    }
+    tcg_gen_atomic_cmpxchg_i64(oldv, addr, cmpv, newv,
+                               get_mem_index(s), memop);
+    tcg_gen_setcond_i64(TCG_COND_NE, cpu_reg(s, rd), oldv, cmpv);
+    tcg_temp_free_i64(cmpv);
+    tcg_temp_free_i64(newv);
+    tcg_temp_free_i64(oldv);
+    tcg_temp_free_i64(addr);
+
+    tcg_gen_br(done_label);
+    gen_set_label(fail_label);
+    tcg_gen_movi_i64(cpu_reg(s, rd), 1);
+    gen_set_label(done_label);
+    tcg_gen_movi_i64(cpu_exclusive_addr, -1);
+}
+
 static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
                                 TCGv_i64 inaddr, int size, int is_pair)
 {
@@ -1821,12 +1902,18 @@ static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
      */
     TCGLabel *fail_label = gen_new_label();
     TCGLabel *done_label = gen_new_label();
-    TCGv_i64 addr = tcg_temp_local_new_i64();
+    TCGv_i64 addr;
     TCGv_i64 tmp;
 
+    if (parallel_cpus) {
+        gen_store_exclusive_parallel(s, rd, rt, rt2, inaddr, size, is_pair);
+        return;
+    }
+
     /* Copy input into a local temp so it is not trashed when the
      * basic block ends at the branch insn.
      */
+    addr = tcg_temp_local_new_i64();
     tcg_gen_mov_i64(addr, inaddr);
     tcg_gen_brcond_i64(TCG_COND_NE, addr, cpu_exclusive_addr, fail_label);
 
@@ -1926,9 +2013,10 @@ static void disas_ldst_excl(DisasContext *s, uint32_t insn)
     }
     tcg_addr = read_cpu_reg_sp(s, rn, 1);
 
-    /* Note that since TCG is single threaded load-acquire/store-release
-     * semantics require no extra if (is_lasr) { ... } handling.
-     */
+    /* Store-release: earlier accesses first.  */
+    if (is_lasr && is_store) {
+        tcg_gen_mb(TCG_MO_ALL);
+    }
 
     if (is_excl) {
         if (!is_store) {
@@ -1950,6 +2038,11 @@ static void disas_ldst_excl(DisasContext *s, uint32_t insn)
                       true, rt, iss_sf, is_lasr);
         }
     }
+
+    /* Load-acquire: later accesses after it.  */
+    if (is_lasr && !is_store) {
+        tcg_gen_mb(TCG_MO_ALL);
+    }
 }
 
 /*
@@ -5819,9 +5912,6 @@ static void handle_simd_dupg(DisasContext *s, int is_q, int rd, int rn,
                              int imm5)
 {
     int size = ctz32(imm5);
-    int esize = 8 << size;
-    int elements = (is_q ? 128 : 64)/esize;
-    int i = 0;
 
     if (size > 3 || ((size == 3) && !is_q)) {
         unallocated_encoding(s);
@@ -5832,9 +5922,8 @@ static void handle_simd_dupg(DisasContext *s, int is_q, int rd, int rn,
         return;
     }
 
-    for (i = 0; i < elements; i++) {
-        write_vec_element(s, cpu_reg(s, rn), rd, i, size);
-    }
+    tcg_gen_gvec_dup_i64(size, vec_full_reg_offset(s, rd), is_q ? 16 : 8,
+                         cpu_reg(s, rn));
     if (!is_q) {
         clear_vec_high(s, rd);
     }
@@ -8257,6 +8346,30 @@ static void handle_vec_simd_shri(DisasContext *s, bool is_q, bool is_u,
         return;
     }
 
+    if (opcode == 0x00) {
+        /* SSHR / USHR */
+        int rd_ofs = vec_full_reg_offset(s, rd);
+        int rn_ofs = vec_full_reg_offset(s, rn);
+
+        if (shift < esize) {
+            if (is_u) {
+                tcg_gen_gvec_shri(size, rd_ofs, rn_ofs, shift, dsize / 8);
+            } else {
+                tcg_gen_gvec_sari(size, rd_ofs, rn_ofs, shift, dsize / 8);
+            }
+        } else if (is_u) {
+            /* Shifting out all the bits leaves zero...  */
+            tcg_gen_gvec_xor(size, rd_ofs, rn_ofs, rn_ofs, dsize / 8);
+        } else {
+            /* ... or copies of the sign bit.  */
+            tcg_gen_gvec_sari(size, rd_ofs, rn_ofs, esize - 1, dsize / 8);
+        }
+        if (!is_q) {
+            clear_vec_high(s, rd);
+        }
+        return;
+    }
+
     switch (opcode) {
     case 0x02: /* SSRA / USRA (accumulate) */
         accumulate = true;
@@ -8332,6 +8445,16 @@ static void handle_vec_simd_shli(DisasContext *s, bool is_q, bool insert,
         return;
     }
 
+    if (!insert) {
+        /* SHL */
+        tcg_gen_gvec_shli(size, vec_full_reg_offset(s, rd),
+                          vec_full_reg_offset(s, rn), shift, dsize / 8);
+        if (!is_q) {
+            clear_vec_high(s, rd);
+        }
+        return;
+    }
+
     for (i = 0; i < elements; i++) {
         read_vec_element(s, tcg_rn, rn, i, size);
         if (insert) {
@@ -8983,6 +9106,22 @@ static void disas_simd_3same_logic(DisasContext *s, uint32_t insn)
         return;
     }
 
+    if (!is_u || size == 0) {
+        /* AND, BIC, ORR, ORN, EOR */
+        static void (* const fns[5])(unsigned, uint32_t, uint32_t,
+                                     uint32_t, uint32_t) = {
+            tcg_gen_gvec_and, tcg_gen_gvec_andc,
+            tcg_gen_gvec_or, tcg_gen_gvec_orc, tcg_gen_gvec_xor,
+        };
+        fns[is_u ? 4 : size](0, vec_full_reg_offset(s, rd),
+                             vec_full_reg_offset(s, rn),
+                             vec_full_reg_offset(s, rm), is_q ? 16 : 8);
+        if (!is_q) {
+            clear_vec_high(s, rd);
+        }
+        return;
+    }
+
     tcg_op1 = tcg_temp_new_i64();
     tcg_op2 = tcg_temp_new_i64();
     tcg_res[0] = tcg_temp_new_i64();
@@ -9295,6 +9434,44 @@ static void disas_simd_3same_float(DisasContext *s, uint32_t insn)
     }
 }
 
+/* Expand the 3same integer ops that map directly onto a generic vector
+ * operation on the whole register.
+ */
+static void gen_gvec_3same_int(DisasContext *s, int opcode, bool u,
+                               bool is_q, int size, int rd, int rn, int rm)
+{
+    int rd_ofs = vec_full_reg_offset(s, rd);
+    int rn_ofs = vec_full_reg_offset(s, rn);
+    int rm_ofs = vec_full_reg_offset(s, rm);
+    int vec_size = is_q ? 16 : 8;
+
+    switch (opcode) {
+    case 0x06: /* CMGT, CMHI */
+        tcg_gen_gvec_cmp(u ? TCG_COND_GTU : TCG_COND_GT, size,
+                         rd_ofs, rn_ofs, rm_ofs, vec_size);
+        break;
+    case 0x07: /* CMGE, CMHS */
+        tcg_gen_gvec_cmp(u ? TCG_COND_GEU : TCG_COND_GE, size,
+                         rd_ofs, rn_ofs, rm_ofs, vec_size);
+        break;
+    case 0x10: /* ADD, SUB */
+        if (u) {
+            tcg_gen_gvec_sub(size, rd_ofs, rn_ofs, rm_ofs, vec_size);
+        } else {
+            tcg_gen_gvec_add(size, rd_ofs, rn_ofs, rm_ofs, vec_size);
+        }
+        break;
+    case 0x11: /* CMEQ */
+        tcg_gen_gvec_cmp(TCG_COND_EQ, size, rd_ofs, rn_ofs, rm_ofs, vec_size);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+    if (!is_q) {
+        clear_vec_high(s, rd);
+    }
+}
+
 /* Integer op subgroup of C3.6.16. */
 static void disas_simd_3same_int(DisasContext *s, uint32_t insn)
 {
@@ -9345,6 +9522,19 @@ static void disas_simd_3same_int(DisasContext *s, uint32_t insn)
         return;
     }
 
+    switch (opcode) {
+    case 0x06: /* CMGT, CMHI */
+    case 0x07: /* CMGE, CMHS */
+    case 0x10: /* ADD, SUB */
+    case 0x11: /* CMTST, CMEQ */
+        if (opcode == 0x11 && !u) {
+            /* CMTST keeps the element loop below.  */
+            break;
+        }
+        gen_gvec_3same_int(s, opcode, u, is_q, size, rd, rn, rm);
+        return;
+    }
+
     if (size == 3) {
         assert(is_q);
         for (pass = 0; pass < 2; pass++) {
@@ -11294,11 +11484,13 @@ void gen_intermediate_code_a64(ARMCPU *cpu, TranslationBlock *tb)
         default:
         case DISAS_UPDATE:
             gen_a64_set_pc_im(dc->pc);
-            /* fall through */
-        case DISAS_JUMP:
             /* indicate that the hash table must be used to find the next TB */
             tcg_gen_exit_tb(0);
             break;
+        case DISAS_JUMP:
+            /* BR, BLR, RET and ERET: look up the next TB from the new PC */
+            tcg_gen_lookup_and_goto_ptr();
+            break;
         case DISAS_TB_JUMP:
         case DISAS_EXC:
         case DISAS_SWI:
@@ -25,6 +25,7 @@
 #include "disas/disas.h"
 #include "exec/exec-all.h"
 #include "tcg-op.h"
+#include "tcg-op-gvec.h"
 #include "qemu/log.h"
 #include "qemu/bitops.h"
 #include "arm_ldst.h"
@@ -1066,6 +1067,22 @@ DO_GEN_ST(8, MO_UB, 3)
 DO_GEN_ST(16, MO_UW, 2)
 DO_GEN_ST(32, MO_UL, 0)
 
+/* Return the guest address for an AArch32 access of size OP to A32,
+ * munged for BE32 like the accessors above, for the atomic operations
+ * which have no gen_aa32_* wrapper.
+ */
+static TCGv gen_aa32_addr(DisasContext *s, TCGv_i32 a32, TCGMemOp op)
+{
+    TCGv addr = tcg_temp_new();
+
+    tcg_gen_extu_i32_tl(addr, a32);
+    /* Not needed for user-mode BE32, where we use MO_BE instead.  */
+    if (!IS_USER_ONLY && s->sctlr_b && (op & MO_SIZE) < MO_32) {
+        tcg_gen_xori_tl(addr, addr, 4 - (1 << (op & MO_SIZE)));
+    }
+    return addr;
+}
+
 static inline void gen_set_pc_im(DisasContext *s, target_ulong val)
 {
     tcg_gen_movi_i32(cpu_R[15], val);
@@ -3238,17 +3255,9 @@ static int disas_vfp_insn(DisasContext *s, uint32_t insn)
                     tmp = load_reg(s, rd);
                     if (insn & (1 << 23)) {
                         /* VDUP */
-                        if (size == 0) {
-                            gen_neon_dup_u8(tmp, 0);
-                        } else if (size == 1) {
-                            gen_neon_dup_low16(tmp);
-                        }
-                        for (n = 0; n <= pass * 2; n++) {
-                            tmp2 = tcg_temp_new_i32();
-                            tcg_gen_mov_i32(tmp2, tmp);
-                            neon_store_reg(rn, n, tmp2);
-                        }
-                        neon_store_reg(rn, n, tmp);
+                        tcg_gen_gvec_dup_i32(size, vfp_reg_offset(1, rn),
+                                             pass ? 16 : 8, tmp);
+                        tcg_temp_free_i32(tmp);
                     } else {
                         /* VMOV */
                         switch (size) {
@@ -4054,7 +4063,8 @@ static int disas_vfp_insn(DisasContext *s, uint32_t insn)
 static inline bool use_goto_tb(DisasContext *s, target_ulong dest)
 {
 #ifndef CONFIG_USER_ONLY
-    return (s->tb->pc & TARGET_PAGE_MASK) == (dest & TARGET_PAGE_MASK) ||
+    return tb_cross_page_chaining ||
+           (s->tb->pc & TARGET_PAGE_MASK) == (dest & TARGET_PAGE_MASK) ||
            ((s->pc - 1) & TARGET_PAGE_MASK) == (dest & TARGET_PAGE_MASK);
 #else
     return true;
@@ -4063,6 +4073,7 @@ static inline bool use_goto_tb(DisasContext *s, target_ulong dest)
 
 static inline void gen_goto_tb(DisasContext *s, int n, target_ulong dest)
 {
+    tb_note_successor(dest);
     if (use_goto_tb(s, dest)) {
         tcg_gen_goto_tb(n);
         gen_set_pc_im(s, dest);
@@ -5499,6 +5510,60 @@ static int disas_neon_data_insn(DisasContext *s, uint32_t insn)
             tcg_temp_free_i32(tmp3);
             return 0;
         }
+
+        /* Element-wise integer operations with a generic vector expansion,
+           done on the whole D or Q register at once.  */
+        {
+            int vec_size = q ? 16 : 8;
+            int rd_ofs = vfp_reg_offset(1, rd);
+            int rn_ofs = vfp_reg_offset(1, rn);
+            int rm_ofs = vfp_reg_offset(1, rm);
+
+            switch (op) {
+            case NEON_3R_LOGIC:
+                switch ((u << 2) | size) {
+                case 0: /* VAND */
+                    tcg_gen_gvec_and(0, rd_ofs, rn_ofs, rm_ofs, vec_size);
+                    return 0;
+                case 1: /* VBIC */
+                    tcg_gen_gvec_andc(0, rd_ofs, rn_ofs, rm_ofs, vec_size);
+                    return 0;
+                case 2: /* VORR */
+                    tcg_gen_gvec_or(0, rd_ofs, rn_ofs, rm_ofs, vec_size);
+                    return 0;
+                case 3: /* VORN */
+                    tcg_gen_gvec_orc(0, rd_ofs, rn_ofs, rm_ofs, vec_size);
+                    return 0;
+                case 4: /* VEOR */
+                    tcg_gen_gvec_xor(0, rd_ofs, rn_ofs, rm_ofs, vec_size);
+                    return 0;
+                }
+                break;
+            case NEON_3R_VADD_VSUB:
+                if (u) {
+                    tcg_gen_gvec_sub(size, rd_ofs, rn_ofs, rm_ofs, vec_size);
+                } else {
+                    tcg_gen_gvec_add(size, rd_ofs, rn_ofs, rm_ofs, vec_size);
+                }
+                return 0;
+            case NEON_3R_VTST_VCEQ:
+                if (u) { /* VCEQ */
+                    tcg_gen_gvec_cmp(TCG_COND_EQ, size,
+                                     rd_ofs, rn_ofs, rm_ofs, vec_size);
+                    return 0;
+                }
+                break;
+            case NEON_3R_VCGT:
+                tcg_gen_gvec_cmp(u ? TCG_COND_GTU : TCG_COND_GT, size,
+                                 rd_ofs, rn_ofs, rm_ofs, vec_size);
+                return 0;
+            case NEON_3R_VCGE:
+                tcg_gen_gvec_cmp(u ? TCG_COND_GEU : TCG_COND_GE, size,
+                                 rd_ofs, rn_ofs, rm_ofs, vec_size);
+                return 0;
+            }
+        }
+
         if (size == 3 && op != NEON_3R_LOGIC) {
             /* 64-bit element instructions. */
             for (pass = 0; pass < (q ? 2 : 1); pass++) {
@@ -5985,6 +6050,34 @@ static int disas_neon_data_insn(DisasContext *s, uint32_t insn)
                    element size in bits.  */
                 if (op <= 4)
                     shift = shift - (1 << (size + 3));
+                if (op == 0 || (op == 5 && !u)) {
+                    /* VSHR, VSHL: use the generic vector expansion.  */
+                    int vec_size = q ? 16 : 8;
+                    int rd_ofs = vfp_reg_offset(1, rd);
+                    int rm_ofs = vfp_reg_offset(1, rm);
+
+                    if (op == 5) {
+                        tcg_gen_gvec_shli(size, rd_ofs, rm_ofs, shift,
+                                          vec_size);
+                    } else if (-shift < (8 << size)) {
+                        if (u) {
+                            tcg_gen_gvec_shri(size, rd_ofs, rm_ofs, -shift,
+                                              vec_size);
+                        } else {
+                            tcg_gen_gvec_sari(size, rd_ofs, rm_ofs, -shift,
+                                              vec_size);
+                        }
+                    } else if (u) {
+                        /* A shift by the element size gives zero...  */
+                        tcg_gen_gvec_xor(size, rd_ofs, rm_ofs, rm_ofs,
+                                         vec_size);
+                    } else {
+                        /* ... or the replicated sign bit.  */
+                        tcg_gen_gvec_sari(size, rd_ofs, rm_ofs,
+                                          (8 << size) - 1, vec_size);
+                    }
+                    return 0;
+                }
                 if (size == 3) {
                     count = q + 1;
                 } else {
@@ -7721,9 +7814,11 @@ static void gen_logicq_cc(TCGv_i32 lo, TCGv_i32 hi)
    the architecturally mandated semantics, and avoids having to monitor
    regular stores.
 
-   In system emulation mode only one CPU will be running at once, so
-   this sequence is effectively atomic.  In user emulation mode we
-   throw an exception and handle the atomic operation elsewhere.  */
+   In system emulation mode the store does the compare and the write
+   as one host cmpxchg when vCPUs run in parallel; otherwise only one
+   CPU runs at once and the sequence is effectively atomic.  In user
+   emulation mode we throw an exception and handle the atomic operation
+   elsewhere.  */
 static void gen_load_exclusive(DisasContext *s, int rt, int rt2,
                                TCGv_i32 addr, int size)
 {
@@ -7778,6 +7873,67 @@ static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
     gen_exception_internal_insn(s, 4, EXCP_STREX);
 }
 #else
+/* Store {Rt} (and {Rt2} for size 3) to [addr] with a host cmpxchg
+   against the value seen by the load exclusive.  */
+static void gen_store_exclusive_parallel(DisasContext *s, int rd, int rt,
+                                         int rt2, TCGv_i32 addr, int size)
+{
+    TCGMemOp opc = size | MO_ALIGN | s->be_data;
+    TCGLabel *done_label = gen_new_label();
+    TCGLabel *fail_label = gen_new_label();
+    TCGv_i64 extaddr = tcg_temp_new_i64();
+    TCGv taddr;
+
+    tcg_gen_extu_i32_i64(extaddr, addr);
+    tcg_gen_brcond_i64(TCG_COND_NE, extaddr, cpu_exclusive_addr, fail_label);
+    tcg_temp_free_i64(extaddr);
+
+    taddr = gen_aa32_addr(s, addr, opc);
+    if (size == 3) {
+        TCGv_i32 lo = load_reg(s, rt);
+        TCGv_i32 hi = load_reg(s, rt2);
+        TCGv_i64 n64 = tcg_temp_new_i64();
+        TCGv_i64 c64 = tcg_temp_new_i64();
+        TCGv_i64 o64 = tcg_temp_new_i64();
+
+        /* exclusive_val has the word at [addr] in its low half, but a
+           big-endian doubleword has it in the high half.  */
+        tcg_gen_concat_i32_i64(n64, lo, hi);
+        tcg_temp_free_i32(lo);
+        tcg_temp_free_i32(hi);
+        tcg_gen_mov_i64(c64, cpu_exclusive_val);
+        if (s->be_data == MO_BE) {
+            tcg_gen_rotri_i64(n64, n64, 32);
+            tcg_gen_rotri_i64(c64, c64, 32);
+        }
+        tcg_gen_atomic_cmpxchg_i64(o64, taddr, c64, n64,
+                                   get_mem_index(s), opc);
+        tcg_gen_setcond_i64(TCG_COND_NE, o64, o64, c64);
+        tcg_gen_extrl_i64_i32(cpu_R[rd], o64);
+        tcg_temp_free_i64(n64);
+        tcg_temp_free_i64(c64);
+        tcg_temp_free_i64(o64);
+    } else {
+        TCGv_i32 n32 = load_reg(s, rt);
+        TCGv_i32 c32 = tcg_temp_new_i32();
+        TCGv_i32 o32 = tcg_temp_new_i32();
+
+        tcg_gen_extrl_i64_i32(c32, cpu_exclusive_val);
+        tcg_gen_atomic_cmpxchg_i32(o32, taddr, c32, n32,
+                                   get_mem_index(s), opc);
+        tcg_gen_setcond_i32(TCG_COND_NE, cpu_R[rd], o32, c32);
+        tcg_temp_free_i32(n32);
+        tcg_temp_free_i32(c32);
+        tcg_temp_free_i32(o32);
+    }
+    tcg_temp_free(taddr);
+    tcg_gen_br(done_label);
+    gen_set_label(fail_label);
+    tcg_gen_movi_i32(cpu_R[rd], 1);
+    gen_set_label(done_label);
+    tcg_gen_movi_i64(cpu_exclusive_addr, -1);
+}
+
 static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
                                 TCGv_i32 addr, int size)
 {
@@ -7786,6 +7942,11 @@ static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
     TCGLabel *done_label;
     TCGLabel *fail_label;
 
+    if (parallel_cpus) {
+        gen_store_exclusive_parallel(s, rd, rt, rt2, addr, size);
+        return;
+    }
+
     /* if (env->exclusive_addr == addr && env->exclusive_val == [addr]) {
          [addr] = {Rt};
          {Rd} = 0;
@@ -8083,7 +8244,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
             case 4: /* dsb */
             case 5: /* dmb */
                 ARCH(7);
-                /* We don't emulate caches so these are a no-op.  */
+                tcg_gen_mb(TCG_MO_ALL);
                 return;
             case 6: /* isb */
                 /* We need to break the TB after this insn to execute
@@ -8750,9 +8911,10 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                         addr = tcg_temp_local_new_i32();
                         load_reg_var(s, addr, rn);
 
-                        /* Since the emulation does not have barriers,
-                           the acquire/release semantics need no special
-                           handling */
+                        /* Store-release: earlier accesses first.  */
+                        if (op2 != 3 && !(insn & (1 << 20))) {
+                            tcg_gen_mb(TCG_MO_ALL);
+                        }
                         if (op2 == 0) {
                             if (insn & (1 << 20)) {
                                 tmp = tcg_temp_new_i32();
@@ -8830,27 +8992,28 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                                 abort();
                             }
                         }
+                        /* Load-acquire: later accesses after it.  */
+                        if (op2 != 3 && (insn & (1 << 20))) {
+                            tcg_gen_mb(TCG_MO_ALL);
+                        }
                         tcg_temp_free_i32(addr);
                     } else {
                         /* SWP instruction */
+                        TCGMemOp opc = s->be_data;
+                        TCGv taddr;
+
                         rm = (insn) & 0xf;
+                        opc |= insn & (1 << 22) ? MO_UB : MO_UL;
 
-                        /* ??? This is not really atomic.  However we know
-                           we never have multiple CPUs running in parallel,
-                           so it is good enough.  */
                         addr = load_reg(s, rn);
-                        tmp = load_reg(s, rm);
-                        tmp2 = tcg_temp_new_i32();
-                        if (insn & (1 << 22)) {
-                            gen_aa32_ld8u(s, tmp2, addr, get_mem_index(s));
-                            gen_aa32_st8(s, tmp, addr, get_mem_index(s));
-                        } else {
-                            gen_aa32_ld32u(s, tmp2, addr, get_mem_index(s));
-                            gen_aa32_st32(s, tmp, addr, get_mem_index(s));
-                        }
-                        tcg_temp_free_i32(tmp);
+                        taddr = gen_aa32_addr(s, addr, opc);
                         tcg_temp_free_i32(addr);
-                        store_reg(s, rd, tmp2);
+
+                        tmp = load_reg(s, rm);
+                        tcg_gen_atomic_xchg_i32(tmp, taddr, tmp,
+                                                get_mem_index(s), opc);
+                        tcg_temp_free(taddr);
+                        store_reg(s, rd, tmp);
                     }
                 }
             } else {
@@ -9551,6 +9714,282 @@ gen_thumb2_data_op(DisasContext *s, int op, int conds, uint32_t shifter_out,
     return 0;
 }
 
+/* Field functions for t32.decode.  */
+
+/* S:J1:J2:imm10:imm11 -> S:I1:I2:imm10:imm11:0, with In = !(Jn ^ S) */
+static int t32_branch24(int x)
+{
+    x ^= !(x < 0) * (3 << 21);
+    return x << 1;
+}
+
+static int times_2(int x)
+{
+    return x * 2;
+}
+
+#include "decode-t32.inc.c"
+
+/* Load register RN, or zero for r15: the encodings that would read the
+   PC name other insns (MOV, MVN, BFC) that have no first operand.  */
+static TCGv_i32 load_reg_t32_rn(DisasContext *s, int rn)
+{
+    if (rn == 15) {
+        return tcg_const_i32(0);
+    }
+    return load_reg(s, rn);
+}
+
+/* Data processing (modified immediate) */
+
+/* Expand the modified immediate i:imm3:imm8.  SHIFTER_OUT is set for
+   rotated constants, whose bit 31 is the carry out of logical ops.  */
+static uint32_t t32_expand_imm(int imm12, bool *shifter_out)
+{
+    uint32_t imm = imm12 & 0xff;
+
+    *shifter_out = false;
+    switch (imm12 >> 8) {
+    case 0: /* XY */
+        break;
+    case 1: /* 00XY00XY */
+        imm |= imm << 16;
+        break;
+    case 2: /* XY00XY00 */
+        imm |= imm << 16;
+        imm <<= 8;
+        break;
+    case 3: /* XYXYXYXY */
+        imm |= imm << 16;
+        imm |= imm << 8;
+        break;
+    default: /* Rotated constant.  */
+        imm = (imm | 0x80) << (32 - (imm12 >> 7));
+        *shifter_out = true;
+        break;
+    }
+    return imm;
+}
+
+static bool op_s_rri_rot(DisasContext *s, arg_s_rri *a, int op)
+{
+    TCGv_i32 tmp, tmp2;
+    bool shifter_out;
+
+    tmp2 = tcg_const_i32(t32_expand_imm(a->imm, &shifter_out));
+    tmp = load_reg_t32_rn(s, a->rn);
+    gen_thumb2_data_op(s, op, a->s, shifter_out, tmp, tmp2);
+    tcg_temp_free_i32(tmp2);
+    /* TST, TEQ, CMN and CMP */
+    if (a->rd != 15) {
+        store_reg(s, a->rd, tmp);
+    } else {
+        tcg_temp_free_i32(tmp);
+    }
+    return true;
+}
+
+#define DO_S_RRI_ROT(NAME, OP)                                   \
+static bool trans_##NAME##_rri(DisasContext *s, arg_s_rri *a)    \
+{                                                                \
+    return op_s_rri_rot(s, a, OP);                               \
+}
+
+DO_S_RRI_ROT(AND, 0)
+DO_S_RRI_ROT(BIC, 1)
+DO_S_RRI_ROT(ORR, 2)
+DO_S_RRI_ROT(ORN, 3)
+DO_S_RRI_ROT(EOR, 4)
+DO_S_RRI_ROT(ADD, 8)
+DO_S_RRI_ROT(ADC, 10)
+DO_S_RRI_ROT(SBC, 11)
+DO_S_RRI_ROT(SUB, 13)
+DO_S_RRI_ROT(RSB, 14)
+
+#undef DO_S_RRI_ROT
+
+/* Data processing (plain binary immediate) */
+
+static bool op_addsubw(DisasContext *s, arg_rri *a, int imm)
+{
+    TCGv_i32 tmp;
+
+    if (a->rn == 15) {
+        /* ADR */
+        tmp = tcg_const_i32((s->pc & ~(uint32_t)3) + imm);
+    } else {
+        tmp = load_reg(s, a->rn);
+        tcg_gen_addi_i32(tmp, tmp, imm);
+    }
+    store_reg(s, a->rd, tmp);
+    return true;
+}
+
+static bool trans_ADDW(DisasContext *s, arg_rri *a)
+{
+    return op_addsubw(s, a, a->imm);
+}
+
+static bool trans_SUBW(DisasContext *s, arg_rri *a)
+{
+    return op_addsubw(s, a, -a->imm);
+}
+
+static bool trans_MOVW(DisasContext *s, arg_ri *a)
+{
+    store_reg(s, a->rd, tcg_const_i32(a->imm));
+    return true;
+}
+
+static bool trans_MOVT(DisasContext *s, arg_ri *a)
+{
+    TCGv_i32 tmp = load_reg(s, a->rd);
+
+    tcg_gen_ext16u_i32(tmp, tmp);
+    tcg_gen_ori_i32(tmp, tmp, a->imm << 16);
+    store_reg(s, a->rd, tmp);
+    return true;
+}
+
+static bool op_sat(DisasContext *s, arg_sat *a,
+                   void (*gen)(TCGv_i32, TCGv_env, TCGv_i32, TCGv_i32))
+{
+    TCGv_i32 tmp, satimm;
+
+    tmp = load_reg_t32_rn(s, a->rn);
+    if (a->sh) {
+        tcg_gen_sari_i32(tmp, tmp, a->lsb);
+    } else {
+        tcg_gen_shli_i32(tmp, tmp, a->lsb);
+    }
+    satimm = tcg_const_i32(a->satimm);
+    gen(tmp, cpu_env, tmp, satimm);
+    tcg_temp_free_i32(satimm);
+    store_reg(s, a->rd, tmp);
+    return true;
+}
+
+static bool trans_SSAT(DisasContext *s, arg_sat *a)
+{
+    /* ASR #0 is SSAT16, which is left UNDEF without the DSP insns */
+    if (a->sh && a->lsb == 0) {
+        return false;
+    }
+    return op_sat(s, a, gen_helper_ssat);
+}
+
+static bool trans_USAT(DisasContext *s, arg_sat *a)
+{
+    if (a->sh && a->lsb == 0) {
+        return false;
+    }
+    return op_sat(s, a, gen_helper_usat);
+}
+
+static bool trans_SSAT16(DisasContext *s, arg_sat *a)
+{
+    if (!arm_dc_feature(s, ARM_FEATURE_THUMB_DSP)) {
+        return false;
+    }
+    return op_sat(s, a, gen_helper_ssat16);
+}
+
+static bool trans_USAT16(DisasContext *s, arg_sat *a)
+{
+    if (!arm_dc_feature(s, ARM_FEATURE_THUMB_DSP)) {
+        return false;
+    }
+    return op_sat(s, a, gen_helper_usat16);
+}
+
+static bool trans_SBFX(DisasContext *s, arg_bfx *a)
+{
+    int width = a->widthm1 + 1;
+    TCGv_i32 tmp;
+
+    if (a->lsb + width > 32) {
+        return false;
+    }
+    tmp = load_reg_t32_rn(s, a->rn);
+    if (width < 32) {
+        gen_sbfx(tmp, a->lsb, width);
+    }
+    store_reg(s, a->rd, tmp);
+    return true;
+}
+
+static bool trans_UBFX(DisasContext *s, arg_bfx *a)
+{
+    int width = a->widthm1 + 1;
+    TCGv_i32 tmp;
+
+    if (a->lsb + width > 32) {
+        return false;
+    }
+    tmp = load_reg_t32_rn(s, a->rn);
+    if (width < 32) {
+        gen_ubfx(tmp, a->lsb, (1u << width) - 1);
+    }
+    store_reg(s, a->rd, tmp);
+    return true;
+}
+
+static bool trans_BFI(DisasContext *s, arg_bfi *a)
+{
+    int width = a->msb + 1 - a->lsb;
+    TCGv_i32 tmp, tmp2;
+
+    if (a->msb < a->lsb) {
+        return false;
+    }
+    /* BFC with rn == 15 */
+    tmp = load_reg_t32_rn(s, a->rn);
+    if (width != 32) {
+        tmp2 = load_reg(s, a->rd);
+        tcg_gen_deposit_i32(tmp, tmp2, tmp, a->lsb, width);
+        tcg_temp_free_i32(tmp2);
+    }
+    store_reg(s, a->rd, tmp);
+    return true;
+}
+
+/* Branches */
+
+static bool trans_B(DisasContext *s, arg_i *a)
+{
+    gen_jmp(s, s->pc + a->imm);
+    return true;
+}
+
+static bool trans_BL(DisasContext *s, arg_i *a)
+{
+    tcg_gen_movi_i32(cpu_R[14], s->pc | 1);
+    gen_jmp(s, s->pc + a->imm);
+    return true;
+}
+
+static bool trans_BLX_i(DisasContext *s, arg_i *a)
+{
+    tcg_gen_movi_i32(cpu_R[14], s->pc | 1);
+    /* thumb2 bx, no need to check */
+    gen_bx_im(s, (s->pc + a->imm) & ~(uint32_t)2);
+    return true;
+}
+
+static bool trans_B_cond(DisasContext *s, arg_ci *a)
+{
+    if (a->cond >= 0xe) {
+        /* Misc control */
+        return false;
+    }
+    /* Generate a conditional jump to next instruction.  */
+    s->condlabel = gen_new_label();
+    arm_gen_test_cc(a->cond ^ 1, s->condlabel);
+    s->condjmp = 1;
+    gen_jmp(s, s->pc + a->imm);
+    return true;
+}
+
 /* Translate a 32-bit thumb instruction.  Returns nonzero if the instruction
    is not legal.  */
 static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw1)
@@ -9617,6 +10056,10 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
         ARCH(6T2);
     }
 
+    if (disas_t32(s, insn)) {
+        return 0;
+    }
+
     rn = (insn >> 16) & 0xf;
     rs = (insn >> 12) & 0xf;
     rd = (insn >> 8) & 0xf;
@@ -9733,6 +10176,10 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                 }
                 addr = tcg_temp_local_new_i32();
                 load_reg_var(s, addr, rn);
+                /* Store-release: earlier accesses first.  */
+                if (op2 != 1 && !(insn & (1 << 20))) {
+                    tcg_gen_mb(TCG_MO_ALL);
+                }
                 if (!(op2 & 1)) {
                     if (insn & (1 << 20)) {
                         tmp = tcg_temp_new_i32();
@@ -9772,6 +10219,10 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                 } else {
                     gen_store_exclusive(s, rm, rs, rd, addr, op);
                 }
+                /* Load-acquire: later accesses after it.  */
+                if (op2 != 1 && (insn & (1 << 20))) {
+                    tcg_gen_mb(TCG_MO_ALL);
+                }
                 tcg_temp_free_i32(addr);
             }
         } else {
@@ -10311,32 +10762,8 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
         if (insn & (1 << 15)) {
             /* Branches, misc control.  */
             if (insn & 0x5000) {
-                /* Unconditional branch.  */
-                /* signextend(hw1[10:0]) -> offset[:12].  */
-                offset = ((int32_t)insn << 5) >> 9 & ~(int32_t)0xfff;
-                /* hw1[10:0] -> offset[11:1].  */
-                offset |= (insn & 0x7ff) << 1;
-                /* (~hw2[13, 11] ^ offset[24]) -> offset[23,22]
-                   offset[24:22] already have the same value because of the
-                   sign extension above.  */
-                offset ^= ((~insn) & (1 << 13)) << 10;
-                offset ^= ((~insn) & (1 << 11)) << 11;
-
-                if (insn & (1 << 14)) {
-                    /* Branch and link.  */
-                    tcg_gen_movi_i32(cpu_R[14], s->pc | 1);
-                }
-
-                offset += s->pc;
-                if (insn & (1 << 12)) {
-                    /* b/bl */
-                    gen_jmp(s, offset);
-                } else {
-                    /* blx */
-                    offset &= ~(uint32_t)2;
-                    /* thumb2 bx, no need to check */
-                    gen_bx_im(s, offset);
-                }
+                /* Unconditional branch, decoded by disas_t32().  */
+                g_assert_not_reached();
             } else if (((insn >> 23) & 7) == 7) {
                 /* Misc control */
                 if (insn & (1 << 13))
@@ -10432,7 +10859,7 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                             break;
                         case 4: /* dsb */
                         case 5: /* dmb */
-                            /* These execute as NOPs.  */
+                            tcg_gen_mb(TCG_MO_ALL);
                             break;
                         case 6: /* isb */
                             /* We need to break the TB after this insn
@@ -10504,191 +10931,13 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                     }
                 }
             } else {
-                /* Conditional branch.  */
-                op = (insn >> 22) & 0xf;
-                /* Generate a conditional jump to next instruction.  */
-                s->condlabel = gen_new_label();
-                arm_gen_test_cc(op ^ 1, s->condlabel);
-                s->condjmp = 1;
-
-                /* offset[11:1] = insn[10:0] */
-                offset = (insn & 0x7ff) << 1;
-                /* offset[17:12] = insn[21:16].  */
-                offset |= (insn & 0x003f0000) >> 4;
-                /* offset[31:20] = insn[26].  */
-                offset |= ((int32_t)((insn << 5) & 0x80000000)) >> 11;
-                /* offset[18] = insn[13].  */
-                offset |= (insn & (1 << 13)) << 5;
-                /* offset[19] = insn[11].  */
-                offset |= (insn & (1 << 11)) << 8;
-
-                /* jump to the offset */
-                gen_jmp(s, s->pc + offset);
+                /* Conditional branch, decoded by disas_t32().  */
+                g_assert_not_reached();
             }
         } else {
-            /* Data processing immediate.  */
-            if (insn & (1 << 25)) {
-                if (insn & (1 << 24)) {
-                    if (insn & (1 << 20))
-                        goto illegal_op;
-                    /* Bitfield/Saturate.  */
-                    op = (insn >> 21) & 7;
-                    imm = insn & 0x1f;
-                    shift = ((insn >> 6) & 3) | ((insn >> 10) & 0x1c);
-                    if (rn == 15) {
-                        tmp = tcg_temp_new_i32();
-                        tcg_gen_movi_i32(tmp, 0);
-                    } else {
-                        tmp = load_reg(s, rn);
-                    }
-                    switch (op) {
-                    case 2: /* Signed bitfield extract.  */
-                        imm++;
-                        if (shift + imm > 32)
-                            goto illegal_op;
-                        if (imm < 32)
-                            gen_sbfx(tmp, shift, imm);
-                        break;
-                    case 6: /* Unsigned bitfield extract.  */
-                        imm++;
-                        if (shift + imm > 32)
-                            goto illegal_op;
-                        if (imm < 32)
-                            gen_ubfx(tmp, shift, (1u << imm) - 1);
-                        break;
-                    case 3: /* Bitfield insert/clear.  */
-                        if (imm < shift)
-                            goto illegal_op;
-                        imm = imm + 1 - shift;
-                        if (imm != 32) {
-                            tmp2 = load_reg(s, rd);
-                            tcg_gen_deposit_i32(tmp, tmp2, tmp, shift, imm);
-                            tcg_temp_free_i32(tmp2);
-                        }
-                        break;
-                    case 7:
-                        goto illegal_op;
-                    default: /* Saturate.  */
-                        if (shift) {
-                            if (op & 1)
-                                tcg_gen_sari_i32(tmp, tmp, shift);
-                            else
-                                tcg_gen_shli_i32(tmp, tmp, shift);
-                        }
-                        tmp2 = tcg_const_i32(imm);
-                        if (op & 4) {
-                            /* Unsigned.  */
-                            if ((op & 1) && shift == 0) {
-                                if (!arm_dc_feature(s, ARM_FEATURE_THUMB_DSP)) {
-                                    tcg_temp_free_i32(tmp);
-                                    tcg_temp_free_i32(tmp2);
-                                    goto illegal_op;
-                                }
-                                gen_helper_usat16(tmp, cpu_env, tmp, tmp2);
-                            } else {
-                                gen_helper_usat(tmp, cpu_env, tmp, tmp2);
-                            }
-                        } else {
-                            /* Signed.  */
-                            if ((op & 1) && shift == 0) {
-                                if (!arm_dc_feature(s, ARM_FEATURE_THUMB_DSP)) {
-                                    tcg_temp_free_i32(tmp);
-                                    tcg_temp_free_i32(tmp2);
-                                    goto illegal_op;
-                                }
-                                gen_helper_ssat16(tmp, cpu_env, tmp, tmp2);
-                            } else {
-                                gen_helper_ssat(tmp, cpu_env, tmp, tmp2);
-                            }
-                        }
-                        tcg_temp_free_i32(tmp2);
-                        break;
-                    }
-                    store_reg(s, rd, tmp);
-                } else {
-                    imm = ((insn & 0x04000000) >> 15)
-                          | ((insn & 0x7000) >> 4) | (insn & 0xff);
-                    if (insn & (1 << 22)) {
-                        /* 16-bit immediate.  */
-                        imm |= (insn >> 4) & 0xf000;
-                        if (insn & (1 << 23)) {
-                            /* movt */
-                            tmp = load_reg(s, rd);
-                            tcg_gen_ext16u_i32(tmp, tmp);
-                            tcg_gen_ori_i32(tmp, tmp, imm << 16);
-                        } else {
-                            /* movw */
-                            tmp = tcg_temp_new_i32();
-                            tcg_gen_movi_i32(tmp, imm);
-                        }
-                    } else {
-                        /* Add/sub 12-bit immediate.  */
-                        if (rn == 15) {
-                            offset = s->pc & ~(uint32_t)3;
-                            if (insn & (1 << 23))
-                                offset -= imm;
-                            else
-                                offset += imm;
-                            tmp = tcg_temp_new_i32();
-                            tcg_gen_movi_i32(tmp, offset);
-                        } else {
-                            tmp = load_reg(s, rn);
-                            if (insn & (1 << 23))
-                                tcg_gen_subi_i32(tmp, tmp, imm);
-                            else
-                                tcg_gen_addi_i32(tmp, tmp, imm);
-                        }
-                    }
-                    store_reg(s, rd, tmp);
-                }
-            } else {
-                int shifter_out = 0;
-                /* modified 12-bit immediate.  */
-                shift = ((insn & 0x04000000) >> 23) | ((insn & 0x7000) >> 12);
-                imm = (insn & 0xff);
-                switch (shift) {
-                case 0: /* XY */
-                    /* Nothing to do.  */
-                    break;
-                case 1: /* 00XY00XY */
-                    imm |= imm << 16;
-                    break;
-                case 2: /* XY00XY00 */
-                    imm |= imm << 16;
-                    imm <<= 8;
-                    break;
-                case 3: /* XYXYXYXY */
-                    imm |= imm << 16;
-                    imm |= imm << 8;
-                    break;
-                default: /* Rotated constant.  */
-                    shift = (shift << 1) | (imm >> 7);
-                    imm |= 0x80;
-                    imm = imm << (32 - shift);
-                    shifter_out = 1;
-                    break;
-                }
-                tmp2 = tcg_temp_new_i32();
-                tcg_gen_movi_i32(tmp2, imm);
-                rn = (insn >> 16) & 0xf;
-                if (rn == 15) {
-                    tmp = tcg_temp_new_i32();
-                    tcg_gen_movi_i32(tmp, 0);
-                } else {
-                    tmp = load_reg(s, rn);
-                }
-                op = (insn >> 21) & 0xf;
-                if (gen_thumb2_data_op(s, op, (insn & (1 << 20)) != 0,
-                                       shifter_out, tmp, tmp2))
-                    goto illegal_op;
-                tcg_temp_free_i32(tmp2);
-                rd = (insn >> 8) & 0xf;
-                if (rd != 15) {
-                    store_reg(s, rd, tmp);
-                } else {
-                    tcg_temp_free_i32(tmp);
-                }
-            }
+            /* Data processing immediate.  The allocated encodings are
+               decoded by disas_t32().  */
+            goto illegal_op;
         }
         break;
     case 12: /* Load/store single data item.  */
@@ -11949,10 +12198,14 @@ void gen_intermediate_code(CPUARMState *env, TranslationBlock *tb)
         case DISAS_NEXT:
             gen_goto_tb(dc, 1, dc->pc);
             break;
+        case DISAS_JUMP:
+            /* Indirect branches, exception returns and CPU state changes:
+               look up the next TB from the new state */
+            tcg_gen_lookup_and_goto_ptr();
+            break;
         case DISAS_UPDATE:
             gen_set_pc_im(dc, dc->pc);
             /* fall through */
-        case DISAS_JUMP:
         default:
             /* indicate that the hash table must be used to find the next TB */
             tcg_gen_exit_tb(0);
@@ -75,6 +75,8 @@ DEF_HELPER_3(boundl, void, env, tl, int)
 DEF_HELPER_1(rsm, void, env)
 DEF_HELPER_2(into, void, env, int)
 DEF_HELPER_2(cmpxchg8b, void, env, tl)
+DEF_HELPER_6(rep_movs, tl, env, tl, tl, tl, tl, i32)
+DEF_HELPER_6(rep_stos, tl, env, tl, tl, tl, tl, i32)
 #ifdef TARGET_X86_64
 DEF_HELPER_2(cmpxchg16b, void, env, tl)
 #endif
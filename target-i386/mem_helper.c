@@ -22,6 +22,7 @@
 #include "exec/helper-proto.h"
 #include "exec/exec-all.h"
 #include "exec/cpu_ldst.h"
+#include "tcg.h"
 
 /* broken thread support */
 
@@ -56,12 +57,151 @@ void helper_lock_init(void)
 }
 #endif
 
+/* Number of elements of SIZE bytes, at most COUNT, that a string
+   instruction can process from ADDR in the direction of DF without
+   leaving the page.  */
+static target_ulong string_page_elements(target_ulong addr,
+                                         target_ulong count, int size,
+                                         int df)
+{
+    target_ulong offset = addr & ~TARGET_PAGE_MASK;
+    target_ulong n;
+
+    if (offset + size > TARGET_PAGE_SIZE) {
+        return 0;
+    }
+    n = df > 0 ? (TARGET_PAGE_SIZE - offset) / size : offset / size + 1;
+    return MIN(n, count);
+}
+
+/* Likewise, without wrapping around the offset REG & AMASK, where AMASK
+   covers the address size (16-bit offsets wrap at 64 KiB).  */
+static target_ulong string_wrap_elements(target_ulong reg, target_ulong amask,
+                                         target_ulong count, int size, int df)
+{
+    target_ulong offset = reg & amask;
+    target_ulong n;
+
+    if (offset > amask - (size - 1)) {
+        return 0;
+    }
+    n = df > 0 ? (amask - offset - (size - 1)) / size + 1 : offset / size + 1;
+    return MIN(n, count);
+}
+
+/* The rest of a "rep movs" or "rep stos" within the current pages is done
+   directly in host memory when possible.  A0S and A0D are the linear
+   addresses of the current element, COUNT is ECX and AMASK the mask of
+   the address size.  These return the number of elements processed, and
+   leave ESI, EDI and ECX to the caller; 0 means that the caller must go
+   through the normal accessors.  */
+target_ulong helper_rep_movs(CPUX86State *env, target_ulong a0s,
+                             target_ulong a0d, target_ulong count,
+                             target_ulong amask, uint32_t ot)
+{
+    int size = 1 << ot;
+    int mmu_idx = cpu_mmu_index(env, false);
+    target_ulong n;
+    uint8_t *src, *dst;
+    size_t len;
+
+    n = string_page_elements(a0s, count, size, env->df);
+    n = string_page_elements(a0d, n, size, env->df);
+    n = string_wrap_elements(env->regs[R_ESI], amask, n, size, env->df);
+    n = string_wrap_elements(env->regs[R_EDI], amask, n, size, env->df);
+    if (n <= 1) {
+        return 0;
+    }
+    src = probe_host(env, a0s, MMU_DATA_LOAD, mmu_idx, GETPC());
+    dst = probe_host(env, a0d, MMU_DATA_STORE, mmu_idx, GETPC());
+    if (!src || !dst) {
+        return 0;
+    }
+
+    len = n * size;
+    if (env->df < 0) {
+        src -= len - size;
+        dst -= len - size;
+    }
+    /* Overlapping copies in the direction of DF replicate the data, which
+       memmove does not do.  */
+    if (env->df > 0 ? dst > src && dst < src + len
+                    : src > dst && src < dst + len) {
+        return 0;
+    }
+    memmove(dst, src, len);
+    return n;
+}
+
+target_ulong helper_rep_stos(CPUX86State *env, target_ulong a0d,
+                             target_ulong count, target_ulong val,
+                             target_ulong amask, uint32_t ot)
+{
+    int size = 1 << ot;
+    int mmu_idx = cpu_mmu_index(env, false);
+    target_ulong n, i;
+    uint8_t *dst;
+
+    n = string_page_elements(a0d, count, size, env->df);
+    n = string_wrap_elements(env->regs[R_EDI], amask, n, size, env->df);
+    if (n <= 1) {
+        return 0;
+    }
+    dst = probe_host(env, a0d, MMU_DATA_STORE, mmu_idx, GETPC());
+    if (!dst) {
+        return 0;
+    }
+
+    if (env->df < 0) {
+        dst -= (n - 1) * size;
+    }
+    switch (size) {
+    case 1:
+        memset(dst, val, n);
+        break;
+    case 2:
+        for (i = 0; i < n; i++) {
+            stw_le_p(dst + i * 2, val);
+        }
+        break;
+    case 4:
+        for (i = 0; i < n; i++) {
+            stl_le_p(dst + i * 4, val);
+        }
+        break;
+    default:
+        for (i = 0; i < n; i++) {
+            stq_le_p(dst + i * 8, val);
+        }
+        break;
+    }
+    return n;
+}
+
 void helper_cmpxchg8b(CPUX86State *env, target_ulong a0)
 {
     uint64_t d;
     int eflags;
 
     eflags = cpu_cc_compute_all(env, CC_OP);
+    if (parallel_cpus) {
+        uint64_t cmpv = ((uint64_t)env->regs[R_EDX] << 32)
+                        | (uint32_t)env->regs[R_EAX];
+        uint64_t newv = ((uint64_t)env->regs[R_ECX] << 32)
+                        | (uint32_t)env->regs[R_EBX];
+        TCGMemOpIdx oi = make_memop_idx(MO_LEQ, cpu_mmu_index(env, false));
+
+        d = tcg_atomic_cmpxchg_i64(env, a0, cmpv, newv, oi, GETPC());
+        if (d == cmpv) {
+            eflags |= CC_Z;
+        } else {
+            env->regs[R_EDX] = (uint32_t)(d >> 32);
+            env->regs[R_EAX] = (uint32_t)d;
+            eflags &= ~CC_Z;
+        }
+        CC_SRC = eflags;
+        return;
+    }
     d = cpu_ldq_data_ra(env, a0, GETPC());
     if (d == (((uint64_t)env->regs[R_EDX] << 32) | (uint32_t)env->regs[R_EAX])) {
         cpu_stq_data_ra(env, a0, ((uint64_t)env->regs[R_ECX] << 32)
@@ -23,16 +23,10 @@
  */
 #include "qemu/osdep.h"
 #include "qemu/host-utils.h"
-
-/* This file is compiled once, and thus we can't include the standard
-   "exec/helper-proto.h", which has includes that are target specific.  */
-
-#include "exec/helper-head.h"
-
-#define DEF_HELPER_FLAGS_2(name, flags, ret, t1, t2) \
-  dh_ctype(ret) HELPER(name) (dh_ctype(t1), dh_ctype(t2));
-
-#include "tcg-runtime.h"
+#include "cpu.h"
+#include "exec/helper-proto.h"
+#include "exec/exec-all.h"
+#include "exec/tb-hash.h"
 
 
 /* 32-bit helpers */
@@ -107,3 +101,207 @@ int64_t HELPER(mulsh_i64)(int64_t arg1, int64_t arg2)
     muls64(&l, &h, arg1, arg2);
     return h;
 }
+
+/* Indirect branches */
+
+/* Return the host code of the TB that is to run next, or the epilogue
+   if it is not in the jump cache and the main loop has to find it.  The
+   main loop must also handle pending interrupts, and while traces are
+   being formed, every block that is not a trace has to be counted.  */
+void *HELPER(lookup_tb_ptr)(CPUArchState *env)
+{
+    CPUState *cpu = ENV_GET_CPU(env);
+    TranslationBlock *tb;
+    target_ulong cs_base, pc;
+    uint32_t flags;
+
+    if (unlikely(atomic_read(&cpu->interrupt_request))) {
+        return tcg_ctx.code_gen_epilogue;
+    }
+    cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    tb = atomic_read(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)]);
+    if (unlikely(!tb || tb->pc != pc || tb->cs_base != cs_base ||
+                 tb->flags != flags || tb->invalid)) {
+        return tcg_ctx.code_gen_epilogue;
+    }
+    if (tb_trace_threshold && !(tb->cflags & CF_TRACE)) {
+        return tcg_ctx.code_gen_epilogue;
+    }
+    return tb->tc_ptr;
+}
+
+/* Memory barriers and atomic operations */
+
+void HELPER(mb)(void)
+{
+    smp_mb();
+}
+
+void HELPER(exit_atomic)(CPUArchState *env)
+{
+    cpu_loop_exit_atomic(ENV_GET_CPU(env), GETPC());
+}
+
+/* While vCPUs run in parallel, a guest read-modify-write is done with a
+   host atomic instruction on the host address of the guest data.  When
+   there is no such address (I/O, watchpoints, pages with translated
+   code), when the access is not aligned or when it is wider than the
+   host can do atomically, the instruction is restarted in an exclusive
+   section instead, where it is done with plain loads and stores.  */
+static void *atomic_mmu_lookup(CPUArchState *env, target_ulong addr,
+                               TCGMemOpIdx oi, uintptr_t retaddr)
+{
+    TCGMemOp mop = get_memop(oi);
+    target_ulong size = 1 << (mop & MO_SIZE);
+    void *haddr = NULL;
+
+    /* Aligned accesses never cross a page.  */
+    if (!(addr & (size - 1))
+        && (HOST_LONG_BITS == 64 || (mop & MO_SIZE) != MO_64)) {
+        haddr = probe_host(env, addr, MMU_DATA_STORE, get_mmuidx(oi),
+                           retaddr);
+    }
+    if (!haddr) {
+        cpu_loop_exit_atomic(ENV_GET_CPU(env), retaddr);
+    }
+    return haddr;
+}
+
+/* Values are in host order and zero-extended; MO_BSWAP in MOP tells
+   whether guest memory has the other byte order.  */
+static uint32_t host_cmpxchg_i32(void *haddr, uint32_t cmpv, uint32_t newv,
+                                 TCGMemOp mop)
+{
+    switch (mop & MO_SIZE) {
+    case MO_8:
+        return atomic_cmpxchg((uint8_t *)haddr, cmpv, newv);
+    case MO_16:
+        if (mop & MO_BSWAP) {
+            return bswap16(atomic_cmpxchg((uint16_t *)haddr,
+                                          bswap16(cmpv), bswap16(newv)));
+        }
+        return atomic_cmpxchg((uint16_t *)haddr, cmpv, newv);
+    default:
+        if (mop & MO_BSWAP) {
+            return bswap32(atomic_cmpxchg((uint32_t *)haddr,
+                                          bswap32(cmpv), bswap32(newv)));
+        }
+        return atomic_cmpxchg((uint32_t *)haddr, cmpv, newv);
+    }
+}
+
+static uint32_t host_load_i32(void *haddr, TCGMemOp mop)
+{
+    switch (mop & MO_SIZE) {
+    case MO_8:
+        return atomic_read((uint8_t *)haddr);
+    case MO_16:
+        if (mop & MO_BSWAP) {
+            return bswap16(atomic_read((uint16_t *)haddr));
+        }
+        return atomic_read((uint16_t *)haddr);
+    default:
+        if (mop & MO_BSWAP) {
+            return bswap32(atomic_read((uint32_t *)haddr));
+        }
+        return atomic_read((uint32_t *)haddr);
+    }
+}
+
+#if HOST_LONG_BITS == 64
+static uint64_t host_cmpxchg_i64(void *haddr, uint64_t cmpv, uint64_t newv,
+                                 TCGMemOp mop)
+{
+    if ((mop & MO_SIZE) != MO_64) {
+        return host_cmpxchg_i32(haddr, cmpv, newv, mop);
+    }
+    if (mop & MO_BSWAP) {
+        return bswap64(atomic_cmpxchg((uint64_t *)haddr,
+                                      bswap64(cmpv), bswap64(newv)));
+    }
+    return atomic_cmpxchg((uint64_t *)haddr, cmpv, newv);
+}
+
+static uint64_t host_load_i64(void *haddr, TCGMemOp mop)
+{
+    if ((mop & MO_SIZE) != MO_64) {
+        return host_load_i32(haddr, mop);
+    }
+    if (mop & MO_BSWAP) {
+        return bswap64(atomic_read((uint64_t *)haddr));
+    }
+    return atomic_read((uint64_t *)haddr);
+}
+#else
+/* atomic_mmu_lookup never lets 64-bit accesses through to these.  */
+static uint64_t host_cmpxchg_i64(void *haddr, uint64_t cmpv, uint64_t newv,
+                                 TCGMemOp mop)
+{
+    return host_cmpxchg_i32(haddr, cmpv, newv, mop);
+}
+
+static uint64_t host_load_i64(void *haddr, TCGMemOp mop)
+{
+    return host_load_i32(haddr, mop);
+}
+#endif
+
+uint32_t tcg_atomic_cmpxchg_i32(CPUArchState *env, target_ulong addr,
+                                uint32_t cmpv, uint32_t newv,
+                                TCGMemOpIdx oi, uintptr_t retaddr)
+{
+    void *haddr = atomic_mmu_lookup(env, addr, oi, retaddr);
+
+    return host_cmpxchg_i32(haddr, cmpv, newv, get_memop(oi));
+}
+
+uint64_t tcg_atomic_cmpxchg_i64(CPUArchState *env, target_ulong addr,
+                                uint64_t cmpv, uint64_t newv,
+                                TCGMemOpIdx oi, uintptr_t retaddr)
+{
+    void *haddr = atomic_mmu_lookup(env, addr, oi, retaddr);
+
+    return host_cmpxchg_i64(haddr, cmpv, newv, get_memop(oi));
+}
+
+uint32_t HELPER(atomic_cmpxchg_i32)(CPUArchState *env, target_ulong addr,
+                                    uint32_t cmpv, uint32_t newv, uint32_t oi)
+{
+    return tcg_atomic_cmpxchg_i32(env, addr, cmpv, newv, oi, GETPC());
+}
+
+uint64_t HELPER(atomic_cmpxchg_i64)(CPUArchState *env, target_ulong addr,
+                                    uint64_t cmpv, uint64_t newv, uint32_t oi)
+{
+    return tcg_atomic_cmpxchg_i64(env, addr, cmpv, newv, oi, GETPC());
+}
+
+/* The other operations are a compare-and-swap loop, which also covers
+   the sizes and operations the host has no direct instruction for.  */
+#define GEN_ATOMIC_HELPER(NAME, TYPE, BITS, OP)                         \
+TYPE HELPER(atomic_##NAME##_i##BITS)(CPUArchState *env, target_ulong addr, \
+                                     TYPE val, uint32_t oi)             \
+{                                                                       \
+    void *haddr = atomic_mmu_lookup(env, addr, oi, GETPC());            \
+    TCGMemOp mop = get_memop(oi);                                       \
+    TYPE cmpv, old = host_load_i##BITS(haddr, mop);                     \
+                                                                        \
+    do {                                                                \
+        cmpv = old;                                                     \
+        old = host_cmpxchg_i##BITS(haddr, cmpv, OP, mop);               \
+    } while (old != cmpv);                                              \
+    return old;                                                         \
+}
+
+GEN_ATOMIC_HELPER(xchg, uint32_t, 32, val)
+GEN_ATOMIC_HELPER(xchg, uint64_t, 64, val)
+GEN_ATOMIC_HELPER(fetch_add, uint32_t, 32, cmpv + val)
+GEN_ATOMIC_HELPER(fetch_add, uint64_t, 64, cmpv + val)
+GEN_ATOMIC_HELPER(fetch_and, uint32_t, 32, cmpv & val)
+GEN_ATOMIC_HELPER(fetch_and, uint64_t, 64, cmpv & val)
+GEN_ATOMIC_HELPER(fetch_or, uint32_t, 32, cmpv | val)
+GEN_ATOMIC_HELPER(fetch_or, uint64_t, 64, cmpv | val)
+GEN_ATOMIC_HELPER(fetch_xor, uint32_t, 32, cmpv ^ val)
+GEN_ATOMIC_HELPER(fetch_xor, uint64_t, 64, cmpv ^ val)
+
+#undef GEN_ATOMIC_HELPER
@@ -36,6 +36,7 @@ struct tcg_temp_info {
     bool is_const;
     uint16_t prev_copy;
     uint16_t next_copy;
+    uint32_t version;
     tcg_target_ulong val;
     tcg_target_ulong mask;
 };
@@ -43,6 +44,30 @@ struct tcg_temp_info {
 static struct tcg_temp_info temps[TCG_MAX_TEMPS];
 static TCGTempSet temps_used;
 
+/* Value numbering.  Pure operations are remembered together with the
+   temp holding their result, until the end of the basic block.  A temp
+   changes version whenever it is written, so an expression can only be
+   reused while neither its inputs nor its result have been overwritten.
+   Loads are also tied to the number of operations so far that may have
+   written memory.  */
+#define EXPR_TABLE_SIZE 128
+#define EXPR_MAX_ARGS   6
+
+struct tcg_opt_expr {
+    uint32_t gen;
+    uint32_t mem_epoch;
+    TCGOpcode opc;
+    uint8_t const_args;         /* inputs given by value, one bit each */
+    TCGArg result;
+    uint32_t result_version;
+    TCGArg args[EXPR_MAX_ARGS];
+    uint32_t versions[EXPR_MAX_ARGS];
+};
+
+static struct tcg_opt_expr exprs[EXPR_TABLE_SIZE];
+static uint32_t expr_gen;
+static uint32_t mem_epoch;
+
 static inline bool temp_is_const(TCGArg arg)
 {
     return temps[arg].is_const;
@@ -62,12 +87,15 @@ static void reset_temp(TCGArg temp)
     temps[temp].prev_copy = temp;
     temps[temp].is_const = false;
     temps[temp].mask = -1;
+    temps[temp].version++;
 }
 
 /* Reset all temporaries, given that there are NB_TEMPS of them.  */
 static void reset_all_temps(int nb_temps)
 {
     bitmap_zero(temps_used.l, nb_temps);
+    /* Forget all expressions as well.  */
+    expr_gen++;
 }
 
 /* Initialize and activate a temporary.  */
@@ -538,7 +566,211 @@ static bool swap_commutative2(TCGArg *p1, TCGArg *p2)
     return false;
 }
 
-/* Propagate constants and copies, fold constant expressions. */
+/* Return the number of bytes accessed by the host memory load or store
+   OPC, or 0 if it is not one.  */
+static int op_mem_size(TCGOpcode opc)
+{
+    switch (opc) {
+    CASE_OP_32_64(ld8u):
+    CASE_OP_32_64(ld8s):
+    CASE_OP_32_64(st8):
+        return 1;
+    CASE_OP_32_64(ld16u):
+    CASE_OP_32_64(ld16s):
+    CASE_OP_32_64(st16):
+        return 2;
+    case INDEX_op_ld_i32:
+    case INDEX_op_ld32u_i64:
+    case INDEX_op_ld32s_i64:
+    case INDEX_op_st_i32:
+    case INDEX_op_st32_i64:
+        return 4;
+    case INDEX_op_ld_i64:
+    case INDEX_op_st_i64:
+        return 8;
+    case INDEX_op_ld_vec:
+    case INDEX_op_st_vec:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+static bool op_is_store(TCGOpcode opc)
+{
+    const TCGOpDef *def = &tcg_op_defs[opc];
+    return def->nb_oargs == 0 && op_mem_size(opc) != 0;
+}
+
+/* Return the slot of EXPRS for the operation OPC, or -1 if its result
+   is not worth remembering.  */
+static int expr_slot(TCGContext *s, TCGOpcode opc, const TCGArg *args)
+{
+    const TCGOpDef *def = &tcg_op_defs[opc];
+    int i, nb_args = def->nb_iargs + def->nb_cargs;
+    uint32_t h = opc;
+
+    if (def->nb_oargs != 1 || nb_args > EXPR_MAX_ARGS
+        || (def->flags & (TCG_OPF_BB_END | TCG_OPF_CALL_CLOBBER
+                          | TCG_OPF_SIDE_EFFECTS | TCG_OPF_NOT_PRESENT))
+        || s->temps[args[0]].type == TCG_TYPE_V128) {
+        return -1;
+    }
+    switch (opc) {
+    CASE_OP_32_64(mov):
+    CASE_OP_32_64(movi):
+        return -1;
+    default:
+        break;
+    }
+    for (i = 1; i <= nb_args; i++) {
+        if (i <= def->nb_iargs) {
+            if (args[i] == args[0]) {
+                /* The result overwrites an input.  */
+                return -1;
+            }
+            h = h * 31 + (temp_is_const(args[i]) ? temps[args[i]].val
+                                                 : args[i]);
+        } else {
+            h = h * 31 + args[i];
+        }
+    }
+    return h % EXPR_TABLE_SIZE;
+}
+
+/* Return true and set *RES if the expression in slot I computes the same
+   value as operation OPC, and that value is still held in *RES.  */
+static bool expr_find(int i, TCGOpcode opc, const TCGArg *args, TCGArg *res)
+{
+    const TCGOpDef *def = &tcg_op_defs[opc];
+    const struct tcg_opt_expr *e = &exprs[i];
+    int j;
+
+    if (e->gen != expr_gen || e->opc != opc
+        || temps[e->result].version != e->result_version
+        || (op_mem_size(opc) && e->mem_epoch != mem_epoch)) {
+        return false;
+    }
+    for (j = 0; j < def->nb_iargs + def->nb_cargs; j++) {
+        TCGArg arg = args[j + 1];
+
+        if (j >= def->nb_iargs) {
+            if (e->args[j] != arg) {
+                return false;
+            }
+        } else if (e->const_args & (1 << j)) {
+            if (!temp_is_const(arg) || temps[arg].val != e->args[j]) {
+                return false;
+            }
+        } else if (e->args[j] != arg || temps[arg].version != e->versions[j]) {
+            return false;
+        }
+    }
+    *res = e->result;
+    return true;
+}
+
+/* Remember in slot I the operation OPC, whose result has just been
+   written.  */
+static void expr_record(int i, TCGOpcode opc, const TCGArg *args)
+{
+    const TCGOpDef *def = &tcg_op_defs[opc];
+    struct tcg_opt_expr *e = &exprs[i];
+    int j;
+
+    e->gen = expr_gen;
+    e->mem_epoch = mem_epoch;
+    e->opc = opc;
+    e->const_args = 0;
+    e->result = args[0];
+    e->result_version = temps[args[0]].version;
+    for (j = 0; j < def->nb_iargs + def->nb_cargs; j++) {
+        TCGArg arg = args[j + 1];
+
+        if (j < def->nb_iargs && temp_is_const(arg)) {
+            e->const_args |= 1 << j;
+            e->args[j] = temps[arg].val;
+        } else {
+            e->args[j] = arg;
+            e->versions[j] = temps[arg].version;
+        }
+    }
+}
+
+/* Remove stores to the CPU state that are overwritten later in the same
+   basic block, with no operation in between that could read them.
+   Calls, operations that can raise exceptions and loads through
+   pointers other than env are all assumed to read the whole state.  */
+#define DEAD_STORE_RANGES 16
+
+static void tcg_optimize_dead_stores(TCGContext *s)
+{
+    struct {
+        intptr_t ofs;
+        int size;
+    } killed[DEAD_STORE_RANGES];
+    TCGArg env = GET_TCGV_PTR(s->tcg_env);
+    int oi, oi_prev, nb_killed = 0;
+
+    for (oi = s->gen_op_buf[0].prev; oi != 0; oi = oi_prev) {
+        TCGOp * const op = &s->gen_op_buf[oi];
+        TCGArg * const args = &s->gen_opparam_buf[op->args];
+        TCGOpcode opc = op->opc;
+        const TCGOpDef *def = &tcg_op_defs[opc];
+        intptr_t ofs;
+        int i, size;
+
+        oi_prev = op->prev;
+
+        if (opc == INDEX_op_call
+            || (def->flags & (TCG_OPF_BB_END | TCG_OPF_CALL_CLOBBER
+                              | TCG_OPF_SIDE_EFFECTS))) {
+            nb_killed = 0;
+            continue;
+        }
+        size = op_mem_size(opc);
+        if (size == 0) {
+            continue;
+        }
+        ofs = args[2];
+        if (args[1] != env) {
+            if (!op_is_store(opc)) {
+                nb_killed = 0;
+            }
+            continue;
+        }
+
+        if (!op_is_store(opc)) {
+            /* Stores before this load are no longer dead.  */
+            for (i = 0; i < nb_killed; ) {
+                if (ofs < killed[i].ofs + killed[i].size
+                    && killed[i].ofs < ofs + size) {
+                    killed[i] = killed[--nb_killed];
+                } else {
+                    i++;
+                }
+            }
+            continue;
+        }
+
+        for (i = 0; i < nb_killed; i++) {
+            if (killed[i].ofs <= ofs
+                && ofs + size <= killed[i].ofs + killed[i].size) {
+                break;
+            }
+        }
+        if (i < nb_killed) {
+            tcg_op_remove(s, op);
+        } else if (nb_killed < DEAD_STORE_RANGES) {
+            killed[nb_killed].ofs = ofs;
+            killed[nb_killed].size = size;
+            nb_killed++;
+        }
+    }
+}
+
+/* Propagate constants and copies, fold constant expressions, reuse the
+   results of identical operations and remove dead stores.  */
 void tcg_optimize(TCGContext *s)
 {
     int oi, oi_next, nb_temps, nb_globals;
@@ -554,7 +786,7 @@ void tcg_optimize(TCGContext *s)
 
     for (oi = s->gen_op_buf[0].next; oi != 0; oi = oi_next) {
         tcg_target_ulong mask, partmask, affected;
-        int nb_oargs, nb_iargs, i;
+        int nb_oargs, nb_iargs, i, slot;
         TCGArg tmp;
 
         TCGOp * const op = &s->gen_op_buf[oi];
@@ -590,6 +822,12 @@ void tcg_optimize(TCGContext *s)
             }
         }
 
+        /* Loads cannot be reused across anything that may write memory */
+        if (opc == INDEX_op_call || op_is_store(opc)
+            || (def->flags & (TCG_OPF_CALL_CLOBBER | TCG_OPF_SIDE_EFFECTS))) {
+            mem_epoch++;
+        }
+
         /* For commutative operations make constant second argument */
         switch (opc) {
         CASE_OP_32_64(add):
@@ -1271,7 +1509,10 @@ void tcg_optimize(TCGContext *s)
                     }
                 }
             }
-            goto do_reset_output;
+            for (i = 0; i < nb_oargs; i++) {
+                reset_temp(args[i]);
+            }
+            break;
 
         default:
         do_default:
@@ -1282,18 +1523,29 @@ void tcg_optimize(TCGContext *s)
                the non-zero bits mask for the first output arg.  */
             if (def->flags & TCG_OPF_BB_END) {
                 reset_all_temps(nb_temps);
-            } else {
-        do_reset_output:
-                for (i = 0; i < nb_oargs; i++) {
-                    reset_temp(args[i]);
-                    /* Save the corresponding known-zero bits mask for the
-                       first output argument (only one supported so far). */
-                    if (i == 0) {
-                        temps[args[i]].mask = mask;
-                    }
+                break;
+            }
+            /* Reuse the result of an identical operation if there is
+               one, otherwise remember this one.  */
+            slot = expr_slot(s, opc, args);
+            if (slot >= 0 && expr_find(slot, opc, args, &tmp)) {
+                tcg_opt_gen_mov(s, op, args, args[0], tmp);
+                break;
+            }
+            for (i = 0; i < nb_oargs; i++) {
+                reset_temp(args[i]);
+                /* Save the corresponding known-zero bits mask for the
+                   first output argument (only one supported so far). */
+                if (i == 0) {
+                    temps[args[i]].mask = mask;
                 }
             }
+            if (slot >= 0) {
+                expr_record(slot, opc, args);
+            }
             break;
         }
     }
+
+    tcg_optimize_dead_stores(s);
 }
@@ -118,6 +118,9 @@ enum {
     TCG_AREG0 = TCG_REG_R10,
 };
 
+/* z/Architecture orders all accesses except stores followed by loads */
+#define TCG_TARGET_DEFAULT_MO (TCG_MO_ALL & ~TCG_MO_ST_LD)
+
 static inline void flush_icache_range(uintptr_t start, uintptr_t stop)
 {
 }
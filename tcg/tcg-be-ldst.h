@@ -59,6 +59,19 @@ static void tcg_out_qemu_st_slow_path(TCGContext *s, TCGLabelQemuLdst *l);
 static bool tcg_out_tb_finalize(TCGContext *s)
 {
     TCGLabelQemuLdst *lb;
+    tcg_insn_unit *hot_ptr = NULL;
+    void *highwater = s->code_gen_highwater;
+    bool ok = true;
+
+#ifdef TCG_TARGET_SPLIT_COLD_CODE
+    /* Move the slow paths out of line, unless the TB is recorded for the
+       translation cache, which saves a single contiguous block.  */
+    if (s->be->labels && s->code_gen_cold_ptr && !s->code_relocs_enabled) {
+        hot_ptr = s->code_ptr;
+        s->code_ptr = s->code_gen_cold_ptr;
+        highwater = s->code_gen_cold_highwater;
+    }
+#endif
 
     /* qemu_ld/st slow paths */
     for (lb = s->be->labels; lb != NULL; lb = lb->next) {
@@ -72,11 +85,21 @@ static bool tcg_out_tb_finalize(TCGContext *s)
            one operation beginning below the high water mark cannot overrun
            the buffer completely.  Thus we can test for overflow after
            generating code without having to check during generation.  */
-        if (unlikely((void *)s->code_ptr > s->code_gen_highwater)) {
-            return false;
+        if (unlikely((void *)s->code_ptr > highwater)) {
+            ok = false;
+            break;
+        }
+    }
+
+    if (hot_ptr) {
+        if (ok) {
+            flush_icache_range((uintptr_t)s->code_gen_cold_ptr,
+                               (uintptr_t)s->code_ptr);
+            s->code_gen_cold_ptr = s->code_ptr;
         }
+        s->code_ptr = hot_ptr;
     }
-    return true;
+    return ok;
 }
 
 /*
@@ -0,0 +1,481 @@
+/*
+ * Generic vector operation expansion
+ *
+ * Copyright (c) 2016 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "tcg.h"
+#include "tcg-op.h"
+#include "tcg-op-gvec.h"
+
+/* Replicate the low 8 << VECE bits of C across 64 bits.  */
+static uint64_t gvec_dup_const(unsigned vece, uint64_t c)
+{
+    switch (vece) {
+    case MO_8:
+        return 0x0101010101010101ull * (uint8_t)c;
+    case MO_16:
+        return 0x0001000100010001ull * (uint16_t)c;
+    case MO_32:
+        return 0x0000000100000001ull * (uint32_t)c;
+    case MO_64:
+        return c;
+    default:
+        tcg_abort();
+    }
+}
+
+/* All-ones in the low 8 << VECE bits.  */
+static uint64_t gvec_elt_mask(unsigned vece)
+{
+    return vece == MO_64 ? -1ull : (1ull << (8 << vece)) - 1;
+}
+
+static void check_size(uint32_t oprsz)
+{
+    tcg_debug_assert(oprsz == 8 || (oprsz > 0 && oprsz % 16 == 0));
+}
+
+/* Return true if the 16-byte chunks of an operation can use OPC.  */
+static bool use_vec(TCGOpcode opc, unsigned vece, uint32_t oprsz)
+{
+    return (TCG_TARGET_HAS_v128 && oprsz >= 16
+            && tcg_can_emit_vec_op(opc, vece));
+}
+
+typedef struct {
+    /* Expand one 64-bit word.  */
+    void (*fni8)(unsigned, TCGv_i64, TCGv_i64, TCGv_i64);
+    /* Expand one 128-bit chunk, if the host supports OPC.  */
+    void (*fniv)(unsigned, TCGv_vec, TCGv_vec, TCGv_vec);
+    TCGOpcode opc;
+} GVecGen3;
+
+typedef struct {
+    void (*fni8)(unsigned, TCGv_i64, TCGv_i64, unsigned);
+    void (*fniv)(unsigned, TCGv_vec, TCGv_vec, int64_t);
+    TCGOpcode opc;
+} GVecGen2i;
+
+static void expand_3(unsigned vece, uint32_t dofs, uint32_t aofs,
+                     uint32_t bofs, uint32_t oprsz, const GVecGen3 *g)
+{
+    uint32_t i = 0;
+
+    check_size(oprsz);
+    if (use_vec(g->opc, vece, oprsz)) {
+        TCGv_vec t0 = tcg_temp_new_vec();
+        TCGv_vec t1 = tcg_temp_new_vec();
+
+        for (; i < oprsz; i += 16) {
+            tcg_gen_ld_vec(t0, tcg_ctx.tcg_env, aofs + i);
+            tcg_gen_ld_vec(t1, tcg_ctx.tcg_env, bofs + i);
+            g->fniv(vece, t0, t0, t1);
+            tcg_gen_st_vec(t0, tcg_ctx.tcg_env, dofs + i);
+        }
+        tcg_temp_free_vec(t0);
+        tcg_temp_free_vec(t1);
+    } else {
+        TCGv_i64 t0 = tcg_temp_new_i64();
+        TCGv_i64 t1 = tcg_temp_new_i64();
+
+        for (; i < oprsz; i += 8) {
+            tcg_gen_ld_i64(t0, tcg_ctx.tcg_env, aofs + i);
+            tcg_gen_ld_i64(t1, tcg_ctx.tcg_env, bofs + i);
+            g->fni8(vece, t0, t0, t1);
+            tcg_gen_st_i64(t0, tcg_ctx.tcg_env, dofs + i);
+        }
+        tcg_temp_free_i64(t0);
+        tcg_temp_free_i64(t1);
+    }
+}
+
+static void expand_2i(unsigned vece, uint32_t dofs, uint32_t aofs,
+                      unsigned shift, uint32_t oprsz, const GVecGen2i *g)
+{
+    uint32_t i = 0;
+
+    check_size(oprsz);
+    tcg_debug_assert(shift < (8u << vece));
+    if (use_vec(g->opc, vece, oprsz)) {
+        TCGv_vec t0 = tcg_temp_new_vec();
+
+        for (; i < oprsz; i += 16) {
+            tcg_gen_ld_vec(t0, tcg_ctx.tcg_env, aofs + i);
+            g->fniv(vece, t0, t0, shift);
+            tcg_gen_st_vec(t0, tcg_ctx.tcg_env, dofs + i);
+        }
+        tcg_temp_free_vec(t0);
+    } else {
+        TCGv_i64 t0 = tcg_temp_new_i64();
+
+        for (; i < oprsz; i += 8) {
+            tcg_gen_ld_i64(t0, tcg_ctx.tcg_env, aofs + i);
+            g->fni8(vece, t0, t0, shift);
+            tcg_gen_st_i64(t0, tcg_ctx.tcg_env, dofs + i);
+        }
+        tcg_temp_free_i64(t0);
+    }
+}
+
+void tcg_gen_gvec_mov(unsigned vece, uint32_t dofs, uint32_t aofs,
+                      uint32_t oprsz)
+{
+    uint32_t i = 0;
+
+    check_size(oprsz);
+    if (dofs == aofs) {
+        return;
+    }
+    if (TCG_TARGET_HAS_v128 && oprsz >= 16) {
+        TCGv_vec t0 = tcg_temp_new_vec();
+
+        for (; i < oprsz; i += 16) {
+            tcg_gen_ld_vec(t0, tcg_ctx.tcg_env, aofs + i);
+            tcg_gen_st_vec(t0, tcg_ctx.tcg_env, dofs + i);
+        }
+        tcg_temp_free_vec(t0);
+    } else {
+        TCGv_i64 t0 = tcg_temp_new_i64();
+
+        for (; i < oprsz; i += 8) {
+            tcg_gen_ld_i64(t0, tcg_ctx.tcg_env, aofs + i);
+            tcg_gen_st_i64(t0, tcg_ctx.tcg_env, dofs + i);
+        }
+        tcg_temp_free_i64(t0);
+    }
+}
+
+/* Lane-wise addition within a 64-bit word: add with the top bit of each
+   element cleared so that no carry crosses into the next element, then
+   fix up the top bits with an exclusive-or.  */
+static void gen_add_i64(unsigned vece, TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    TCGv_i64 t1, t2, t3;
+    uint64_t m;
+
+    if (vece == MO_64) {
+        tcg_gen_add_i64(d, a, b);
+        return;
+    }
+    m = gvec_dup_const(vece, 1ull << ((8 << vece) - 1));
+    t1 = tcg_temp_new_i64();
+    t2 = tcg_temp_new_i64();
+    t3 = tcg_temp_new_i64();
+    tcg_gen_andi_i64(t1, a, ~m);
+    tcg_gen_andi_i64(t2, b, ~m);
+    tcg_gen_xor_i64(t3, a, b);
+    tcg_gen_add_i64(d, t1, t2);
+    tcg_gen_andi_i64(t3, t3, m);
+    tcg_gen_xor_i64(d, d, t3);
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t2);
+    tcg_temp_free_i64(t3);
+}
+
+/* As above, but setting the top bit of each element of the minuend so
+   that no borrow crosses into the next element.  */
+static void gen_sub_i64(unsigned vece, TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    TCGv_i64 t1, t2, t3;
+    uint64_t m;
+
+    if (vece == MO_64) {
+        tcg_gen_sub_i64(d, a, b);
+        return;
+    }
+    m = gvec_dup_const(vece, 1ull << ((8 << vece) - 1));
+    t1 = tcg_temp_new_i64();
+    t2 = tcg_temp_new_i64();
+    t3 = tcg_temp_new_i64();
+    tcg_gen_ori_i64(t1, a, m);
+    tcg_gen_andi_i64(t2, b, ~m);
+    tcg_gen_eqv_i64(t3, a, b);
+    tcg_gen_sub_i64(d, t1, t2);
+    tcg_gen_andi_i64(t3, t3, m);
+    tcg_gen_xor_i64(d, d, t3);
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t2);
+    tcg_temp_free_i64(t3);
+}
+
+void tcg_gen_gvec_add(unsigned vece, uint32_t dofs, uint32_t aofs,
+                      uint32_t bofs, uint32_t oprsz)
+{
+    static const GVecGen3 g = {
+        .fni8 = gen_add_i64,
+        .fniv = tcg_gen_add_vec,
+        .opc = INDEX_op_add_vec,
+    };
+    expand_3(vece, dofs, aofs, bofs, oprsz, &g);
+}
+
+void tcg_gen_gvec_sub(unsigned vece, uint32_t dofs, uint32_t aofs,
+                      uint32_t bofs, uint32_t oprsz)
+{
+    static const GVecGen3 g = {
+        .fni8 = gen_sub_i64,
+        .fniv = tcg_gen_sub_vec,
+        .opc = INDEX_op_sub_vec,
+    };
+    expand_3(vece, dofs, aofs, bofs, oprsz, &g);
+}
+
+#define GEN_LOGIC(NAME, OPC, I64, VEC)                                     \
+static void gen_##NAME##_i64(unsigned vece, TCGv_i64 d,                   \
+                             TCGv_i64 a, TCGv_i64 b)                      \
+{                                                                         \
+    I64(d, a, b);                                                         \
+}                                                                         \
+static void gen_##NAME##_vec(unsigned vece, TCGv_vec d,                   \
+                             TCGv_vec a, TCGv_vec b)                      \
+{                                                                         \
+    VEC(d, a, b);                                                         \
+}                                                                         \
+void tcg_gen_gvec_##NAME(unsigned vece, uint32_t dofs, uint32_t aofs,     \
+                         uint32_t bofs, uint32_t oprsz)                   \
+{                                                                         \
+    static const GVecGen3 g = {                                           \
+        .fni8 = gen_##NAME##_i64,                                         \
+        .fniv = gen_##NAME##_vec,                                         \
+        .opc = OPC,                                                       \
+    };                                                                    \
+    expand_3(vece, dofs, aofs, bofs, oprsz, &g);                          \
+}
+
+GEN_LOGIC(and, INDEX_op_and_vec, tcg_gen_and_i64, tcg_gen_and_vec)
+GEN_LOGIC(or, INDEX_op_or_vec, tcg_gen_or_i64, tcg_gen_or_vec)
+GEN_LOGIC(xor, INDEX_op_xor_vec, tcg_gen_xor_i64, tcg_gen_xor_vec)
+GEN_LOGIC(andc, INDEX_op_andc_vec, tcg_gen_andc_i64, tcg_gen_andc_vec)
+GEN_LOGIC(orc, INDEX_op_or_vec, tcg_gen_orc_i64, tcg_gen_orc_vec)
+
+#undef GEN_LOGIC
+
+static void gen_shli_i64(unsigned vece, TCGv_i64 d, TCGv_i64 a, unsigned c)
+{
+    uint64_t mask = gvec_dup_const(vece, gvec_elt_mask(vece) << c);
+
+    tcg_gen_shli_i64(d, a, c);
+    if (vece != MO_64) {
+        tcg_gen_andi_i64(d, d, mask);
+    }
+}
+
+static void gen_shri_i64(unsigned vece, TCGv_i64 d, TCGv_i64 a, unsigned c)
+{
+    uint64_t mask = gvec_dup_const(vece, gvec_elt_mask(vece) >> c);
+
+    tcg_gen_shri_i64(d, a, c);
+    if (vece != MO_64) {
+        tcg_gen_andi_i64(d, d, mask);
+    }
+}
+
+/* Shift right logically, then isolate the shifted sign bit of each
+   element and replicate it into the vacated bits with a multiply.  */
+static void gen_sari_i64(unsigned vece, TCGv_i64 d, TCGv_i64 a, unsigned c)
+{
+    uint64_t s_mask, c_mask;
+    TCGv_i64 s;
+
+    if (vece == MO_64) {
+        tcg_gen_sari_i64(d, a, c);
+        return;
+    }
+    if (c == 0) {
+        tcg_gen_mov_i64(d, a);
+        return;
+    }
+    s_mask = gvec_dup_const(vece, (1ull << ((8 << vece) - 1)) >> c);
+    c_mask = gvec_dup_const(vece, gvec_elt_mask(vece) >> c);
+    s = tcg_temp_new_i64();
+    tcg_gen_shri_i64(d, a, c);
+    tcg_gen_andi_i64(s, d, s_mask);
+    tcg_gen_muli_i64(s, s, (2ull << c) - 2);
+    tcg_gen_andi_i64(d, d, c_mask);
+    tcg_gen_or_i64(d, d, s);
+    tcg_temp_free_i64(s);
+}
+
+void tcg_gen_gvec_shli(unsigned vece, uint32_t dofs, uint32_t aofs,
+                       unsigned shift, uint32_t oprsz)
+{
+    static const GVecGen2i g = {
+        .fni8 = gen_shli_i64,
+        .fniv = tcg_gen_shli_vec,
+        .opc = INDEX_op_shli_vec,
+    };
+    expand_2i(vece, dofs, aofs, shift, oprsz, &g);
+}
+
+void tcg_gen_gvec_shri(unsigned vece, uint32_t dofs, uint32_t aofs,
+                       unsigned shift, uint32_t oprsz)
+{
+    static const GVecGen2i g = {
+        .fni8 = gen_shri_i64,
+        .fniv = tcg_gen_shri_vec,
+        .opc = INDEX_op_shri_vec,
+    };
+    expand_2i(vece, dofs, aofs, shift, oprsz, &g);
+}
+
+void tcg_gen_gvec_sari(unsigned vece, uint32_t dofs, uint32_t aofs,
+                       unsigned shift, uint32_t oprsz)
+{
+    static const GVecGen2i g = {
+        .fni8 = gen_sari_i64,
+        .fniv = tcg_gen_sari_vec,
+        .opc = INDEX_op_sari_vec,
+    };
+    expand_2i(vece, dofs, aofs, shift, oprsz, &g);
+}
+
+static void gen_ld_elt(unsigned vece, bool sign, TCGv_i64 ret, uint32_t ofs)
+{
+    TCGv_ptr env = tcg_ctx.tcg_env;
+
+    switch (vece) {
+    case MO_8:
+        (sign ? tcg_gen_ld8s_i64 : tcg_gen_ld8u_i64)(ret, env, ofs);
+        break;
+    case MO_16:
+        (sign ? tcg_gen_ld16s_i64 : tcg_gen_ld16u_i64)(ret, env, ofs);
+        break;
+    case MO_32:
+        (sign ? tcg_gen_ld32s_i64 : tcg_gen_ld32u_i64)(ret, env, ofs);
+        break;
+    default:
+        tcg_gen_ld_i64(ret, env, ofs);
+        break;
+    }
+}
+
+static void gen_st_elt(unsigned vece, TCGv_i64 val, uint32_t ofs)
+{
+    TCGv_ptr env = tcg_ctx.tcg_env;
+
+    switch (vece) {
+    case MO_8:
+        tcg_gen_st8_i64(val, env, ofs);
+        break;
+    case MO_16:
+        tcg_gen_st16_i64(val, env, ofs);
+        break;
+    case MO_32:
+        tcg_gen_st32_i64(val, env, ofs);
+        break;
+    default:
+        tcg_gen_st_i64(val, env, ofs);
+        break;
+    }
+}
+
+void tcg_gen_gvec_cmp(TCGCond cond, unsigned vece, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs, uint32_t oprsz)
+{
+    uint32_t i = 0;
+
+    check_size(oprsz);
+    if (use_vec(INDEX_op_cmp_vec, vece, oprsz)) {
+        TCGv_vec t0 = tcg_temp_new_vec();
+        TCGv_vec t1 = tcg_temp_new_vec();
+
+        for (; i < oprsz; i += 16) {
+            tcg_gen_ld_vec(t0, tcg_ctx.tcg_env, aofs + i);
+            tcg_gen_ld_vec(t1, tcg_ctx.tcg_env, bofs + i);
+            tcg_gen_cmp_vec(cond, vece, t0, t0, t1);
+            tcg_gen_st_vec(t0, tcg_ctx.tcg_env, dofs + i);
+        }
+        tcg_temp_free_vec(t0);
+        tcg_temp_free_vec(t1);
+    } else {
+        /* One element at a time, so that each can be loaded with the
+           extension the condition requires.  */
+        bool sign = !is_unsigned_cond(cond);
+        TCGv_i64 t0 = tcg_temp_new_i64();
+        TCGv_i64 t1 = tcg_temp_new_i64();
+
+        for (; i < oprsz; i += 1 << vece) {
+            gen_ld_elt(vece, sign, t0, aofs + i);
+            gen_ld_elt(vece, sign, t1, bofs + i);
+            tcg_gen_setcond_i64(cond, t0, t0, t1);
+            tcg_gen_neg_i64(t0, t0);
+            gen_st_elt(vece, t0, dofs + i);
+        }
+        tcg_temp_free_i64(t0);
+        tcg_temp_free_i64(t1);
+    }
+}
+
+void tcg_gen_gvec_dup_i64(unsigned vece, uint32_t dofs, uint32_t oprsz,
+                          TCGv_i64 in)
+{
+    uint32_t i = 0;
+
+    check_size(oprsz);
+    if (use_vec(INDEX_op_dup_vec, vece, oprsz)) {
+        TCGv_vec t0 = tcg_temp_new_vec();
+
+        tcg_gen_dup_i64_vec(vece, t0, in);
+        for (; i < oprsz; i += 16) {
+            tcg_gen_st_vec(t0, tcg_ctx.tcg_env, dofs + i);
+        }
+        tcg_temp_free_vec(t0);
+    } else {
+        TCGv_i64 t0 = tcg_temp_new_i64();
+
+        switch (vece) {
+        case MO_8:
+            tcg_gen_ext8u_i64(t0, in);
+            tcg_gen_muli_i64(t0, t0, 0x0101010101010101ull);
+            break;
+        case MO_16:
+            tcg_gen_ext16u_i64(t0, in);
+            tcg_gen_muli_i64(t0, t0, 0x0001000100010001ull);
+            break;
+        case MO_32:
+            tcg_gen_deposit_i64(t0, in, in, 32, 32);
+            break;
+        default:
+            tcg_gen_mov_i64(t0, in);
+            break;
+        }
+        for (; i < oprsz; i += 8) {
+            tcg_gen_st_i64(t0, tcg_ctx.tcg_env, dofs + i);
+        }
+        tcg_temp_free_i64(t0);
+    }
+}
+
+void tcg_gen_gvec_dup_i32(unsigned vece, uint32_t dofs, uint32_t oprsz,
+                          TCGv_i32 in)
+{
+    TCGv_i64 t0 = tcg_temp_new_i64();
+
+    tcg_debug_assert(vece <= MO_32);
+    tcg_gen_extu_i32_i64(t0, in);
+    tcg_gen_gvec_dup_i64(vece, dofs, oprsz, t0);
+    tcg_temp_free_i64(t0);
+}
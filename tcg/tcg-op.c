@@ -24,6 +24,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu-common.h"
+#include "qemu/log.h"
 #include "cpu.h"
 #include "exec/exec-all.h"
 #include "tcg.h"
@@ -1835,6 +1836,194 @@ void tcg_gen_extr32_i64(TCGv_i64 lo, TCGv_i64 hi, TCGv_i64 arg)
     tcg_gen_shri_i64(hi, arg, 32);
 }
 
+/* 128-bit vector operations.  These may only be used once
+   tcg_can_emit_vec_op has returned true for the opcode and element
+   size; tcg-op-gvec.c provides the expansions that check for this.  */
+
+void tcg_gen_ld_vec(TCGv_vec ret, TCGv_ptr base, tcg_target_long offset)
+{
+    tcg_gen_op3(&tcg_ctx, INDEX_op_ld_vec, GET_TCGV_VEC(ret),
+                GET_TCGV_PTR(base), offset);
+}
+
+void tcg_gen_st_vec(TCGv_vec arg, TCGv_ptr base, tcg_target_long offset)
+{
+    tcg_gen_op3(&tcg_ctx, INDEX_op_st_vec, GET_TCGV_VEC(arg),
+                GET_TCGV_PTR(base), offset);
+}
+
+void tcg_gen_dup_i32_vec(unsigned vece, TCGv_vec ret, TCGv_i32 arg)
+{
+    tcg_debug_assert(vece <= MO_32);
+    tcg_gen_op3(&tcg_ctx, INDEX_op_dup_vec, GET_TCGV_VEC(ret),
+                GET_TCGV_I32(arg), vece);
+}
+
+void tcg_gen_dup_i64_vec(unsigned vece, TCGv_vec ret, TCGv_i64 arg)
+{
+    tcg_debug_assert(vece <= MO_64);
+    tcg_gen_op3(&tcg_ctx, INDEX_op_dup_vec, GET_TCGV_VEC(ret),
+                GET_TCGV_I64(arg), vece);
+}
+
+void tcg_gen_dupi_vec(unsigned vece, TCGv_vec ret, uint64_t arg)
+{
+    TCGv_i64 t0 = tcg_const_i64(arg);
+    tcg_gen_dup_i64_vec(vece, ret, t0);
+    tcg_temp_free_i64(t0);
+}
+
+static void tcg_gen_vec_op3(TCGOpcode opc, TCGv_vec ret,
+                            TCGv_vec arg1, TCGv_vec arg2)
+{
+    tcg_gen_op3(&tcg_ctx, opc, GET_TCGV_VEC(ret),
+                GET_TCGV_VEC(arg1), GET_TCGV_VEC(arg2));
+}
+
+static void tcg_gen_vec_op3e(TCGOpcode opc, unsigned vece, TCGv_vec ret,
+                             TCGv_vec arg1, TCGv_vec arg2)
+{
+    tcg_debug_assert(tcg_can_emit_vec_op(opc, vece));
+    tcg_gen_op4(&tcg_ctx, opc, GET_TCGV_VEC(ret),
+                GET_TCGV_VEC(arg1), GET_TCGV_VEC(arg2), vece);
+}
+
+void tcg_gen_add_vec(unsigned vece, TCGv_vec ret, TCGv_vec arg1, TCGv_vec arg2)
+{
+    tcg_gen_vec_op3e(INDEX_op_add_vec, vece, ret, arg1, arg2);
+}
+
+void tcg_gen_sub_vec(unsigned vece, TCGv_vec ret, TCGv_vec arg1, TCGv_vec arg2)
+{
+    tcg_gen_vec_op3e(INDEX_op_sub_vec, vece, ret, arg1, arg2);
+}
+
+void tcg_gen_and_vec(TCGv_vec ret, TCGv_vec arg1, TCGv_vec arg2)
+{
+    tcg_gen_vec_op3(INDEX_op_and_vec, ret, arg1, arg2);
+}
+
+void tcg_gen_or_vec(TCGv_vec ret, TCGv_vec arg1, TCGv_vec arg2)
+{
+    tcg_gen_vec_op3(INDEX_op_or_vec, ret, arg1, arg2);
+}
+
+void tcg_gen_xor_vec(TCGv_vec ret, TCGv_vec arg1, TCGv_vec arg2)
+{
+    tcg_gen_vec_op3(INDEX_op_xor_vec, ret, arg1, arg2);
+}
+
+void tcg_gen_andc_vec(TCGv_vec ret, TCGv_vec arg1, TCGv_vec arg2)
+{
+    tcg_gen_vec_op3(INDEX_op_andc_vec, ret, arg1, arg2);
+}
+
+void tcg_gen_not_vec(TCGv_vec ret, TCGv_vec arg)
+{
+    TCGv_vec t0 = tcg_temp_new_vec();
+    tcg_gen_dupi_vec(MO_64, t0, -1);
+    tcg_gen_xor_vec(ret, arg, t0);
+    tcg_temp_free_vec(t0);
+}
+
+void tcg_gen_orc_vec(TCGv_vec ret, TCGv_vec arg1, TCGv_vec arg2)
+{
+    TCGv_vec t0 = tcg_temp_new_vec();
+    tcg_gen_not_vec(t0, arg2);
+    tcg_gen_or_vec(ret, arg1, t0);
+    tcg_temp_free_vec(t0);
+}
+
+static void tcg_gen_vec_shifti(TCGOpcode opc, unsigned vece, TCGv_vec ret,
+                               TCGv_vec arg, int64_t shift)
+{
+    tcg_debug_assert(shift >= 0 && shift < (8 << vece));
+    if (shift == 0) {
+        tcg_gen_or_vec(ret, arg, arg);
+    } else {
+        tcg_debug_assert(tcg_can_emit_vec_op(opc, vece));
+        tcg_gen_op4(&tcg_ctx, opc, GET_TCGV_VEC(ret), GET_TCGV_VEC(arg),
+                    vece, shift);
+    }
+}
+
+void tcg_gen_shli_vec(unsigned vece, TCGv_vec ret, TCGv_vec arg, int64_t i)
+{
+    tcg_gen_vec_shifti(INDEX_op_shli_vec, vece, ret, arg, i);
+}
+
+void tcg_gen_shri_vec(unsigned vece, TCGv_vec ret, TCGv_vec arg, int64_t i)
+{
+    tcg_gen_vec_shifti(INDEX_op_shri_vec, vece, ret, arg, i);
+}
+
+void tcg_gen_sari_vec(unsigned vece, TCGv_vec ret, TCGv_vec arg, int64_t i)
+{
+    tcg_gen_vec_shifti(INDEX_op_sari_vec, vece, ret, arg, i);
+}
+
+/* Backends only implement EQ and signed GT for cmp_vec, producing -1 in
+   each element that compares true and 0 otherwise.  Everything else is
+   built from those by swapping operands, inverting the result, or
+   biasing both operands by the sign bit for the unsigned conditions.  */
+void tcg_gen_cmp_vec(TCGCond cond, unsigned vece, TCGv_vec ret,
+                     TCGv_vec arg1, TCGv_vec arg2)
+{
+    TCGv_vec t1 = arg1, t2 = arg2;
+    bool invert = false;
+
+    tcg_debug_assert(tcg_can_emit_vec_op(INDEX_op_cmp_vec, vece));
+
+    switch (cond) {
+    case TCG_COND_NEVER:
+    case TCG_COND_ALWAYS:
+        tcg_gen_dupi_vec(MO_64, ret, cond == TCG_COND_ALWAYS ? -1 : 0);
+        return;
+    case TCG_COND_LTU:
+    case TCG_COND_GEU:
+    case TCG_COND_LEU:
+    case TCG_COND_GTU:
+        {
+            TCGv_vec sign = tcg_temp_new_vec();
+            t1 = tcg_temp_new_vec();
+            t2 = tcg_temp_new_vec();
+            tcg_gen_dupi_vec(vece, sign, 1ull << ((8 << vece) - 1));
+            tcg_gen_xor_vec(t1, arg1, sign);
+            tcg_gen_xor_vec(t2, arg2, sign);
+            tcg_temp_free_vec(sign);
+            cond = tcg_signed_cond(cond);
+        }
+        break;
+    default:
+        break;
+    }
+
+    if (cond == TCG_COND_LT || cond == TCG_COND_GE) {
+        TCGv_vec tmp = t1;
+        t1 = t2;
+        t2 = tmp;
+        cond = tcg_swap_cond(cond);
+    }
+    if (cond == TCG_COND_NE || cond == TCG_COND_LE) {
+        cond = tcg_invert_cond(cond);
+        invert = true;
+    }
+    tcg_debug_assert(cond == TCG_COND_EQ || cond == TCG_COND_GT);
+
+    tcg_gen_op5(&tcg_ctx, INDEX_op_cmp_vec, GET_TCGV_VEC(ret),
+                GET_TCGV_VEC(t1), GET_TCGV_VEC(t2), vece, cond);
+    if (invert) {
+        tcg_gen_not_vec(ret, ret);
+    }
+
+    if (!TCGV_EQUAL_VEC(t1, arg1) && !TCGV_EQUAL_VEC(t1, arg2)) {
+        tcg_temp_free_vec(t1);
+    }
+    if (!TCGV_EQUAL_VEC(t2, arg1) && !TCGV_EQUAL_VEC(t2, arg2)) {
+        tcg_temp_free_vec(t2);
+    }
+}
+
 /* QEMU specific operations.  */
 
 void tcg_gen_goto_tb(unsigned idx)
@@ -1849,6 +2038,18 @@ void tcg_gen_goto_tb(unsigned idx)
     tcg_gen_op1i(INDEX_op_goto_tb, idx);
 }
 
+void tcg_gen_lookup_and_goto_ptr(void)
+{
+    if (TCG_TARGET_HAS_goto_ptr && !qemu_loglevel_mask(CPU_LOG_TB_NOCHAIN)) {
+        TCGv_ptr ptr = tcg_temp_new_ptr();
+        gen_helper_lookup_tb_ptr(ptr, tcg_ctx.tcg_env);
+        tcg_gen_op1i(INDEX_op_goto_ptr, GET_TCGV_PTR(ptr));
+        tcg_temp_free_ptr(ptr);
+    } else {
+        tcg_gen_exit_tb(0);
+    }
+}
+
 static inline TCGMemOp tcg_canonicalize_memop(TCGMemOp op, bool is64, bool st)
 {
     /* Trigger the asserts within as early as possible.  */
@@ -1958,3 +2159,219 @@ void tcg_gen_qemu_st_i64(TCGv_i64 val, TCGv addr, TCGArg idx, TCGMemOp memop)
                                addr, trace_mem_get_info(memop, 1));
     gen_ldst_i64(INDEX_op_qemu_st_i64, val, addr, memop, idx);
 }
+
+static void tcg_gen_ext_i32(TCGv_i32 ret, TCGv_i32 val, TCGMemOp opc)
+{
+    switch (opc & MO_SSIZE) {
+    case MO_SB:
+        tcg_gen_ext8s_i32(ret, val);
+        break;
+    case MO_UB:
+        tcg_gen_ext8u_i32(ret, val);
+        break;
+    case MO_SW:
+        tcg_gen_ext16s_i32(ret, val);
+        break;
+    case MO_UW:
+        tcg_gen_ext16u_i32(ret, val);
+        break;
+    default:
+        tcg_gen_mov_i32(ret, val);
+        break;
+    }
+}
+
+static void tcg_gen_ext_i64(TCGv_i64 ret, TCGv_i64 val, TCGMemOp opc)
+{
+    switch (opc & MO_SSIZE) {
+    case MO_SB:
+        tcg_gen_ext8s_i64(ret, val);
+        break;
+    case MO_UB:
+        tcg_gen_ext8u_i64(ret, val);
+        break;
+    case MO_SW:
+        tcg_gen_ext16s_i64(ret, val);
+        break;
+    case MO_UW:
+        tcg_gen_ext16u_i64(ret, val);
+        break;
+    case MO_SL:
+        tcg_gen_ext32s_i64(ret, val);
+        break;
+    case MO_UL:
+        tcg_gen_ext32u_i64(ret, val);
+        break;
+    default:
+        tcg_gen_mov_i64(ret, val);
+        break;
+    }
+}
+
+typedef void (*gen_atomic_op_i32)(TCGv_i32, TCGv_env, TCGv,
+                                  TCGv_i32, TCGv_i32);
+typedef void (*gen_atomic_op_i64)(TCGv_i64, TCGv_env, TCGv,
+                                  TCGv_i64, TCGv_i32);
+
+void tcg_gen_atomic_cmpxchg_i32(TCGv_i32 retv, TCGv addr, TCGv_i32 cmpv,
+                                TCGv_i32 newv, TCGArg idx, TCGMemOp memop)
+{
+    memop = tcg_canonicalize_memop(memop, 0, 0);
+
+    if (!parallel_cpus) {
+        TCGv_i32 t1 = tcg_temp_new_i32();
+        TCGv_i32 t2 = tcg_temp_new_i32();
+
+        tcg_gen_ext_i32(t2, cmpv, memop & MO_SIZE);
+
+        tcg_gen_qemu_ld_i32(t1, addr, idx, memop & ~MO_SIGN);
+        tcg_gen_movcond_i32(TCG_COND_EQ, t2, t1, t2, newv, t1);
+        tcg_gen_qemu_st_i32(t2, addr, idx, memop);
+        tcg_temp_free_i32(t2);
+
+        tcg_gen_ext_i32(retv, t1, memop);
+        tcg_temp_free_i32(t1);
+    } else {
+        TCGv_i32 oi = tcg_const_i32(make_memop_idx(memop & ~MO_SIGN, idx));
+
+        gen_helper_atomic_cmpxchg_i32(retv, tcg_ctx.tcg_env, addr,
+                                      cmpv, newv, oi);
+        tcg_temp_free_i32(oi);
+
+        tcg_gen_ext_i32(retv, retv, memop);
+    }
+}
+
+void tcg_gen_atomic_cmpxchg_i64(TCGv_i64 retv, TCGv addr, TCGv_i64 cmpv,
+                                TCGv_i64 newv, TCGArg idx, TCGMemOp memop)
+{
+    memop = tcg_canonicalize_memop(memop, 1, 0);
+
+    if (!parallel_cpus) {
+        TCGv_i64 t1 = tcg_temp_new_i64();
+        TCGv_i64 t2 = tcg_temp_new_i64();
+
+        tcg_gen_ext_i64(t2, cmpv, memop & MO_SIZE);
+
+        tcg_gen_qemu_ld_i64(t1, addr, idx, memop & ~MO_SIGN);
+        tcg_gen_movcond_i64(TCG_COND_EQ, t2, t1, t2, newv, t1);
+        tcg_gen_qemu_st_i64(t2, addr, idx, memop);
+        tcg_temp_free_i64(t2);
+
+        tcg_gen_ext_i64(retv, t1, memop);
+        tcg_temp_free_i64(t1);
+    } else {
+        TCGv_i32 oi = tcg_const_i32(make_memop_idx(memop & ~MO_SIGN, idx));
+
+        gen_helper_atomic_cmpxchg_i64(retv, tcg_ctx.tcg_env, addr,
+                                      cmpv, newv, oi);
+        tcg_temp_free_i32(oi);
+
+        tcg_gen_ext_i64(retv, retv, memop);
+    }
+}
+
+static void do_atomic_op_i32(TCGv_i32 ret, TCGv addr, TCGv_i32 val,
+                             TCGArg idx, TCGMemOp memop,
+                             void (*gen)(TCGv_i32, TCGv_i32, TCGv_i32),
+                             gen_atomic_op_i32 gen_helper)
+{
+    memop = tcg_canonicalize_memop(memop, 0, 0);
+
+    if (!parallel_cpus) {
+        TCGv_i32 t1 = tcg_temp_new_i32();
+        TCGv_i32 t2 = tcg_temp_new_i32();
+
+        tcg_gen_qemu_ld_i32(t1, addr, idx, memop & ~MO_SIGN);
+        gen(t2, t1, val);
+        tcg_gen_qemu_st_i32(t2, addr, idx, memop);
+
+        tcg_gen_ext_i32(ret, t1, memop);
+        tcg_temp_free_i32(t1);
+        tcg_temp_free_i32(t2);
+    } else {
+        TCGv_i32 oi = tcg_const_i32(make_memop_idx(memop & ~MO_SIGN, idx));
+
+        gen_helper(ret, tcg_ctx.tcg_env, addr, val, oi);
+        tcg_temp_free_i32(oi);
+
+        tcg_gen_ext_i32(ret, ret, memop);
+    }
+}
+
+static void do_atomic_op_i64(TCGv_i64 ret, TCGv addr, TCGv_i64 val,
+                             TCGArg idx, TCGMemOp memop,
+                             void (*gen)(TCGv_i64, TCGv_i64, TCGv_i64),
+                             gen_atomic_op_i64 gen_helper)
+{
+    memop = tcg_canonicalize_memop(memop, 1, 0);
+
+    if (!parallel_cpus) {
+        TCGv_i64 t1 = tcg_temp_new_i64();
+        TCGv_i64 t2 = tcg_temp_new_i64();
+
+        tcg_gen_qemu_ld_i64(t1, addr, idx, memop & ~MO_SIGN);
+        gen(t2, t1, val);
+        tcg_gen_qemu_st_i64(t2, addr, idx, memop);
+
+        tcg_gen_ext_i64(ret, t1, memop);
+        tcg_temp_free_i64(t1);
+        tcg_temp_free_i64(t2);
+    } else {
+        TCGv_i32 oi = tcg_const_i32(make_memop_idx(memop & ~MO_SIGN, idx));
+
+        gen_helper(ret, tcg_ctx.tcg_env, addr, val, oi);
+        tcg_temp_free_i32(oi);
+
+        tcg_gen_ext_i64(ret, ret, memop);
+    }
+}
+
+static void tcg_gen_mov2_i32(TCGv_i32 r, TCGv_i32 a, TCGv_i32 b)
+{
+    tcg_gen_mov_i32(r, b);
+}
+
+static void tcg_gen_mov2_i64(TCGv_i64 r, TCGv_i64 a, TCGv_i64 b)
+{
+    tcg_gen_mov_i64(r, b);
+}
+
+#define GEN_ATOMIC_OP(NAME, OP)                                         \
+void tcg_gen_atomic_##NAME##_i32                                        \
+    (TCGv_i32 ret, TCGv addr, TCGv_i32 val, TCGArg idx, TCGMemOp memop) \
+{                                                                       \
+    do_atomic_op_i32(ret, addr, val, idx, memop, tcg_gen_##OP##_i32,    \
+                     gen_helper_atomic_##NAME##_i32);                   \
+}                                                                       \
+void tcg_gen_atomic_##NAME##_i64                                        \
+    (TCGv_i64 ret, TCGv addr, TCGv_i64 val, TCGArg idx, TCGMemOp memop) \
+{                                                                       \
+    do_atomic_op_i64(ret, addr, val, idx, memop, tcg_gen_##OP##_i64,    \
+                     gen_helper_atomic_##NAME##_i64);                   \
+}
+
+GEN_ATOMIC_OP(xchg, mov2)
+GEN_ATOMIC_OP(fetch_add, add)
+GEN_ATOMIC_OP(fetch_and, and)
+GEN_ATOMIC_OP(fetch_or, or)
+GEN_ATOMIC_OP(fetch_xor, xor)
+
+#undef GEN_ATOMIC_OP
+
+void tcg_gen_mb(TCGBar type)
+{
+#ifdef TCG_TARGET_DEFAULT_MO
+    type &= ~TCG_TARGET_DEFAULT_MO;
+#endif
+    /* Without parallel vCPUs nobody can see the order of our accesses;
+       user-mode threads always run in parallel.  */
+#ifndef CONFIG_USER_ONLY
+    if (!parallel_cpus) {
+        return;
+    }
+#endif
+    if (type) {
+        gen_helper_mb();
+    }
+}
@@ -694,6 +694,28 @@ static inline void tcg_gen_concat32_i64(TCGv_i64 ret, TCGv_i64 lo, TCGv_i64 hi)
     tcg_gen_deposit_i64(ret, lo, hi, 32, 32);
 }
 
+/* 128-bit vector operations.  VECE is the element size as a MO_8..MO_64
+   value.  */
+
+void tcg_gen_ld_vec(TCGv_vec ret, TCGv_ptr base, tcg_target_long offset);
+void tcg_gen_st_vec(TCGv_vec arg, TCGv_ptr base, tcg_target_long offset);
+void tcg_gen_dup_i32_vec(unsigned vece, TCGv_vec ret, TCGv_i32 arg);
+void tcg_gen_dup_i64_vec(unsigned vece, TCGv_vec ret, TCGv_i64 arg);
+void tcg_gen_dupi_vec(unsigned vece, TCGv_vec ret, uint64_t arg);
+void tcg_gen_add_vec(unsigned vece, TCGv_vec ret, TCGv_vec arg1, TCGv_vec arg2);
+void tcg_gen_sub_vec(unsigned vece, TCGv_vec ret, TCGv_vec arg1, TCGv_vec arg2);
+void tcg_gen_and_vec(TCGv_vec ret, TCGv_vec arg1, TCGv_vec arg2);
+void tcg_gen_or_vec(TCGv_vec ret, TCGv_vec arg1, TCGv_vec arg2);
+void tcg_gen_xor_vec(TCGv_vec ret, TCGv_vec arg1, TCGv_vec arg2);
+void tcg_gen_andc_vec(TCGv_vec ret, TCGv_vec arg1, TCGv_vec arg2);
+void tcg_gen_orc_vec(TCGv_vec ret, TCGv_vec arg1, TCGv_vec arg2);
+void tcg_gen_not_vec(TCGv_vec ret, TCGv_vec arg);
+void tcg_gen_shli_vec(unsigned vece, TCGv_vec ret, TCGv_vec arg, int64_t i);
+void tcg_gen_shri_vec(unsigned vece, TCGv_vec ret, TCGv_vec arg, int64_t i);
+void tcg_gen_sari_vec(unsigned vece, TCGv_vec ret, TCGv_vec arg, int64_t i);
+void tcg_gen_cmp_vec(TCGCond cond, unsigned vece, TCGv_vec ret,
+                     TCGv_vec arg1, TCGv_vec arg2);
+
 /* QEMU specific operations.  */
 
 #ifndef TARGET_LONG_BITS
@@ -768,6 +790,18 @@ static inline void tcg_gen_exit_tb(uintptr_t val)
  */
 void tcg_gen_goto_tb(unsigned idx);
 
+/**
+ * tcg_gen_lookup_and_goto_ptr() - look up the next TB and jump to it
+ *
+ * End the TB after an indirect branch, once the guest state has been
+ * updated for the next instruction.  If the per-CPU jump cache holds a
+ * TB matching that state, jump straight to its code; otherwise return
+ * to the main loop as tcg_gen_exit_tb(0) would.  Unlike goto_tb, the
+ * lookup is made every time, so this is safe wherever the destination
+ * is not known at translation time.
+ */
+void tcg_gen_lookup_and_goto_ptr(void);
+
 #if TARGET_LONG_BITS == 32
 #define tcg_temp_new() tcg_temp_new_i32()
 #define tcg_global_reg_new tcg_global_reg_new_i32
@@ -779,6 +813,12 @@ void tcg_gen_goto_tb(unsigned idx);
 #define TCGV_EQUAL(a, b) TCGV_EQUAL_I32(a, b)
 #define tcg_gen_qemu_ld_tl tcg_gen_qemu_ld_i32
 #define tcg_gen_qemu_st_tl tcg_gen_qemu_st_i32
+#define tcg_gen_atomic_cmpxchg_tl tcg_gen_atomic_cmpxchg_i32
+#define tcg_gen_atomic_xchg_tl tcg_gen_atomic_xchg_i32
+#define tcg_gen_atomic_fetch_add_tl tcg_gen_atomic_fetch_add_i32
+#define tcg_gen_atomic_fetch_and_tl tcg_gen_atomic_fetch_and_i32
+#define tcg_gen_atomic_fetch_or_tl tcg_gen_atomic_fetch_or_i32
+#define tcg_gen_atomic_fetch_xor_tl tcg_gen_atomic_fetch_xor_i32
 #else
 #define tcg_temp_new() tcg_temp_new_i64()
 #define tcg_global_reg_new tcg_global_reg_new_i64
@@ -790,6 +830,12 @@ void tcg_gen_goto_tb(unsigned idx);
 #define TCGV_EQUAL(a, b) TCGV_EQUAL_I64(a, b)
 #define tcg_gen_qemu_ld_tl tcg_gen_qemu_ld_i64
 #define tcg_gen_qemu_st_tl tcg_gen_qemu_st_i64
+#define tcg_gen_atomic_cmpxchg_tl tcg_gen_atomic_cmpxchg_i64
+#define tcg_gen_atomic_xchg_tl tcg_gen_atomic_xchg_i64
+#define tcg_gen_atomic_fetch_add_tl tcg_gen_atomic_fetch_add_i64
+#define tcg_gen_atomic_fetch_and_tl tcg_gen_atomic_fetch_and_i64
+#define tcg_gen_atomic_fetch_or_tl tcg_gen_atomic_fetch_or_i64
+#define tcg_gen_atomic_fetch_xor_tl tcg_gen_atomic_fetch_xor_i64
 #endif
 
 void tcg_gen_qemu_ld_i32(TCGv_i32, TCGv, TCGArg, TCGMemOp);
@@ -852,6 +898,35 @@ static inline void tcg_gen_qemu_st64(TCGv_i64 arg, TCGv addr, int mem_index)
     tcg_gen_qemu_st_i64(arg, addr, mem_index, MO_TEQ);
 }
 
+/* Atomic read-modify-write of guest memory.  RET receives the old value,
+ * extended according to MEMOP.  While other vCPUs run in parallel these
+ * use a host atomic instruction, otherwise a plain load and store.
+ */
+void tcg_gen_atomic_cmpxchg_i32(TCGv_i32, TCGv, TCGv_i32, TCGv_i32,
+                                TCGArg, TCGMemOp);
+void tcg_gen_atomic_cmpxchg_i64(TCGv_i64, TCGv, TCGv_i64, TCGv_i64,
+                                TCGArg, TCGMemOp);
+
+void tcg_gen_atomic_xchg_i32(TCGv_i32, TCGv, TCGv_i32, TCGArg, TCGMemOp);
+void tcg_gen_atomic_xchg_i64(TCGv_i64, TCGv, TCGv_i64, TCGArg, TCGMemOp);
+void tcg_gen_atomic_fetch_add_i32(TCGv_i32, TCGv, TCGv_i32, TCGArg, TCGMemOp);
+void tcg_gen_atomic_fetch_add_i64(TCGv_i64, TCGv, TCGv_i64, TCGArg, TCGMemOp);
+void tcg_gen_atomic_fetch_and_i32(TCGv_i32, TCGv, TCGv_i32, TCGArg, TCGMemOp);
+void tcg_gen_atomic_fetch_and_i64(TCGv_i64, TCGv, TCGv_i64, TCGArg, TCGMemOp);
+void tcg_gen_atomic_fetch_or_i32(TCGv_i32, TCGv, TCGv_i32, TCGArg, TCGMemOp);
+void tcg_gen_atomic_fetch_or_i64(TCGv_i64, TCGv, TCGv_i64, TCGArg, TCGMemOp);
+void tcg_gen_atomic_fetch_xor_i32(TCGv_i32, TCGv, TCGv_i32, TCGArg, TCGMemOp);
+void tcg_gen_atomic_fetch_xor_i64(TCGv_i64, TCGv, TCGv_i64, TCGArg, TCGMemOp);
+
+/**
+ * tcg_gen_mb:
+ * @type: the orderings (TCG_MO_*) the guest barrier requires
+ *
+ * Emit a host memory barrier for the orderings that the host does not
+ * already provide, if other vCPUs can observe our accesses.
+ */
+void tcg_gen_mb(TCGBar type);
+
 #if TARGET_LONG_BITS == 64
 #define tcg_gen_movi_tl tcg_gen_movi_i64
 #define tcg_gen_mov_tl tcg_gen_mov_i64
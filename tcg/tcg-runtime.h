@@ -14,3 +14,24 @@ DEF_HELPER_FLAGS_2(sar_i64, TCG_CALL_NO_RWG_SE, s64, s64, s64)
 
 DEF_HELPER_FLAGS_2(mulsh_i64, TCG_CALL_NO_RWG_SE, s64, s64, s64)
 DEF_HELPER_FLAGS_2(muluh_i64, TCG_CALL_NO_RWG_SE, i64, i64, i64)
+
+DEF_HELPER_FLAGS_1(lookup_tb_ptr, TCG_CALL_NO_WG_SE, ptr, env)
+
+DEF_HELPER_FLAGS_0(mb, TCG_CALL_NO_RWG, void)
+DEF_HELPER_FLAGS_1(exit_atomic, TCG_CALL_NO_WG, noreturn, env)
+
+DEF_HELPER_FLAGS_5(atomic_cmpxchg_i32, TCG_CALL_NO_WG,
+                   i32, env, tl, i32, i32, i32)
+DEF_HELPER_FLAGS_5(atomic_cmpxchg_i64, TCG_CALL_NO_WG,
+                   i64, env, tl, i64, i64, i32)
+
+DEF_HELPER_FLAGS_4(atomic_xchg_i32, TCG_CALL_NO_WG, i32, env, tl, i32, i32)
+DEF_HELPER_FLAGS_4(atomic_xchg_i64, TCG_CALL_NO_WG, i64, env, tl, i64, i32)
+DEF_HELPER_FLAGS_4(atomic_fetch_add_i32, TCG_CALL_NO_WG, i32, env, tl, i32, i32)
+DEF_HELPER_FLAGS_4(atomic_fetch_add_i64, TCG_CALL_NO_WG, i64, env, tl, i64, i32)
+DEF_HELPER_FLAGS_4(atomic_fetch_and_i32, TCG_CALL_NO_WG, i32, env, tl, i32, i32)
+DEF_HELPER_FLAGS_4(atomic_fetch_and_i64, TCG_CALL_NO_WG, i64, env, tl, i64, i32)
+DEF_HELPER_FLAGS_4(atomic_fetch_or_i32, TCG_CALL_NO_WG, i32, env, tl, i32, i32)
+DEF_HELPER_FLAGS_4(atomic_fetch_or_i64, TCG_CALL_NO_WG, i64, env, tl, i64, i32)
+DEF_HELPER_FLAGS_4(atomic_fetch_xor_i32, TCG_CALL_NO_WG, i32, env, tl, i32, i32)
+DEF_HELPER_FLAGS_4(atomic_fetch_xor_i64, TCG_CALL_NO_WG, i64, env, tl, i64, i32)
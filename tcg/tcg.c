@@ -114,10 +114,13 @@ static int tcg_target_const_match(tcg_target_long val, TCGType type,
                                   const TCGArgConstraint *arg_ct);
 static void tcg_out_tb_init(TCGContext *s);
 static bool tcg_out_tb_finalize(TCGContext *s);
+#if TCG_TARGET_HAS_v128
+static bool tcg_target_vec_op_valid(TCGOpcode opc, unsigned vece);
+#endif
 
 
 
-static TCGRegSet tcg_target_available_regs[2];
+static TCGRegSet tcg_target_available_regs[TCG_TYPE_COUNT];
 static TCGRegSet tcg_target_call_clobber_regs;
 
 #if TCG_TARGET_INSN_UNIT_SIZE == 1
@@ -240,6 +243,26 @@ static void tcg_out_label(TCGContext *s, TCGLabel *l, tcg_insn_unit *ptr)
     l->u.value_ptr = ptr;
 }
 
+/* host address recording, see TCGCodeReloc */
+
+static inline void tcg_note_code_reloc(TCGContext *s, tcg_insn_unit *field,
+                                       TCGCodeRelocType type, uintptr_t target)
+{
+    TCGCodeReloc *r;
+
+    if (!s->code_relocs_enabled) {
+        return;
+    }
+    if (s->nb_code_relocs >= TCG_MAX_CODE_RELOCS) {
+        s->code_relocs_unsafe = true;
+        return;
+    }
+    r = &s->code_relocs[s->nb_code_relocs++];
+    r->offset = (uint8_t *)field - (uint8_t *)s->code_buf;
+    r->type = type;
+    r->target = target;
+}
+
 TCGLabel *gen_new_label(void)
 {
     TCGContext *s = &tcg_ctx;
@@ -393,8 +416,12 @@ void tcg_prologue_init(TCGContext *s)
     s->code_gen_prologue = buf0;
 
     /* Generate the prologue.  */
+    s->code_gen_epilogue = NULL;
     tcg_target_qemu_prologue(s);
     buf1 = s->code_ptr;
+    if (TCG_TARGET_HAS_goto_ptr) {
+        tcg_debug_assert(s->code_gen_epilogue != NULL);
+    }
     flush_icache_range((uintptr_t)buf0, (uintptr_t)buf1);
 
     /* Deduct the prologue from the buffer.  */
@@ -432,6 +459,7 @@ void tcg_func_start(TCGContext *s)
 
     s->nb_labels = 0;
     s->current_frame_offset = s->frame_start;
+    s->code_relocs_unsafe = false;
 
 #ifdef CONFIG_DEBUG_TCG
     s->goto_tb_issue_mask = 0;
@@ -659,6 +687,15 @@ static void tcg_temp_free_internal(int idx)
     set_bit(idx, s->free_temps[k].l);
 }
 
+TCGv_vec tcg_temp_new_vec(void)
+{
+    int idx;
+
+    tcg_debug_assert(TCG_TARGET_HAS_v128);
+    idx = tcg_temp_new_internal(TCG_TYPE_V128, 0);
+    return MAKE_TCGV_VEC(idx);
+}
+
 void tcg_temp_free_i32(TCGv_i32 arg)
 {
     tcg_temp_free_internal(GET_TCGV_I32(arg));
@@ -669,6 +706,11 @@ void tcg_temp_free_i64(TCGv_i64 arg)
     tcg_temp_free_internal(GET_TCGV_I64(arg));
 }
 
+void tcg_temp_free_vec(TCGv_vec arg)
+{
+    tcg_temp_free_internal(GET_TCGV_VEC(arg));
+}
+
 TCGv_i32 tcg_const_i32(int32_t val)
 {
     TCGv_i32 t0;
@@ -1018,6 +1060,19 @@ static const char * const alignment_name[(MO_AMASK >> MO_ASHIFT) + 1] = {
     [MO_ALIGN_64 >> MO_ASHIFT] = "al64+",
 };
 
+#ifdef DEBUG_DISAS
+/* Count the operations of the current TB, leaving out insn_start markers. */
+static int tcg_count_ops(TCGContext *s)
+{
+    int oi, n = 0;
+
+    for (oi = s->gen_op_buf[0].next; oi != 0; oi = s->gen_op_buf[oi].next) {
+        n += s->gen_op_buf[oi].opc != INDEX_op_insn_start;
+    }
+    return n;
+}
+#endif
+
 void tcg_dump_ops(TCGContext *s)
 {
     char buf[128];
@@ -1221,6 +1276,15 @@ static void sort_constraints(TCGOpDef *def, int start, int n)
     }
 }
 
+bool tcg_can_emit_vec_op(TCGOpcode opc, unsigned vece)
+{
+#if TCG_TARGET_HAS_v128
+    return tcg_target_vec_op_valid(opc, vece);
+#else
+    return false;
+#endif
+}
+
 void tcg_add_target_add_op_defs(const TCGTargetOpDef *tdefs)
 {
     TCGOpcode op;
@@ -1422,6 +1486,25 @@ static inline void tcg_la_bb_end(TCGContext *s, uint8_t *temp_state)
     }
 }
 
+/* liveness analysis: conditional branch: all temps are dead, globals
+   and local temps should be synced; their liveness along the
+   fall-through path is preserved. */
+static inline void tcg_la_bb_sync(TCGContext *s, uint8_t *temp_state)
+{
+    int i, n;
+
+    for (i = 0; i < s->nb_globals; i++) {
+        temp_state[i] |= TS_MEM;
+    }
+    for (i = s->nb_globals, n = s->nb_temps; i < n; i++) {
+        if (s->temps[i].temp_local) {
+            temp_state[i] |= TS_MEM;
+        } else {
+            temp_state[i] = TS_DEAD;
+        }
+    }
+}
+
 /* Liveness analysis : update the opc_arg_life array to tell if a
    given input arguments is dead. Instructions updating dead
    temporaries are removed. */
@@ -1625,7 +1708,9 @@ static void liveness_pass_1(TCGContext *s, uint8_t *temp_state)
                 }
 
                 /* if end of basic block, update */
-                if (def->flags & TCG_OPF_BB_END) {
+                if (def->flags & TCG_OPF_COND_BRANCH) {
+                    tcg_la_bb_sync(s, temp_state);
+                } else if (def->flags & TCG_OPF_BB_END) {
                     tcg_la_bb_end(s, temp_state);
                 } else if (def->flags & TCG_OPF_SIDE_EFFECTS) {
                     /* globals should be synced to memory */
@@ -1696,7 +1781,10 @@ static bool liveness_pass_2(TCGContext *s, uint8_t *temp_state)
             nb_oargs = def->nb_oargs;
 
             /* Set flags similar to how calls require.  */
-            if (def->flags & TCG_OPF_BB_END) {
+            if (def->flags & TCG_OPF_COND_BRANCH) {
+                /* Like reading globals: sync_globals */
+                call_flags = TCG_CALL_NO_WRITE_GLOBALS;
+            } else if (def->flags & TCG_OPF_BB_END) {
                 /* Like writing globals: save_globals */
                 call_flags = 0;
             } else if (def->flags & TCG_OPF_SIDE_EFFECTS) {
@@ -1770,6 +1858,12 @@ static bool liveness_pass_2(TCGContext *s, uint8_t *temp_state)
             }
         }
 
+        /* The direct temporaries do not survive a conditional branch;
+           reload them along the fall-through path.  */
+        if (def->flags & TCG_OPF_COND_BRANCH) {
+            memset(temp_state, TS_DEAD, nb_globals);
+        }
+
         /* Outputs become available.  */
         for (i = 0; i < nb_oargs; i++) {
             arg = args[i];
@@ -1886,21 +1980,24 @@ static void check_regs(TCGContext *s)
 static void temp_allocate_frame(TCGContext *s, int temp)
 {
     TCGTemp *ts;
+    tcg_target_long size;
+
     ts = &s->temps[temp];
+    /* Vector temps get a full 16-byte slot; everything else fits in
+       a host register-sized one.  */
+    size = (ts->type == TCG_TYPE_V128 ? 16 : sizeof(tcg_target_long));
 #if !(defined(__sparc__) && TCG_TARGET_REG_BITS == 64)
     /* Sparc64 stack is accessed with offset of 2047 */
-    s->current_frame_offset = (s->current_frame_offset +
-                               (tcg_target_long)sizeof(tcg_target_long) - 1) &
-        ~(sizeof(tcg_target_long) - 1);
+    s->current_frame_offset = (s->current_frame_offset + size - 1) &
+        ~(size - 1);
 #endif
-    if (s->current_frame_offset + (tcg_target_long)sizeof(tcg_target_long) >
-        s->frame_end) {
+    if (s->current_frame_offset + size > s->frame_end) {
         tcg_abort();
     }
     ts->mem_offset = s->current_frame_offset;
     ts->mem_base = s->frame_temp;
     ts->mem_allocated = 1;
-    s->current_frame_offset += sizeof(tcg_target_long);
+    s->current_frame_offset += size;
 }
 
 static void temp_load(TCGContext *, TCGTemp *, TCGRegSet, TCGRegSet);
@@ -2099,6 +2196,29 @@ static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
     save_globals(s, allocated_regs);
 }
 
+/* at a conditional branch, we assume all temporaries are dead and
+   all globals and local temps are synced to their canonical location;
+   registers stay valid along the fall-through path. */
+static void tcg_reg_alloc_cbranch(TCGContext *s, TCGRegSet allocated_regs)
+{
+    int i;
+
+    sync_globals(s, allocated_regs);
+
+    for (i = s->nb_globals; i < s->nb_temps; i++) {
+        TCGTemp *ts = &s->temps[i];
+        /* The liveness analysis already ensures that temps are dead
+           and local temps are synced.  Keep tcg_debug_asserts for
+           safety.  */
+        if (ts->temp_local) {
+            tcg_debug_assert(ts->val_type != TEMP_VAL_REG
+                             || ts->mem_coherent);
+        } else {
+            tcg_debug_assert(ts->val_type == TEMP_VAL_DEAD);
+        }
+    }
+}
+
 static void tcg_reg_alloc_movi(TCGContext *s, const TCGArg *args,
                                TCGLifeData arg_life)
 {
@@ -2294,7 +2414,9 @@ static void tcg_reg_alloc_op(TCGContext *s,
         }
     }
 
-    if (def->flags & TCG_OPF_BB_END) {
+    if (def->flags & TCG_OPF_COND_BRANCH) {
+        tcg_reg_alloc_cbranch(s, allocated_regs);
+    } else if (def->flags & TCG_OPF_BB_END) {
         tcg_reg_alloc_bb_end(s, allocated_regs);
     } else {
         if (def->flags & TCG_OPF_CALL_CLOBBER) {
@@ -2524,6 +2646,9 @@ void tcg_dump_op_count(FILE *f, fprintf_function cpu_fprintf)
 int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
 {
     int i, oi, oi_next, num_insns;
+#ifdef DEBUG_DISAS
+    int nb_ops_before = 0;
+#endif
 
 #ifdef CONFIG_PROFILER
     {
@@ -2550,6 +2675,10 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
         tcg_dump_ops(s);
         qemu_log("\n");
     }
+    if (unlikely(qemu_loglevel_mask(CPU_LOG_TB_OP_OPT)
+                 && qemu_log_in_addr_range(tb->pc))) {
+        nb_ops_before = tcg_count_ops(s);
+    }
 #endif
 
 #ifdef CONFIG_PROFILER
@@ -2594,7 +2723,8 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
 #ifdef DEBUG_DISAS
     if (unlikely(qemu_loglevel_mask(CPU_LOG_TB_OP_OPT)
                  && qemu_log_in_addr_range(tb->pc))) {
-        qemu_log("OP after optimization and liveness analysis:\n");
+        qemu_log("OP after optimization and liveness analysis "
+                 "(%d ops, %d before):\n", tcg_count_ops(s), nb_ops_before);
         tcg_dump_ops(s);
         qemu_log("\n");
     }
@@ -2604,6 +2734,7 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
 
     s->code_buf = tb->tc_ptr;
     s->code_ptr = tb->tc_ptr;
+    s->nb_code_relocs = 0;
 
     tcg_out_tb_init(s);
 
@@ -131,6 +131,19 @@ typedef uint64_t TCGRegSet;
 #define TCG_TARGET_deposit_i64_valid(ofs, len) 1
 #endif
 
+/* Hosts that provide 128-bit vector registers define this to 1 and
+   implement tcg_target_vec_op_valid to report which element sizes each
+   vector opcode supports.  */
+#ifndef TCG_TARGET_HAS_v128
+#define TCG_TARGET_HAS_v128             0
+#endif
+
+/* Hosts that can jump to an address held in a register define this to 1,
+   and set code_gen_epilogue in their prologue.  */
+#ifndef TCG_TARGET_HAS_goto_ptr
+#define TCG_TARGET_HAS_goto_ptr         0
+#endif
+
 /* Only one of DIV or DIV2 should be defined.  */
 #if defined(TCG_TARGET_HAS_div_i32)
 #define TCG_TARGET_HAS_div2_i32         0
@@ -235,6 +248,7 @@ typedef struct TCGPool {
 typedef enum TCGType {
     TCG_TYPE_I32,
     TCG_TYPE_I64,
+    TCG_TYPE_V128,
     TCG_TYPE_COUNT, /* number of different types */
 
     /* An alias for the size of the host register.  */
@@ -348,6 +362,21 @@ typedef enum TCGMemOp {
     MO_SSIZE = MO_SIZE | MO_SIGN,
 } TCGMemOp;
 
+/* Memory ordering guarantees.  A guest declares the orderings its
+ * architecture requires with TCG_GUEST_DEFAULT_MO, and a host backend
+ * declares the orderings the host provides for plain loads and stores
+ * with TCG_TARGET_DEFAULT_MO.  Multi-threaded TCG is only enabled by
+ * default when every ordering required by the guest is provided by
+ * the host.
+ */
+typedef enum {
+    TCG_MO_LD_LD  = 0x01,  /* loads are not reordered with earlier loads */
+    TCG_MO_ST_LD  = 0x02,  /* loads are not reordered with earlier stores */
+    TCG_MO_LD_ST  = 0x04,  /* stores are not reordered with earlier loads */
+    TCG_MO_ST_ST  = 0x08,  /* stores are not reordered with earlier stores */
+    TCG_MO_ALL    = 0x0F,  /* OR of the above */
+} TCGBar;
+
 /**
  * get_alignment_bits
  * @memop: TCGMemOp value
@@ -395,12 +424,15 @@ typedef tcg_target_ulong TCGArg;
    instructions that get implied on 64-bit hosts.  Users of tcg_gen_* don't
    need to know about any of this, and should treat TCGv as an opaque type.
    In addition we do typechecking for different types of variables.  TCGv_i32
-   and TCGv_i64 are 32/64-bit variables respectively.  TCGv and TCGv_ptr
-   are aliases for target_ulong and host pointer sized values respectively.  */
+   and TCGv_i64 are 32/64-bit variables respectively.  TCGv_vec is a 128-bit
+   vector variable, only available when the host sets TCG_TARGET_HAS_v128.
+   TCGv and TCGv_ptr are aliases for target_ulong and host pointer sized
+   values respectively.  */
 
 typedef struct TCGv_i32_d *TCGv_i32;
 typedef struct TCGv_i64_d *TCGv_i64;
 typedef struct TCGv_ptr_d *TCGv_ptr;
+typedef struct TCGv_vec_d *TCGv_vec;
 typedef TCGv_ptr TCGv_env;
 #if TARGET_LONG_BITS == 32
 #define TCGv TCGv_i32
@@ -425,6 +457,11 @@ static inline TCGv_ptr QEMU_ARTIFICIAL MAKE_TCGV_PTR(intptr_t i)
     return (TCGv_ptr)i;
 }
 
+static inline TCGv_vec QEMU_ARTIFICIAL MAKE_TCGV_VEC(intptr_t i)
+{
+    return (TCGv_vec)i;
+}
+
 static inline intptr_t QEMU_ARTIFICIAL GET_TCGV_I32(TCGv_i32 t)
 {
     return (intptr_t)t;
@@ -440,6 +477,11 @@ static inline intptr_t QEMU_ARTIFICIAL GET_TCGV_PTR(TCGv_ptr t)
     return (intptr_t)t;
 }
 
+static inline intptr_t QEMU_ARTIFICIAL GET_TCGV_VEC(TCGv_vec t)
+{
+    return (intptr_t)t;
+}
+
 #if TCG_TARGET_REG_BITS == 32
 #define TCGV_LOW(t) MAKE_TCGV_I32(GET_TCGV_I64(t))
 #define TCGV_HIGH(t) MAKE_TCGV_I32(GET_TCGV_I64(t) + 1)
@@ -448,6 +490,7 @@ static inline intptr_t QEMU_ARTIFICIAL GET_TCGV_PTR(TCGv_ptr t)
 #define TCGV_EQUAL_I32(a, b) (GET_TCGV_I32(a) == GET_TCGV_I32(b))
 #define TCGV_EQUAL_I64(a, b) (GET_TCGV_I64(a) == GET_TCGV_I64(b))
 #define TCGV_EQUAL_PTR(a, b) (GET_TCGV_PTR(a) == GET_TCGV_PTR(b))
+#define TCGV_EQUAL_VEC(a, b) (GET_TCGV_VEC(a) == GET_TCGV_VEC(b))
 
 /* Dummy definition to avoid compiler warnings.  */
 #define TCGV_UNUSED_I32(x) x = MAKE_TCGV_I32(-1)
@@ -520,6 +563,12 @@ static inline TCGCond tcg_unsigned_cond(TCGCond c)
     return c & 2 ? (TCGCond)(c ^ 6) : c;
 }
 
+/* Create a "signed" version of an "unsigned" comparison.  */
+static inline TCGCond tcg_signed_cond(TCGCond c)
+{
+    return c & 4 ? (TCGCond)(c ^ 6) : c;
+}
+
 /* Must a comparison be considered unsigned?  */
 static inline bool is_unsigned_cond(TCGCond c)
 {
@@ -611,6 +660,29 @@ QEMU_BUILD_BUG_ON(OPPARAM_BUF_SIZE > (1 << 14));
 /* Make sure that we don't overflow 64 bits without noticing.  */
 QEMU_BUILD_BUG_ON(sizeof(TCGOp) > 8);
 
+/* Host addresses embedded in generated code.  When recording is enabled,
+   backends that define TCG_TARGET_HAS_CODE_RELOCS note every such field
+   so that the code of a TB can later be moved to another address, e.g.
+   by the persistent translation cache.  */
+#ifndef TCG_TARGET_HAS_CODE_RELOCS
+#define TCG_TARGET_HAS_CODE_RELOCS 0
+#endif
+
+#define TCG_MAX_CODE_RELOCS 256
+
+typedef enum TCGCodeRelocType {
+    /* 32-bit displacement, relative to the end of the field.  */
+    TCG_CODE_RELOC_PCREL32,
+    /* Absolute host address, stored in a full host word.  */
+    TCG_CODE_RELOC_ABS,
+} TCGCodeRelocType;
+
+typedef struct TCGCodeReloc {
+    uint32_t offset;            /* of the field, from the start of the TB */
+    TCGCodeRelocType type;
+    uintptr_t target;           /* address the field refers to */
+} TCGCodeReloc;
+
 struct TCGContext {
     uint8_t *pool_cur, *pool_end;
     TCGPool *pool_first, *pool_current, *pool_first_large;
@@ -633,6 +705,14 @@ struct TCGContext {
 
     tcg_insn_unit *code_ptr;
 
+    /* Host address relocation recording, see TCGCodeReloc.  The frontend
+       sets code_relocs_unsafe when it embeds a host pointer that cannot
+       be described, such as a tcg_const_ptr.  */
+    bool code_relocs_enabled;
+    bool code_relocs_unsafe;
+    int nb_code_relocs;
+    TCGCodeReloc code_relocs[TCG_MAX_CODE_RELOCS];
+
     GHashTable *helpers;
 
 #ifdef CONFIG_PROFILER
@@ -669,6 +749,7 @@ struct TCGContext {
        extension that allows arithmetic on void*.  */
     int code_gen_max_blocks;
     void *code_gen_prologue;
+    void *code_gen_epilogue;
     void *code_gen_buffer;
     size_t code_gen_buffer_size;
     void *code_gen_ptr;
@@ -676,6 +757,12 @@ struct TCGContext {
     /* Threshold to flush the translated code buffer.  */
     void *code_gen_highwater;
 
+    /* Rarely executed code, such as the softmmu slow paths, goes here
+       when the backend defines TCG_TARGET_SPLIT_COLD_CODE, so that it
+       does not dilute the hot code in the caches.  NULL if unused.  */
+    void *code_gen_cold_ptr;
+    void *code_gen_cold_highwater;
+
     TBContext tb_ctx;
 
     /* Track which vCPU triggers events */
@@ -763,6 +850,14 @@ TCGv_i64 tcg_temp_new_internal_i64(int temp_local);
 void tcg_temp_free_i32(TCGv_i32 arg);
 void tcg_temp_free_i64(TCGv_i64 arg);
 
+TCGv_vec tcg_temp_new_vec(void);
+void tcg_temp_free_vec(TCGv_vec arg);
+
+/* Return true if the host can emit vector opcode OPC for elements of
+   size 1 << VECE bytes; when false the caller must expand the operation
+   with scalar ops, as tcg-op-gvec.c does.  */
+bool tcg_can_emit_vec_op(TCGOpcode opc, unsigned vece);
+
 static inline TCGv_i32 tcg_global_mem_new_i32(TCGv_ptr reg, intptr_t offset,
                                               const char *name)
 {
@@ -842,6 +937,9 @@ enum {
     /* Instruction is optional and not implemented by the host, or insn
        is generic and should not be implemened by the host.  */
     TCG_OPF_NOT_PRESENT  = 0x10,
+    /* Instruction is a conditional branch: globals are only synced, so
+       the fall-through path may keep them in host registers.  */
+    TCG_OPF_COND_BRANCH  = 0x20,
 };
 
 typedef struct TCGOpDef {
@@ -875,7 +973,9 @@ void tcg_add_target_add_op_defs(const TCGTargetOpDef *tdefs);
 #define TCGV_NAT_TO_PTR(n) MAKE_TCGV_PTR(GET_TCGV_I32(n))
 #define TCGV_PTR_TO_NAT(n) MAKE_TCGV_I32(GET_TCGV_PTR(n))
 
-#define tcg_const_ptr(V) TCGV_NAT_TO_PTR(tcg_const_i32((intptr_t)(V)))
+#define tcg_const_ptr(V) \
+    (tcg_ctx.code_relocs_unsafe = true, \
+     TCGV_NAT_TO_PTR(tcg_const_i32((intptr_t)(V))))
 #define tcg_global_reg_new_ptr(R, N) \
     TCGV_NAT_TO_PTR(tcg_global_reg_new_i32((R), (N)))
 #define tcg_global_mem_new_ptr(R, O, N) \
@@ -886,7 +986,9 @@ void tcg_add_target_add_op_defs(const TCGTargetOpDef *tdefs);
 #define TCGV_NAT_TO_PTR(n) MAKE_TCGV_PTR(GET_TCGV_I64(n))
 #define TCGV_PTR_TO_NAT(n) MAKE_TCGV_I64(GET_TCGV_PTR(n))
 
-#define tcg_const_ptr(V) TCGV_NAT_TO_PTR(tcg_const_i64((intptr_t)(V)))
+#define tcg_const_ptr(V) \
+    (tcg_ctx.code_relocs_unsafe = true, \
+     TCGV_NAT_TO_PTR(tcg_const_i64((intptr_t)(V))))
 #define tcg_global_reg_new_ptr(R, N) \
     TCGV_NAT_TO_PTR(tcg_global_reg_new_i64((R), (N)))
 #define tcg_global_mem_new_ptr(R, O, N) \
@@ -1083,6 +1185,15 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr);
 
 void tcg_register_jit(void *buf, size_t buf_size);
 
+/* Guest compare-and-swap with a host atomic instruction, for helpers
+   that need one while vCPUs run in parallel; see tcg-runtime.c.  */
+uint32_t tcg_atomic_cmpxchg_i32(CPUArchState *env, target_ulong addr,
+                                uint32_t cmpv, uint32_t newv,
+                                TCGMemOpIdx oi, uintptr_t retaddr);
+uint64_t tcg_atomic_cmpxchg_i64(CPUArchState *env, target_ulong addr,
+                                uint64_t cmpv, uint64_t newv,
+                                TCGMemOpIdx oi, uintptr_t retaddr);
+
 /*
  * Memory helpers that will be used by TCG generated code.
  */
@@ -43,6 +43,7 @@
 #define TCG_TARGET_INTERPRETER 1
 #define TCG_TARGET_INSN_UNIT_SIZE 1
 #define TCG_TARGET_TLB_DISPLACEMENT_BITS 32
+#define TCG_TARGET_IMPLEMENTS_DYN_TLB 1
 
 #if UINTPTR_MAX == UINT32_MAX
 # define TCG_TARGET_REG_BITS 32
@@ -80,6 +81,7 @@
 #define TCG_TARGET_HAS_muls2_i32        0
 #define TCG_TARGET_HAS_muluh_i32        0
 #define TCG_TARGET_HAS_mulsh_i32        0
+#define TCG_TARGET_HAS_goto_ptr         1
 
 #if TCG_TARGET_REG_BITS == 64
 #define TCG_TARGET_HAS_extrl_i64_i32    0
@@ -162,8 +164,6 @@ typedef enum {
     TCG_REG_R31,
 #endif
 #endif
-    /* Special value UINT8_MAX is used by TCI to encode constant values. */
-    TCG_CONST = UINT8_MAX
 } TCGReg;
 
 #define TCG_AREG0                       (TCG_TARGET_NB_REGS - 2)
@@ -173,6 +173,27 @@ typedef enum {
 #define TCG_TARGET_CALL_STACK_OFFSET    0
 #define TCG_TARGET_STACK_ALIGN          16
 
+/* TCI bytecode is a sequence of instructions, each made of one or more
+ * 64-bit words.  The first word holds
+ *
+ *     bits  0..7   the opcode,
+ *     bits  8..15  the length of the instruction in 64-bit words,
+ *     bits 16..63  up to six 8-bit fields (registers, conditions and
+ *                  deposit positions), or two fields followed by a
+ *                  32-bit immediate in bits 32..63;
+ *
+ * the following words hold labels, helper addresses, 64-bit constants
+ * and memory operation indexes.  All other operands are registers.
+ */
+#define TCI_INSN(opc, len)      ((uint64_t)(opc) | ((uint64_t)(len) << 8))
+#define TCI_F(n, val)           ((uint64_t)(uint8_t)(val) << (16 + 8 * (n)))
+#define TCI_I32(val)            ((uint64_t)(uint32_t)(val) << 32)
+
+#define TCI_OPC(insn)           ((uint8_t)(insn))
+#define TCI_LEN(insn)           ((uint8_t)((insn) >> 8))
+#define TCI_FIELD(insn, n)      ((uint8_t)((insn) >> (16 + 8 * (n))))
+#define TCI_IMM32(insn)         ((int32_t)((insn) >> 32))
+
 void tci_disas(uint8_t opc);
 
 #define HAVE_TCG_QEMU_TB_EXEC
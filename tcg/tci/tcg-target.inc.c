@@ -39,9 +39,10 @@
 /* Bitfield n...m (in 32 bit value). */
 #define BITS(n, m) (((0xffffffffU << (31 - n)) >> (31 - n + m)) << m)
 
-/* Macros used in tcg_target_op_defs. */
+/* Macros used in tcg_target_op_defs.  There are no constant operands:
+   the register allocator loads constants with movi, so that the
+   interpreter never has to check the kind of an operand.  */
 #define R       "r"
-#define RI      "ri"
 #if TCG_TARGET_REG_BITS == 32
 # define R64    "r", "r"
 #else
@@ -59,6 +60,7 @@
 static const TCGTargetOpDef tcg_target_op_defs[] = {
     { INDEX_op_exit_tb, { NULL } },
     { INDEX_op_goto_tb, { NULL } },
+    { INDEX_op_goto_ptr, { R } },
     { INDEX_op_br, { NULL } },
 
     { INDEX_op_ld8u_i32, { R, R } },
@@ -70,9 +72,9 @@ static const TCGTargetOpDef tcg_target_op_defs[] = {
     { INDEX_op_st16_i32, { R, R } },
     { INDEX_op_st_i32, { R, R } },
 
-    { INDEX_op_add_i32, { R, RI, RI } },
-    { INDEX_op_sub_i32, { R, RI, RI } },
-    { INDEX_op_mul_i32, { R, RI, RI } },
+    { INDEX_op_add_i32, { R, R, R } },
+    { INDEX_op_sub_i32, { R, R, R } },
+    { INDEX_op_mul_i32, { R, R, R } },
 #if TCG_TARGET_HAS_div_i32
     { INDEX_op_div_i32, { R, R, R } },
     { INDEX_op_divu_i32, { R, R, R } },
@@ -82,51 +84,48 @@ static const TCGTargetOpDef tcg_target_op_defs[] = {
     { INDEX_op_div2_i32, { R, R, "0", "1", R } },
     { INDEX_op_divu2_i32, { R, R, "0", "1", R } },
 #endif
-    /* TODO: Does R, RI, RI result in faster code than R, R, RI?
-       If both operands are constants, we can optimize. */
-    { INDEX_op_and_i32, { R, RI, RI } },
+    { INDEX_op_and_i32, { R, R, R } },
 #if TCG_TARGET_HAS_andc_i32
-    { INDEX_op_andc_i32, { R, RI, RI } },
+    { INDEX_op_andc_i32, { R, R, R } },
 #endif
 #if TCG_TARGET_HAS_eqv_i32
-    { INDEX_op_eqv_i32, { R, RI, RI } },
+    { INDEX_op_eqv_i32, { R, R, R } },
 #endif
 #if TCG_TARGET_HAS_nand_i32
-    { INDEX_op_nand_i32, { R, RI, RI } },
+    { INDEX_op_nand_i32, { R, R, R } },
 #endif
 #if TCG_TARGET_HAS_nor_i32
-    { INDEX_op_nor_i32, { R, RI, RI } },
+    { INDEX_op_nor_i32, { R, R, R } },
 #endif
-    { INDEX_op_or_i32, { R, RI, RI } },
+    { INDEX_op_or_i32, { R, R, R } },
 #if TCG_TARGET_HAS_orc_i32
-    { INDEX_op_orc_i32, { R, RI, RI } },
+    { INDEX_op_orc_i32, { R, R, R } },
 #endif
-    { INDEX_op_xor_i32, { R, RI, RI } },
-    { INDEX_op_shl_i32, { R, RI, RI } },
-    { INDEX_op_shr_i32, { R, RI, RI } },
-    { INDEX_op_sar_i32, { R, RI, RI } },
+    { INDEX_op_xor_i32, { R, R, R } },
+    { INDEX_op_shl_i32, { R, R, R } },
+    { INDEX_op_shr_i32, { R, R, R } },
+    { INDEX_op_sar_i32, { R, R, R } },
 #if TCG_TARGET_HAS_rot_i32
-    { INDEX_op_rotl_i32, { R, RI, RI } },
-    { INDEX_op_rotr_i32, { R, RI, RI } },
+    { INDEX_op_rotl_i32, { R, R, R } },
+    { INDEX_op_rotr_i32, { R, R, R } },
 #endif
 #if TCG_TARGET_HAS_deposit_i32
     { INDEX_op_deposit_i32, { R, "0", R } },
 #endif
 
-    { INDEX_op_brcond_i32, { R, RI } },
+    { INDEX_op_brcond_i32, { R, R } },
 
-    { INDEX_op_setcond_i32, { R, R, RI } },
+    { INDEX_op_setcond_i32, { R, R, R } },
 #if TCG_TARGET_REG_BITS == 64
-    { INDEX_op_setcond_i64, { R, R, RI } },
+    { INDEX_op_setcond_i64, { R, R, R } },
 #endif /* TCG_TARGET_REG_BITS == 64 */
 
 #if TCG_TARGET_REG_BITS == 32
-    /* TODO: Support R, R, R, R, RI, RI? Will it be faster? */
     { INDEX_op_add2_i32, { R, R, R, R, R, R } },
     { INDEX_op_sub2_i32, { R, R, R, R, R, R } },
-    { INDEX_op_brcond2_i32, { R, R, RI, RI } },
+    { INDEX_op_brcond2_i32, { R, R, R, R } },
     { INDEX_op_mulu2_i32, { R, R, R, R } },
-    { INDEX_op_setcond2_i32, { R, R, R, RI, RI } },
+    { INDEX_op_setcond2_i32, { R, R, R, R, R } },
 #endif
 
 #if TCG_TARGET_HAS_not_i32
@@ -150,9 +149,9 @@ static const TCGTargetOpDef tcg_target_op_defs[] = {
     { INDEX_op_st32_i64, { R, R } },
     { INDEX_op_st_i64, { R, R } },
 
-    { INDEX_op_add_i64, { R, RI, RI } },
-    { INDEX_op_sub_i64, { R, RI, RI } },
-    { INDEX_op_mul_i64, { R, RI, RI } },
+    { INDEX_op_add_i64, { R, R, R } },
+    { INDEX_op_sub_i64, { R, R, R } },
+    { INDEX_op_mul_i64, { R, R, R } },
 #if TCG_TARGET_HAS_div_i64
     { INDEX_op_div_i64, { R, R, R } },
     { INDEX_op_divu_i64, { R, R, R } },
@@ -162,35 +161,35 @@ static const TCGTargetOpDef tcg_target_op_defs[] = {
     { INDEX_op_div2_i64, { R, R, "0", "1", R } },
     { INDEX_op_divu2_i64, { R, R, "0", "1", R } },
 #endif
-    { INDEX_op_and_i64, { R, RI, RI } },
+    { INDEX_op_and_i64, { R, R, R } },
 #if TCG_TARGET_HAS_andc_i64
-    { INDEX_op_andc_i64, { R, RI, RI } },
+    { INDEX_op_andc_i64, { R, R, R } },
 #endif
 #if TCG_TARGET_HAS_eqv_i64
-    { INDEX_op_eqv_i64, { R, RI, RI } },
+    { INDEX_op_eqv_i64, { R, R, R } },
 #endif
 #if TCG_TARGET_HAS_nand_i64
-    { INDEX_op_nand_i64, { R, RI, RI } },
+    { INDEX_op_nand_i64, { R, R, R } },
 #endif
 #if TCG_TARGET_HAS_nor_i64
-    { INDEX_op_nor_i64, { R, RI, RI } },
+    { INDEX_op_nor_i64, { R, R, R } },
 #endif
-    { INDEX_op_or_i64, { R, RI, RI } },
+    { INDEX_op_or_i64, { R, R, R } },
 #if TCG_TARGET_HAS_orc_i64
-    { INDEX_op_orc_i64, { R, RI, RI } },
+    { INDEX_op_orc_i64, { R, R, R } },
 #endif
-    { INDEX_op_xor_i64, { R, RI, RI } },
-    { INDEX_op_shl_i64, { R, RI, RI } },
-    { INDEX_op_shr_i64, { R, RI, RI } },
-    { INDEX_op_sar_i64, { R, RI, RI } },
+    { INDEX_op_xor_i64, { R, R, R } },
+    { INDEX_op_shl_i64, { R, R, R } },
+    { INDEX_op_shr_i64, { R, R, R } },
+    { INDEX_op_sar_i64, { R, R, R } },
 #if TCG_TARGET_HAS_rot_i64
-    { INDEX_op_rotl_i64, { R, RI, RI } },
-    { INDEX_op_rotr_i64, { R, RI, RI } },
+    { INDEX_op_rotl_i64, { R, R, R } },
+    { INDEX_op_rotr_i64, { R, R, R } },
 #endif
 #if TCG_TARGET_HAS_deposit_i64
     { INDEX_op_deposit_i64, { R, "0", R } },
 #endif
-    { INDEX_op_brcond_i64, { R, RI } },
+    { INDEX_op_brcond_i64, { R, R } },
 
 #if TCG_TARGET_HAS_ext8s_i64
     { INDEX_op_ext8s_i64, { R, R } },
@@ -360,14 +359,10 @@ static void patch_reloc(tcg_insn_unit *code_ptr, int type,
                         intptr_t value, intptr_t addend)
 {
     /* tcg_out_reloc always uses the same type, addend. */
-    tcg_debug_assert(type == sizeof(tcg_target_long));
+    tcg_debug_assert(type == sizeof(uint64_t));
     tcg_debug_assert(addend == 0);
     tcg_debug_assert(value != 0);
-    if (TCG_TARGET_REG_BITS == 32) {
-        tcg_patch32(code_ptr, value);
-    } else {
-        tcg_patch64(code_ptr, value);
-    }
+    tcg_patch64(code_ptr, (uintptr_t)value);
 }
 
 /* Parse target specific constraints. */
@@ -399,166 +394,102 @@ void tci_disas(uint8_t opc)
 }
 #endif
 
-/* Write value (native size). */
-static void tcg_out_i(TCGContext *s, tcg_target_ulong v)
-{
-    if (TCG_TARGET_REG_BITS == 32) {
-        tcg_out32(s, v);
-    } else {
-        tcg_out64(s, v);
-    }
-}
-
-/* Write opcode. */
-static void tcg_out_op_t(TCGContext *s, TCGOpcode op)
-{
-    tcg_out8(s, op);
-    tcg_out8(s, 0);
-}
-
-/* Write register. */
-static void tcg_out_r(TCGContext *s, TCGArg t0)
-{
-    tcg_debug_assert(t0 < TCG_TARGET_NB_REGS);
-    tcg_out8(s, t0);
-}
-
-/* Write register or constant (native size). */
-static void tcg_out_ri(TCGContext *s, int const_arg, TCGArg arg)
-{
-    if (const_arg) {
-        tcg_debug_assert(const_arg == 1);
-        tcg_out8(s, TCG_CONST);
-        tcg_out_i(s, arg);
-    } else {
-        tcg_out_r(s, arg);
-    }
-}
-
-/* Write register or constant (32 bit). */
-static void tcg_out_ri32(TCGContext *s, int const_arg, TCGArg arg)
+/* Write the first word of an instruction. */
+static void tci_out_insn(TCGContext *s, TCGOpcode opc, int len,
+                         uint64_t fields)
 {
-    if (const_arg) {
-        tcg_debug_assert(const_arg == 1);
-        tcg_out8(s, TCG_CONST);
-        tcg_out32(s, arg);
-    } else {
-        tcg_out_r(s, arg);
-    }
+    tcg_debug_assert(((uintptr_t)s->code_ptr & 7) == 0);
+    tcg_out64(s, TCI_INSN(opc, len) | fields);
 }
 
-#if TCG_TARGET_REG_BITS == 64
-/* Write register or constant (64 bit). */
-static void tcg_out_ri64(TCGContext *s, int const_arg, TCGArg arg)
+/* Register field. */
+static uint64_t tci_r(int n, TCGArg r)
 {
-    if (const_arg) {
-        tcg_debug_assert(const_arg == 1);
-        tcg_out8(s, TCG_CONST);
-        tcg_out64(s, arg);
-    } else {
-        tcg_out_r(s, arg);
-    }
+    tcg_debug_assert(r < TCG_TARGET_NB_REGS);
+    return TCI_F(n, r);
 }
-#endif
 
 /* Write label. */
 static void tci_out_label(TCGContext *s, TCGLabel *label)
 {
     if (label->has_value) {
-        tcg_out_i(s, label->u.value);
         tcg_debug_assert(label->u.value);
+        tcg_out64(s, label->u.value);
     } else {
-        tcg_out_reloc(s, s->code_ptr, sizeof(tcg_target_ulong), label, 0);
-        s->code_ptr += sizeof(tcg_target_ulong);
+        tcg_out_reloc(s, s->code_ptr, sizeof(uint64_t), label, 0);
+        s->code_ptr += sizeof(uint64_t);
     }
 }
 
 static void tcg_out_ld(TCGContext *s, TCGType type, TCGReg ret, TCGReg arg1,
                        intptr_t arg2)
 {
-    uint8_t *old_code_ptr = s->code_ptr;
-    if (type == TCG_TYPE_I32) {
-        tcg_out_op_t(s, INDEX_op_ld_i32);
-        tcg_out_r(s, ret);
-        tcg_out_r(s, arg1);
-        tcg_out32(s, arg2);
-    } else {
-        tcg_debug_assert(type == TCG_TYPE_I64);
+    TCGOpcode opc = INDEX_op_ld_i32;
+
+    if (type == TCG_TYPE_I64) {
 #if TCG_TARGET_REG_BITS == 64
-        tcg_out_op_t(s, INDEX_op_ld_i64);
-        tcg_out_r(s, ret);
-        tcg_out_r(s, arg1);
-        tcg_debug_assert(arg2 == (int32_t)arg2);
-        tcg_out32(s, arg2);
+        opc = INDEX_op_ld_i64;
 #else
         TODO();
 #endif
     }
-    old_code_ptr[1] = s->code_ptr - old_code_ptr;
+    tcg_debug_assert(arg2 == (int32_t)arg2);
+    tci_out_insn(s, opc, 1, tci_r(0, ret) | tci_r(1, arg1) | TCI_I32(arg2));
 }
 
 static void tcg_out_mov(TCGContext *s, TCGType type, TCGReg ret, TCGReg arg)
 {
-    uint8_t *old_code_ptr = s->code_ptr;
     tcg_debug_assert(ret != arg);
 #if TCG_TARGET_REG_BITS == 32
-    tcg_out_op_t(s, INDEX_op_mov_i32);
+    tci_out_insn(s, INDEX_op_mov_i32, 1, tci_r(0, ret) | tci_r(1, arg));
 #else
-    tcg_out_op_t(s, INDEX_op_mov_i64);
+    tci_out_insn(s, INDEX_op_mov_i64, 1, tci_r(0, ret) | tci_r(1, arg));
 #endif
-    tcg_out_r(s, ret);
-    tcg_out_r(s, arg);
-    old_code_ptr[1] = s->code_ptr - old_code_ptr;
 }
 
 static void tcg_out_movi(TCGContext *s, TCGType type,
                          TCGReg t0, tcg_target_long arg)
 {
-    uint8_t *old_code_ptr = s->code_ptr;
     uint32_t arg32 = arg;
+
     if (type == TCG_TYPE_I32 || arg == arg32) {
-        tcg_out_op_t(s, INDEX_op_movi_i32);
-        tcg_out_r(s, t0);
-        tcg_out32(s, arg32);
+        tci_out_insn(s, INDEX_op_movi_i32, 1, tci_r(0, t0) | TCI_I32(arg32));
     } else {
         tcg_debug_assert(type == TCG_TYPE_I64);
 #if TCG_TARGET_REG_BITS == 64
-        tcg_out_op_t(s, INDEX_op_movi_i64);
-        tcg_out_r(s, t0);
+        tci_out_insn(s, INDEX_op_movi_i64, 2, tci_r(0, t0));
         tcg_out64(s, arg);
 #else
         TODO();
 #endif
     }
-    old_code_ptr[1] = s->code_ptr - old_code_ptr;
 }
 
 static inline void tcg_out_call(TCGContext *s, tcg_insn_unit *arg)
 {
-    uint8_t *old_code_ptr = s->code_ptr;
-    tcg_out_op_t(s, INDEX_op_call);
-    tcg_out_ri(s, 1, (uintptr_t)arg);
-    old_code_ptr[1] = s->code_ptr - old_code_ptr;
+    tci_out_insn(s, INDEX_op_call, 2, 0);
+    tcg_out64(s, (uintptr_t)arg);
 }
 
 static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
                        const int *const_args)
 {
-    uint8_t *old_code_ptr = s->code_ptr;
-
-    tcg_out_op_t(s, opc);
+    uint64_t f;
+    int i;
 
     switch (opc) {
     case INDEX_op_exit_tb:
+        tci_out_insn(s, opc, 2, 0);
         tcg_out64(s, args[0]);
         break;
     case INDEX_op_goto_tb:
         if (s->tb_jmp_insn_offset) {
-            /* Direct jump method. */
+            /* Direct jump method.  The second word starts with a 32-bit
+               displacement from its own end, see tb_set_jmp_target1. */
             tcg_debug_assert(args[0] < ARRAY_SIZE(s->tb_jmp_insn_offset));
-            /* Align for atomic patching and thread safety */
-            s->code_ptr = QEMU_ALIGN_PTR_UP(s->code_ptr, 4);
+            tci_out_insn(s, opc, 2, 0);
             s->tb_jmp_insn_offset[args[0]] = tcg_current_code_size(s);
+            tcg_out32(s, 4);
             tcg_out32(s, 0);
         } else {
             /* Indirect jump method. */
@@ -567,31 +498,24 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
         tcg_debug_assert(args[0] < ARRAY_SIZE(s->tb_jmp_reset_offset));
         s->tb_jmp_reset_offset[args[0]] = tcg_current_code_size(s);
         break;
+    case INDEX_op_goto_ptr:
+        tci_out_insn(s, opc, 1, tci_r(0, args[0]));
+        break;
     case INDEX_op_br:
+        tci_out_insn(s, opc, 2, 0);
         tci_out_label(s, arg_label(args[0]));
         break;
     case INDEX_op_setcond_i32:
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
-        tcg_out_ri32(s, const_args[2], args[2]);
-        tcg_out8(s, args[3]);   /* condition */
+    case INDEX_op_setcond_i64:
+        tci_out_insn(s, opc, 1, tci_r(0, args[0]) | tci_r(1, args[1]) |
+                     tci_r(2, args[2]) | TCI_F(3, args[3]));
         break;
 #if TCG_TARGET_REG_BITS == 32
     case INDEX_op_setcond2_i32:
         /* setcond2_i32 cond, t0, t1_low, t1_high, t2_low, t2_high */
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
-        tcg_out_r(s, args[2]);
-        tcg_out_ri32(s, const_args[3], args[3]);
-        tcg_out_ri32(s, const_args[4], args[4]);
-        tcg_out8(s, args[5]);   /* condition */
-        break;
-#elif TCG_TARGET_REG_BITS == 64
-    case INDEX_op_setcond_i64:
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
-        tcg_out_ri64(s, const_args[2], args[2]);
-        tcg_out8(s, args[3]);   /* condition */
+        tci_out_insn(s, opc, 1, tci_r(0, args[0]) | tci_r(1, args[1]) |
+                     tci_r(2, args[2]) | tci_r(3, args[3]) |
+                     tci_r(4, args[4]) | TCI_F(5, args[5]));
         break;
 #endif
     case INDEX_op_ld8u_i32:
@@ -613,10 +537,9 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
     case INDEX_op_st16_i64:
     case INDEX_op_st32_i64:
     case INDEX_op_st_i64:
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
         tcg_debug_assert(args[2] == (int32_t)args[2]);
-        tcg_out32(s, args[2]);
+        tci_out_insn(s, opc, 1, tci_r(0, args[0]) | tci_r(1, args[1]) |
+                     TCI_I32(args[2]));
         break;
     case INDEX_op_add_i32:
     case INDEX_op_sub_i32:
@@ -634,20 +557,10 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
     case INDEX_op_sar_i32:
     case INDEX_op_rotl_i32:     /* Optional (TCG_TARGET_HAS_rot_i32). */
     case INDEX_op_rotr_i32:     /* Optional (TCG_TARGET_HAS_rot_i32). */
-        tcg_out_r(s, args[0]);
-        tcg_out_ri32(s, const_args[1], args[1]);
-        tcg_out_ri32(s, const_args[2], args[2]);
-        break;
-    case INDEX_op_deposit_i32:  /* Optional (TCG_TARGET_HAS_deposit_i32). */
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
-        tcg_out_r(s, args[2]);
-        tcg_debug_assert(args[3] <= UINT8_MAX);
-        tcg_out8(s, args[3]);
-        tcg_debug_assert(args[4] <= UINT8_MAX);
-        tcg_out8(s, args[4]);
-        break;
-
+    case INDEX_op_div_i32:      /* Optional (TCG_TARGET_HAS_div_i32). */
+    case INDEX_op_divu_i32:     /* Optional (TCG_TARGET_HAS_div_i32). */
+    case INDEX_op_rem_i32:      /* Optional (TCG_TARGET_HAS_div_i32). */
+    case INDEX_op_remu_i32:     /* Optional (TCG_TARGET_HAS_div_i32). */
 #if TCG_TARGET_REG_BITS == 64
     case INDEX_op_add_i64:
     case INDEX_op_sub_i64:
@@ -665,19 +578,20 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
     case INDEX_op_sar_i64:
     case INDEX_op_rotl_i64:     /* Optional (TCG_TARGET_HAS_rot_i64). */
     case INDEX_op_rotr_i64:     /* Optional (TCG_TARGET_HAS_rot_i64). */
-        tcg_out_r(s, args[0]);
-        tcg_out_ri64(s, const_args[1], args[1]);
-        tcg_out_ri64(s, const_args[2], args[2]);
+#endif
+        tci_out_insn(s, opc, 1, tci_r(0, args[0]) | tci_r(1, args[1]) |
+                     tci_r(2, args[2]));
         break;
+    case INDEX_op_deposit_i32:  /* Optional (TCG_TARGET_HAS_deposit_i32). */
     case INDEX_op_deposit_i64:  /* Optional (TCG_TARGET_HAS_deposit_i64). */
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
-        tcg_out_r(s, args[2]);
         tcg_debug_assert(args[3] <= UINT8_MAX);
-        tcg_out8(s, args[3]);
         tcg_debug_assert(args[4] <= UINT8_MAX);
-        tcg_out8(s, args[4]);
+        tci_out_insn(s, opc, 1, tci_r(0, args[0]) | tci_r(1, args[1]) |
+                     tci_r(2, args[2]) | TCI_F(3, args[3]) |
+                     TCI_F(4, args[4]));
         break;
+
+#if TCG_TARGET_REG_BITS == 64
     case INDEX_op_div_i64:      /* Optional (TCG_TARGET_HAS_div_i64). */
     case INDEX_op_divu_i64:     /* Optional (TCG_TARGET_HAS_div_i64). */
     case INDEX_op_rem_i64:      /* Optional (TCG_TARGET_HAS_div_i64). */
@@ -689,11 +603,13 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
         TODO();
         break;
     case INDEX_op_brcond_i64:
-        tcg_out_r(s, args[0]);
-        tcg_out_ri64(s, const_args[1], args[1]);
-        tcg_out8(s, args[2]);           /* condition */
+#endif /* TCG_TARGET_REG_BITS == 64 */
+    case INDEX_op_brcond_i32:
+        tci_out_insn(s, opc, 2, tci_r(0, args[0]) | tci_r(1, args[1]) |
+                     TCI_F(2, args[2]));
         tci_out_label(s, arg_label(args[3]));
         break;
+#if TCG_TARGET_REG_BITS == 64
     case INDEX_op_bswap16_i64:  /* Optional (TCG_TARGET_HAS_bswap16_i64). */
     case INDEX_op_bswap32_i64:  /* Optional (TCG_TARGET_HAS_bswap32_i64). */
     case INDEX_op_bswap64_i64:  /* Optional (TCG_TARGET_HAS_bswap64_i64). */
@@ -716,16 +632,7 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
     case INDEX_op_ext16u_i32:   /* Optional (TCG_TARGET_HAS_ext16u_i32). */
     case INDEX_op_bswap16_i32:  /* Optional (TCG_TARGET_HAS_bswap16_i32). */
     case INDEX_op_bswap32_i32:  /* Optional (TCG_TARGET_HAS_bswap32_i32). */
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
-        break;
-    case INDEX_op_div_i32:      /* Optional (TCG_TARGET_HAS_div_i32). */
-    case INDEX_op_divu_i32:     /* Optional (TCG_TARGET_HAS_div_i32). */
-    case INDEX_op_rem_i32:      /* Optional (TCG_TARGET_HAS_div_i32). */
-    case INDEX_op_remu_i32:     /* Optional (TCG_TARGET_HAS_div_i32). */
-        tcg_out_r(s, args[0]);
-        tcg_out_ri32(s, const_args[1], args[1]);
-        tcg_out_ri32(s, const_args[2], args[2]);
+        tci_out_insn(s, opc, 1, tci_r(0, args[0]) | tci_r(1, args[1]));
         break;
     case INDEX_op_div2_i32:     /* Optional (TCG_TARGET_HAS_div2_i32). */
     case INDEX_op_divu2_i32:    /* Optional (TCG_TARGET_HAS_div2_i32). */
@@ -734,71 +641,45 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
 #if TCG_TARGET_REG_BITS == 32
     case INDEX_op_add2_i32:
     case INDEX_op_sub2_i32:
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
-        tcg_out_r(s, args[2]);
-        tcg_out_r(s, args[3]);
-        tcg_out_r(s, args[4]);
-        tcg_out_r(s, args[5]);
+        tci_out_insn(s, opc, 1, tci_r(0, args[0]) | tci_r(1, args[1]) |
+                     tci_r(2, args[2]) | tci_r(3, args[3]) |
+                     tci_r(4, args[4]) | tci_r(5, args[5]));
         break;
     case INDEX_op_brcond2_i32:
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
-        tcg_out_ri32(s, const_args[2], args[2]);
-        tcg_out_ri32(s, const_args[3], args[3]);
-        tcg_out8(s, args[4]);           /* condition */
+        tci_out_insn(s, opc, 2, tci_r(0, args[0]) | tci_r(1, args[1]) |
+                     tci_r(2, args[2]) | tci_r(3, args[3]) |
+                     TCI_F(4, args[4]));
         tci_out_label(s, arg_label(args[5]));
         break;
     case INDEX_op_mulu2_i32:
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
-        tcg_out_r(s, args[2]);
-        tcg_out_r(s, args[3]);
+        tci_out_insn(s, opc, 1, tci_r(0, args[0]) | tci_r(1, args[1]) |
+                     tci_r(2, args[2]) | tci_r(3, args[3]));
         break;
 #endif
-    case INDEX_op_brcond_i32:
-        tcg_out_r(s, args[0]);
-        tcg_out_ri32(s, const_args[1], args[1]);
-        tcg_out8(s, args[2]);           /* condition */
-        tci_out_label(s, arg_label(args[3]));
-        break;
     case INDEX_op_qemu_ld_i32:
-        tcg_out_r(s, *args++);
-        tcg_out_r(s, *args++);
-        if (TARGET_LONG_BITS > TCG_TARGET_REG_BITS) {
-            tcg_out_r(s, *args++);
-        }
-        tcg_out_i(s, *args++);
-        break;
     case INDEX_op_qemu_ld_i64:
-        tcg_out_r(s, *args++);
-        if (TCG_TARGET_REG_BITS == 32) {
-            tcg_out_r(s, *args++);
-        }
-        tcg_out_r(s, *args++);
-        if (TARGET_LONG_BITS > TCG_TARGET_REG_BITS) {
-            tcg_out_r(s, *args++);
-        }
-        tcg_out_i(s, *args++);
-        break;
     case INDEX_op_qemu_st_i32:
-        tcg_out_r(s, *args++);
-        tcg_out_r(s, *args++);
-        if (TARGET_LONG_BITS > TCG_TARGET_REG_BITS) {
-            tcg_out_r(s, *args++);
-        }
-        tcg_out_i(s, *args++);
-        break;
     case INDEX_op_qemu_st_i64:
-        tcg_out_r(s, *args++);
-        if (TCG_TARGET_REG_BITS == 32) {
-            tcg_out_r(s, *args++);
+        /* The value (two registers for 64-bit values on 32-bit hosts),
+           the address (two registers if the guest address is wider than
+           a host register) and the memory operation index.  */
+        f = 0;
+        i = 0;
+        f |= tci_r(i, args[i]);
+        i++;
+        if (TCG_TARGET_REG_BITS == 32 &&
+            (opc == INDEX_op_qemu_ld_i64 || opc == INDEX_op_qemu_st_i64)) {
+            f |= tci_r(i, args[i]);
+            i++;
         }
-        tcg_out_r(s, *args++);
+        f |= tci_r(i, args[i]);
+        i++;
         if (TARGET_LONG_BITS > TCG_TARGET_REG_BITS) {
-            tcg_out_r(s, *args++);
+            f |= tci_r(i, args[i]);
+            i++;
         }
-        tcg_out_i(s, *args++);
+        tci_out_insn(s, opc, 2, f);
+        tcg_out64(s, args[i]);
         break;
     case INDEX_op_mov_i32:  /* Always emitted via tcg_out_mov.  */
     case INDEX_op_mov_i64:
@@ -808,30 +689,22 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
     default:
         tcg_abort();
     }
-    old_code_ptr[1] = s->code_ptr - old_code_ptr;
 }
 
 static void tcg_out_st(TCGContext *s, TCGType type, TCGReg arg, TCGReg arg1,
                        intptr_t arg2)
 {
-    uint8_t *old_code_ptr = s->code_ptr;
-    if (type == TCG_TYPE_I32) {
-        tcg_out_op_t(s, INDEX_op_st_i32);
-        tcg_out_r(s, arg);
-        tcg_out_r(s, arg1);
-        tcg_out32(s, arg2);
-    } else {
-        tcg_debug_assert(type == TCG_TYPE_I64);
+    TCGOpcode opc = INDEX_op_st_i32;
+
+    if (type == TCG_TYPE_I64) {
 #if TCG_TARGET_REG_BITS == 64
-        tcg_out_op_t(s, INDEX_op_st_i64);
-        tcg_out_r(s, arg);
-        tcg_out_r(s, arg1);
-        tcg_out32(s, arg2);
+        opc = INDEX_op_st_i64;
 #else
         TODO();
 #endif
     }
-    old_code_ptr[1] = s->code_ptr - old_code_ptr;
+    tcg_debug_assert(arg2 == (int32_t)arg2);
+    tci_out_insn(s, opc, 1, tci_r(0, arg) | tci_r(1, arg1) | TCI_I32(arg2));
 }
 
 static inline bool tcg_out_sti(TCGContext *s, TCGType type, TCGArg val,
@@ -881,7 +754,11 @@ static void tcg_target_init(TCGContext *s)
                   CPU_TEMP_BUF_NLONGS * sizeof(long));
 }
 
-/* Generate global QEMU prologue and epilogue code. */
+/* Generate global QEMU prologue and epilogue code.  There is no prologue,
+   the epilogue is the target of goto_ptr when no TB was found.  */
 static inline void tcg_target_qemu_prologue(TCGContext *s)
 {
+    s->code_gen_epilogue = s->code_ptr;
+    tci_out_insn(s, INDEX_op_exit_tb, 2, 0);
+    tcg_out64(s, 0);
 }
@@ -0,0 +1,405 @@
+/*
+ * fp-bench.c - softfloat throughput benchmark
+ *
+ * Copyright (c) 2016 agent <agent@local>
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+#include "fpu/softfloat.h"
+
+enum op {
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_FMA,
+    OP_SQRT,
+};
+
+static const char * const op_names[] = {
+    [OP_ADD] = "add",
+    [OP_SUB] = "sub",
+    [OP_MUL] = "mul",
+    [OP_DIV] = "div",
+    [OP_FMA] = "mulAdd",
+    [OP_SQRT] = "sqrt",
+};
+
+#define N_INPUTS 1024
+
+static enum op op;
+static bool use_double;
+static bool force_soft;
+static bool check;
+static unsigned int duration = 1;
+static uint64_t random_seed = 0xdeadbeef;
+
+static float32 f32_in[N_INPUTS][3];
+static float64 f64_in[N_INPUTS][3];
+
+static const char commands_string[] =
+    " -o = operation: add, sub, mul, div, mulAdd, sqrt (default: add)\n"
+    " -p = precision: single, double (default: single)\n"
+    " -d = duration, in seconds (default: 1)\n"
+    " -r = seed for the random inputs\n"
+    " -s = clear the inexact flag before each operation, which forces\n"
+    "      the soft-float code path\n"
+    " -c = check that the host FPU path and the soft-float path give\n"
+    "      the same results and flags, instead of benchmarking.  The\n"
+    "      inputs then also include zeroes, denormals, small integers\n"
+    "      and numbers close to overflow and underflow, and every\n"
+    "      rounding mode is tried";
+
+static void usage_complete(int argc, char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+    exit(-1);
+}
+
+/* See tests/qht-bench.c */
+static uint64_t xorshift64star(uint64_t x)
+{
+    x ^= x >> 12; /* a */
+    x ^= x << 25; /* b */
+    x ^= x >> 27; /* c */
+    return x * UINT64_C(2685821657736338717);
+}
+
+/*
+ * Random normal numbers with exponents close enough to 1.0 that neither
+ * overflow nor underflow can happen, whatever the operation.
+ */
+static void fill_inputs(void)
+{
+    uint64_t r = random_seed;
+    int i, j;
+
+    for (i = 0; i < N_INPUTS; i++) {
+        for (j = 0; j < 3; j++) {
+            uint32_t e32, f32;
+            uint64_t e64, f64;
+
+            r = xorshift64star(r);
+            e32 = 0x7f - 32 + (r & 63);
+            f32 = (r >> 6) & 0x007fffff;
+            f32_in[i][j] = make_float32((e32 << 23) | f32);
+
+            r = xorshift64star(r);
+            e64 = 0x3ff - 64 + (r & 127);
+            f64 = (r >> 7) & LIT64(0x000fffffffffffff);
+            f64_in[i][j] = make_float64((e64 << 52) | f64);
+        }
+    }
+}
+
+/*
+ * The inputs for -c also cover the cases that the host FPU path has to
+ * leave to the soft-float code, or handle with care: results that
+ * overflow, that may be tiny, and exact zeroes from x - x, x * 0 or
+ * a * b - a * b.  Small integers give exact results, the others are
+ * mostly inexact.
+ */
+enum check_class {
+    CLASS_NORMAL,
+    CLASS_HUGE,
+    CLASS_TINY,
+    CLASS_DENORMAL,
+    CLASS_ZERO,
+    CLASS_INT,
+    CLASS_NEG_PREV,
+    CLASS_NEG_PRODUCT,
+    N_CHECK_CLASSES
+};
+
+static float32 check_input32(const float32 *in, int j, uint64_t r)
+{
+    float_status st = { 0 };
+    uint32_t sign = (r >> 63) << 31;
+    uint32_t f = (r >> 8) & 0x007fffff;
+    uint32_t e;
+
+    switch ((r >> 3) % N_CHECK_CLASSES) {
+    case CLASS_NORMAL:
+    default:
+        e = 0x7f - 32 + (r & 63);
+        break;
+    case CLASS_HUGE:
+        e = 0xfe - (r & 7);
+        break;
+    case CLASS_TINY:
+        e = 1 + (r & 7);
+        break;
+    case CLASS_DENORMAL:
+        e = 0;
+        f >>= r & 7;
+        break;
+    case CLASS_ZERO:
+        e = 0;
+        f = 0;
+        break;
+    case CLASS_INT:
+        return int32_to_float32((int32_t)(r >> 40) >> 12, &st);
+    case CLASS_NEG_PREV:
+        if (j == 0) {
+            return float32_one;
+        }
+        return float32_chs(in[j - 1]);
+    case CLASS_NEG_PRODUCT:
+        if (j < 2) {
+            return float32_one;
+        }
+        return float32_chs(float32_mul(in[0], in[1], &st));
+    }
+    return make_float32(sign | (e << 23) | f);
+}
+
+static float64 check_input64(const float64 *in, int j, uint64_t r)
+{
+    float_status st = { 0 };
+    uint64_t sign = (r >> 63) << 63;
+    uint64_t f = (r >> 8) & LIT64(0x000fffffffffffff);
+    uint64_t e;
+
+    switch ((r >> 3) % N_CHECK_CLASSES) {
+    case CLASS_NORMAL:
+    default:
+        e = 0x3ff - 64 + (r & 127);
+        break;
+    case CLASS_HUGE:
+        e = 0x7fe - (r & 7);
+        break;
+    case CLASS_TINY:
+        e = 1 + (r & 7);
+        break;
+    case CLASS_DENORMAL:
+        e = 0;
+        f >>= r & 7;
+        break;
+    case CLASS_ZERO:
+        e = 0;
+        f = 0;
+        break;
+    case CLASS_INT:
+        return int32_to_float64((int32_t)(r >> 40) >> 12, &st);
+    case CLASS_NEG_PREV:
+        if (j == 0) {
+            return float64_one;
+        }
+        return float64_chs(in[j - 1]);
+    case CLASS_NEG_PRODUCT:
+        if (j < 2) {
+            return float64_one;
+        }
+        return float64_chs(float64_mul(in[0], in[1], &st));
+    }
+    return make_float64(sign | (e << 52) | f);
+}
+
+static void fill_check_inputs(void)
+{
+    uint64_t r = random_seed;
+    int i, j;
+
+    for (i = 0; i < N_INPUTS; i++) {
+        for (j = 0; j < 3; j++) {
+            r = xorshift64star(r);
+            f32_in[i][j] = check_input32(f32_in[i], j, r);
+            r = xorshift64star(r);
+            f64_in[i][j] = check_input64(f64_in[i], j, r);
+        }
+    }
+}
+
+static float32 do_op32(const float32 *in, float_status *st)
+{
+    switch (op) {
+    case OP_ADD:
+        return float32_add(in[0], in[1], st);
+    case OP_SUB:
+        return float32_sub(in[0], in[1], st);
+    case OP_MUL:
+        return float32_mul(in[0], in[1], st);
+    case OP_DIV:
+        return float32_div(in[0], in[1], st);
+    case OP_FMA:
+        return float32_muladd(in[0], in[1], in[2], 0, st);
+    case OP_SQRT:
+        return float32_sqrt(in[0], st);
+    }
+    g_assert_not_reached();
+}
+
+static float64 do_op64(const float64 *in, float_status *st)
+{
+    switch (op) {
+    case OP_ADD:
+        return float64_add(in[0], in[1], st);
+    case OP_SUB:
+        return float64_sub(in[0], in[1], st);
+    case OP_MUL:
+        return float64_mul(in[0], in[1], st);
+    case OP_DIV:
+        return float64_div(in[0], in[1], st);
+    case OP_FMA:
+        return float64_muladd(in[0], in[1], in[2], 0, st);
+    case OP_SQRT:
+        return float64_sqrt(in[0], st);
+    }
+    g_assert_not_reached();
+}
+
+static void bench(void)
+{
+    float_status st = { 0 };
+    int64_t t0, t1, deadline;
+    uint64_t n_ops = 0;
+    uint64_t sink = 0;
+    int i;
+
+    st.float_rounding_mode = float_round_nearest_even;
+    st.float_exception_flags = float_flag_inexact;
+
+    t0 = get_clock();
+    deadline = t0 + duration * NANOSECONDS_PER_SECOND;
+    do {
+        for (i = 0; i < N_INPUTS; i++) {
+            if (force_soft) {
+                st.float_exception_flags = 0;
+            }
+            if (use_double) {
+                sink += float64_val(do_op64(f64_in[i], &st));
+            } else {
+                sink += float32_val(do_op32(f32_in[i], &st));
+            }
+        }
+        n_ops += N_INPUTS;
+        t1 = get_clock();
+    } while (t1 < deadline);
+
+    printf("%s %s%s: %.2f MFlops (sink %" PRIx64 ")\n",
+           use_double ? "float64" : "float32", op_names[op],
+           force_soft ? " (soft)" : "",
+           (double)n_ops * 1e3 / (t1 - t0), sink);
+}
+
+static const int rounding_modes[] = {
+    float_round_nearest_even,
+    float_round_down,
+    float_round_up,
+    float_round_to_zero,
+    float_round_ties_away,
+};
+
+/*
+ * The host FPU path is only taken when the inexact flag is already
+ * raised, so the result and flags of each operation are compared with
+ * those of the same operation done with clear flags.  In rounding modes
+ * other than nearest-even, this checks that the host path is not taken.
+ */
+static int run_check(void)
+{
+    int errors = 0;
+    int i, m;
+
+    for (m = 0; m < ARRAY_SIZE(rounding_modes); m++) {
+        for (i = 0; i < N_INPUTS; i++) {
+            float_status hard = { 0 }, soft = { 0 };
+            uint64_t r_hard, r_soft;
+
+            hard.float_rounding_mode = rounding_modes[m];
+            soft.float_rounding_mode = rounding_modes[m];
+            hard.float_exception_flags = float_flag_inexact;
+
+            if (use_double) {
+                r_hard = float64_val(do_op64(f64_in[i], &hard));
+                r_soft = float64_val(do_op64(f64_in[i], &soft));
+            } else {
+                r_hard = float32_val(do_op32(f32_in[i], &hard));
+                r_soft = float32_val(do_op32(f32_in[i], &soft));
+            }
+            soft.float_exception_flags |= float_flag_inexact;
+
+            if (r_hard != r_soft ||
+                hard.float_exception_flags != soft.float_exception_flags) {
+                fprintf(stderr, "mismatch on input %d, rounding mode %d: "
+                        "hard %" PRIx64 "/0x%x, soft %" PRIx64 "/0x%x\n",
+                        i, rounding_modes[m],
+                        r_hard, hard.float_exception_flags,
+                        r_soft, soft.float_exception_flags);
+                errors++;
+            }
+        }
+    }
+    printf("%s %s: %d inputs checked in %d rounding modes, %d mismatches\n",
+           use_double ? "float64" : "float32", op_names[op],
+           N_INPUTS, (int)ARRAY_SIZE(rounding_modes), errors);
+    return errors ? 1 : 0;
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+    int i;
+
+    for (;;) {
+        c = getopt(argc, argv, "hcd:o:p:r:s");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argc, argv);
+            exit(0);
+        case 'c':
+            check = true;
+            break;
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'o':
+            for (i = 0; i < ARRAY_SIZE(op_names); i++) {
+                if (!strcmp(optarg, op_names[i])) {
+                    op = i;
+                    break;
+                }
+            }
+            if (i == ARRAY_SIZE(op_names)) {
+                fprintf(stderr, "unknown operation '%s'\n", optarg);
+                exit(-1);
+            }
+            break;
+        case 'p':
+            if (!strcmp(optarg, "single")) {
+                use_double = false;
+            } else if (!strcmp(optarg, "double")) {
+                use_double = true;
+            } else {
+                fprintf(stderr, "unknown precision '%s'\n", optarg);
+                exit(-1);
+            }
+            break;
+        case 'r':
+            random_seed = strtoull(optarg, NULL, 0);
+            break;
+        case 's':
+            force_soft = true;
+            break;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    parse_args(argc, argv);
+    if (check) {
+        fill_check_inputs();
+        return run_check();
+    }
+    fill_inputs();
+    bench();
+    return 0;
+}
@@ -0,0 +1,158 @@
+#!/usr/bin/env python
+#
+# Measure how fast qemu-system-arm translates Thumb-2 code
+#
+# Copyright (c) 2016 agent <agent@local>
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+# The guest is a raw image of straight-line Thumb-2 data processing and
+# branch instructions, each executed once, that exits through
+# semihosting.  Almost all of the run time is spent translating, so
+# comparing the run times of two image sizes gives the number of
+# instructions translated per second, without the startup costs.
+#
+#   tests/tcg/t32-translate-bench.py arm-softmmu/qemu-system-arm
+
+from __future__ import print_function
+import argparse
+import os
+import random
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+# Data processing (modified immediate): AND BIC ORR ORN EOR ADD ADC SBC
+# SUB RSB.  TST and the like have rd == 15 and are left out.
+MODIMM_OPS = [0, 1, 2, 3, 4, 8, 10, 11, 13, 14]
+
+
+def reg():
+    return random.randint(0, 12)
+
+
+def modimm():
+    op = random.choice(MODIMM_OPS)
+    imm = random.randint(0, 0xfff)
+    return (0xf0000000 | (imm >> 11) << 26 | op << 21 |
+            random.randint(0, 1) << 20 | reg() << 16 |
+            ((imm >> 8) & 7) << 12 | reg() << 8 | (imm & 0xff))
+
+
+def plainimm():
+    op = random.choice([0x00, 0x0a, 0x04, 0x0c])   # ADDW SUBW MOVW MOVT
+    imm = random.randint(0, 0xffff if op & 4 else 0xfff)
+    return (0xf2000000 | ((imm >> 11) & 1) << 26 | op << 20 |
+            ((imm >> 12) if op & 4 else reg()) << 16 |
+            ((imm >> 8) & 7) << 12 | reg() << 8 | (imm & 0xff))
+
+
+def bitfield():
+    op = random.choice(["sat", "sat16", "bfx", "bfi"])
+    lsb = random.randint(0, 31)
+    if op == "sat":
+        u = random.randint(0, 1)
+        sh = random.randint(0, 1) if lsb else 0
+        op3, low = u << 2 | sh, random.randint(0, 31)
+    elif op == "sat16":
+        lsb = 0
+        op3, low = random.choice([1, 5]), random.randint(0, 15)
+    elif op == "bfx":
+        op3, low = random.choice([2, 6]), random.randint(0, 31 - lsb)
+    else:
+        op3, low = 3, random.randint(lsb, 31)
+    return (0xf3000000 | op3 << 21 | reg() << 16 | (lsb >> 2) << 12 |
+            reg() << 8 | (lsb & 3) << 6 | low)
+
+
+def branch():
+    # To the next insn, which ends the TB
+    if random.randint(0, 1):
+        return 0xf000b800                                   # B.W
+    return 0xf0008000 | random.randint(0, 13) << 22         # B<c>.W
+
+
+def thumb2(insn):
+    return struct.pack("<HH", insn >> 16, insn & 0xffff)
+
+
+def thumb_movw_movt(rd, value):
+    lo, hi = value & 0xffff, value >> 16
+    movw = (0xf2400000 | ((lo >> 11) & 1) << 26 | (lo >> 12) << 16 |
+            ((lo >> 8) & 7) << 12 | rd << 8 | (lo & 0xff))
+    movt = (0xf2c00000 | ((hi >> 11) & 1) << 26 | (hi >> 12) << 16 |
+            ((hi >> 8) & 7) << 12 | rd << 8 | (hi & 0xff))
+    return thumb2(movw) + thumb2(movt)
+
+
+def make_image(count, branch_every):
+    # Loaded in ARM state: add r12, pc, #1; bx r12
+    code = [struct.pack("<II", 0xe28fc001, 0xe12fff1c)]
+    for i in range(count):
+        if branch_every and i % branch_every == branch_every - 1:
+            insn = branch()
+        else:
+            insn = random.choice([modimm, modimm, plainimm, bitfield])()
+        code.append(thumb2(insn))
+    # SYS_EXIT with ADP_Stopped_ApplicationExit
+    code.append(struct.pack("<H", 0x2018))                  # movs r0, #0x18
+    code.append(thumb_movw_movt(1, 0x20026))
+    code.append(struct.pack("<H", 0xdfab))                  # svc 0xab
+    return b"".join(code)
+
+
+def run(qemu, image, args):
+    cmd = [qemu, "-M", "virt", "-cpu", "cortex-a15", "-m", "512",
+           "-display", "none", "-serial", "none", "-monitor", "none",
+           "-semihosting", "-kernel", image] + args
+    start = time.time()
+    subprocess.check_call(cmd)
+    return time.time() - start
+
+
+def best_time(qemu, count, args):
+    fd, image = tempfile.mkstemp(suffix=".bin")
+    try:
+        os.write(fd, make_image(count, args.branch_every))
+        os.close(fd)
+        return min(run(qemu, image, args.qemu_args)
+                   for i in range(args.repeat))
+    finally:
+        os.unlink(image)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Thumb-2 translation "
+                                     "throughput of qemu-system-arm")
+    parser.add_argument("qemu", help="qemu-system-arm binary")
+    parser.add_argument("--insns", type=int, default=1000000,
+                        help="instructions in the large image")
+    parser.add_argument("--branch-every", type=int, default=32,
+                        help="put a branch every N instructions, 0 for none")
+    parser.add_argument("--repeat", type=int, default=5,
+                        help="runs per image, the fastest is kept")
+    parser.add_argument("--seed", type=int, default=0)
+    parser.add_argument("qemu_args", nargs=argparse.REMAINDER,
+                        help="more arguments for QEMU, after '--'")
+    args = parser.parse_args()
+    if args.qemu_args[:1] == ["--"]:
+        args.qemu_args = args.qemu_args[1:]
+
+    random.seed(args.seed)
+    small = args.insns // 10
+    t0 = best_time(args.qemu, small, args)
+    t1 = best_time(args.qemu, args.insns, args)
+    if t1 <= t0:
+        print("run times too close, use a larger --insns", file=sys.stderr)
+        return 1
+    print("%d insns: %.3f s, %d insns: %.3f s" % (small, t0, args.insns, t1))
+    print("%.0f insns translated per second" %
+          ((args.insns - small) / (t1 - t0)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,139 @@
+/*
+ * Scaling of multi-threaded guest programs under linux-user
+ *
+ * Copyright (c) 2016 agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Each thread does the same amount of work: atomic increments of a
+ * shared counter and of a counter of its own, compare-and-swap loops on
+ * a shared word, and every so often an mmap/munmap pair.  Run it with
+ * 1, 2, 4, ... threads: with perfect scaling the run time stays the same.
+ *
+ *   test-mt-scaling [THREADS [ITERATIONS [MMAP_EVERY]]]
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#define MAX_THREADS 256
+
+static long iterations = 1000000;
+static long mmap_every = 1000;
+
+static volatile uint32_t shared_counter;
+static volatile uint32_t shared_max;
+
+/* Keep the counters of the threads apart, so that only shared_counter
+   and shared_max are contended.  */
+static struct {
+    volatile uint32_t counter;
+    char pad[60];
+} per_thread[MAX_THREADS] __attribute__((aligned(64)));
+
+static void update_max(uint32_t val)
+{
+    uint32_t old = shared_max;
+
+    while (old < val) {
+        uint32_t prev = __sync_val_compare_and_swap(&shared_max, old, val);
+        if (prev == old) {
+            break;
+        }
+        old = prev;
+    }
+}
+
+static void *worker(void *opaque)
+{
+    long id = (long)opaque;
+    long i;
+
+    for (i = 0; i < iterations; i++) {
+        __sync_fetch_and_add(&per_thread[id].counter, 1);
+        if ((i & 15) == 0) {
+            update_max(__sync_add_and_fetch(&shared_counter, 1));
+        }
+        if (mmap_every && i % mmap_every == 0) {
+            char *p = mmap(NULL, 65536, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            assert(p != MAP_FAILED);
+            p[0] = p[65535] = 1;
+            if (mprotect(p, 4096, PROT_READ) != 0) {
+                perror("mprotect");
+                abort();
+            }
+            if (munmap(p, 65536) != 0) {
+                perror("munmap");
+                abort();
+            }
+        }
+    }
+    return NULL;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t threads[MAX_THREADS];
+    long nthreads = 4;
+    long i;
+    int ret;
+    double start, elapsed;
+
+    if (argc > 1) {
+        nthreads = atol(argv[1]);
+    }
+    if (argc > 2) {
+        iterations = atol(argv[2]);
+    }
+    if (argc > 3) {
+        mmap_every = atol(argv[3]);
+    }
+    if (nthreads < 1 || nthreads > MAX_THREADS) {
+        fprintf(stderr, "the number of threads must be 1 to %d\n",
+                MAX_THREADS);
+        return 1;
+    }
+
+    start = now();
+    for (i = 0; i < nthreads; i++) {
+        ret = pthread_create(&threads[i], NULL, worker, (void *)i);
+        if (ret != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+            return 1;
+        }
+    }
+    for (i = 0; i < nthreads; i++) {
+        ret = pthread_join(threads[i], NULL);
+        if (ret != 0) {
+            fprintf(stderr, "pthread_join: %s\n", strerror(ret));
+            return 1;
+        }
+    }
+    elapsed = now() - start;
+
+    for (i = 0; i < nthreads; i++) {
+        assert(per_thread[i].counter == iterations);
+    }
+    assert(shared_counter == nthreads * ((iterations + 15) / 16));
+    assert(shared_max == shared_counter);
+
+    printf("%ld threads: %.3f s, %.0f iterations/s\n", nthreads, elapsed,
+           nthreads * iterations / elapsed);
+    return 0;
+}
@@ -0,0 +1,265 @@
+/*
+ * Interval tree tests
+ *
+ * Copyright (c) 2016 agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/interval-tree.h"
+
+/* The tree is checked against a map of N values, each covered by at
+   most one interval.  */
+#define N 512
+
+static IntervalTreeRoot root;
+static IntervalTreeNode nodes[N];
+static IntervalTreeNode *covered_by[N];
+
+static void reset(void)
+{
+    root.root = NULL;
+    memset(nodes, 0, sizeof(nodes));
+    memset(covered_by, 0, sizeof(covered_by));
+}
+
+static bool insert(uint64_t start, uint64_t last)
+{
+    IntervalTreeNode *n = &nodes[start];
+    uint64_t i;
+
+    for (i = start; i <= last; i++) {
+        if (covered_by[i]) {
+            return false;
+        }
+    }
+    n->start = start;
+    n->last = last;
+    interval_tree_insert(n, &root);
+    for (i = start; i <= last; i++) {
+        covered_by[i] = n;
+    }
+    return true;
+}
+
+static void remove_at(uint64_t x)
+{
+    IntervalTreeNode *n = covered_by[x];
+    uint64_t i;
+
+    interval_tree_remove(n, &root);
+    for (i = n->start; i <= n->last; i++) {
+        covered_by[i] = NULL;
+    }
+}
+
+/* Check the red-black and augmentation invariants, return the black
+   height.  */
+static int check_subtree(IntervalTreeNode *n, uint64_t *subtree_last,
+                         uint64_t *subtree_gap)
+{
+    uint64_t last = 0, gap = 0;
+    int lh = 0, rh = 0;
+
+    if (!n) {
+        *subtree_last = 0;
+        *subtree_gap = 0;
+        return 1;
+    }
+    if (n->left) {
+        g_assert(n->left->parent == n);
+        g_assert(n->left->start <= n->start);
+        g_assert(!(n->red && n->left->red));
+    }
+    if (n->right) {
+        g_assert(n->right->parent == n);
+        g_assert(n->right->start >= n->start);
+        g_assert(!(n->red && n->right->red));
+    }
+    lh = check_subtree(n->left, &last, &gap);
+    *subtree_last = MAX(last, n->last);
+    *subtree_gap = MAX(gap, n->gap);
+    rh = check_subtree(n->right, &last, &gap);
+    *subtree_last = MAX(*subtree_last, last);
+    *subtree_gap = MAX(*subtree_gap, gap);
+    g_assert_cmpint(lh, ==, rh);
+    g_assert_cmpuint(n->subtree_last, ==, *subtree_last);
+    g_assert_cmpuint(n->subtree_gap, ==, *subtree_gap);
+    return lh + !n->red;
+}
+
+static void check_tree(void)
+{
+    uint64_t last, gap, free = 0;
+    int i;
+
+    if (root.root) {
+        g_assert(!root.root->red);
+        g_assert(root.root->parent == NULL);
+        check_subtree(root.root, &last, &gap);
+    }
+
+    /* The gaps */
+    for (i = 0; i < N; i++) {
+        if (!covered_by[i]) {
+            free++;
+        } else if (covered_by[i]->start == i) {
+            g_assert_cmpuint(covered_by[i]->gap, ==, free);
+            free = 0;
+        }
+    }
+}
+
+static void check_iter(uint64_t start, uint64_t last)
+{
+    IntervalTreeNode *n, *expect = NULL;
+    uint64_t i;
+
+    n = interval_tree_iter_first(&root, start, last);
+    for (i = start; i <= last && i < N; i++) {
+        if (covered_by[i] && covered_by[i] != expect) {
+            expect = covered_by[i];
+            g_assert(n == expect);
+            n = interval_tree_iter_next(n, start, last);
+        }
+    }
+    g_assert(n == NULL);
+}
+
+static bool is_free(uint64_t a, uint64_t size)
+{
+    uint64_t i;
+
+    for (i = a; i < a + size; i++) {
+        if (i < N && covered_by[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void check_gap(uint64_t min, uint64_t max, uint64_t size,
+                      uint64_t align)
+{
+    uint64_t a, lowest = -1, highest = -1, addr;
+    bool found, any = false;
+
+    /* Everything from N up is free, so stop a little above it.  */
+    for (a = (min + align - 1) & -align; a <= max && a < 2 * N; a += align) {
+        if (a + size - 1 >= a && a + size - 1 <= max && is_free(a, size)) {
+            if (!any) {
+                lowest = a;
+            }
+            highest = a;
+            any = true;
+        }
+    }
+
+    found = interval_tree_find_gap_up(&root, min, max, size, align, &addr);
+    g_assert(found == any);
+    if (found) {
+        g_assert_cmpuint(addr, ==, lowest);
+    }
+    if (max < 2 * N) {
+        found = interval_tree_find_gap_down(&root, min, max, size, align,
+                                            &addr);
+        g_assert(found == any);
+        if (found) {
+            g_assert_cmpuint(addr, ==, highest);
+        }
+    }
+}
+
+static void test_random(void)
+{
+    int i, j;
+
+    reset();
+    for (i = 0; i < 20000; i++) {
+        uint64_t x = g_test_rand_int_range(0, N);
+
+        if (covered_by[x] && g_test_rand_int_range(0, 2)) {
+            remove_at(x);
+        } else {
+            uint64_t len = g_test_rand_int_range(1, 9);
+            insert(x, MIN(x + len, N) - 1);
+        }
+        check_tree();
+
+        for (j = 0; j < 4; j++) {
+            uint64_t start = g_test_rand_int_range(0, N + 16);
+            uint64_t last = start + g_test_rand_int_range(0, N / 4);
+            uint64_t size = g_test_rand_int_range(1, 24);
+            uint64_t align = 1 << g_test_rand_int_range(0, 4);
+
+            check_iter(start, last);
+            check_gap(start, last, size, align);
+        }
+    }
+}
+
+static void test_gap_edges(void)
+{
+    uint64_t addr;
+
+    reset();
+    g_assert(interval_tree_find_gap_down(&root, 0, UINT64_MAX, 4096, 4096,
+                                         &addr));
+    g_assert_cmpuint(addr, ==, -4096ull);
+    g_assert(interval_tree_find_gap_up(&root, 1, UINT64_MAX, 1, 4096,
+                                       &addr));
+    g_assert_cmpuint(addr, ==, 4096);
+
+    /* Nothing above the top interval, nothing below the bottom one.  */
+    nodes[0].start = 0;
+    nodes[0].last = 99;
+    interval_tree_insert(&nodes[0], &root);
+    nodes[1].start = UINT64_MAX - 99;
+    nodes[1].last = UINT64_MAX;
+    interval_tree_insert(&nodes[1], &root);
+
+    g_assert(interval_tree_find_gap_down(&root, 0, UINT64_MAX, 1, 1, &addr));
+    g_assert_cmpuint(addr, ==, UINT64_MAX - 100);
+    g_assert(interval_tree_find_gap_up(&root, 0, UINT64_MAX, 1, 1, &addr));
+    g_assert_cmpuint(addr, ==, 100);
+    g_assert(!interval_tree_find_gap_up(&root, UINT64_MAX, UINT64_MAX, 1, 1,
+                                        &addr));
+    g_assert(!interval_tree_find_gap_down(&root, 0, 99, 1, 1, &addr));
+    g_assert(interval_tree_find_gap_up(&root, 0, UINT64_MAX,
+                                       UINT64_MAX - 199, 1, &addr));
+    g_assert_cmpuint(addr, ==, 100);
+    g_assert(!interval_tree_find_gap_down(&root, 0, UINT64_MAX,
+                                          UINT64_MAX - 198, 1, &addr));
+}
+
+static void test_overlap(void)
+{
+    IntervalTreeNode *n;
+    int i, count;
+
+    /* Overlapping intervals are fine for lookups: [i, i + 9] */
+    reset();
+    for (i = 0; i < 100; i++) {
+        nodes[i].start = i;
+        nodes[i].last = i + 9;
+        interval_tree_insert(&nodes[i], &root);
+    }
+    count = 0;
+    for (n = interval_tree_iter_first(&root, 50, 50); n;
+         n = interval_tree_iter_next(n, 50, 50)) {
+        g_assert(n->start <= 50 && n->last >= 50);
+        g_assert_cmpuint(n->start, ==, 41 + count);
+        count++;
+    }
+    g_assert_cmpint(count, ==, 10);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/interval-tree/random", test_random);
+    g_test_add_func("/interval-tree/gap-edges", test_gap_edges);
+    g_test_add_func("/interval-tree/overlap", test_overlap);
+    return g_test_run();
+}
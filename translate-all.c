@@ -28,9 +28,11 @@
 #include "trace.h"
 #include "disas/disas.h"
 #include "exec/exec-all.h"
+#include "exec/jit-perf.h"
 #include "tcg.h"
 #if defined(CONFIG_USER_ONLY)
 #include "qemu.h"
+#include "qemu/interval-tree.h"
 #if defined(__FreeBSD__) || defined(__FreeBSD_kernel__)
 #include <sys/param.h>
 #if __FreeBSD_version >= 700104
@@ -47,13 +49,16 @@
 #endif
 #else
 #include "exec/address-spaces.h"
+#include "exec/cpu_ldst.h"
+#include "sysemu/sysemu.h"
+#include "qmp-commands.h"
 #endif
 
 #include "exec/cputlb.h"
 #include "exec/tb-hash.h"
 #include "translate-all.h"
-#include "qemu/bitmap.h"
 #include "qemu/timer.h"
+#include "qemu/error-report.h"
 #include "exec/log.h"
 
 //#define DEBUG_TB_INVALIDATE
@@ -66,18 +71,28 @@
 #undef DEBUG_TB_CHECK
 #endif
 
-#define SMC_BITMAP_USE_THRESHOLD 10
+#ifdef CONFIG_SOFTMMU
+/* A part of a page that holds translated code, [start, end[ */
+typedef struct PageCodeRange {
+    uint32_t start;
+    uint32_t end;
+} PageCodeRange;
+#endif
 
 typedef struct PageDesc {
     /* list of TBs intersecting this ram page */
     TranslationBlock *first_tb;
 #ifdef CONFIG_SOFTMMU
-    /* in order to optimize self modifying code, we count the number
-       of lookups we do to a given page to use a bitmap */
-    unsigned int code_write_count;
-    unsigned long *code_bitmap;
+    /* in order to optimize self modifying code, the parts of the page
+       covered by TBs are kept as sorted, disjoint ranges, so that writes
+       next to the code do not have to look at the TBs.  -1 ranges means
+       that they must be recomputed from first_tb.  */
+    PageCodeRange *code_ranges;
+    int nb_code_ranges;
 #else
-    unsigned long flags;
+    /* the host page was made read-only because of the TBs; the flags
+       of the page itself are in pageflags_root */
+    bool write_protected;
 #endif
 } PageDesc;
 
@@ -121,40 +136,71 @@ static void *l1_map[V_L1_SIZE];
 TCGContext tcg_ctx;
 
 /* translation block context */
-#ifdef CONFIG_USER_ONLY
 __thread int have_tb_lock;
-#endif
 
 void tb_lock(void)
 {
-#ifdef CONFIG_USER_ONLY
     assert(!have_tb_lock);
     qemu_mutex_lock(&tcg_ctx.tb_ctx.tb_lock);
     have_tb_lock++;
-#endif
 }
 
 void tb_unlock(void)
 {
-#ifdef CONFIG_USER_ONLY
     assert(have_tb_lock);
     have_tb_lock--;
     qemu_mutex_unlock(&tcg_ctx.tb_ctx.tb_lock);
-#endif
 }
 
 void tb_lock_reset(void)
 {
-#ifdef CONFIG_USER_ONLY
     if (have_tb_lock) {
         qemu_mutex_unlock(&tcg_ctx.tb_ctx.tb_lock);
         have_tb_lock = 0;
     }
-#endif
 }
 
 static TranslationBlock *tb_find_pc(uintptr_t tc_ptr);
 
+/* Speculative translation
+ *
+ * A lookup miss stalls the vCPU while the block is translated.  When
+ * enabled, the successors of each new TB are queued and translated ahead
+ * of time: by a helper thread in user mode, where guest code is plain
+ * host memory, and by idle vCPU threads in system mode.
+ */
+#define TB_SPEC_QUEUE_SIZE  64
+#define TB_SPEC_MAX_DEPTH   2
+
+typedef struct TBSpecRequest {
+    CPUState *cpu;
+    target_ulong pc;
+    target_ulong cs_base;
+    uint32_t flags;
+    /* number of speculative TBs on the way from a TB that ran */
+    int depth;
+} TBSpecRequest;
+
+static struct {
+    bool enabled;
+    /* The rest is protected by tb_lock.  */
+    TBSpecRequest queue[TB_SPEC_QUEUE_SIZE];
+    int nb_queued;
+    /* successors of the TB being translated, see tb_note_successor() */
+    target_ulong succ[2];
+    int nb_succ;
+    int depth;
+    /* statistics */
+    int count;
+#ifdef CONFIG_USER_ONLY
+    QemuThread thread;
+    QemuCond cond;
+#endif
+} tb_spec;
+
+static void tb_spec_queue_successors(CPUState *cpu, TranslationBlock *tb,
+                                     int cflags);
+
 void cpu_gen_init(void)
 {
     tcg_context_init(&tcg_ctx); 
@@ -298,7 +344,15 @@ static int cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
 bool cpu_restore_state(CPUState *cpu, uintptr_t retaddr)
 {
     TranslationBlock *tb;
+    bool r = false;
+
+    /* A retaddr of zero never points into translated code; return early
+     * rather than recursively taking tb_lock from within tb_gen_code.  */
+    if (!retaddr) {
+        return r;
+    }
 
+    tb_lock();
     tb = tb_find_pc(retaddr);
     if (tb) {
         cpu_restore_state_from_tb(cpu, tb, retaddr);
@@ -307,9 +361,11 @@ bool cpu_restore_state(CPUState *cpu, uintptr_t retaddr)
             tb_phys_invalidate(tb, -1);
             tb_free(tb);
         }
-        return true;
+        r = true;
     }
-    return false;
+    tb_unlock();
+
+    return r;
 }
 
 void page_size_init(void)
@@ -397,7 +453,7 @@ static void page_init(void)
 }
 
 /* If alloc=1:
- * Called with mmap_lock held for user-mode emulation.
+ * Called with tb_lock held.
  */
 static PageDesc *page_find_alloc(tb_page_addr_t index, int alloc)
 {
@@ -440,6 +496,32 @@ static inline PageDesc *page_find(tb_page_addr_t index)
     return page_find_alloc(index, 0);
 }
 
+/* Like page_find(), and also set *NEXT to the next page that can have a
+ * PageDesc, skipping the whole range of a missing table.  This is for
+ * walking large, sparsely populated ranges.
+ */
+static PageDesc *page_find_next(tb_page_addr_t index, tb_page_addr_t *next)
+{
+    void **lp = l1_map + ((index >> V_L1_SHIFT) & (V_L1_SIZE - 1));
+    void *p;
+    int i;
+
+    for (i = V_L1_SHIFT / V_L2_BITS; ; i--) {
+        p = atomic_rcu_read(lp);
+        if (p == NULL) {
+            *next = (index | (((tb_page_addr_t)1 << (i * V_L2_BITS)) - 1)) + 1;
+            return NULL;
+        }
+        if (i == 1) {
+            break;
+        }
+        lp = (void **)p + ((index >> ((i - 1) * V_L2_BITS)) & (V_L2_SIZE - 1));
+    }
+
+    *next = index + 1;
+    return (PageDesc *)p + (index & (V_L2_SIZE - 1));
+}
+
 #if defined(CONFIG_USER_ONLY)
 /* Currently it is not recommended to allocate big chunks of data in
    user mode. It will change when a dedicated libc will be used.  */
@@ -634,6 +716,7 @@ static inline void *alloc_code_gen_buffer(void)
     int flags = MAP_PRIVATE | MAP_ANONYMOUS;
     uintptr_t start = 0;
     size_t size = tcg_ctx.code_gen_buffer_size;
+    size_t extra = 0;
     void *buf;
 
     /* Constrain the position of the buffer based on the host cpu.
@@ -664,11 +747,29 @@ static inline void *alloc_code_gen_buffer(void)
 #  endif
 # endif
 
-    buf = mmap((void *)start, size + qemu_real_host_page_size,
+    /* Transparent huge pages only back the aligned parts of a mapping.
+       Over-allocate so that the buffer can start on a huge page.  */
+    if (QEMU_VMALLOC_ALIGN > qemu_real_host_page_size) {
+        extra = QEMU_VMALLOC_ALIGN;
+    }
+
+    buf = mmap((void *)start, size + qemu_real_host_page_size + extra,
                PROT_NONE, flags, -1, 0);
     if (buf == MAP_FAILED) {
         return NULL;
     }
+    if (extra) {
+        void *aligned = QEMU_ALIGN_PTR_UP(buf, QEMU_VMALLOC_ALIGN);
+        size_t head = aligned - buf;
+
+        if (head) {
+            munmap(buf, head);
+        }
+        if (extra - head) {
+            munmap(aligned + size + qemu_real_host_page_size, extra - head);
+        }
+        buf = aligned;
+    }
 
 #ifdef __mips__
     if (cross_256mb(buf, size)) {
@@ -761,39 +862,116 @@ bool tcg_enabled(void)
     return tcg_ctx.code_gen_buffer != NULL;
 }
 
-/* Allocate a new translation block. Flush the translation buffer if
-   too many translation blocks or too much generated code. */
+static void tb_region_set_current(int i)
+{
+    TBRegion *r = &tcg_ctx.tb_ctx.regions[i];
+
+    tcg_ctx.tb_ctx.cur_region = i;
+    tcg_ctx.code_gen_ptr = r->start;
+    tcg_ctx.code_gen_highwater = r->highwater;
+    tcg_ctx.code_gen_cold_ptr = r->cold_start;
+    tcg_ctx.code_gen_cold_highwater = r->cold_highwater;
+}
+
+/* With softmmu, the backend can move the slow paths of guest memory
+   accesses out of the hot code.  They go to the top of each region,
+   which is evicted together with the TBs that use them.  */
+#if defined(CONFIG_SOFTMMU) && defined(TCG_TARGET_SPLIT_COLD_CODE)
+#define TB_REGION_COLD_SHIFT 2
+#endif
+
+/* Split the code buffer left after the prologue into regions.  This is
+   done on first use, since user mode emulation only generates the
+   prologue once the guest base is known.  */
+static void tb_regions_init(void)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    size_t size, hot_size;
+    int i, n;
+
+    n = tcg_ctx.code_gen_buffer_size / TB_REGION_MIN_SIZE;
+    n = MAX(1, MIN(n, TB_REGION_MAX));
+    size = QEMU_ALIGN_DOWN(tcg_ctx.code_gen_buffer_size / n, CODE_GEN_ALIGN);
+#ifdef TB_REGION_COLD_SHIFT
+    hot_size = size - QEMU_ALIGN_DOWN(size >> TB_REGION_COLD_SHIFT,
+                                      CODE_GEN_ALIGN);
+#else
+    hot_size = size;
+#endif
+
+    ctx->nb_regions = n;
+    ctx->region_max_tbs = tcg_ctx.code_gen_max_blocks / n;
+    for (i = 0; i < n; i++) {
+        TBRegion *r = &ctx->regions[i];
+
+        r->start = tcg_ctx.code_gen_buffer + i * size;
+        r->highwater = r->start + hot_size - 1024;
+        r->end = r->start;
+        if (hot_size < size) {
+            r->cold_start = r->start + hot_size;
+            r->cold_highwater = r->start + size - 1024;
+        } else {
+            r->cold_start = NULL;
+            r->cold_highwater = NULL;
+        }
+        r->cold_end = r->cold_start;
+        r->tbs = ctx->tbs + i * ctx->region_max_tbs;
+        r->nb_tbs = 0;
+    }
+    tb_region_set_current(0);
+}
+
+/* Allocate a new translation block in the current region.  Returns
+   NULL if the region has no room left for it.  */
 static TranslationBlock *tb_alloc(target_ulong pc)
 {
+    TBRegion *r;
     TranslationBlock *tb;
 
-    if (tcg_ctx.tb_ctx.nb_tbs >= tcg_ctx.code_gen_max_blocks) {
+    if (unlikely(!tcg_ctx.tb_ctx.nb_regions)) {
+        tb_regions_init();
+    }
+    r = &tcg_ctx.tb_ctx.regions[tcg_ctx.tb_ctx.cur_region];
+    if (r->nb_tbs >= tcg_ctx.tb_ctx.region_max_tbs) {
         return NULL;
     }
-    tb = &tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs++];
+    tb = &r->tbs[r->nb_tbs++];
+    tcg_ctx.tb_ctx.nb_tbs++;
     tb->pc = pc;
     tb->cflags = 0;
+    tb->invalid = true;
     return tb;
 }
 
 void tb_free(TranslationBlock *tb)
 {
+    TBRegion *r = &tcg_ctx.tb_ctx.regions[tcg_ctx.tb_ctx.cur_region];
+
     /* In practice this is mostly used for single use temporary TB
        Ignore the hard cases and just back up if this TB happens to
        be the last one generated.  */
-    if (tcg_ctx.tb_ctx.nb_tbs > 0 &&
-            tb == &tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs - 1]) {
+    if (r->nb_tbs > 0 && tb == &r->tbs[r->nb_tbs - 1]) {
         tcg_ctx.code_gen_ptr = tb->tc_ptr;
+        tcg_ctx.code_gen_cold_ptr = tb->tc_cold_ptr;
+        r->nb_tbs--;
         tcg_ctx.tb_ctx.nb_tbs--;
     }
 }
 
-static inline void invalidate_page_bitmap(PageDesc *p)
+/* A TB of the page went away: recompute its code ranges lazily.  */
+static inline void invalidate_page_code_ranges(PageDesc *p)
+{
+#ifdef CONFIG_SOFTMMU
+    p->nb_code_ranges = -1;
+#endif
+}
+
+static inline void free_page_code_ranges(PageDesc *p)
 {
 #ifdef CONFIG_SOFTMMU
-    g_free(p->code_bitmap);
-    p->code_bitmap = NULL;
-    p->code_write_count = 0;
+    g_free(p->code_ranges);
+    p->code_ranges = NULL;
+    p->nb_code_ranges = 0;
 #endif
 }
 
@@ -810,7 +988,7 @@ static void page_flush_tb_1(int level, void **lp)
 
         for (i = 0; i < V_L2_SIZE; ++i) {
             pd[i].first_tb = NULL;
-            invalidate_page_bitmap(pd + i);
+            free_page_code_ranges(pd + i);
         }
     } else {
         void **pp = *lp;
@@ -831,9 +1009,17 @@ static void page_flush_tb(void)
 }
 
 /* flush all the translation blocks */
-/* XXX: tb_flush is currently not thread safe */
-void tb_flush(CPUState *cpu)
+static void do_tb_flush(CPUState *cpu, int tb_flush_count)
 {
+    int i;
+
+    /* If it has already been done on request of another CPU,
+     * just retry.
+     */
+    if (tcg_ctx.tb_ctx.tb_flush_count != tb_flush_count) {
+        return;
+    }
+
 #if defined(DEBUG_FLUSH)
     printf("qemu: flush code_size=%ld nb_tbs=%d avg_tb_size=%ld\n",
            (unsigned long)(tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer),
@@ -845,7 +1031,19 @@ void tb_flush(CPUState *cpu)
         > tcg_ctx.code_gen_buffer_size) {
         cpu_abort(cpu, "Internal error: code buffer overflow\n");
     }
+    if (!tcg_ctx.tb_ctx.nb_regions) {
+        tb_regions_init();
+    }
+    for (i = 0; i < tcg_ctx.tb_ctx.nb_regions; i++) {
+        tcg_ctx.tb_ctx.regions[i].nb_tbs = 0;
+        tcg_ctx.tb_ctx.regions[i].end = tcg_ctx.tb_ctx.regions[i].start;
+        tcg_ctx.tb_ctx.regions[i].cold_end =
+            tcg_ctx.tb_ctx.regions[i].cold_start;
+    }
     tcg_ctx.tb_ctx.nb_tbs = 0;
+    if (tcg_ctx.tb_ctx.cross_page_jumps) {
+        g_array_set_size(tcg_ctx.tb_ctx.cross_page_jumps, 0);
+    }
 
     CPU_FOREACH(cpu) {
         memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
@@ -855,10 +1053,40 @@ void tb_flush(CPUState *cpu)
     qht_reset_size(&tcg_ctx.tb_ctx.htable, CODE_GEN_HTABLE_SIZE);
     page_flush_tb();
 
-    tcg_ctx.code_gen_ptr = tcg_ctx.code_gen_buffer;
+    tb_region_set_current(0);
     /* XXX: flush processor icache at this point if cache flush is
        expensive */
-    tcg_ctx.tb_ctx.tb_flush_count++;
+    atomic_mb_set(&tcg_ctx.tb_ctx.tb_flush_count,
+                  tcg_ctx.tb_ctx.tb_flush_count + 1);
+}
+
+#ifndef CONFIG_USER_ONLY
+static void tb_flush_safe_work(void *data)
+{
+    /* Other vCPUs are out of cpu_exec, but an idle one may still be
+       translating in tb_speculate().  */
+    tb_lock();
+    do_tb_flush(first_cpu, (uintptr_t)data);
+    tb_unlock();
+}
+#endif
+
+/* With multi-threaded TCG other vCPUs may be executing translated code,
+ * so the flush is deferred until all of them have left cpu_exec.  The
+ * caller must then return to the main loop before translating again.
+ */
+void tb_flush(CPUState *cpu)
+{
+    int tb_flush_count = atomic_mb_read(&tcg_ctx.tb_ctx.tb_flush_count);
+
+#ifndef CONFIG_USER_ONLY
+    if (qemu_tcg_mttcg_enabled()) {
+        async_safe_run_on_cpu(cpu, tb_flush_safe_work,
+                              (void *)(uintptr_t)tb_flush_count);
+        return;
+    }
+#endif
+    do_tb_flush(cpu, tb_flush_count);
 }
 
 #ifdef DEBUG_TB_CHECK
@@ -947,6 +1175,7 @@ static inline void tb_remove_from_jmp_list(TranslationBlock *tb, int n)
         *ptb = tb->jmp_list_next[n];
 
         tb->jmp_list_next[n] = (uintptr_t)NULL;
+        tb->jmp_cross_page &= ~(1 << n);
     }
 }
 
@@ -976,11 +1205,77 @@ static inline void tb_jmp_unlink(TranslationBlock *tb)
         tb_reset_jump(tb1, n1);
         *ptb = tb1->jmp_list_next[n1];
         tb1->jmp_list_next[n1] = (uintptr_t)NULL;
+        tb1->jmp_cross_page &= ~(1 << n1);
     }
 }
 
-/* invalidate one TB */
-void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
+/* Direct jumps bypass the virtual to physical translation of their
+ * target.  Within a guest page this is safe: the jump is only taken once
+ * the TB itself has been found through the physical address of that
+ * page.  A jump to another page however remains valid only as long as
+ * the mapping that was current when it was chained, so these jumps are
+ * all undone whenever the TLB is flushed, which the guest must do after
+ * changing its page tables.  Changes to the code itself are caught by
+ * tb_phys_invalidate() as for any other jump.
+ *
+ * The chains are shared by all vCPUs but only the TLB of the vCPU that
+ * made them is watched, hence tb_cross_page_chaining requires a single
+ * vCPU.
+ */
+bool tb_cross_page_chaining;
+
+/* Called with tb_lock held */
+void tb_add_cross_page_jump(TranslationBlock *tb, int n,
+                            TranslationBlock *tb_next)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    uintptr_t entry = (uintptr_t)tb | n;
+
+    if (tb->jmp_list_next[n]) {
+        return;
+    }
+    if (!ctx->cross_page_jumps) {
+        ctx->cross_page_jumps = g_array_new(false, false, sizeof(uintptr_t));
+    }
+    tb_add_jump(tb, n, tb_next);
+    tb->jmp_cross_page |= 1 << n;
+    g_array_append_val(ctx->cross_page_jumps, entry);
+    ctx->cross_page_chain_count++;
+}
+
+/* Undo all jumps chained across pages, called by tlb_flush() and
+   tlb_flush_page() from the vCPU thread.  */
+void tb_unlink_cross_page_jumps(void)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    bool locked = !have_tb_lock;
+    guint i;
+
+    if (!ctx->cross_page_jumps || !ctx->cross_page_jumps->len) {
+        return;
+    }
+    if (locked) {
+        tb_lock();
+    }
+    for (i = 0; i < ctx->cross_page_jumps->len; i++) {
+        uintptr_t entry = g_array_index(ctx->cross_page_jumps, uintptr_t, i);
+        TranslationBlock *tb = (TranslationBlock *)(entry & ~3);
+        int n = entry & 3;
+
+        if (tb->jmp_cross_page & (1 << n)) {
+            tb_remove_from_jmp_list(tb, n);
+            tb_reset_jump(tb, n);
+            ctx->cross_page_unlink_count++;
+        }
+    }
+    g_array_set_size(ctx->cross_page_jumps, 0);
+    if (locked) {
+        tb_unlock();
+    }
+}
+
+static void do_tb_phys_invalidate(TranslationBlock *tb,
+                                  tb_page_addr_t page_addr)
 {
     CPUState *cpu;
     PageDesc *p;
@@ -996,19 +1291,19 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     if (tb->page_addr[0] != page_addr) {
         p = page_find(tb->page_addr[0] >> TARGET_PAGE_BITS);
         tb_page_remove(&p->first_tb, tb);
-        invalidate_page_bitmap(p);
+        invalidate_page_code_ranges(p);
     }
     if (tb->page_addr[1] != -1 && tb->page_addr[1] != page_addr) {
         p = page_find(tb->page_addr[1] >> TARGET_PAGE_BITS);
         tb_page_remove(&p->first_tb, tb);
-        invalidate_page_bitmap(p);
+        invalidate_page_code_ranges(p);
     }
 
     /* remove the TB from the hash list */
     h = tb_jmp_cache_hash_func(tb->pc);
     CPU_FOREACH(cpu) {
-        if (cpu->tb_jmp_cache[h] == tb) {
-            cpu->tb_jmp_cache[h] = NULL;
+        if (atomic_read(&cpu->tb_jmp_cache[h]) == tb) {
+            atomic_set(&cpu->tb_jmp_cache[h], NULL);
         }
     }
 
@@ -1019,43 +1314,191 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     /* suppress any remaining jumps to this TB */
     tb_jmp_unlink(tb);
 
+    tb->invalid = true;
+}
+
+/* invalidate one TB */
+void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
+{
+    do_tb_phys_invalidate(tb, page_addr);
     tcg_ctx.tb_ctx.tb_phys_invalidate_count++;
 }
 
+/* Forget the successors recorded for trace formation that lie in region
+   R, whose TB descriptors are about to be reused.  */
+static void tb_region_forget_successors(TBRegion *r)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    TranslationBlock *first = r->tbs, *last = r->tbs + r->nb_tbs;
+    int i, j, n;
+
+    for (i = 0; i < ctx->nb_regions; i++) {
+        TBRegion *other = &ctx->regions[i];
+
+        for (j = 0; j < other->nb_tbs; j++) {
+            TranslationBlock *tb = &other->tbs[j];
+
+            for (n = 0; n < 2; n++) {
+                if (tb->trace_next[n] >= first && tb->trace_next[n] < last) {
+                    tb->trace_next[n] = NULL;
+                }
+            }
+        }
+    }
+}
+
+/* Make the region after the current one current, invalidating the TBs
+   that are left in it from its previous use.  */
+static void do_tb_evict(CPUState *cpu, int tb_evict_count)
+{
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    int next = (ctx->cur_region + 1) % ctx->nb_regions;
+    TBRegion *r = &ctx->regions[next];
+    int i;
+
+    /* If it has already been done on request of another CPU,
+     * just retry.
+     */
+    if (ctx->tb_evict_count != tb_evict_count) {
+        return;
+    }
+
+    ctx->regions[ctx->cur_region].end = tcg_ctx.code_gen_ptr;
+    ctx->regions[ctx->cur_region].cold_end = tcg_ctx.code_gen_cold_ptr;
+    for (i = 0; i < r->nb_tbs; i++) {
+        if (!r->tbs[i].invalid) {
+            do_tb_phys_invalidate(&r->tbs[i], -1);
+        }
+    }
+    if (tb_trace_threshold) {
+        tb_region_forget_successors(r);
+    }
+
+    /* Do not chain the TB that ran last to one in the new region.  */
+    CPU_FOREACH(cpu) {
+        cpu->tb_flushed = true;
+    }
+
+    ctx->nb_tbs -= r->nb_tbs;
+    r->nb_tbs = 0;
+    tb_region_set_current(next);
+    atomic_mb_set(&ctx->tb_evict_count, ctx->tb_evict_count + 1);
+}
+
+#ifndef CONFIG_USER_ONLY
+static void tb_evict_safe_work(void *data)
+{
+    /* See tb_flush_safe_work().  */
+    tb_lock();
+    do_tb_evict(first_cpu, (uintptr_t)data);
+    tb_unlock();
+}
+#endif
+
+/* Make room in the code buffer by reusing its oldest region.  Hot code
+ * in the other regions stays translated and chained.  As for tb_flush(),
+ * with multi-threaded TCG this is deferred until all vCPUs have left
+ * cpu_exec.
+ */
+static void tb_evict(CPUState *cpu)
+{
+    int tb_evict_count = atomic_mb_read(&tcg_ctx.tb_ctx.tb_evict_count);
+
+#ifndef CONFIG_USER_ONLY
+    if (qemu_tcg_mttcg_enabled()) {
+        async_safe_run_on_cpu(cpu, tb_evict_safe_work,
+                              (void *)(uintptr_t)tb_evict_count);
+        return;
+    }
+#endif
+    do_tb_evict(cpu, tb_evict_count);
+}
+
 #ifdef CONFIG_SOFTMMU
-static void build_page_bitmap(PageDesc *p)
+/* Add the part of page N of TB to the code ranges of its page P.  */
+static void page_code_ranges_add(PageDesc *p, TranslationBlock *tb, int n)
+{
+    PageCodeRange *r = p->code_ranges;
+    int nb = p->nb_code_ranges;
+    uint32_t start, end;
+    int i, j;
+
+    /* NOTE: this is subtle as a TB may span two physical pages */
+    if (n == 0) {
+        start = tb->pc & ~TARGET_PAGE_MASK;
+        end = MIN(start + tb->size, TARGET_PAGE_SIZE);
+    } else {
+        start = 0;
+        end = (tb->pc + tb->size) & ~TARGET_PAGE_MASK;
+    }
+
+    /* Ranges i to j - 1 touch the new one and are merged with it.  */
+    i = 0;
+    while (i < nb && r[i].end < start) {
+        i++;
+    }
+    for (j = i; j < nb && r[j].start <= end; j++) {
+        start = MIN(start, r[j].start);
+        end = MAX(end, r[j].end);
+    }
+    if (i == j) {
+        r = p->code_ranges = g_renew(PageCodeRange, r, nb + 1);
+        memmove(&r[i + 1], &r[i], (nb - i) * sizeof(*r));
+        nb++;
+    } else {
+        memmove(&r[i + 1], &r[j], (nb - j) * sizeof(*r));
+        nb -= j - i - 1;
+    }
+    r[i].start = start;
+    r[i].end = end;
+    p->nb_code_ranges = nb;
+}
+
+static void build_page_code_ranges(PageDesc *p)
 {
-    int n, tb_start, tb_end;
     TranslationBlock *tb;
+    int n;
 
-    p->code_bitmap = bitmap_new(TARGET_PAGE_SIZE);
-
+    p->nb_code_ranges = 0;
     tb = p->first_tb;
     while (tb != NULL) {
         n = (uintptr_t)tb & 3;
         tb = (TranslationBlock *)((uintptr_t)tb & ~3);
-        /* NOTE: this is subtle as a TB may span two physical pages */
-        if (n == 0) {
-            /* NOTE: tb_end may be after the end of the page, but
-               it is not a problem */
-            tb_start = tb->pc & ~TARGET_PAGE_MASK;
-            tb_end = tb_start + tb->size;
-            if (tb_end > TARGET_PAGE_SIZE) {
-                tb_end = TARGET_PAGE_SIZE;
-            }
+        page_code_ranges_add(p, tb, n);
+        tb = tb->page_next[n];
+    }
+}
+
+/* Return true if [start, end[ overlaps code in page P.  */
+static bool page_code_ranges_overlap(PageDesc *p, uint32_t start,
+                                     uint32_t end)
+{
+    const PageCodeRange *r;
+    int lo, hi, mid;
+
+    if (p->nb_code_ranges < 0) {
+        build_page_code_ranges(p);
+    }
+    r = p->code_ranges;
+
+    /* Find the first range that ends after start.  */
+    lo = 0;
+    hi = p->nb_code_ranges;
+    while (lo < hi) {
+        mid = (lo + hi) >> 1;
+        if (r[mid].end <= start) {
+            lo = mid + 1;
         } else {
-            tb_start = 0;
-            tb_end = ((tb->pc + tb->size) & ~TARGET_PAGE_MASK);
+            hi = mid;
         }
-        bitmap_set(p->code_bitmap, tb_start, tb_end - tb_start);
-        tb = tb->page_next[n];
     }
+    return lo < p->nb_code_ranges && r[lo].start < end;
 }
 #endif
 
 /* add the tb in the target page and protect it if necessary
  *
- * Called with mmap_lock held for user-mode emulation.
+ * Called with tb_lock held.
  */
 static inline void tb_alloc_page(TranslationBlock *tb,
                                  unsigned int n, tb_page_addr_t page_addr)
@@ -1072,13 +1515,16 @@ static inline void tb_alloc_page(TranslationBlock *tb,
     page_already_protected = p->first_tb != NULL;
 #endif
     p->first_tb = (TranslationBlock *)((uintptr_t)tb | n);
-    invalidate_page_bitmap(p);
+#ifdef CONFIG_SOFTMMU
+    if (p->nb_code_ranges >= 0) {
+        page_code_ranges_add(p, tb, n);
+    }
+#endif
 
 #if defined(CONFIG_USER_ONLY)
-    if (p->flags & PAGE_WRITE) {
+    if (page_get_flags(page_addr) & PAGE_WRITE) {
         target_ulong addr;
-        PageDesc *p2;
-        int prot;
+        int flags, prot;
 
         /* force the host page as non writable (writes will have a
            page fault + mprotect overhead) */
@@ -1087,13 +1533,13 @@ static inline void tb_alloc_page(TranslationBlock *tb,
         for (addr = page_addr; addr < page_addr + qemu_host_page_size;
             addr += TARGET_PAGE_SIZE) {
 
-            p2 = page_find(addr >> TARGET_PAGE_BITS);
-            if (!p2) {
-                continue;
+            flags = page_get_flags(addr);
+            if (flags & PAGE_WRITE) {
+                page_find_alloc(addr >> TARGET_PAGE_BITS, 1)->write_protected
+                    = true;
             }
-            prot |= p2->flags;
-            p2->flags &= ~PAGE_WRITE;
-          }
+            prot |= flags;
+        }
         mprotect(g2h(page_addr), qemu_host_page_size,
                  (prot & PAGE_BITS) & ~PAGE_WRITE);
 #ifdef DEBUG_TB_INVALIDATE
@@ -1114,7 +1560,7 @@ static inline void tb_alloc_page(TranslationBlock *tb,
 /* add a new TB and link it to the physical page tables. phys_page2 is
  * (-1) to indicate that only one page contains the TB.
  *
- * Called with mmap_lock held for user-mode emulation.
+ * Called with tb_lock held.
  */
 static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
                          tb_page_addr_t phys_page2)
@@ -1124,6 +1570,7 @@ static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
     /* add in the hash table */
     h = tb_hash_func(phys_pc, tb->pc, tb->flags);
     qht_insert(&tcg_ctx.tb_ctx.htable, tb, h);
+    tb->invalid = false;
 
     /* add in the page list */
     tb_alloc_page(tb, 0, phys_pc & TARGET_PAGE_MASK);
@@ -1138,83 +1585,1055 @@ static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
 #endif
 }
 
-/* Called with mmap_lock held for user mode emulation.  */
-TranslationBlock *tb_gen_code(CPUState *cpu,
-                              target_ulong pc, target_ulong cs_base,
-                              uint32_t flags, int cflags)
-{
-    CPUArchState *env = cpu->env_ptr;
-    TranslationBlock *tb;
-    tb_page_addr_t phys_pc, phys_page2;
-    target_ulong virt_page2;
-    tcg_insn_unit *gen_code_buf;
-    int gen_code_size, search_size;
-#ifdef CONFIG_PROFILER
-    int64_t ti;
+/* Persistent translation cache
+ *
+ * With "-accel tcg,tb-cache=FILE" the host code of every live TB is
+ * written to FILE at exit.  The backend records each host address that
+ * it embeds in the code (see TCGCodeReloc); these are stored relative
+ * to the TB itself, to the prologue or to the QEMU executable, so that
+ * the code can be moved to a new code_gen_buffer.  In the next run,
+ * tb_gen_code looks for a cached block with the same physical address,
+ * pc, cs_base and flags, checks that the guest code is unchanged and
+ * copies the host code instead of translating it again.
+ *
+ * The file holds host code and is only accepted by the same executable
+ * with the same CPU configuration.  It must not be writable by anyone
+ * who should not be able to run code in the QEMU process.
+ */
+#if !defined(CONFIG_USER_ONLY) && defined(CONFIG_LINUX) && \
+    TCG_TARGET_HAS_CODE_RELOCS && defined(USE_DIRECT_JUMP)
+#define TB_CACHE_SUPPORTED
 #endif
 
-    phys_pc = get_page_addr_code(env, pc);
-    if (use_icount && !(cflags & CF_IGNORE_ICOUNT)) {
-        cflags |= CF_USE_ICOUNT;
-    }
+#ifdef TB_CACHE_SUPPORTED
 
-    tb = tb_alloc(pc);
-    if (unlikely(!tb)) {
- buffer_overflow:
-        /* flush must be done */
-        tb_flush(cpu);
-        /* cannot fail at this point */
-        tb = tb_alloc(pc);
-        assert(tb != NULL);
-    }
+#define TB_CACHE_MAGIC      0x43425451  /* "QTBC" */
+#define TB_CACHE_VERSION    1
 
-    gen_code_buf = tcg_ctx.code_gen_ptr;
-    tb->tc_ptr = gen_code_buf;
-    tb->cs_base = cs_base;
-    tb->flags = flags;
-    tb->cflags = cflags;
+/* Blocks that have not been used for this many runs are dropped.  */
+#define TB_CACHE_MAX_AGE    16
 
-#ifdef CONFIG_PROFILER
-    tcg_ctx.tb_count1++; /* includes aborted translations because of
-                       exceptions */
-    ti = profile_getclock();
-#endif
+/* Provided by the linker.  */
+extern const char __executable_start[];
+extern const char etext[];
 
-    tcg_func_start(&tcg_ctx);
+enum {
+    TB_CACHE_BASE_SELF,         /* the host code of the TB */
+    TB_CACHE_BASE_TB,           /* the TranslationBlock */
+    TB_CACHE_BASE_PROLOGUE,     /* the TCG prologue */
+    TB_CACHE_BASE_TEXT,         /* the QEMU executable */
+};
 
-    tcg_ctx.cpu = ENV_GET_CPU(env);
-    gen_intermediate_code(env, tb);
-    tcg_ctx.cpu = NULL;
+typedef struct TBCacheReloc {
+    uint32_t offset;
+    uint8_t type;               /* TCGCodeRelocType */
+    uint8_t base;               /* TB_CACHE_BASE_* */
+    uint16_t pad;
+    int64_t addend;
+} TBCacheReloc;
+
+struct TBCacheInfo {
+    uint32_t code_size;
+    uint32_t search_size;
+    uint32_t nb_relocs;
+    uint32_t pad;
+    TBCacheReloc relocs[];
+};
 
-    trace_translate_block(tb, tb->pc, tb->tc_ptr);
+/* The file starts with a TBCacheHeader and the identity string, followed
+ * by nb_entries blocks.  Each block is a TBCacheEntry followed by the
+ * guest code, the host code and search data, and the relocations, each
+ * padded to 8 bytes.  Everything is in host byte order.
+ */
+typedef struct TBCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t id_len;
+    uint32_t nb_entries;
+} TBCacheHeader;
+
+typedef struct TBCacheEntry {
+    uint64_t pc;
+    uint64_t cs_base;
+    uint64_t phys_pc;
+    uint32_t flags;
+    uint32_t cflags;
+    uint16_t size;
+    uint16_t icount;
+    uint16_t jmp_reset_offset[2];
+    uint16_t jmp_insn_offset[2];
+    uint32_t age;
+    uint32_t code_size;
+    uint32_t search_size;
+    uint32_t nb_relocs;
+    uint32_t pad;
+} TBCacheEntry;
 
-    /* generate machine code */
-    tb->jmp_reset_offset[0] = TB_JMP_RESET_OFFSET_INVALID;
-    tb->jmp_reset_offset[1] = TB_JMP_RESET_OFFSET_INVALID;
-    tcg_ctx.tb_jmp_reset_offset = tb->jmp_reset_offset;
-#ifdef USE_DIRECT_JUMP
-    tcg_ctx.tb_jmp_insn_offset = tb->jmp_insn_offset;
-    tcg_ctx.tb_jmp_target_addr = NULL;
-#else
-    tcg_ctx.tb_jmp_insn_offset = NULL;
-    tcg_ctx.tb_jmp_target_addr = tb->jmp_target_addr;
-#endif
+QEMU_BUILD_BUG_ON(sizeof(TBCacheEntry) % 8);
+QEMU_BUILD_BUG_ON(sizeof(TBCacheReloc) % 8);
 
-#ifdef CONFIG_PROFILER
-    tcg_ctx.tb_count++;
-    tcg_ctx.interm_time += profile_getclock() - ti;
-    tcg_ctx.code_time -= profile_getclock();
-#endif
+typedef struct TBCacheSlot {
+    const TBCacheEntry *entry;
+    bool used;                  /* installed in this run */
+    bool written;               /* a live TB with this key was saved */
+    bool stale;                 /* guest code changed, or duplicate */
+} TBCacheSlot;
 
-    /* ??? Overflow could be handled better here.  In particular, we
-       don't need to re-do gen_intermediate_code, nor should we re-do
-       the tcg optimization currently hidden inside tcg_gen_code.  All
-       that should be required is to flush the TBs, allocate a new TB,
-       re-initialize it per above, and re-do the actual code generation.  */
-    gen_code_size = tcg_gen_code(&tcg_ctx, tb);
-    if (unlikely(gen_code_size < 0)) {
+typedef struct TBCacheState {
+    char *path;
+    char *id;
+    gchar *data;
+    TBCacheSlot *slots;
+    uint32_t nb_slots;
+    GHashTable *index;
+    Notifier machine_done;
+    Notifier exit;
+} TBCacheState;
+
+static TBCacheState tb_cache;
+
+static inline size_t tb_cache_pad(size_t len)
+{
+    return ROUND_UP(len, 8);
+}
+
+static inline const uint8_t *tb_cache_guest_code(const TBCacheEntry *e)
+{
+    return (const uint8_t *)(e + 1);
+}
+
+static inline const uint8_t *tb_cache_host_code(const TBCacheEntry *e)
+{
+    return tb_cache_guest_code(e) + tb_cache_pad(e->size);
+}
+
+static inline const TBCacheReloc *tb_cache_relocs(const TBCacheEntry *e)
+{
+    return (const TBCacheReloc *)(tb_cache_host_code(e) +
+                                  tb_cache_pad(e->code_size + e->search_size));
+}
+
+static inline size_t tb_cache_entry_len(const TBCacheEntry *e)
+{
+    return sizeof(*e) + tb_cache_pad(e->size)
+        + tb_cache_pad((size_t)e->code_size + e->search_size)
+        + (size_t)e->nb_relocs * sizeof(TBCacheReloc);
+}
+
+static guint tb_cache_hash(gconstpointer p)
+{
+    const TBCacheEntry *e = ((const TBCacheSlot *)p)->entry;
+
+    return tb_hash_func(e->phys_pc, e->pc, e->flags);
+}
+
+static gboolean tb_cache_equal(gconstpointer a, gconstpointer b)
+{
+    const TBCacheEntry *x = ((const TBCacheSlot *)a)->entry;
+    const TBCacheEntry *y = ((const TBCacheSlot *)b)->entry;
+
+    return x->pc == y->pc && x->cs_base == y->cs_base &&
+           x->phys_pc == y->phys_pc && x->flags == y->flags &&
+           x->cflags == y->cflags;
+}
+
+static bool tb_cache_scalar_type(const char *type)
+{
+    return !strcmp(type, "bool") || !strcmp(type, "str") ||
+           !strcmp(type, "string") || !strncmp(type, "int", 3) ||
+           !strncmp(type, "uint", 4);
+}
+
+static gint tb_cache_compare_str(gconstpointer a, gconstpointer b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* Describe everything that the generated code depends on besides the
+ * key of each block: the executable and the CPU configuration.  There
+ * is no build ID to go by, so the identity of the executable file is
+ * used instead.
+ */
+static char *tb_cache_identity(void)
+{
+    Object *obj = OBJECT(first_cpu);
+    ObjectPropertyIterator iter;
+    ObjectProperty *prop;
+    GPtrArray *props;
+    GString *id;
+    struct stat st;
+    guint i;
+
+    if (stat("/proc/self/exe", &st) < 0) {
+        return NULL;
+    }
+
+    id = g_string_new(QEMU_VERSION " " TARGET_NAME);
+    g_string_append_printf(id, " exe=%llx:%llx:%llx:%lld.%09ld",
+                           (unsigned long long)st.st_dev,
+                           (unsigned long long)st.st_ino,
+                           (unsigned long long)st.st_size,
+                           (long long)st.st_mtim.tv_sec,
+                           (long)st.st_mtim.tv_nsec);
+    g_string_append_printf(id, " singlestep=%d cpu=%s",
+                           singlestep, object_get_typename(obj));
+
+    props = g_ptr_array_new_with_free_func(g_free);
+    object_property_iter_init(&iter, obj);
+    while ((prop = object_property_iter_next(&iter))) {
+        char *val;
+
+        if (!tb_cache_scalar_type(prop->type)) {
+            continue;
+        }
+        val = object_property_print(obj, prop->name, false, NULL);
+        if (val) {
+            g_ptr_array_add(props, g_strdup_printf("%s=%s", prop->name, val));
+            g_free(val);
+        }
+    }
+    g_ptr_array_sort(props, tb_cache_compare_str);
+    for (i = 0; i < props->len; i++) {
+        g_string_append_printf(id, " %s", (char *)g_ptr_array_index(props, i));
+    }
+    g_ptr_array_free(props, true);
+
+    return g_string_free(id, false);
+}
+
+static bool tb_cache_entry_valid(const TBCacheEntry *e)
+{
+    const TBCacheReloc *r = tb_cache_relocs(e);
+    uint32_t i;
+    int n;
+
+    if (e->size == 0 || e->size > TARGET_PAGE_SIZE || e->code_size == 0 ||
+        (size_t)e->code_size + e->search_size
+            > tcg_ctx.code_gen_buffer_size / 2) {
+        return false;
+    }
+    for (n = 0; n < 2; n++) {
+        if (e->jmp_reset_offset[n] != TB_JMP_RESET_OFFSET_INVALID &&
+            (e->jmp_reset_offset[n] > e->code_size ||
+             e->jmp_insn_offset[n] + 4 > e->code_size)) {
+            return false;
+        }
+    }
+    for (i = 0; i < e->nb_relocs; i++, r++) {
+        size_t len = r->type == TCG_CODE_RELOC_PCREL32 ? 4 : sizeof(uintptr_t);
+
+        if (r->type > TCG_CODE_RELOC_ABS || r->base > TB_CACHE_BASE_TEXT ||
+            (size_t)r->offset + len > e->code_size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void tb_cache_load(void)
+{
+    const TBCacheHeader *hdr;
+    GError *gerr = NULL;
+    gsize len, pos;
+    uint32_t i;
+
+    if (!g_file_get_contents(tb_cache.path, &tb_cache.data, &len, &gerr)) {
+        if (!g_error_matches(gerr, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+            error_report("tb-cache: %s", gerr->message);
+        }
+        g_error_free(gerr);
+        return;
+    }
+
+    /* A file from a different executable or CPU is silently replaced
+       at exit.  */
+    hdr = (const TBCacheHeader *)tb_cache.data;
+    if (len < sizeof(*hdr) || hdr->magic != TB_CACHE_MAGIC ||
+        hdr->version != TB_CACHE_VERSION ||
+        hdr->id_len != strlen(tb_cache.id) ||
+        len - sizeof(*hdr) < tb_cache_pad(hdr->id_len) ||
+        memcmp(hdr + 1, tb_cache.id, hdr->id_len)) {
+        goto discard;
+    }
+
+    pos = sizeof(*hdr) + tb_cache_pad(hdr->id_len);
+    if (hdr->nb_entries > (len - pos) / sizeof(TBCacheEntry)) {
+        error_report("tb-cache: %s is corrupt, ignoring it", tb_cache.path);
+        goto discard;
+    }
+    tb_cache.slots = g_new0(TBCacheSlot, hdr->nb_entries);
+    for (i = 0; i < hdr->nb_entries; i++) {
+        const TBCacheEntry *e = (const TBCacheEntry *)(tb_cache.data + pos);
+        TBCacheSlot *slot = &tb_cache.slots[tb_cache.nb_slots];
+
+        if (len - pos < sizeof(*e) || len - pos < tb_cache_entry_len(e) ||
+            !tb_cache_entry_valid(e)) {
+            error_report("tb-cache: %s is corrupt, ignoring it",
+                         tb_cache.path);
+            goto discard;
+        }
+        pos += tb_cache_entry_len(e);
+
+        slot->entry = e;
+        if (g_hash_table_lookup(tb_cache.index, slot)) {
+            continue;
+        }
+        g_hash_table_insert(tb_cache.index, slot, slot);
+        tb_cache.nb_slots++;
+    }
+    return;
+
+discard:
+    g_hash_table_remove_all(tb_cache.index);
+    g_free(tb_cache.slots);
+    tb_cache.slots = NULL;
+    tb_cache.nb_slots = 0;
+    g_free(tb_cache.data);
+    tb_cache.data = NULL;
+}
+
+static void tb_cache_machine_done(Notifier *n, void *unused)
+{
+    if (!first_cpu) {
+        tcg_ctx.code_relocs_enabled = false;
+        return;
+    }
+    tb_cache.id = tb_cache_identity();
+    if (!tb_cache.id) {
+        error_report("tb-cache: cannot identify the executable, "
+                     "translation cache disabled");
+        tcg_ctx.code_relocs_enabled = false;
+        return;
+    }
+    tb_cache.index = g_hash_table_new(tb_cache_hash, tb_cache_equal);
+    tb_cache_load();
+}
+
+static bool tb_cache_relocate(TranslationBlock *tb, const TBCacheReloc *r)
+{
+    uint8_t *field = (uint8_t *)tb->tc_ptr + r->offset;
+    uintptr_t value;
+    intptr_t disp;
+
+    switch (r->base) {
+    case TB_CACHE_BASE_SELF:
+        value = (uintptr_t)tb->tc_ptr;
+        break;
+    case TB_CACHE_BASE_TB:
+        value = (uintptr_t)tb;
+        break;
+    case TB_CACHE_BASE_PROLOGUE:
+        value = (uintptr_t)tcg_ctx.code_gen_prologue;
+        break;
+    default:
+        value = (uintptr_t)__executable_start;
+        break;
+    }
+    value += r->addend;
+
+    if (r->type == TCG_CODE_RELOC_PCREL32) {
+        disp = value - (uintptr_t)(field + 4);
+        if (disp != (int32_t)disp) {
+            return false;
+        }
+        stl_he_p(field, disp);
+    } else {
+        memcpy(field, &value, sizeof(value));
+    }
+    return true;
+}
+
+/* Fill in @tb from the cache.  Returns the end of the data written to
+ * code_gen_buffer, or NULL if @tb must be translated.
+ *
+ * Called with tb_lock held.
+ */
+static void *tb_cache_fill(CPUState *cpu, TranslationBlock *tb,
+                           tb_page_addr_t phys_pc)
+{
+    CPUArchState *env = cpu->env_ptr;
+    TBCacheEntry key;
+    TBCacheSlot key_slot = { .entry = &key };
+    TBCacheSlot *slot;
+    const TBCacheEntry *e;
+    const uint8_t *guest;
+    TBCacheInfo *info;
+    size_t len1, info_size;
+    uint32_t i;
+
+    /* Cached code has no execution counter.  */
+    if (!tb_cache.index || (tb->cflags & (CF_NOCACHE | CF_TRACE)) ||
+        tb_profile_enabled ||
+        !QTAILQ_EMPTY(&cpu->breakpoints) || cpu->singlestep_enabled) {
+        return NULL;
+    }
+
+    key.pc = tb->pc;
+    key.cs_base = tb->cs_base;
+    key.phys_pc = phys_pc;
+    key.flags = tb->flags;
+    key.cflags = tb->cflags;
+    slot = g_hash_table_lookup(tb_cache.index, &key_slot);
+    if (!slot) {
+        return NULL;
+    }
+    e = slot->entry;
+    guest = tb_cache_guest_code(e);
+
+    /* The guest code must be unchanged.  Do not fault in a second page
+       here; if it is not in the TLB, translate the block normally.  */
+    len1 = MIN(e->size, TARGET_PAGE_SIZE - (tb->pc & ~TARGET_PAGE_MASK));
+    if (memcmp(qemu_map_ram_ptr(NULL, phys_pc), guest, len1)) {
+        goto stale;
+    }
+    if (len1 < e->size) {
+        target_ulong virt_page2 = (tb->pc + e->size - 1) & TARGET_PAGE_MASK;
+        void *host2 = tlb_vaddr_to_host(env, virt_page2, 2,
+                                        cpu_mmu_index(env, true));
+
+        if (!host2) {
+            return NULL;
+        }
+        if (memcmp(host2, guest + len1, e->size - len1)) {
+            goto stale;
+        }
+    }
+
+    info = QEMU_ALIGN_PTR_UP(tb->tc_ptr + e->code_size + e->search_size,
+                             sizeof(uint64_t));
+    info_size = sizeof(*info) + e->nb_relocs * sizeof(TBCacheReloc);
+    if ((void *)info + info_size > tcg_ctx.code_gen_highwater) {
+        return NULL;
+    }
+
+    memcpy(tb->tc_ptr, tb_cache_host_code(e), e->code_size + e->search_size);
+    for (i = 0; i < e->nb_relocs; i++) {
+        if (!tb_cache_relocate(tb, &tb_cache_relocs(e)[i])) {
+            return NULL;
+        }
+    }
+    flush_icache_range((uintptr_t)tb->tc_ptr,
+                       (uintptr_t)tb->tc_ptr + e->code_size);
+
+    tb->size = e->size;
+    tb->icount = e->icount;
+    tb->jmp_reset_offset[0] = e->jmp_reset_offset[0];
+    tb->jmp_reset_offset[1] = e->jmp_reset_offset[1];
+    tb->jmp_insn_offset[0] = e->jmp_insn_offset[0];
+    tb->jmp_insn_offset[1] = e->jmp_insn_offset[1];
+
+    info->code_size = e->code_size;
+    info->search_size = e->search_size;
+    info->nb_relocs = e->nb_relocs;
+    info->pad = 0;
+    memcpy(info->relocs, tb_cache_relocs(e),
+           e->nb_relocs * sizeof(TBCacheReloc));
+    tb->cache_info = info;
+
+    slot->used = true;
+    return (void *)info + info_size;
+
+ stale:
+    slot->stale = true;
+    g_hash_table_remove(tb_cache.index, slot);
+    return NULL;
+}
+
+static bool tb_cache_classify(TranslationBlock *tb, uint32_t code_size,
+                              const TCGCodeReloc *r, TBCacheReloc *out)
+{
+    uintptr_t code = (uintptr_t)tb->tc_ptr;
+    uintptr_t t = r->target;
+
+    if (t >= code && t < code + code_size) {
+        out->base = TB_CACHE_BASE_SELF;
+        out->addend = t - code;
+    } else if (t >= (uintptr_t)tb && t < (uintptr_t)(tb + 1)) {
+        out->base = TB_CACHE_BASE_TB;
+        out->addend = t - (uintptr_t)tb;
+    } else if (t >= (uintptr_t)tcg_ctx.code_gen_prologue &&
+               t < (uintptr_t)tcg_ctx.code_gen_buffer) {
+        out->base = TB_CACHE_BASE_PROLOGUE;
+        out->addend = t - (uintptr_t)tcg_ctx.code_gen_prologue;
+    } else if (t >= (uintptr_t)__executable_start && t < (uintptr_t)etext) {
+        out->base = TB_CACHE_BASE_TEXT;
+        out->addend = t - (uintptr_t)__executable_start;
+    } else {
+        return false;
+    }
+    out->offset = r->offset;
+    out->type = r->type;
+    out->pad = 0;
+    return true;
+}
+
+/* Record what is needed to save the freshly generated @tb, right after
+ * its search data which ends at @end.  Returns the new end of the data
+ * in code_gen_buffer.
+ */
+static void *tb_cache_record(TranslationBlock *tb, int gen_code_size,
+                             int search_size, void *end)
+{
+    TBCacheInfo *info;
+    size_t info_size;
+    int i;
+
+    if (!tcg_ctx.code_relocs_enabled || tcg_ctx.code_relocs_unsafe ||
+        (tb->cflags & (CF_NOCACHE | CF_TRACE))) {
+        return end;
+    }
+
+    info = QEMU_ALIGN_PTR_UP(end, sizeof(uint64_t));
+    info_size = sizeof(*info)
+        + tcg_ctx.nb_code_relocs * sizeof(TBCacheReloc);
+    if ((void *)info + info_size > tcg_ctx.code_gen_highwater) {
+        return end;
+    }
+
+    for (i = 0; i < tcg_ctx.nb_code_relocs; i++) {
+        if (!tb_cache_classify(tb, gen_code_size, &tcg_ctx.code_relocs[i],
+                               &info->relocs[i])) {
+            return end;
+        }
+    }
+    info->code_size = gen_code_size;
+    info->search_size = search_size;
+    info->nb_relocs = tcg_ctx.nb_code_relocs;
+    info->pad = 0;
+    tb->cache_info = info;
+
+    return (void *)info + info_size;
+}
+
+static void tb_cache_append(GByteArray *buf, const void *data, size_t len)
+{
+    static const uint8_t zero[8];
+
+    g_byte_array_append(buf, data, len);
+    g_byte_array_append(buf, zero, tb_cache_pad(len) - len);
+}
+
+typedef struct TBCacheSaveState {
+    GByteArray *buf;
+    uint32_t nb_entries;
+} TBCacheSaveState;
+
+static void tb_cache_save_tb(struct qht *ht, void *p, uint32_t h, void *opaque)
+{
+    TranslationBlock *tb = p;
+    TBCacheSaveState *s = opaque;
+    TBCacheInfo *info = tb->cache_info;
+    TBCacheEntry e;
+    TBCacheSlot key_slot = { .entry = &e };
+    TBCacheSlot *slot;
+    uint8_t guest[TARGET_PAGE_SIZE];
+    size_t len1;
+
+    if (!info) {
+        return;
+    }
+
+    memset(&e, 0, sizeof(e));
+    e.pc = tb->pc;
+    e.cs_base = tb->cs_base;
+    e.phys_pc = tb->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK);
+    e.flags = tb->flags;
+    e.cflags = tb->cflags;
+    e.size = tb->size;
+    e.icount = tb->icount;
+    e.jmp_reset_offset[0] = tb->jmp_reset_offset[0];
+    e.jmp_reset_offset[1] = tb->jmp_reset_offset[1];
+    e.jmp_insn_offset[0] = tb->jmp_insn_offset[0];
+    e.jmp_insn_offset[1] = tb->jmp_insn_offset[1];
+    e.code_size = info->code_size;
+    e.search_size = info->search_size;
+    e.nb_relocs = info->nb_relocs;
+
+    len1 = MIN(tb->size, TARGET_PAGE_SIZE - (tb->pc & ~TARGET_PAGE_MASK));
+    memcpy(guest, qemu_map_ram_ptr(NULL, e.phys_pc), len1);
+    if (len1 < tb->size) {
+        memcpy(guest + len1, qemu_map_ram_ptr(NULL, tb->page_addr[1]),
+               tb->size - len1);
+    }
+
+    g_byte_array_append(s->buf, (const uint8_t *)&e, sizeof(e));
+    tb_cache_append(s->buf, guest, tb->size);
+    tb_cache_append(s->buf, tb->tc_ptr, info->code_size + info->search_size);
+    g_byte_array_append(s->buf, (const uint8_t *)info->relocs,
+                        info->nb_relocs * sizeof(TBCacheReloc));
+    s->nb_entries++;
+
+    slot = g_hash_table_lookup(tb_cache.index, &key_slot);
+    if (slot) {
+        slot->written = true;
+    }
+}
+
+static void tb_cache_save(Notifier *n, void *unused)
+{
+    TBCacheSaveState s;
+    TBCacheHeader hdr;
+    GError *gerr = NULL;
+    CPUState *cpu;
+    uint32_t i;
+
+    if (!tb_cache.index) {
+        return;
+    }
+    /* Code generated while debugging is not worth keeping.  */
+    CPU_FOREACH(cpu) {
+        if (!QTAILQ_EMPTY(&cpu->breakpoints) || cpu->singlestep_enabled) {
+            return;
+        }
+    }
+    /* exit() may be called with tb_lock held, e.g. from a helper.  */
+    if (qemu_mutex_trylock(&tcg_ctx.tb_ctx.tb_lock)) {
+        error_report("tb-cache: translator busy, not saving %s",
+                     tb_cache.path);
+        return;
+    }
+
+    s.buf = g_byte_array_new();
+    s.nb_entries = 0;
+    hdr.magic = TB_CACHE_MAGIC;
+    hdr.version = TB_CACHE_VERSION;
+    hdr.id_len = strlen(tb_cache.id);
+    hdr.nb_entries = 0;
+    g_byte_array_append(s.buf, (const uint8_t *)&hdr, sizeof(hdr));
+    tb_cache_append(s.buf, tb_cache.id, hdr.id_len);
+
+    rcu_read_lock();
+    qht_iter(&tcg_ctx.tb_ctx.htable, tb_cache_save_tb, &s);
+    rcu_read_unlock();
+
+    /* Keep the blocks that were not needed in this run for a while.  */
+    for (i = 0; i < tb_cache.nb_slots; i++) {
+        TBCacheSlot *slot = &tb_cache.slots[i];
+        size_t pos = s.buf->len;
+        TBCacheEntry *e;
+
+        if (slot->written || slot->stale ||
+            (!slot->used && slot->entry->age >= TB_CACHE_MAX_AGE)) {
+            continue;
+        }
+        g_byte_array_append(s.buf, (const uint8_t *)slot->entry,
+                            tb_cache_entry_len(slot->entry));
+        e = (TBCacheEntry *)(s.buf->data + pos);
+        e->age = slot->used ? 0 : e->age + 1;
+        s.nb_entries++;
+    }
+    qemu_mutex_unlock(&tcg_ctx.tb_ctx.tb_lock);
+
+    ((TBCacheHeader *)s.buf->data)->nb_entries = s.nb_entries;
+    if (!g_file_set_contents(tb_cache.path, (const gchar *)s.buf->data,
+                             s.buf->len, &gerr)) {
+        error_report("tb-cache: %s", gerr->message);
+        g_error_free(gerr);
+    }
+    g_byte_array_free(s.buf, true);
+}
+
+void tb_cache_init(const char *path, Error **errp)
+{
+    tb_cache.path = g_strdup(path);
+    tcg_ctx.code_relocs_enabled = true;
+
+    tb_cache.machine_done.notify = tb_cache_machine_done;
+    qemu_add_machine_init_done_notifier(&tb_cache.machine_done);
+    tb_cache.exit.notify = tb_cache_save;
+    qemu_add_exit_notifier(&tb_cache.exit);
+}
+
+#else
+
+void tb_cache_init(const char *path, Error **errp)
+{
+    error_setg(errp, "The translation cache is not supported on this host");
+}
+
+static inline void *tb_cache_fill(CPUState *cpu, TranslationBlock *tb,
+                                  tb_page_addr_t phys_pc)
+{
+    return NULL;
+}
+
+static inline void *tb_cache_record(TranslationBlock *tb, int gen_code_size,
+                                    int search_size, void *end)
+{
+    return end;
+}
+
+#endif /* TB_CACHE_SUPPORTED */
+
+/*
+ * Hot traces
+ *
+ * With -accel tcg,trace-threshold=N, blocks are no longer chained to
+ * each other.  Every execution goes through tb_find_fast(), which counts
+ * it and records which block followed it.  Once a block has run N times,
+ * it is translated again together with its most frequent successors,
+ * as a single op stream in which the jump leaving each block for the
+ * next one falls through into it.  Globals are then only synced at the
+ * conditional branches between the blocks, and can stay in host
+ * registers along the trace.  The other jumps become side exits to the
+ * main loop.
+ *
+ * A trace replaces its head block, and is only chained to other traces.
+ * All its blocks must lie in the page of the head, after the head pc, so
+ * that [pc, pc + size) covers them for invalidation.
+ */
+
+unsigned int tb_trace_threshold;
+
+bool tb_profile_enabled;
+
+#define TB_TRACE_MAX_BLOCKS 8
+
+typedef struct TBTraceBlock {
+    target_ulong pc;
+    target_ulong cs_base;
+    uint32_t flags;
+    uint16_t size;
+    uint16_t icount;
+    int exit;           /* jump leaving for the next block */
+} TBTraceBlock;
+
+/* The trace being translated, protected by tb_lock.  The blocks are
+   copied out of their TBs, since tb_gen_code() may flush them.  */
+static struct {
+    int nb_blocks;
+    TBTraceBlock blocks[TB_TRACE_MAX_BLOCKS];
+} tb_trace;
+
+static bool tb_trace_can_include(TranslationBlock *head, TranslationBlock *tb)
+{
+    return !tb->invalid && !(tb->cflags & (CF_TRACE | CF_NOCACHE)) &&
+           tb->pc >= head->pc &&
+           (tb->pc & TARGET_PAGE_MASK) == (head->pc & TARGET_PAGE_MASK) &&
+           tb->page_addr[0] == head->page_addr[0] && tb->page_addr[1] == -1;
+}
+
+/* Follow the most frequent successors of HEAD into tb_trace.blocks,
+ * until a block repeats or leaves the page.  Returns the number of
+ * blocks.
+ */
+static int tb_trace_select(TranslationBlock *head)
+{
+    TranslationBlock *tb = head;
+    int i, n = 0;
+
+    for (;;) {
+        TBTraceBlock *b = &tb_trace.blocks[n++];
+        TranslationBlock *next;
+        int jmp;
+
+        b->pc = tb->pc;
+        b->cs_base = tb->cs_base;
+        b->flags = tb->flags;
+        b->size = tb->size;
+        b->icount = tb->icount;
+        b->exit = -1;
+        if (n == TB_TRACE_MAX_BLOCKS) {
+            return n;
+        }
+
+        jmp = tb->exit_count[1] > tb->exit_count[0];
+        next = tb->trace_next[jmp];
+        if (!next || !tb_trace_can_include(head, next)) {
+            return n;
+        }
+        for (i = 0; i < n; i++) {
+            if (tb_trace.blocks[i].pc == next->pc) {
+                return n;
+            }
+        }
+        b->exit = jmp;
+        tb = next;
+    }
+}
+
+/* Return the index of the exit_tb op through which the block in ops
+ * [FIRST, LAST], translated for TAG, leaves by jump EXIT, or 0 if the
+ * trace cannot continue there.  The ops after it are only reached by
+ * branches and end up after the rest of the trace, so they must not
+ * need to restore the guest state from the search data.
+ */
+static int tb_trace_find_exit(int first, int last, uintptr_t tag, int exit)
+{
+    int oi, found = 0;
+
+    for (oi = first; oi <= last; oi++) {
+        TCGOp *op = &tcg_ctx.gen_op_buf[oi];
+        TCGArg *args = &tcg_ctx.gen_opparam_buf[op->args];
+
+        if (found) {
+            if (op->opc == INDEX_op_insn_start ||
+                (tcg_op_defs[op->opc].flags & TCG_OPF_CALL_CLOBBER)) {
+                return 0;
+            }
+        } else if (op->opc == INDEX_op_exit_tb && args[0] == tag + exit) {
+            found = oi;
+        }
+    }
+    return found;
+}
+
+/* Append ops [FIRST, LAST] of a block translated for TAG to ORDER.
+ * The jumps of the last block leave the trace TB; the others become
+ * side exits that are never chained.
+ */
+static int tb_trace_emit(TranslationBlock *tb, uintptr_t tag, bool last_block,
+                         int *order, int n, int first, int last)
+{
+    int oi;
+
+    for (oi = first; oi <= last; oi++) {
+        TCGOp *op = &tcg_ctx.gen_op_buf[oi];
+        TCGArg *args = &tcg_ctx.gen_opparam_buf[op->args];
+
+        if (op->opc == INDEX_op_goto_tb && !last_block) {
+            continue;
+        }
+        if (op->opc == INDEX_op_exit_tb && args[0] - tag <= TB_EXIT_IDX1) {
+            args[0] = last_block ? (uintptr_t)tb + (args[0] - tag) : 0;
+        }
+        order[n++] = oi;
+    }
+    return n;
+}
+
+/* Translate the blocks of tb_trace into TB.  The ops of each block are
+ * appended to the op buffer in turn, then relinked so that the exit_tb
+ * leaving a block for the next one is replaced by the ops of that block.
+ * The code after that exit_tb, reached by branches, follows the last
+ * block.
+ */
+static void gen_intermediate_trace(CPUArchState *env, TranslationBlock *tb)
+{
+    TranslationBlock sub;
+    TranslationBlock *cur = tb;
+    int first[TB_TRACE_MAX_BLOCKS], last[TB_TRACE_MAX_BLOCKS];
+    int cont[TB_TRACE_MAX_BLOCKS];
+    target_ulong end;
+    uint32_t icount;
+    int *order;
+    int i, n, nb_ops, prev;
+
+    first[0] = tcg_ctx.gen_next_op_idx;
+    gen_intermediate_code(env, tb);
+    last[0] = tcg_ctx.gen_next_op_idx - 1;
+    end = tb->pc + tb->size;
+    icount = tb->icount;
+
+    for (n = 1; n < tb_trace.nb_blocks; n++) {
+        const TBTraceBlock *p = &tb_trace.blocks[n - 1];
+        const TBTraceBlock *b = &tb_trace.blocks[n];
+
+        /* The exits were recorded for the earlier translation; only
+           trust them if the block came out the same.  */
+        if (cur->size != p->size || cur->icount != p->icount) {
+            break;
+        }
+        cont[n - 1] = tb_trace_find_exit(first[n - 1], last[n - 1],
+                                         (uintptr_t)cur, p->exit);
+        if (!cont[n - 1] || icount + b->icount > TCG_MAX_INSNS) {
+            break;
+        }
+
+        memset(&sub, 0, sizeof(sub));
+        sub.pc = b->pc;
+        sub.cs_base = b->cs_base;
+        sub.flags = b->flags;
+        sub.cflags = CF_TRACE_TAIL;
+#ifdef CONFIG_DEBUG_TCG
+        tcg_ctx.goto_tb_issue_mask = 0;
+#endif
+        first[n] = tcg_ctx.gen_next_op_idx;
+        gen_intermediate_code(env, &sub);
+        last[n] = tcg_ctx.gen_next_op_idx - 1;
+        cur = &sub;
+    }
+    if (n > 1 && (cur->size != tb_trace.blocks[n - 1].size ||
+                  cur->icount != tb_trace.blocks[n - 1].icount)) {
+        /* The op buffer filled up; drop the incomplete block.  */
+        n--;
+    }
+    for (i = 1; i < n; i++) {
+        end = MAX(end, tb_trace.blocks[i].pc + tb_trace.blocks[i].size);
+        icount += tb_trace.blocks[i].icount;
+    }
+    tb->size = end - tb->pc;
+    tb->icount = icount;
+
+    /* Relink the op list, also dropping the ops of any block that was
+       translated but not kept.  */
+    order = tcg_malloc(OPC_BUF_SIZE * sizeof(int));
+    nb_ops = 0;
+    for (i = 0; i < n; i++) {
+        nb_ops = tb_trace_emit(tb, i ? (uintptr_t)&sub : (uintptr_t)tb,
+                               i == n - 1, order, nb_ops, first[i],
+                               i == n - 1 ? last[i] : cont[i] - 1);
+    }
+    for (i = n - 2; i >= 0; i--) {
+        nb_ops = tb_trace_emit(tb, i ? (uintptr_t)&sub : (uintptr_t)tb,
+                               false, order, nb_ops, cont[i] + 1, last[i]);
+    }
+
+    prev = 0;
+    for (i = 0; i < nb_ops; i++) {
+        tcg_ctx.gen_op_buf[prev].next = order[i];
+        tcg_ctx.gen_op_buf[order[i]].prev = prev;
+        prev = order[i];
+    }
+    tcg_ctx.gen_op_buf[prev].next = 0;
+    tcg_ctx.gen_op_buf[0].prev = prev;
+}
+
+/* Called with tb_lock held when TB is about to run after LAST_TB left
+ * through jump TB_EXIT.  Returns the TB to execute instead, which is a
+ * new trace if TB has just become hot.
+ */
+TranslationBlock *tb_trace_profile(CPUState *cpu, TranslationBlock *last_tb,
+                                   int tb_exit, TranslationBlock *tb)
+{
+    TranslationBlock *trace;
+
+    if (last_tb && !(last_tb->cflags & CF_TRACE) &&
+        tb_exit <= TB_EXIT_IDX1) {
+        last_tb->trace_next[tb_exit] = tb;
+        last_tb->exit_count[tb_exit]++;
+    }
+    if ((tb->cflags & (CF_TRACE | CF_NOCACHE)) ||
+        ++tb->exec_count != tb_trace_threshold ||
+        !tb_trace_can_include(tb, tb)) {
+        return tb;
+    }
+
+    tb_trace.nb_blocks = tb_trace_select(tb);
+    if (tb_trace.nb_blocks < 2) {
+        return tb;
+    }
+
+    /* The trace takes the place of its head block.  */
+    tb_phys_invalidate(tb, -1);
+    trace = tb_gen_code(cpu, tb_trace.blocks[0].pc, tb_trace.blocks[0].cs_base,
+                        tb_trace.blocks[0].flags, CF_TRACE);
+    atomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(trace->pc)], trace);
+    return trace;
+}
+
+/* Called with tb_lock held.  */
+TranslationBlock *tb_gen_code(CPUState *cpu,
+                              target_ulong pc, target_ulong cs_base,
+                              uint32_t flags, int cflags)
+{
+    CPUArchState *env = cpu->env_ptr;
+    TranslationBlock *tb;
+    tb_page_addr_t phys_pc, phys_page2;
+    target_ulong virt_page2;
+    tcg_insn_unit *gen_code_buf;
+    int gen_code_size, search_size;
+    void *gen_code_end;
+    void *cold_code_buf = NULL;
+    size_t cold_code_size = 0;
+#ifdef CONFIG_PROFILER
+    int64_t ti;
+#endif
+
+    phys_pc = get_page_addr_code(env, pc);
+    if (use_icount && !(cflags & CF_IGNORE_ICOUNT)) {
+        cflags |= CF_USE_ICOUNT;
+    }
+
+    tb = tb_alloc(pc);
+    if (unlikely(!tb)) {
+ buffer_overflow:
+        /* the current region is full, move on to the next one */
+        if (tb) {
+            tb_free(tb);
+        }
+        if (cflags & CF_SPECULATIVE) {
+            /* not worth throwing away code that is known to be used */
+            return NULL;
+        }
+        tb_evict(cpu);
+        if (qemu_tcg_mttcg_enabled()) {
+            /* the eviction only happens once we are out of cpu_exec */
+            cpu_loop_exit(cpu);
+        }
+        /* cannot fail at this point */
+        tb = tb_alloc(pc);
+        assert(tb != NULL);
+    }
+
+    gen_code_buf = tcg_ctx.code_gen_ptr;
+    tb->tc_ptr = gen_code_buf;
+    tb->tc_cold_ptr = tcg_ctx.code_gen_cold_ptr;
+    tb->cs_base = cs_base;
+    tb->flags = flags;
+    tb->cflags = cflags & ~CF_SPECULATIVE;
+    tb->cache_info = NULL;
+    tb->exec_count = 0;
+    tb->exit_count[0] = 0;
+    tb->exit_count[1] = 0;
+    tb->trace_next[0] = NULL;
+    tb->trace_next[1] = NULL;
+    tb->prof_count = 0;
+
+    tb_spec.nb_succ = 0;
+    gen_code_end = tb_cache_fill(cpu, tb, phys_pc);
+    if (gen_code_end) {
+        gen_code_size = tb->cache_info->code_size;
+        goto cached;
+    }
+
+#ifdef CONFIG_PROFILER
+    tcg_ctx.tb_count1++; /* includes aborted translations because of
+                       exceptions */
+    ti = profile_getclock();
+#endif
+
+    tcg_func_start(&tcg_ctx);
+
+    tcg_ctx.cpu = ENV_GET_CPU(env);
+    if (cflags & CF_TRACE) {
+        gen_intermediate_trace(env, tb);
+    } else {
+        gen_intermediate_code(env, tb);
+    }
+    tcg_ctx.cpu = NULL;
+
+    trace_translate_block(tb, tb->pc, tb->tc_ptr);
+
+    /* generate machine code */
+    tb->jmp_reset_offset[0] = TB_JMP_RESET_OFFSET_INVALID;
+    tb->jmp_reset_offset[1] = TB_JMP_RESET_OFFSET_INVALID;
+    tcg_ctx.tb_jmp_reset_offset = tb->jmp_reset_offset;
+#ifdef USE_DIRECT_JUMP
+    tcg_ctx.tb_jmp_insn_offset = tb->jmp_insn_offset;
+    tcg_ctx.tb_jmp_target_addr = NULL;
+#else
+    tcg_ctx.tb_jmp_insn_offset = NULL;
+    tcg_ctx.tb_jmp_target_addr = tb->jmp_target_addr;
+#endif
+
+#ifdef CONFIG_PROFILER
+    tcg_ctx.tb_count++;
+    tcg_ctx.interm_time += profile_getclock() - ti;
+    tcg_ctx.code_time -= profile_getclock();
+#endif
+
+    /* ??? Overflow could be handled better here.  In particular, we
+       don't need to re-do gen_intermediate_code, nor should we re-do
+       the tcg optimization currently hidden inside tcg_gen_code.  All
+       that should be required is to flush the TBs, allocate a new TB,
+       re-initialize it per above, and re-do the actual code generation.  */
+    cold_code_buf = tcg_ctx.code_gen_cold_ptr;
+    gen_code_size = tcg_gen_code(&tcg_ctx, tb);
+    if (unlikely(gen_code_size < 0)) {
         goto buffer_overflow;
     }
+    cold_code_size = tcg_ctx.code_gen_cold_ptr - cold_code_buf;
     search_size = encode_search(tb, (void *)gen_code_buf + gen_code_size);
     if (unlikely(search_size < 0)) {
         goto buffer_overflow;
@@ -1233,19 +2652,33 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         qemu_log("OUT: [size=%d]\n", gen_code_size);
         log_disas(tb->tc_ptr, gen_code_size);
         qemu_log("\n");
+        if (cold_code_size) {
+            qemu_log("OUT (cold): [size=%zd]\n", cold_code_size);
+            log_disas(cold_code_buf, cold_code_size);
+            qemu_log("\n");
+        }
         qemu_log_flush();
     }
 #endif
 
+    gen_code_end = tb_cache_record(tb, gen_code_size, search_size,
+                                   (void *)gen_code_buf + gen_code_size
+                                   + search_size);
+
+ cached:
     tcg_ctx.code_gen_ptr = (void *)
-        ROUND_UP((uintptr_t)gen_code_buf + gen_code_size + search_size,
-                 CODE_GEN_ALIGN);
+        ROUND_UP((uintptr_t)gen_code_end, CODE_GEN_ALIGN);
+    jit_perf_report_code(tb, gen_code_buf, gen_code_size);
+    if (cold_code_size) {
+        jit_perf_report_code(tb, cold_code_buf, cold_code_size);
+    }
 
     /* init jump list */
     assert(((uintptr_t)tb & 3) == 0);
     tb->jmp_list_first = (uintptr_t)tb | 2;
     tb->jmp_list_next[0] = (uintptr_t)NULL;
     tb->jmp_list_next[1] = (uintptr_t)NULL;
+    tb->jmp_cross_page = 0;
 
     /* init original jump addresses wich has been set during tcg_gen_code() */
     if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
@@ -1261,15 +2694,217 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     if ((pc & TARGET_PAGE_MASK) != virt_page2) {
         phys_page2 = get_page_addr_code(env, virt_page2);
     }
-    /* As long as consistency of the TB stuff is provided by tb_lock in user
-     * mode and is implicit in single-threaded softmmu emulation, no explicit
-     * memory barrier is required before tb_link_page() makes the TB visible
-     * through the physical hash table and physical page list.
+    /* As long as consistency of the TB stuff is provided by tb_lock, no
+     * explicit memory barrier is required before tb_link_page() makes the
+     * TB visible through the physical hash table and physical page list.
      */
     tb_link_page(tb, phys_pc, phys_page2);
+
+    if (tb_spec.enabled && !(cflags & (CF_NOCACHE | CF_TRACE))) {
+        tb_spec_queue_successors(cpu, tb, cflags);
+    }
     return tb;
 }
 
+/* Note that the TB being translated can continue at PC, with the same
+ * cs_base and flags.  Frontends call this for the destinations of their
+ * direct jumps.
+ */
+void tb_note_successor(target_ulong pc)
+{
+    if (tb_spec.nb_succ < ARRAY_SIZE(tb_spec.succ)) {
+        tb_spec.succ[tb_spec.nb_succ++] = pc;
+    }
+}
+
+/* Called with tb_lock held.  Returns false if there is no request for
+ * CPU, or for any CPU if it is NULL.  The most recent request is served
+ * first.
+ */
+static bool tb_spec_pop(CPUState *cpu, TBSpecRequest *req)
+{
+    int i;
+
+    for (i = tb_spec.nb_queued - 1; i >= 0; i--) {
+        if (cpu == NULL || tb_spec.queue[i].cpu == cpu) {
+            *req = tb_spec.queue[i];
+            tb_spec.nb_queued--;
+            memmove(&tb_spec.queue[i], &tb_spec.queue[i + 1],
+                    (tb_spec.nb_queued - i) * sizeof(*req));
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Called with tb_lock held.  */
+static void tb_spec_translate(const TBSpecRequest *req)
+{
+    target_ulong page = req->pc & TARGET_PAGE_MASK;
+#ifdef CONFIG_USER_ONLY
+    int i, prot;
+
+    /* A TB can extend into the next page.  Its code must be readable
+       without faulting, as there is no guest context to deliver the
+       fault to; mappings only change under tb_lock, so this check
+       holds until the TB is generated.  Pages that are also written
+       would keep being invalidated, so leave them alone.  */
+    for (i = 0; i < 2; i++) {
+        prot = page_get_flags(page + i * TARGET_PAGE_SIZE);
+        if ((prot & (PAGE_VALID | PAGE_READ | PAGE_WRITE))
+            != (PAGE_VALID | PAGE_READ)) {
+            return;
+        }
+    }
+#else
+    CPUArchState *env = req->cpu->env_ptr;
+    target_ulong pc, cs_base;
+    uint32_t flags;
+
+    /* The frontend reads the code in the current MMU mode, and must not
+       cause a TLB fill; a TB can extend into the next page.  */
+    cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    if (cs_base != req->cs_base || flags != req->flags ||
+        tlb_probe_page_addr_code(env, page) == -1 ||
+        tlb_probe_page_addr_code(env, page + TARGET_PAGE_SIZE) == -1) {
+        return;
+    }
+#endif
+
+    if (tb_find_physical(req->cpu, req->pc, req->cs_base, req->flags)) {
+        return;
+    }
+    tb_spec.depth = req->depth;
+    if (tb_gen_code(req->cpu, req->pc, req->cs_base, req->flags,
+                    CF_SPECULATIVE)) {
+        tb_spec.count++;
+    }
+    tb_spec.depth = 0;
+}
+
+static void tb_spec_queue_successors(CPUState *cpu, TranslationBlock *tb,
+                                     int cflags)
+{
+    int depth = (cflags & CF_SPECULATIVE ? tb_spec.depth : 0) + 1;
+    TBSpecRequest *req;
+    int i;
+
+    if (depth > TB_SPEC_MAX_DEPTH) {
+        return;
+    }
+    if (tb_spec.nb_succ == 0) {
+        /* The frontend did not say, so guess the fall-through.  */
+        tb_note_successor(tb->pc + tb->size);
+    }
+    for (i = 0; i < tb_spec.nb_succ; i++) {
+        if (tb_spec.succ[i] == tb->pc) {
+            continue;
+        }
+        if (tb_spec.nb_queued == TB_SPEC_QUEUE_SIZE) {
+            /* forget the oldest request */
+            tb_spec.nb_queued--;
+            memmove(&tb_spec.queue[0], &tb_spec.queue[1],
+                    tb_spec.nb_queued * sizeof(*req));
+        }
+        req = &tb_spec.queue[tb_spec.nb_queued++];
+        req->cpu = cpu;
+        req->pc = tb_spec.succ[i];
+        req->cs_base = tb->cs_base;
+        req->flags = tb->flags;
+        req->depth = depth;
+    }
+#ifdef CONFIG_USER_ONLY
+    qemu_cond_signal(&tb_spec.cond);
+#endif
+}
+
+#ifdef CONFIG_USER_ONLY
+static void *tb_spec_thread_fn(void *arg)
+{
+    TBSpecRequest req;
+    CPUState *cpu;
+
+    for (;;) {
+        tb_lock();
+        while (tb_spec.nb_queued == 0) {
+            qemu_cond_wait(&tb_spec.cond, &tcg_ctx.tb_ctx.tb_lock);
+        }
+        if (tb_spec_pop(NULL, &req)) {
+            /* The vCPU may have exited since the request was made.  */
+            cpu_list_lock();
+            CPU_FOREACH(cpu) {
+                if (cpu == req.cpu) {
+                    tb_spec_translate(&req);
+                    break;
+                }
+            }
+            cpu_list_unlock();
+        }
+        tb_unlock();
+    }
+    return NULL;
+}
+
+static void tb_spec_start_thread(void)
+{
+    tb_spec.nb_queued = 0;
+    qemu_cond_init(&tb_spec.cond);
+    qemu_thread_create(&tb_spec.thread, "tb-spec", tb_spec_thread_fn,
+                       NULL, QEMU_THREAD_DETACHED);
+}
+
+/* The helper thread does not survive fork(), and the requests in the
+ * queue are for vCPUs of the parent.  Called in the child by fork_end,
+ * after tb_lock has been reinitialized.
+ */
+void tb_speculate_fork_child(void)
+{
+    tb_spec.nb_succ = 0;
+    tb_spec.depth = 0;
+    if (tb_spec.enabled) {
+        tb_spec_start_thread();
+    }
+}
+#else
+/* Called by a vCPU thread that has nothing to run.  With multi-threaded
+ * TCG the BQL is not held and start_exclusive() does not wait for this
+ * thread, so the safe work of tb_flush() and tb_evict() relies on tb_lock
+ * to keep out of the way.  The softmmu TLB of a vCPU belongs to its
+ * thread, so that guest code can only be read from there.  Translates a
+ * block requested by CPU, or by any vCPU if NULL, and returns false if
+ * there was none.
+ */
+bool tb_speculate(CPUState *cpu)
+{
+    TBSpecRequest req;
+    bool found;
+
+    if (!tb_spec.enabled) {
+        return false;
+    }
+    rcu_read_lock();
+    tb_lock();
+    found = tb_spec_pop(cpu, &req);
+    if (found) {
+        tb_spec_translate(&req);
+    }
+    tb_unlock();
+    rcu_read_unlock();
+    return found;
+}
+#endif
+
+void tb_speculate_enable(void)
+{
+    if (tb_spec.enabled) {
+        return;
+    }
+    tb_spec.enabled = true;
+#ifdef CONFIG_USER_ONLY
+    tb_spec_start_thread();
+#endif
+}
+
 /*
  * Invalidate all TBs which intersect with the target physical address range
  * [start;end[. NOTE: start and end may refer to *different* physical pages.
@@ -1277,14 +2912,25 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
  * access: the virtual CPU will exit the current TB if code is modified inside
  * this TB.
  *
- * Called with mmap_lock held for user-mode emulation
+ * Called with tb_lock held.
  */
 void tb_invalidate_phys_range(tb_page_addr_t start, tb_page_addr_t end)
 {
-    while (start < end) {
-        tb_invalidate_phys_page_range(start, end, 0);
-        start &= TARGET_PAGE_MASK;
-        start += TARGET_PAGE_SIZE;
+    tb_page_addr_t index, next, last;
+    PageDesc *p;
+
+    if (start >= end) {
+        return;
+    }
+    /* Large ranges, e.g. from munmap, are mostly without PageDescs:
+       skip the missing tables as a whole.  */
+    last = (end - 1) >> TARGET_PAGE_BITS;
+    for (index = start >> TARGET_PAGE_BITS; index <= last; index = next) {
+        p = page_find_next(index, &next);
+        if (p) {
+            tb_invalidate_phys_page_range(MAX(start, index << TARGET_PAGE_BITS),
+                                          end, 0);
+        }
     }
 }
 
@@ -1295,7 +2941,7 @@ void tb_invalidate_phys_range(tb_page_addr_t start, tb_page_addr_t end)
  * access: the virtual CPU will exit the current TB if code is modified inside
  * this TB.
  *
- * Called with mmap_lock held for user-mode emulation
+ * Called with tb_lock held.
  */
 void tb_invalidate_phys_page_range(tb_page_addr_t start, tb_page_addr_t end,
                                    int is_cpu_write_access)
@@ -1376,7 +3022,7 @@ void tb_invalidate_phys_page_range(tb_page_addr_t start, tb_page_addr_t end,
 #if !defined(CONFIG_USER_ONLY)
     /* if no code remaining, no need to continue to use slow writes */
     if (!p->first_tb) {
-        invalidate_page_bitmap(p);
+        free_page_code_ranges(p);
         tlb_unprotect_code(start);
     }
 #endif
@@ -1396,6 +3042,7 @@ void tb_invalidate_phys_page_range(tb_page_addr_t start, tb_page_addr_t end,
 void tb_invalidate_phys_page_fast(tb_page_addr_t start, int len)
 {
     PageDesc *p;
+    uint32_t nr;
 
 #if 0
     if (1) {
@@ -1410,27 +3057,16 @@ void tb_invalidate_phys_page_fast(tb_page_addr_t start, int len)
     if (!p) {
         return;
     }
-    if (!p->code_bitmap &&
-        ++p->code_write_count >= SMC_BITMAP_USE_THRESHOLD) {
-        /* build code bitmap */
-        build_page_bitmap(p);
-    }
-    if (p->code_bitmap) {
-        unsigned int nr;
-        unsigned long b;
-
-        nr = start & ~TARGET_PAGE_MASK;
-        b = p->code_bitmap[BIT_WORD(nr)] >> (nr & (BITS_PER_LONG - 1));
-        if (b & ((1 << len) - 1)) {
-            goto do_invalidate;
-        }
-    } else {
-    do_invalidate:
+    /* Writes to data that shares the page with code are common, for
+       example with firmware that runs from RAM.  Only walk the TBs if
+       the write actually hits one.  */
+    nr = start & ~TARGET_PAGE_MASK;
+    if (page_code_ranges_overlap(p, nr, nr + len)) {
         tb_invalidate_phys_page_range(start, start + len, 1);
     }
 }
 #else
-/* Called with mmap_lock held. If pc is not 0 then it indicates the
+/* Called with tb_lock held. If pc is not 0 then it indicates the
  * host PC of the faulting store instruction that caused this invalidate.
  * Returns true if the caller needs to abort execution of the current
  * TB (because it was modified by this store and the guest CPU has
@@ -1504,23 +3140,34 @@ static bool tb_invalidate_phys_page(tb_page_addr_t addr, uintptr_t pc)
    tb[1].tc_ptr. Return NULL if not found */
 static TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
 {
-    int m_min, m_max, m;
+    TBContext *ctx = &tcg_ctx.tb_ctx;
+    TBRegion *r = NULL;
+    int i, m_min, m_max, m;
     uintptr_t v;
     TranslationBlock *tb;
 
-    if (tcg_ctx.tb_ctx.nb_tbs <= 0) {
+    if (ctx->nb_tbs <= 0) {
         return NULL;
     }
-    if (tc_ptr < (uintptr_t)tcg_ctx.code_gen_buffer ||
-        tc_ptr >= (uintptr_t)tcg_ctx.code_gen_ptr) {
+    for (i = 0; i < ctx->nb_regions; i++) {
+        void *end = (i == ctx->cur_region ? tcg_ctx.code_gen_ptr
+                     : ctx->regions[i].end);
+
+        if (tc_ptr >= (uintptr_t)ctx->regions[i].start &&
+            tc_ptr < (uintptr_t)end) {
+            r = &ctx->regions[i];
+            break;
+        }
+    }
+    if (r == NULL || r->nb_tbs <= 0) {
         return NULL;
     }
     /* binary search (cf Knuth) */
     m_min = 0;
-    m_max = tcg_ctx.tb_ctx.nb_tbs - 1;
+    m_max = r->nb_tbs - 1;
     while (m_min <= m_max) {
         m = (m_min + m_max) >> 1;
-        tb = &tcg_ctx.tb_ctx.tbs[m];
+        tb = &r->tbs[m];
         v = (uintptr_t)tb->tc_ptr;
         if (v == tc_ptr) {
             return tb;
@@ -1530,7 +3177,7 @@ static TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
             m_min = m + 1;
         }
     }
-    return &tcg_ctx.tb_ctx.tbs[m_max];
+    return m_max < 0 ? NULL : &r->tbs[m_max];
 }
 
 #if !defined(CONFIG_USER_ONLY)
@@ -1548,11 +3195,14 @@ void tb_invalidate_phys_addr(AddressSpace *as, hwaddr addr)
         return;
     }
     ram_addr = memory_region_get_ram_addr(mr) + addr;
+    tb_lock();
     tb_invalidate_phys_page_range(ram_addr, ram_addr + 1, 0);
+    tb_unlock();
     rcu_read_unlock();
 }
 #endif /* !defined(CONFIG_USER_ONLY) */
 
+/* Called with tb_lock held.  */
 void tb_check_watchpoint(CPUState *cpu)
 {
     TranslationBlock *tb;
@@ -1589,6 +3239,8 @@ void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr)
     target_ulong pc, cs_base;
     uint32_t flags;
 
+    /* Released by tb_lock_reset() once we longjmp back to cpu_exec.  */
+    tb_lock();
     tb = tb_find_pc(retaddr);
     if (!tb) {
         cpu_abort(cpu, "cpu_io_recompile: could not find TB for pc=%p",
@@ -1703,9 +3355,11 @@ static void print_qht_statistics(FILE *f, fprintf_function cpu_fprintf,
 
 void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
 {
-    int i, target_code_size, max_target_code_size;
+    int i, j, target_code_size, max_target_code_size;
     int direct_jmp_count, direct_jmp2_count, cross_page;
+    size_t host_code_size, cold_code_size;
     TranslationBlock *tb;
+    TBRegion *r;
     struct qht_stats hst;
 
     target_code_size = 0;
@@ -1713,40 +3367,53 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
     cross_page = 0;
     direct_jmp_count = 0;
     direct_jmp2_count = 0;
-    for (i = 0; i < tcg_ctx.tb_ctx.nb_tbs; i++) {
-        tb = &tcg_ctx.tb_ctx.tbs[i];
-        target_code_size += tb->size;
-        if (tb->size > max_target_code_size) {
-            max_target_code_size = tb->size;
-        }
-        if (tb->page_addr[1] != -1) {
-            cross_page++;
-        }
-        if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
-            direct_jmp_count++;
-            if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
-                direct_jmp2_count++;
+    host_code_size = 0;
+    cold_code_size = 0;
+    for (i = 0; i < tcg_ctx.tb_ctx.nb_regions; i++) {
+        r = &tcg_ctx.tb_ctx.regions[i];
+        host_code_size += (i == tcg_ctx.tb_ctx.cur_region
+                           ? tcg_ctx.code_gen_ptr : r->end) - r->start;
+        cold_code_size += (i == tcg_ctx.tb_ctx.cur_region
+                           ? tcg_ctx.code_gen_cold_ptr : r->cold_end)
+                          - r->cold_start;
+    }
+    for (i = 0; i < tcg_ctx.tb_ctx.nb_regions; i++) {
+        r = &tcg_ctx.tb_ctx.regions[i];
+        for (j = 0; j < r->nb_tbs; j++) {
+            tb = &r->tbs[j];
+            target_code_size += tb->size;
+            if (tb->size > max_target_code_size) {
+                max_target_code_size = tb->size;
+            }
+            if (tb->page_addr[1] != -1) {
+                cross_page++;
+            }
+            if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
+                direct_jmp_count++;
+                if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
+                    direct_jmp2_count++;
+                }
             }
         }
     }
     /* XXX: avoid using doubles ? */
     cpu_fprintf(f, "Translation buffer state:\n");
-    cpu_fprintf(f, "gen code size       %td/%zd\n",
-                tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer,
-                tcg_ctx.code_gen_highwater - tcg_ctx.code_gen_buffer);
+    cpu_fprintf(f, "gen code size       %zd/%zd\n",
+                host_code_size, tcg_ctx.code_gen_buffer_size);
+    cpu_fprintf(f, "out-of-line code    %zd\n", cold_code_size);
+    cpu_fprintf(f, "code regions        %d (current %d)\n",
+                tcg_ctx.tb_ctx.nb_regions, tcg_ctx.tb_ctx.cur_region);
     cpu_fprintf(f, "TB count            %d/%d\n",
             tcg_ctx.tb_ctx.nb_tbs, tcg_ctx.code_gen_max_blocks);
     cpu_fprintf(f, "TB avg target size  %d max=%d bytes\n",
             tcg_ctx.tb_ctx.nb_tbs ? target_code_size /
                     tcg_ctx.tb_ctx.nb_tbs : 0,
             max_target_code_size);
-    cpu_fprintf(f, "TB avg host size    %td bytes (expansion ratio: %0.1f)\n",
-            tcg_ctx.tb_ctx.nb_tbs ? (tcg_ctx.code_gen_ptr -
-                                     tcg_ctx.code_gen_buffer) /
-                                     tcg_ctx.tb_ctx.nb_tbs : 0,
-                target_code_size ? (double) (tcg_ctx.code_gen_ptr -
-                                             tcg_ctx.code_gen_buffer) /
-                                             target_code_size : 0);
+    cpu_fprintf(f, "TB avg host size    %zd bytes (expansion ratio: %0.1f)\n",
+            tcg_ctx.tb_ctx.nb_tbs ? host_code_size /
+                                    tcg_ctx.tb_ctx.nb_tbs : 0,
+                target_code_size ? (double) host_code_size /
+                                   target_code_size : 0);
     cpu_fprintf(f, "cross page TB count %d (%d%%)\n", cross_page,
             tcg_ctx.tb_ctx.nb_tbs ? (cross_page * 100) /
                                     tcg_ctx.tb_ctx.nb_tbs : 0);
@@ -1764,12 +3431,93 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
 
     cpu_fprintf(f, "\nStatistics:\n");
     cpu_fprintf(f, "TB flush count      %d\n", tcg_ctx.tb_ctx.tb_flush_count);
+    cpu_fprintf(f, "TB region evictions %d\n", tcg_ctx.tb_ctx.tb_evict_count);
+    cpu_fprintf(f, "speculative TBs     %d\n", tb_spec.count);
     cpu_fprintf(f, "TB invalidate count %d\n",
             tcg_ctx.tb_ctx.tb_phys_invalidate_count);
+    cpu_fprintf(f, "cross page exits    %" PRIu64 "\n",
+                tcg_ctx.tb_ctx.cross_page_exit_count);
+    cpu_fprintf(f, "cross page chains   %" PRIu64 " (%d unlinked)%s\n",
+                tcg_ctx.tb_ctx.cross_page_chain_count,
+                tcg_ctx.tb_ctx.cross_page_unlink_count,
+                tb_cross_page_chaining ? "" : " (disabled)");
     cpu_fprintf(f, "TLB flush count     %d\n", tlb_flush_count);
+    dump_tlb_info(f, cpu_fprintf);
     tcg_dump_info(f, cpu_fprintf);
 }
 
+static gint tb_hot_cmp(gconstpointer a, gconstpointer b)
+{
+    const TranslationBlock *tb_a = *(TranslationBlock * const *)a;
+    const TranslationBlock *tb_b = *(TranslationBlock * const *)b;
+
+    if (tb_a->prof_count != tb_b->prof_count) {
+        return tb_a->prof_count < tb_b->prof_count ? 1 : -1;
+    }
+    return 0;
+}
+
+TbHotInfoList *qmp_query_tb_hot(bool has_count, int64_t count, Error **errp)
+{
+    TbHotInfoList *head = NULL, **tail = &head;
+    GPtrArray *tbs;
+    TranslationBlock *tb;
+    TBRegion *r;
+    int i, j;
+
+    if (!tb_profile_enabled) {
+        error_setg(errp, "TB profiling is not enabled, "
+                   "use -accel tcg,profile=on");
+        return NULL;
+    }
+    if (!has_count) {
+        count = 10;
+    }
+
+    tb_lock();
+    tbs = g_ptr_array_new();
+    for (i = 0; i < tcg_ctx.tb_ctx.nb_regions; i++) {
+        r = &tcg_ctx.tb_ctx.regions[i];
+        for (j = 0; j < r->nb_tbs; j++) {
+            tb = &r->tbs[j];
+            if (!tb->invalid && atomic_read(&tb->prof_count)) {
+                g_ptr_array_add(tbs, tb);
+            }
+        }
+    }
+    g_ptr_array_sort(tbs, tb_hot_cmp);
+
+    for (i = 0; i < tbs->len && i < count; i++) {
+        TbHotInfoList *entry = g_new0(TbHotInfoList, 1);
+        TbHotInfo *info = g_new0(TbHotInfo, 1);
+
+        tb = g_ptr_array_index(tbs, i);
+        info->pc = tb->pc;
+        info->size = tb->size;
+        info->icount = tb->icount;
+        /* The search data follows the code of the block.  */
+        info->host_size = tb->tc_search - (uint8_t *)tb->tc_ptr;
+        info->exec_count = atomic_read(&tb->prof_count);
+        info->cost = info->exec_count * info->host_size;
+        info->trace = !!(tb->cflags & CF_TRACE);
+        for (j = 0; j < 2; j++) {
+            if (tb->jmp_reset_offset[j] != TB_JMP_RESET_OFFSET_INVALID) {
+                info->jumps++;
+                if (tb->jmp_list_next[j]) {
+                    info->chained++;
+                }
+            }
+        }
+        entry->value = info;
+        *tail = entry;
+        tail = &entry->next;
+    }
+    tb_unlock();
+
+    g_ptr_array_free(tbs, true);
+    return head;
+}
+
 void dump_opcount_info(FILE *f, fprintf_function cpu_fprintf)
 {
     tcg_dump_op_count(f, cpu_fprintf);
@@ -1784,91 +3532,143 @@ void cpu_interrupt(CPUState *cpu, int mask)
 }
 
 /*
- * Walks guest process memory "regions" one by one
- * and calls callback function 'fn' for each region.
+ * The flags of the guest pages are kept in an interval tree of ranges of
+ * pages with the same flags; unmapped pages are not in the tree.  Lookups
+ * come from all threads, e.g. access_ok() without the mmap_lock, so the
+ * tree has a lock of its own.
+ *
+ * The mmap_lock serializes the changes to the guest mappings, and keeps
+ * the free ranges stable while target_mmap() picks one.  The translator
+ * and page_unprotect() do not take it: a change to the host mappings and
+ * the matching update of the flags and of the translated code are made
+ * under tb_lock instead, which is what they hold.
+ *
+ * The pages made read-only because of translated code are not in the
+ * tree, but marked in their PageDesc: page_get_flags() removes PAGE_WRITE
+ * from them.
  */
-struct walk_memory_regions_data {
-    walk_memory_regions_fn fn;
-    void *priv;
-    target_ulong start;
-    int prot;
-};
+typedef struct PageFlagsNode {
+    IntervalTreeNode itree;
+    int flags;
+} PageFlagsNode;
+
+static IntervalTreeRoot pageflags_root;
+static QemuSpin pageflags_lock;
 
-static int walk_memory_regions_end(struct walk_memory_regions_data *data,
-                                   target_ulong end, int new_prot)
+void page_fork_start(void)
 {
-    if (data->start != -1u) {
-        int rc = data->fn(data->priv, data->start, end, data->prot);
-        if (rc != 0) {
-            return rc;
-        }
-    }
+    qemu_spin_lock(&pageflags_lock);
+}
+
+void page_fork_end(void)
+{
+    qemu_spin_unlock(&pageflags_lock);
+}
 
-    data->start = (new_prot ? end : -1u);
-    data->prot = new_prot;
+static PageFlagsNode *pageflags_find(target_ulong start, target_ulong last)
+{
+    IntervalTreeNode *n;
 
-    return 0;
+    n = interval_tree_iter_first(&pageflags_root, start, last);
+    return n ? container_of(n, PageFlagsNode, itree) : NULL;
 }
 
-static int walk_memory_regions_1(struct walk_memory_regions_data *data,
-                                 target_ulong base, int level, void **lp)
+static PageFlagsNode *pageflags_next(PageFlagsNode *p, target_ulong start,
+                                     target_ulong last)
 {
-    target_ulong pa;
-    int i, rc;
+    IntervalTreeNode *n;
 
-    if (*lp == NULL) {
-        return walk_memory_regions_end(data, base, 0);
-    }
+    n = interval_tree_iter_next(&p->itree, start, last);
+    return n ? container_of(n, PageFlagsNode, itree) : NULL;
+}
 
-    if (level == 0) {
-        PageDesc *pd = *lp;
+static void pageflags_create(target_ulong start, target_ulong last, int flags)
+{
+    PageFlagsNode *p = g_new(PageFlagsNode, 1);
 
-        for (i = 0; i < V_L2_SIZE; ++i) {
-            int prot = pd[i].flags;
+    p->itree.start = start;
+    p->itree.last = last;
+    p->flags = flags;
+    interval_tree_insert(&p->itree, &pageflags_root);
+}
 
-            pa = base | (i << TARGET_PAGE_BITS);
-            if (prot != data->prot) {
-                rc = walk_memory_regions_end(data, pa, prot);
-                if (rc != 0) {
-                    return rc;
-                }
-            }
-        }
-    } else {
-        void **pp = *lp;
+/* Give the pages of [start, last] the flags FLAGS, 0 meaning unmapped.
+ * Called with pageflags_lock held.
+ */
+static void pageflags_set(target_ulong start, target_ulong last, int flags)
+{
+    PageFlagsNode *p;
 
-        for (i = 0; i < V_L2_SIZE; ++i) {
-            pa = base | ((target_ulong)i <<
-                (TARGET_PAGE_BITS + V_L2_BITS * level));
-            rc = walk_memory_regions_1(data, pa, level - 1, pp + i);
-            if (rc != 0) {
-                return rc;
-            }
+    /* cut [start, last] out of the ranges that overlap it */
+    while ((p = pageflags_find(start, last))) {
+        target_ulong p_start = p->itree.start;
+        target_ulong p_last = p->itree.last;
+
+        interval_tree_remove(&p->itree, &pageflags_root);
+        if (p_last > last) {
+            pageflags_create(last + 1, p_last, p->flags);
+        }
+        if (p_start < start) {
+            p->itree.last = start - 1;
+            interval_tree_insert(&p->itree, &pageflags_root);
+        } else {
+            g_free(p);
         }
     }
 
-    return 0;
+    if (!flags) {
+        return;
+    }
+
+    /* merge with the neighbours that have the same flags */
+    if (start != 0) {
+        p = pageflags_find(start - 1, start - 1);
+        if (p && p->flags == flags) {
+            interval_tree_remove(&p->itree, &pageflags_root);
+            start = p->itree.start;
+            g_free(p);
+        }
+    }
+    if (last != (target_ulong)-1) {
+        p = pageflags_find(last + 1, last + 1);
+        if (p && p->flags == flags) {
+            interval_tree_remove(&p->itree, &pageflags_root);
+            last = p->itree.last;
+            g_free(p);
+        }
+    }
+    pageflags_create(start, last, flags);
 }
 
+/*
+ * Walks guest process memory "regions" one by one
+ * and calls callback function 'fn' for each region.
+ */
 int walk_memory_regions(void *priv, walk_memory_regions_fn fn)
 {
-    struct walk_memory_regions_data data;
-    uintptr_t i;
+    target_ulong addr = 0, start, last;
+    PageFlagsNode *p;
+    int flags, rc;
 
-    data.fn = fn;
-    data.priv = priv;
-    data.start = -1u;
-    data.prot = 0;
+    while (true) {
+        /* fn may take a while, do not hold the lock across it */
+        qemu_spin_lock(&pageflags_lock);
+        p = pageflags_find(addr, -1);
+        if (!p) {
+            qemu_spin_unlock(&pageflags_lock);
+            return 0;
+        }
+        start = p->itree.start;
+        last = p->itree.last;
+        flags = p->flags;
+        qemu_spin_unlock(&pageflags_lock);
 
-    for (i = 0; i < V_L1_SIZE; i++) {
-        int rc = walk_memory_regions_1(&data, (target_ulong)i << (V_L1_SHIFT + TARGET_PAGE_BITS),
-                                       V_L1_SHIFT / V_L2_BITS - 1, l1_map + i);
-        if (rc != 0) {
+        rc = fn(priv, start, last + 1, flags);
+        if (rc != 0 || last == (target_ulong)-1) {
             return rc;
         }
+        addr = last + 1;
     }
-
-    return walk_memory_regions_end(&data, 0, 0);
 }
 
 static int dump_region(void *priv, target_ulong start,
@@ -1897,21 +3697,32 @@ void page_dump(FILE *f)
 
 int page_get_flags(target_ulong address)
 {
+    PageFlagsNode *n;
     PageDesc *p;
+    int flags;
 
-    p = page_find(address >> TARGET_PAGE_BITS);
-    if (!p) {
-        return 0;
+    qemu_spin_lock(&pageflags_lock);
+    n = pageflags_find(address, address);
+    flags = n ? n->flags : 0;
+    qemu_spin_unlock(&pageflags_lock);
+
+    if (flags & PAGE_WRITE) {
+        p = page_find(address >> TARGET_PAGE_BITS);
+        if (p && p->write_protected) {
+            flags &= ~PAGE_WRITE;
+        }
     }
-    return p->flags;
+    return flags;
 }
 
 /* Modify the flags of a page and invalidate the code if necessary.
    The flag PAGE_WRITE_ORG is positioned automatically depending
-   on PAGE_WRITE.  The mmap_lock should already be held.  */
+   on PAGE_WRITE.  The mmap_lock and tb_lock should already be held,
+   since the host mapping was changed to match.  */
 void page_set_flags(target_ulong start, target_ulong end, int flags)
 {
-    target_ulong addr, len;
+    tb_page_addr_t index, next, last;
+    PageDesc *p;
 
     /* This function should never be called with addresses outside the
        guest address space.  If this assert fires, it probably indicates
@@ -1928,27 +3739,50 @@ void page_set_flags(target_ulong start, target_ulong end, int flags)
         flags |= PAGE_WRITE_ORG;
     }
 
-    for (addr = start, len = end - start;
-         len != 0;
-         len -= TARGET_PAGE_SIZE, addr += TARGET_PAGE_SIZE) {
-        PageDesc *p = page_find_alloc(addr >> TARGET_PAGE_BITS, 1);
+    qemu_spin_lock(&pageflags_lock);
+    pageflags_set(start, end - 1, flags);
+    qemu_spin_unlock(&pageflags_lock);
 
-        /* If the write protection bit is set, then we invalidate
-           the code inside.  */
-        if (!(p->flags & PAGE_WRITE) &&
-            (flags & PAGE_WRITE) &&
-            p->first_tb) {
-            tb_invalidate_phys_page(addr, 0);
+    /* The pages are not write protected anymore.  If they become
+       writable, invalidate the code inside.  Only the pages with a
+       PageDesc can have code.  */
+    last = (end - 1) >> TARGET_PAGE_BITS;
+    for (index = start >> TARGET_PAGE_BITS; index <= last; index = next) {
+        p = page_find_next(index, &next);
+        if (!p) {
+            continue;
+        }
+        if ((flags & PAGE_WRITE) && p->first_tb) {
+            tb_invalidate_phys_page(index << TARGET_PAGE_BITS, 0);
         }
-        p->flags = flags;
+        p->write_protected = false;
     }
 }
 
+/* Return the highest address that is a multiple of ALIGN and starts LEN
+ * bytes of unmapped guest memory in [min, max], or -1 if there is none.
+ * The mmap_lock should be held for the result to stay valid.
+ */
+target_ulong page_find_range_empty(target_ulong min, target_ulong max,
+                                   target_ulong len, target_ulong align)
+{
+    uint64_t addr;
+    bool found;
+
+    qemu_spin_lock(&pageflags_lock);
+    found = interval_tree_find_gap_down(&pageflags_root, min, max, len, align,
+                                        &addr);
+    qemu_spin_unlock(&pageflags_lock);
+    return found ? addr : -1;
+}
+
 int page_check_range(target_ulong start, target_ulong len, int flags)
 {
+    PageFlagsNode *n;
     PageDesc *p;
-    target_ulong end;
-    target_ulong addr;
+    target_ulong last, addr;
+    tb_page_addr_t index, next;
+    int ret;
 
     /* This function should never be called with addresses outside the
        guest address space.  If this assert fires, it probably indicates
@@ -1960,43 +3794,49 @@ int page_check_range(target_ulong start, target_ulong len, int flags)
     if (len == 0) {
         return 0;
     }
-    if (start + len - 1 < start) {
+    last = start + len - 1;
+    if (last < start) {
         /* We've wrapped around.  */
         return -1;
     }
 
-    /* must do before we loose bits in the next step */
-    end = TARGET_PAGE_ALIGN(start + len);
-    start = start & TARGET_PAGE_MASK;
-
-    for (addr = start, len = end - start;
-         len != 0;
-         len -= TARGET_PAGE_SIZE, addr += TARGET_PAGE_SIZE) {
-        p = page_find(addr >> TARGET_PAGE_BITS);
-        if (!p) {
-            return -1;
+    /* the ranges that overlap [start, last] must cover it without holes,
+       and all have the flags */
+    ret = -1;
+    addr = start;
+    qemu_spin_lock(&pageflags_lock);
+    for (n = pageflags_find(start, last); n;
+         n = pageflags_next(n, start, last)) {
+        if (n->itree.start > addr || !(n->flags & PAGE_VALID)) {
+            break;
         }
-        if (!(p->flags & PAGE_VALID)) {
-            return -1;
+        if ((flags & PAGE_READ) && !(n->flags & PAGE_READ)) {
+            break;
         }
-
-        if ((flags & PAGE_READ) && !(p->flags & PAGE_READ)) {
-            return -1;
+        if ((flags & PAGE_WRITE) && !(n->flags & PAGE_WRITE_ORG)) {
+            break;
         }
-        if (flags & PAGE_WRITE) {
-            if (!(p->flags & PAGE_WRITE_ORG)) {
+        if (n->itree.last >= last) {
+            ret = 0;
+            break;
+        }
+        addr = n->itree.last + 1;
+    }
+    qemu_spin_unlock(&pageflags_lock);
+
+    if (ret == 0 && (flags & PAGE_WRITE)) {
+        /* unprotect the pages that were put read-only because they
+           contain translated code */
+        for (index = start >> TARGET_PAGE_BITS;
+             index <= last >> TARGET_PAGE_BITS; index = next) {
+            p = page_find_next(index, &next);
+            if (p && p->write_protected &&
+                !page_unprotect(index << TARGET_PAGE_BITS, 0)) {
                 return -1;
             }
-            /* unprotect the page if it was put read-only because it
-               contains translated code */
-            if (!(p->flags & PAGE_WRITE)) {
-                if (!page_unprotect(addr, 0)) {
-                    return -1;
-                }
-            }
         }
     }
-    return 0;
+    return ret;
 }
 
 /* called from signal handler: invalidate the code and unprotect the
@@ -2015,17 +3855,12 @@ int page_unprotect(target_ulong address, uintptr_t pc)
     /* Technically this isn't safe inside a signal handler.  However we
        know this only ever happens in a synchronous SEGV handler, so in
        practice it seems to be ok.  */
-    mmap_lock();
-
-    p = page_find(address >> TARGET_PAGE_BITS);
-    if (!p) {
-        mmap_unlock();
-        return 0;
-    }
+    tb_lock();
 
     /* if the page was really writable, then we change its
        protection back to writable */
-    if ((p->flags & PAGE_WRITE_ORG) && !(p->flags & PAGE_WRITE)) {
+    p = page_find(address >> TARGET_PAGE_BITS);
+    if (p && p->write_protected) {
         host_start = address & qemu_host_page_mask;
         host_end = host_start + qemu_host_page_size;
 
@@ -2033,12 +3868,14 @@ int page_unprotect(target_ulong address, uintptr_t pc)
         current_tb_invalidated = false;
         for (addr = host_start ; addr < host_end ; addr += TARGET_PAGE_SIZE) {
             p = page_find(addr >> TARGET_PAGE_BITS);
-            p->flags |= PAGE_WRITE;
-            prot |= p->flags;
+            if (p) {
+                p->write_protected = false;
 
-            /* and since the content will be modified, we must invalidate
-               the corresponding translated code. */
-            current_tb_invalidated |= tb_invalidate_phys_page(addr, pc);
+                /* and since the content will be modified, we must
+                   invalidate the corresponding translated code. */
+                current_tb_invalidated |= tb_invalidate_phys_page(addr, pc);
+            }
+            prot |= page_get_flags(addr);
 #ifdef DEBUG_TB_CHECK
             tb_invalidate_check(addr);
 #endif
@@ -2046,11 +3883,11 @@ int page_unprotect(target_ulong address, uintptr_t pc)
         mprotect((void *)g2h(host_start), qemu_host_page_size,
                  prot & PAGE_BITS);
 
-        mmap_unlock();
+        tb_unlock();
         /* If current TB was invalidated return to main loop */
         return current_tb_invalidated ? 2 : 1;
     }
-    mmap_unlock();
+    tb_unlock();
     return 0;
 }
 #endif /* CONFIG_USER_ONLY */
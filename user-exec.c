@@ -50,6 +50,19 @@ static void cpu_exit_tb_from_sighandler(CPUState *cpu, sigset_t *old_set)
     cpu_loop_exit_noexc(cpu);
 }
 
+void *probe_host(CPUArchState *env, target_ulong addr, int access_type,
+                 int mmu_idx, uintptr_t retaddr)
+{
+    int prot = access_type == MMU_DATA_STORE ? PAGE_WRITE : PAGE_READ;
+
+    /* Pages with translated code are write protected: leave them, and
+       faults, to the normal accessors and the SIGSEGV handler.  */
+    if (!(page_get_flags(addr) & prot)) {
+        return NULL;
+    }
+    return g2h(addr);
+}
+
 /* 'pc' is the host PC at which the exception was raised. 'address' is
    the effective address of the memory exception. 'is_write' is 1 if a
    write caused the exception and otherwise 0'. 'old_set' is the
@@ -0,0 +1,598 @@
+/*
+ * Interval trees
+ *
+ * Copyright (c) 2016 agent <agent@local>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * A red-black tree keyed by the start of the intervals.  Each node also
+ * caches two values computed from its subtree:
+ *
+ * - subtree_last, the largest 'last' in the subtree, used to prune the
+ *   search for overlapping intervals;
+ *
+ * - subtree_gap, the largest 'gap' in the subtree.  The gap of a node is
+ *   the number of values between the previous node (in start order) and
+ *   this one, or between 0 and this node for the first one.  It is used
+ *   to prune the search for free ranges.
+ *
+ * Rotations recompute both values for the two nodes they move; insertion
+ * and removal recompute them along the path to the root.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/host-utils.h"
+#include "qemu/interval-tree.h"
+
+static IntervalTreeNode *interval_tree_leftmost(IntervalTreeNode *node)
+{
+    while (node->left) {
+        node = node->left;
+    }
+    return node;
+}
+
+static IntervalTreeNode *interval_tree_rightmost(IntervalTreeNode *node)
+{
+    while (node->right) {
+        node = node->right;
+    }
+    return node;
+}
+
+static IntervalTreeNode *interval_tree_next(IntervalTreeNode *node)
+{
+    IntervalTreeNode *parent;
+
+    if (node->right) {
+        return interval_tree_leftmost(node->right);
+    }
+    while ((parent = node->parent) && node == parent->right) {
+        node = parent;
+    }
+    return parent;
+}
+
+static IntervalTreeNode *interval_tree_prev(IntervalTreeNode *node)
+{
+    IntervalTreeNode *parent;
+
+    if (node->left) {
+        return interval_tree_rightmost(node->left);
+    }
+    while ((parent = node->parent) && node == parent->left) {
+        node = parent;
+    }
+    return parent;
+}
+
+/* The number of values between PREV (NULL for none) and START.  */
+static uint64_t interval_tree_gap(IntervalTreeNode *prev, uint64_t start)
+{
+    if (!prev) {
+        return start;
+    }
+    return start > prev->last ? start - prev->last - 1 : 0;
+}
+
+static void interval_tree_compute(IntervalTreeNode *node)
+{
+    uint64_t last = node->last;
+    uint64_t gap = node->gap;
+
+    if (node->left) {
+        last = MAX(last, node->left->subtree_last);
+        gap = MAX(gap, node->left->subtree_gap);
+    }
+    if (node->right) {
+        last = MAX(last, node->right->subtree_last);
+        gap = MAX(gap, node->right->subtree_gap);
+    }
+    node->subtree_last = last;
+    node->subtree_gap = gap;
+}
+
+static void interval_tree_propagate(IntervalTreeNode *node)
+{
+    for (; node; node = node->parent) {
+        interval_tree_compute(node);
+    }
+}
+
+static void interval_tree_replace_child(IntervalTreeRoot *root,
+                                        IntervalTreeNode *parent,
+                                        IntervalTreeNode *old,
+                                        IntervalTreeNode *new)
+{
+    if (!parent) {
+        root->root = new;
+    } else if (parent->left == old) {
+        parent->left = new;
+    } else {
+        parent->right = new;
+    }
+    if (new) {
+        new->parent = parent;
+    }
+}
+
+static void interval_tree_rotate_left(IntervalTreeRoot *root,
+                                      IntervalTreeNode *node)
+{
+    IntervalTreeNode *right = node->right;
+
+    node->right = right->left;
+    if (right->left) {
+        right->left->parent = node;
+    }
+    interval_tree_replace_child(root, node->parent, node, right);
+    right->left = node;
+    node->parent = right;
+
+    interval_tree_compute(node);
+    interval_tree_compute(right);
+}
+
+static void interval_tree_rotate_right(IntervalTreeRoot *root,
+                                       IntervalTreeNode *node)
+{
+    IntervalTreeNode *left = node->left;
+
+    node->left = left->right;
+    if (left->right) {
+        left->right->parent = node;
+    }
+    interval_tree_replace_child(root, node->parent, node, left);
+    left->right = node;
+    node->parent = left;
+
+    interval_tree_compute(node);
+    interval_tree_compute(left);
+}
+
+static inline bool interval_tree_is_red(IntervalTreeNode *node)
+{
+    return node && node->red;
+}
+
+static void interval_tree_insert_fixup(IntervalTreeRoot *root,
+                                       IntervalTreeNode *node)
+{
+    IntervalTreeNode *parent, *gparent, *uncle;
+
+    while ((parent = node->parent) && parent->red) {
+        gparent = parent->parent;
+        if (parent == gparent->left) {
+            uncle = gparent->right;
+            if (interval_tree_is_red(uncle)) {
+                parent->red = uncle->red = false;
+                gparent->red = true;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->right) {
+                interval_tree_rotate_left(root, parent);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->red = false;
+            gparent->red = true;
+            interval_tree_rotate_right(root, gparent);
+        } else {
+            uncle = gparent->left;
+            if (interval_tree_is_red(uncle)) {
+                parent->red = uncle->red = false;
+                gparent->red = true;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->left) {
+                interval_tree_rotate_right(root, parent);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->red = false;
+            gparent->red = true;
+            interval_tree_rotate_left(root, gparent);
+        }
+    }
+    root->root->red = false;
+}
+
+void interval_tree_insert(IntervalTreeNode *node, IntervalTreeRoot *root)
+{
+    IntervalTreeNode **link = &root->root, *parent = NULL, *next;
+
+    while (*link) {
+        parent = *link;
+        link = node->start < parent->start ? &parent->left : &parent->right;
+    }
+    node->parent = parent;
+    node->left = node->right = NULL;
+    node->red = true;
+    *link = node;
+
+    node->gap = interval_tree_gap(interval_tree_prev(node), node->start);
+    interval_tree_propagate(node);
+    next = interval_tree_next(node);
+    if (next) {
+        next->gap = interval_tree_gap(node, next->start);
+        interval_tree_propagate(next);
+    }
+
+    interval_tree_insert_fixup(root, node);
+}
+
+/* NODE, possibly NULL, is the child of PARENT that lost a black node.  */
+static void interval_tree_remove_fixup(IntervalTreeRoot *root,
+                                       IntervalTreeNode *node,
+                                       IntervalTreeNode *parent)
+{
+    IntervalTreeNode *sibling;
+
+    while (node != root->root && !interval_tree_is_red(node)) {
+        if (node == parent->left) {
+            sibling = parent->right;
+            if (sibling->red) {
+                sibling->red = false;
+                parent->red = true;
+                interval_tree_rotate_left(root, parent);
+                sibling = parent->right;
+            }
+            if (!interval_tree_is_red(sibling->left) &&
+                !interval_tree_is_red(sibling->right)) {
+                sibling->red = true;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+            if (!interval_tree_is_red(sibling->right)) {
+                sibling->left->red = false;
+                sibling->red = true;
+                interval_tree_rotate_right(root, sibling);
+                sibling = parent->right;
+            }
+            sibling->red = parent->red;
+            parent->red = false;
+            sibling->right->red = false;
+            interval_tree_rotate_left(root, parent);
+        } else {
+            sibling = parent->left;
+            if (sibling->red) {
+                sibling->red = false;
+                parent->red = true;
+                interval_tree_rotate_right(root, parent);
+                sibling = parent->left;
+            }
+            if (!interval_tree_is_red(sibling->left) &&
+                !interval_tree_is_red(sibling->right)) {
+                sibling->red = true;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+            if (!interval_tree_is_red(sibling->left)) {
+                sibling->right->red = false;
+                sibling->red = true;
+                interval_tree_rotate_left(root, sibling);
+                sibling = parent->left;
+            }
+            sibling->red = parent->red;
+            parent->red = false;
+            sibling->left->red = false;
+            interval_tree_rotate_right(root, parent);
+        }
+        node = root->root;
+        break;
+    }
+    if (node) {
+        node->red = false;
+    }
+}
+
+void interval_tree_remove(IntervalTreeNode *node, IntervalTreeRoot *root)
+{
+    IntervalTreeNode *prev = interval_tree_prev(node);
+    IntervalTreeNode *next = interval_tree_next(node);
+    IntervalTreeNode *child, *parent;
+    bool removed_red;
+
+    if (!node->left || !node->right) {
+        /* Unlink NODE itself.  */
+        child = node->left ? node->left : node->right;
+        parent = node->parent;
+        removed_red = node->red;
+        interval_tree_replace_child(root, parent, node, child);
+    } else {
+        /* Unlink NEXT, which has no left child, and put it in NODE's
+           place.  */
+        child = next->right;
+        removed_red = next->red;
+        if (next->parent == node) {
+            parent = next;
+        } else {
+            parent = next->parent;
+            interval_tree_replace_child(root, parent, next, child);
+            next->right = node->right;
+            next->right->parent = next;
+        }
+        interval_tree_replace_child(root, node->parent, node, next);
+        next->left = node->left;
+        next->left->parent = next;
+        next->red = node->red;
+    }
+
+    /* PARENT and its ancestors lost NODE, NEXT if it moved is one of
+       them; NEXT and its ancestors have a new gap.  */
+    if (next) {
+        next->gap = interval_tree_gap(prev, next->start);
+    }
+    interval_tree_propagate(parent);
+    interval_tree_propagate(next);
+
+    if (!removed_red) {
+        interval_tree_remove_fixup(root, child, parent);
+    }
+}
+
+/* The leftmost node below NODE that overlaps [start, last].  */
+static IntervalTreeNode *interval_tree_subtree_search(IntervalTreeNode *node,
+                                                      uint64_t start,
+                                                      uint64_t last)
+{
+    while (true) {
+        if (node->left && start <= node->left->subtree_last) {
+            /* Some interval on the left ends after START; the leftmost of
+               them is the answer if it begins before LAST, and nothing
+               further right can be then.  */
+            node = node->left;
+            continue;
+        }
+        if (node->start > last) {
+            return NULL;
+        }
+        if (start <= node->last) {
+            return node;
+        }
+        node = node->right;
+        if (!node || start > node->subtree_last) {
+            return NULL;
+        }
+    }
+}
+
+IntervalTreeNode *interval_tree_iter_first(IntervalTreeRoot *root,
+                                           uint64_t start, uint64_t last)
+{
+    if (!root->root || start > root->root->subtree_last) {
+        return NULL;
+    }
+    return interval_tree_subtree_search(root->root, start, last);
+}
+
+IntervalTreeNode *interval_tree_iter_next(IntervalTreeNode *node,
+                                          uint64_t start, uint64_t last)
+{
+    IntervalTreeNode *right = node->right, *prev;
+
+    while (true) {
+        if (right && start <= right->subtree_last) {
+            return interval_tree_subtree_search(right, start, last);
+        }
+
+        /* Go up until we come from a left child.  */
+        do {
+            prev = node;
+            node = node->parent;
+            if (!node) {
+                return NULL;
+            }
+            right = node->right;
+        } while (prev == right);
+
+        if (node->start > last) {
+            return NULL;
+        }
+        if (start <= node->last) {
+            return node;
+        }
+    }
+}
+
+/* The free range [lo, hi], or its part in [min, max], holds SIZE values
+   starting at a multiple of ALIGN.  */
+static bool interval_tree_fit_up(uint64_t lo, uint64_t hi, uint64_t min,
+                                 uint64_t max, uint64_t size, uint64_t align,
+                                 uint64_t *addr)
+{
+    uint64_t a;
+
+    lo = MAX(lo, min);
+    hi = MIN(hi, max);
+    if (lo > hi || hi - lo < size - 1) {
+        return false;
+    }
+    a = (lo + align - 1) & -align;
+    if (a < lo || a > hi || hi - a < size - 1) {
+        return false;
+    }
+    *addr = a;
+    return true;
+}
+
+static bool interval_tree_fit_down(uint64_t lo, uint64_t hi, uint64_t min,
+                                   uint64_t max, uint64_t size,
+                                   uint64_t align, uint64_t *addr)
+{
+    uint64_t a;
+
+    lo = MAX(lo, min);
+    hi = MIN(hi, max);
+    if (lo > hi || hi - lo < size - 1) {
+        return false;
+    }
+    a = (hi - (size - 1)) & -align;
+    if (a < lo) {
+        return false;
+    }
+    *addr = a;
+    return true;
+}
+
+static bool interval_tree_fit_gap(IntervalTreeNode *node, bool up,
+                                  uint64_t min, uint64_t max, uint64_t size,
+                                  uint64_t align, uint64_t *addr)
+{
+    uint64_t lo = node->start - node->gap, hi = node->start - 1;
+
+    if (!node->gap) {
+        return false;
+    }
+    if (up) {
+        return interval_tree_fit_up(lo, hi, min, max, size, align, addr);
+    }
+    return interval_tree_fit_down(lo, hi, min, max, size, align, addr);
+}
+
+/* The first node that starts at or after BOUND with a gap of SIZE.  */
+static IntervalTreeNode *interval_tree_first_gap(IntervalTreeNode *node,
+                                                 uint64_t bound,
+                                                 uint64_t size)
+{
+    IntervalTreeNode *ret;
+
+    if (!node || node->subtree_gap < size) {
+        return NULL;
+    }
+    if (node->start >= bound) {
+        ret = interval_tree_first_gap(node->left, bound, size);
+        if (ret) {
+            return ret;
+        }
+        if (node->gap >= size) {
+            return node;
+        }
+    }
+    return interval_tree_first_gap(node->right, bound, size);
+}
+
+/* The last node that starts at or before BOUND with a gap of SIZE.  */
+static IntervalTreeNode *interval_tree_last_gap(IntervalTreeNode *node,
+                                                uint64_t bound,
+                                                uint64_t size)
+{
+    IntervalTreeNode *ret;
+
+    if (!node || node->subtree_gap < size) {
+        return NULL;
+    }
+    if (node->start <= bound) {
+        ret = interval_tree_last_gap(node->right, bound, size);
+        if (ret) {
+            return ret;
+        }
+        if (node->gap >= size) {
+            return node;
+        }
+    }
+    return interval_tree_last_gap(node->left, bound, size);
+}
+
+bool interval_tree_find_gap_up(IntervalTreeRoot *root, uint64_t min,
+                               uint64_t max, uint64_t size, uint64_t align,
+                               uint64_t *addr)
+{
+    IntervalTreeNode *node;
+    uint64_t bound;
+
+    assert(size != 0 && is_power_of_2(align));
+    if (min > max) {
+        return false;
+    }
+    if (!root->root) {
+        return interval_tree_fit_up(0, UINT64_MAX, min, max, size, align,
+                                    addr);
+    }
+
+    /* The gaps that end at MIN or above, i.e. those of the nodes that
+       start after MIN, in increasing order.  Only alignment can make
+       one of them fail, so this normally stops at the first one.  */
+    if (min != UINT64_MAX) {
+        bound = min + 1;
+        while ((node = interval_tree_first_gap(root->root, bound, size))) {
+            if (node->start - node->gap > max) {
+                return false;
+            }
+            if (interval_tree_fit_gap(node, true, min, max, size, align,
+                                      addr)) {
+                return true;
+            }
+            if (node->start >= max) {
+                return false;
+            }
+            bound = node->start + 1;
+        }
+    }
+
+    /* The space after the last node.  */
+    node = interval_tree_rightmost(root->root);
+    return node->last != UINT64_MAX &&
+        interval_tree_fit_up(node->last + 1, UINT64_MAX, min, max, size,
+                             align, addr);
+}
+
+bool interval_tree_find_gap_down(IntervalTreeRoot *root, uint64_t min,
+                                 uint64_t max, uint64_t size, uint64_t align,
+                                 uint64_t *addr)
+{
+    IntervalTreeNode *node, *above;
+    uint64_t bound;
+
+    assert(size != 0 && is_power_of_2(align));
+    if (min > max) {
+        return false;
+    }
+    if (!root->root) {
+        return interval_tree_fit_down(0, UINT64_MAX, min, max, size, align,
+                                      addr);
+    }
+
+    /* The space after the last node.  */
+    node = interval_tree_rightmost(root->root);
+    if (node->last != UINT64_MAX &&
+        interval_tree_fit_down(node->last + 1, UINT64_MAX, min, max, size,
+                               align, addr)) {
+        return true;
+    }
+
+    /* The gap of the first node that starts after MAX can still reach
+       down into [min, max].  */
+    above = NULL;
+    for (node = root->root; node; ) {
+        if (node->start > max) {
+            above = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+    if (above && interval_tree_fit_gap(above, false, min, max, size, align,
+                                       addr)) {
+        return true;
+    }
+
+    /* The gaps of the nodes that start at MAX or below, in decreasing
+       order.  */
+    bound = max;
+    while ((node = interval_tree_last_gap(root->root, bound, size))) {
+        if (interval_tree_fit_gap(node, false, min, max, size, align, addr)) {
+            return true;
+        }
+        if (node->start - node->gap <= min) {
+            return false;
+        }
+        bound = node->start - 1;
+    }
+    return false;
+}
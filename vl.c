@@ -438,6 +438,81 @@ static QemuOptsList qemu_mem_opts = {
     },
 };
 
+static QemuOptsList qemu_accel_opts = {
+    .name = "accel",
+    .implied_opt_name = "accel",
+    .head = QTAILQ_HEAD_INITIALIZER(qemu_accel_opts.head),
+    .merge_lists = true,
+    .desc = {
+        {
+            .name = "accel",
+            .type = QEMU_OPT_STRING,
+            .help = "Select the type of accelerator",
+        },
+        {
+            .name = "thread",
+            .type = QEMU_OPT_STRING,
+            .help = "Enable/disable multi-threaded TCG",
+        },
+        {
+            .name = "tb-cache",
+            .type = QEMU_OPT_STRING,
+            .help = "File to keep translated code in across runs",
+        },
+        {
+            .name = "trace-threshold",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Executions after which hot blocks are merged into traces",
+        },
+        {
+            .name = "vtlb-size",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of entries in the victim TLB of each MMU mode",
+        },
+        {
+            .name = "perf-map",
+            .type = QEMU_OPT_BOOL,
+            .help = "Write /tmp/perf-<pid>.map for the translated code",
+        },
+        {
+            .name = "jitdump",
+            .type = QEMU_OPT_BOOL,
+            .help = "Write jit-<pid>.dump for the translated code",
+        },
+        {
+            .name = "speculate",
+            .type = QEMU_OPT_BOOL,
+            .help = "Translate likely successor blocks when idle",
+        },
+        {
+            .name = "profile",
+            .type = QEMU_OPT_BOOL,
+            .help = "Count the executions of each translated block",
+        },
+        {
+            .name = "chain-pages",
+            .type = QEMU_OPT_BOOL,
+            .help = "Chain translated blocks across guest pages",
+        },
+        {
+            .name = "sample-profile",
+            .type = QEMU_OPT_STRING,
+            .help = "Write a sampled profile of the guest code to this file",
+        },
+        {
+            .name = "sample-rate",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Samples per second for sample-profile",
+        },
+        {
+            .name = "sample-stack",
+            .type = QEMU_OPT_BOOL,
+            .help = "Also sample the guest call stack",
+        },
+        { /* end of list */ }
+    },
+};
+
 static QemuOptsList qemu_icount_opts = {
     .name = "icount",
     .implied_opt_name = "shift",
@@ -459,6 +534,12 @@ static QemuOptsList qemu_icount_opts = {
         }, {
             .name = "rrfile",
             .type = QEMU_OPT_STRING,
+        }, {
+            .name = "rrperiod",
+            .type = QEMU_OPT_NUMBER,
+        }, {
+            .name = "rrstart",
+            .type = QEMU_OPT_NUMBER,
         },
         { /* end of list */ }
     },
@@ -2939,6 +3020,7 @@ int main(int argc, char **argv, char **envp)
     DisplayState *ds;
     int cyls, heads, secs, translation;
     QemuOpts *hda_opts = NULL, *opts, *machine_opts, *icount_opts = NULL;
+    QemuOpts *accel_opts = NULL;
     QemuOptsList *olist;
     int optind;
     const char *optarg;
@@ -2999,6 +3081,7 @@ int main(int argc, char **argv, char **envp)
     qemu_add_opts(&qemu_msg_opts);
     qemu_add_opts(&qemu_name_opts);
     qemu_add_opts(&qemu_numa_opts);
+    qemu_add_opts(&qemu_accel_opts);
     qemu_add_opts(&qemu_icount_opts);
     qemu_add_opts(&qemu_semihosting_config_opts);
     qemu_add_opts(&qemu_fw_cfg_opts);
@@ -3650,6 +3733,26 @@ int main(int argc, char **argv, char **envp)
                 olist = qemu_find_opts("machine");
                 qemu_opts_parse_noisily(olist, "accel=kvm", false);
                 break;
+            case QEMU_OPTION_accel:
+                accel_opts = qemu_opts_parse_noisily(qemu_find_opts("accel"),
+                                                     optarg, true);
+                optarg = qemu_opt_get(accel_opts, "accel");
+                if (!accel_opts || !optarg) {
+                    error_report("invalid -accel option");
+                    exit(1);
+                }
+                olist = qemu_find_opts("machine");
+                if (strcmp("kvm", optarg) == 0) {
+                    qemu_opts_parse_noisily(olist, "accel=kvm", false);
+                } else if (strcmp("xen", optarg) == 0) {
+                    qemu_opts_parse_noisily(olist, "accel=xen", false);
+                } else if (strcmp("tcg", optarg) == 0) {
+                    qemu_opts_parse_noisily(olist, "accel=tcg", false);
+                } else {
+                    error_report("unknown accelerator '%s'", optarg);
+                    exit(1);
+                }
+                break;
             case QEMU_OPTION_M:
             case QEMU_OPTION_machine:
                 olist = qemu_find_opts("machine");
@@ -4347,6 +4450,10 @@ int main(int argc, char **argv, char **envp)
         qemu_opts_del(icount_opts);
     }
 
+    if (tcg_enabled()) {
+        qemu_tcg_configure(accel_opts, &error_fatal);
+    }
+
     if (default_net) {
         QemuOptsList *net = qemu_find_opts("net");
         qemu_opts_set(net, NULL, "type", "nic", &error_abort);
@@ -4574,6 +4681,7 @@ int main(int argc, char **argv, char **envp)
     replay_checkpoint(CHECKPOINT_RESET);
     qemu_system_reset(VMRESET_SILENT);
     register_global_state();
+    replay_snapshot_load();
     if (loadvm) {
         if (load_vmstate(loadvm) < 0) {
             autostart = 0;